@@ -0,0 +1,100 @@
+// Measures how fast the binary MIR format is written and read, on a
+// generated program shaped like lowered LA code: many small functions
+// whose instructions are mostly arithmetic on int64 temporaries, with the
+// checks, lengths and calls of array accesses mixed in. Run with
+// `make serialize_bench`.
+#include "mir.h"
+#include "mir_serialize.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+
+using namespace std_alias;
+using namespace mir;
+
+static Uptr<Program> make_program(size_t num_functions, size_t num_accesses) {
+	auto program = mkuptr<Program>();
+	program->external_functions.push_back(mkuptr<ExternalFunction>("print", 1, false));
+	ExternalFunction *print = program->external_functions[0].get();
+	for (size_t f = 0; f < num_functions; ++f) {
+		program->function_defs.push_back(mkuptr<FunctionDef>("function" + std::to_string(f), Type { Type::ArrayType { 0 } }));
+	}
+	for (size_t f = 0; f < num_functions; ++f) {
+		FunctionDef &function = *program->function_defs[f];
+		LocalVar *array = function.create_local_var(true, "array", Type { Type::ArrayType { 1 } });
+		LocalVar *index = function.create_local_var(true, "index", Type { Type::ArrayType { 0 } });
+		LocalVar *sum = function.create_local_var(true, "sum", Type { Type::ArrayType { 0 } });
+		LocalVar *line = function.create_local_var(false, "linenum", Type { Type::ArrayType { 0 } });
+		function.parameter_vars = { array, index };
+		BlockId entry = function.create_block(false, "entry");
+		BlockId error = function.create_block(false, "outofrange");
+		for (size_t i = 0; i < num_accesses; ++i) {
+			LocalVar *condition = function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+			LocalVar *length = function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+			LocalVar *element = function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+			function.append_inst(entry, Place(line), Operand(Int64Constant { static_cast<int64_t>(2 * i + 1) }));
+			function.append_inst(entry, Place(length), LengthGetter { Operand(array), Operand(Int64Constant { 0 }) });
+			function.append_inst(entry, Place(condition), BinaryOperation { Operand(index), Operand(length), Operator::ge });
+			function.append_inst(entry, {}, Guard { Operand(condition), error });
+			function.append_inst(entry, Place(element), Place(array, { Operand(index) }));
+			function.append_inst(entry, Place(element), BinaryOperation { Operand(element), Operand(Int64Constant { 1 }), Operator::rshift });
+			function.append_inst(entry, Place(sum), BinaryOperation { Operand(sum), Operand(element), Operator::plus });
+			if (i % 4 == 0) {
+				FunctionDef *callee = program->function_defs[(f + i + 1) % num_functions].get();
+				function.append_inst(entry, Place(element), FunctionCall { Operand(CodeConstant { callee }), { Operand(array), Operand(sum) } });
+				function.append_inst(entry, {}, FunctionCall { Operand(ExtCodeConstant { print }), { Operand(element) } });
+			}
+		}
+		function.set_terminator(entry, BasicBlock::ReturnVal { Operand(sum) });
+		function.append_inst(error, {}, FunctionCall { Operand(ExtCodeConstant { &tensor_error }), { Operand(line) } });
+		function.set_terminator(error, BasicBlock::ReturnVoid {});
+	}
+	return program;
+}
+
+// the best of several runs, in seconds
+template<typename F>
+static double time_best(int num_runs, F f) {
+	double best = 1e9;
+	for (int run = 0; run < num_runs; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return best;
+}
+
+int main() {
+	Uptr<Program> program = make_program(2700, 6);
+	size_t num_instructions = 0;
+	for (const Uptr<FunctionDef> &function : program->function_defs) {
+		num_instructions += function->instructions.size();
+	}
+
+	std::string bytes;
+	double encode_time = time_best(5, [&]() { bytes = serialize_program(*program); });
+	// the decoded programs are kept so that tearing them down isn't timed
+	Vec<Uptr<Program>> decoded;
+	double decode_time = time_best(5, [&]() { decoded.push_back(deserialize_program(bytes)); });
+
+	// a mapped file only decodes the functions that are asked for
+	std::string path = "/tmp/mir_serialize_bench_" + std::to_string(getpid()) + ".bin";
+	std::ofstream(path, std::ios::binary) << bytes;
+	Vec<Uptr<MappedProgram>> mapped;
+	double open_time = time_best(5, [&]() {
+		mapped.push_back(MappedProgram::open(path));
+		mapped.back()->load_function(0);
+	});
+	unlink(path.c_str());
+
+	double megabytes = bytes.size() / 1e6;
+	std::cout << program->function_defs.size() << " functions, " << num_instructions << " instructions, "
+		<< megabytes << " MB encoded\n";
+	std::cout << "encode: " << encode_time * 1e3 << " ms, " << megabytes / encode_time << " MB/s\n";
+	std::cout << "decode: " << decode_time * 1e3 << " ms, " << megabytes / decode_time << " MB/s\n";
+	std::cout << "map and load one function: " << open_time * 1e3 << " ms\n";
+	return 0;
+}
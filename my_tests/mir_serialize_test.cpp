@@ -0,0 +1,156 @@
+// Round-trips a program that uses every kind of operand, rvalue, type and
+// terminator through the binary MIR format, both in memory and through a
+// memory-mapped file, and checks that the decoded program prints the same
+// IR as the original. Run with `make serialize_test`.
+#include "mir.h"
+#include "mir_serialize.h"
+#include <iostream>
+#include <fstream>
+#include <regex>
+#include <unistd.h>
+
+using namespace std_alias;
+using namespace mir;
+
+static int num_failures = 0;
+
+static void check(bool condition, const std::string &what) {
+	if (!condition) {
+		std::cerr << "FAIL: " << what << "\n";
+		num_failures += 1;
+	}
+}
+
+// the IR names anonymous and user variables after their addresses, which
+// differ between the original and the decoded program, so they're
+// renumbered in the order they first appear
+static std::string normalize_ir(const std::string &ir) {
+	static const std::regex address_regex("(uservar_|var_)([0-9]+)");
+	Map<std::string, size_t> numbers;
+	std::string result;
+	auto last = ir.cbegin();
+	for (std::sregex_iterator it(ir.begin(), ir.end(), address_regex), end; it != end; ++it) {
+		const std::smatch &match = *it;
+		result.append(last, match[0].first);
+		auto [number_it, _] = numbers.insert({ match[2].str(), numbers.size() });
+		result += match[1].str() + "#" + std::to_string(number_it->second);
+		last = match[0].second;
+	}
+	result.append(last, ir.cend());
+	return result;
+}
+
+static Uptr<Program> make_program() {
+	auto program = mkuptr<Program>();
+	program->external_functions.push_back(mkuptr<ExternalFunction>("print", 1, false));
+	program->external_functions.push_back(mkuptr<ExternalFunction>("input", 0, true));
+	ExternalFunction *print = program->external_functions[0].get();
+	ExternalFunction *input = program->external_functions[1].get();
+
+	program->function_defs.push_back(mkuptr<FunctionDef>("helper", Type { Type::TupleType {} }));
+	program->function_defs.push_back(mkuptr<FunctionDef>("main", Type { Type::VoidType {} }));
+	FunctionDef &helper = *program->function_defs[0];
+	FunctionDef &main = *program->function_defs[1];
+
+	// helper(int64[][] matrix, code callback) returns a tuple
+	LocalVar *matrix = helper.create_local_var(true, "matrix", Type { Type::ArrayType { 2 } });
+	LocalVar *callback = helper.create_local_var(true, "callback", Type { Type::CodeType {} });
+	// the same name twice, to check that the string table shares it
+	LocalVar *value = helper.create_local_var(true, "value", Type { Type::ArrayType { 0 } });
+	LocalVar *other_value = helper.create_local_var(true, "value", Type { Type::ArrayType { 0 } });
+	LocalVar *pair = helper.create_local_var(true, "pair", Type { Type::TupleType {} });
+	LocalVar *temp = helper.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+	LocalVar *line = helper.create_local_var(false, "linenum", Type { Type::ArrayType { 0 } });
+	helper.parameter_vars = { matrix, callback };
+
+	BlockId entry = helper.create_block(false, "entry");
+	BlockId loop = helper.create_block(true, "loop");
+	BlockId done = helper.create_block(true, "done");
+	BlockId error = helper.create_block(false, "unallocederror");
+	helper.append_inst(entry, Place(line), Operand(Int64Constant { -12345678901 }));
+	helper.append_inst(entry, Place(temp), BinaryOperation { Operand(matrix), Operand(Int64Constant { 0 }), Operator::eq });
+	helper.append_inst(entry, {}, Guard { Operand(temp), error });
+	helper.append_inst(entry, Place(value), LengthGetter { Operand(matrix), Operand(Int64Constant { 1 }) });
+	helper.append_inst(entry, Place(other_value), Place(matrix, { Operand(Int64Constant { 0 }), Operand(value) }));
+	helper.append_inst(entry, Place(matrix, { Operand(value), Operand(Int64Constant { 0 }) }), Operand(other_value));
+	helper.append_inst(entry, Place(pair), NewTuple { Operand(Int64Constant { 5 }) });
+	helper.append_inst(entry, Place(temp), LengthGetter { Operand(pair), {} });
+	helper.append_inst(entry, Place(pair, { Operand(Int64Constant { 1 }) }), Operand(callback));
+	helper.set_terminator(entry, BasicBlock::Goto { loop });
+	for (int op = 0; op <= static_cast<int>(Operator::rshift); ++op) {
+		helper.append_inst(loop, Place(value), BinaryOperation { Operand(value), Operand(Int64Constant { op - 3 }), static_cast<Operator>(op) });
+	}
+	helper.append_inst(loop, Place(other_value), FunctionCall { Operand(callback), { Operand(value), Operand(matrix) } });
+	helper.set_terminator(loop, BasicBlock::Branch { Operand(value), loop, done });
+	helper.set_terminator(done, BasicBlock::ReturnVal { Operand(pair) });
+	helper.append_inst(error, {}, FunctionCall { Operand(ExtCodeConstant { &tensor_error }), { Operand(line) } });
+	helper.set_terminator(error, BasicBlock::ReturnVoid {});
+
+	LocalVar *array = main.create_local_var(true, "array", Type { Type::ArrayType { 2 } });
+	LocalVar *function = main.create_local_var(true, "function", Type { Type::CodeType {} });
+	LocalVar *result = main.create_local_var(true, "result", Type { Type::TupleType {} });
+	LocalVar *number = main.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+	BlockId main_entry = main.create_block(false, "entry");
+	BlockId unused = main.create_block(false, "unused");
+	BlockId main_exit = main.create_block(true, "exit");
+	main.append_inst(main_entry, Place(number), FunctionCall { Operand(ExtCodeConstant { input }), {} });
+	main.append_inst(main_entry, Place(array), NewArray { { Operand(number), Operand(Int64Constant { 7 }) } });
+	main.append_inst(main_entry, Place(function), Operand(CodeConstant { &helper }));
+	main.append_inst(main_entry, Place(result), FunctionCall { Operand(CodeConstant { &helper }), { Operand(array), Operand(function) } });
+	main.append_inst(main_entry, {}, FunctionCall { Operand(ExtCodeConstant { print }), { Operand(result) } });
+	main.append_inst(main_entry, {}, FunctionCall { Operand(ExtCodeConstant { &tuple_error }), { Operand(number), Operand(number), Operand(number) } });
+	main.set_terminator(main_entry, BasicBlock::Goto { main_exit });
+	main.set_terminator(unused, BasicBlock::Goto { main_exit });
+	// erased blocks aren't encoded, and the blocks after them are
+	// renumbered
+	main.erase_block(unused);
+	main.set_terminator(main_exit, BasicBlock::ReturnVoid {});
+	return program;
+}
+
+int main() {
+	Uptr<Program> program = make_program();
+	std::string bytes = serialize_program(*program);
+	// what the decoded program should print: the original without its
+	// erased blocks
+	for (const Uptr<FunctionDef> &function_def : program->function_defs) {
+		function_def->compact();
+	}
+	std::string expected_ir = normalize_ir(program->to_ir_syntax());
+
+	Uptr<Program> decoded = deserialize_program(bytes);
+	check(normalize_ir(decoded->to_ir_syntax()) == expected_ir, "in-memory round trip prints the same IR");
+	check(decoded->external_functions.size() == 2, "external functions are decoded");
+	check(serialize_program(*decoded) == bytes, "re-encoding the decoded program gives the same bytes");
+	for (const Uptr<FunctionDef> &function_def : decoded->function_defs) {
+		function_def->verify_def_use();
+	}
+
+	// "value" is used by two variables but stored once
+	size_t num_copies = 0;
+	for (size_t pos = bytes.find("value"); pos != std::string::npos; pos = bytes.find("value", pos + 1)) {
+		num_copies += 1;
+	}
+	check(num_copies == 1, "the string table interns each name once");
+
+	std::string path = "/tmp/mir_serialize_test_" + std::to_string(getpid()) + ".bin";
+	std::ofstream(path, std::ios::binary) << bytes;
+	{
+		Uptr<MappedProgram> mapped = MappedProgram::open(path);
+		FunctionDef &lazy_main = *mapped->get_program().function_defs[1];
+		check(lazy_main.basic_blocks.empty(), "a mapped function isn't decoded before it's loaded");
+		Opt<FunctionDef *> loaded_main = mapped->load_function_by_name("main");
+		check(loaded_main == &lazy_main && !lazy_main.basic_blocks.empty(), "a mapped function can be loaded by name");
+		check(mapped->get_program().function_defs[0]->basic_blocks.empty(), "loading one function leaves the others alone");
+		mapped->load_all_functions();
+		check(normalize_ir(mapped->get_program().to_ir_syntax()) == expected_ir, "mapped round trip prints the same IR");
+	}
+	unlink(path.c_str());
+
+	if (num_failures > 0) {
+		std::cerr << num_failures << " checks failed\n";
+		return 1;
+	}
+	std::cout << "binary MIR round trip: all checks passed\n";
+	return 0;
+}
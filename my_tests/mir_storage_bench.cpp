@@ -0,0 +1,190 @@
+// Measures the costs of the flat instruction storage: editing a long
+// function in place, compacting it, walking it in storage order and in
+// block order, and tearing a large program down. Each measurement is also
+// taken on the layout that the flat storage replaced, where every block
+// held its own array of separately allocated instructions, so that the
+// two can be compared. That layout has no def-use chains to maintain. Run
+// with `make storage_bench`.
+#include "mir.h"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+using namespace std_alias;
+using namespace mir;
+
+// the best of several runs, in seconds. `setup` runs untimed before each
+// run
+template<typename Setup, typename F>
+static double time_best(int num_runs, Setup setup, F f) {
+	double best = 1e9;
+	for (int run = 0; run < num_runs; ++run) {
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return best;
+}
+
+// a single block of `num_instructions` additions that each read the
+// previous one's result, like a long run of lowered arithmetic
+static void fill_straight_line(FunctionDef &function, size_t num_instructions) {
+	LocalVar *previous = function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+	BlockId block = function.create_block(false, "entry");
+	for (size_t i = 0; i < num_instructions; ++i) {
+		LocalVar *var = function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+		function.append_inst(block, Place(var), BinaryOperation { Operand(previous), Operand(Int64Constant { static_cast<int64_t>(i) }), Operator::plus });
+		previous = var;
+	}
+	function.set_terminator(block, BasicBlock::ReturnVal { Operand(previous) });
+}
+
+static Uptr<Program> make_program(size_t num_functions, size_t num_instructions) {
+	auto program = mkuptr<Program>();
+	for (size_t f = 0; f < num_functions; ++f) {
+		program->function_defs.push_back(mkuptr<FunctionDef>("function" + std::to_string(f), Type { Type::ArrayType { 0 } }));
+		fill_straight_line(*program->function_defs.back(), num_instructions);
+	}
+	return program;
+}
+
+// the replaced layout: an array of pointers to instructions per block
+struct PointerFunction {
+	Vec<Uptr<LocalVar>> local_vars;
+	Vec<Vec<Uptr<Instruction>>> blocks;
+};
+
+static void fill_straight_line(PointerFunction &function, size_t num_instructions) {
+	function.local_vars.push_back(mkuptr<LocalVar>(false, "", Type { Type::ArrayType { 0 } }));
+	LocalVar *previous = function.local_vars.back().get();
+	function.blocks.emplace_back();
+	for (size_t i = 0; i < num_instructions; ++i) {
+		function.local_vars.push_back(mkuptr<LocalVar>(false, "", Type { Type::ArrayType { 0 } }));
+		LocalVar *var = function.local_vars.back().get();
+		function.blocks[0].push_back(mkuptr<Instruction>(Place(var), BinaryOperation { Operand(previous), Operand(Int64Constant { static_cast<int64_t>(i) }), Operator::plus }));
+		previous = var;
+	}
+}
+
+// visits every operand of every instruction, the way most analyses do
+static size_t count_var_operands(const Instruction &instruction, size_t count) {
+	visit_reads(instruction, [&](const Operand &operand) {
+		if (std::holds_alternative<LocalVar *>(operand.value)) count += 1;
+	}, [&](const LocalVar *) {
+		count += 1;
+	});
+	return count;
+}
+
+int main() {
+	constexpr size_t num_edited = 5000;
+	constexpr int num_runs = 5;
+
+	// copy every instruction right after itself, then erase every third
+	// one of the result
+	Uptr<FunctionDef> function;
+	auto setup_function = [&]() {
+		function = mkuptr<FunctionDef>("edited", Type { Type::ArrayType { 0 } });
+		fill_straight_line(*function, num_edited);
+	};
+	auto edit = [&]() {
+		Vec<InstId> originals;
+		for (InstId inst : function->insts_of(0)) originals.push_back(inst);
+		for (InstId inst : originals) {
+			Instruction copy = function->inst(inst);
+			InstId next = function->next_inst(inst);
+			function->insert_inst(0, next, mv(copy.destination), mv(copy.rvalue));
+		}
+		size_t position = 0;
+		for (InstId inst : function->insts_of(0)) {
+			if (position++ % 3 == 0) function->erase_inst(inst);
+		}
+	};
+	double edit_time = time_best(num_runs, setup_function, edit);
+	double compact_time = time_best(num_runs, [&]() { setup_function(); edit(); }, [&]() { function->compact(); });
+	PointerFunction pointer_function;
+	auto setup_pointer_function = [&]() {
+		pointer_function = {};
+		fill_straight_line(pointer_function, num_edited);
+	};
+	auto edit_pointers = [&]() {
+		Vec<Uptr<Instruction>> &instructions = pointer_function.blocks[0];
+		for (size_t i = 0; i < instructions.size(); i += 2) {
+			instructions.insert(instructions.begin() + i + 1, mkuptr<Instruction>(*instructions[i]));
+		}
+		size_t position = 0;
+		for (size_t i = 0; i < instructions.size(); ) {
+			if (position++ % 3 == 0) {
+				instructions.erase(instructions.begin() + i);
+			} else {
+				i += 1;
+			}
+		}
+	};
+	double pointer_edit_time = time_best(num_runs, setup_pointer_function, edit_pointers);
+
+	// walking the edited function, before compacting it
+	setup_function();
+	edit();
+	size_t num_live = 0;
+	for ([[maybe_unused]] InstId inst : function->all_insts()) num_live += 1;
+	size_t checksum = 0;
+	double storage_walk_time = time_best(num_runs, []() {}, [&]() {
+		for (InstId inst : function->all_insts()) checksum = count_var_operands(function->inst(inst), checksum);
+	});
+	double block_walk_time = time_best(num_runs, []() {}, [&]() {
+		for (InstId inst : function->insts_of(0)) checksum = count_var_operands(function->inst(inst), checksum);
+	});
+	setup_pointer_function();
+	edit_pointers();
+	double pointer_walk_time = time_best(num_runs, []() {}, [&]() {
+		for (const Uptr<Instruction> &instruction : pointer_function.blocks[0]) checksum = count_var_operands(*instruction, checksum);
+	});
+
+	// walking and tearing down a program of many small functions
+	Uptr<Program> program;
+	size_t num_program_insts = 0;
+	auto setup_program = [&]() {
+		program = make_program(2700, 35);
+	};
+	setup_program();
+	for (const Uptr<FunctionDef> &function_def : program->function_defs) num_program_insts += function_def->instructions.size();
+	double program_walk_time = time_best(num_runs, []() {}, [&]() {
+		for (const Uptr<FunctionDef> &function_def : program->function_defs) {
+			for (InstId inst : function_def->all_insts()) checksum = count_var_operands(function_def->inst(inst), checksum);
+		}
+	});
+	double teardown_time = time_best(num_runs, setup_program, [&]() { program.reset(); });
+	Vec<PointerFunction> pointer_program;
+	auto setup_pointer_program = [&]() {
+		pointer_program = Vec<PointerFunction>(2700);
+		for (PointerFunction &function : pointer_program) fill_straight_line(function, 35);
+	};
+	setup_pointer_program();
+	double pointer_program_walk_time = time_best(num_runs, []() {}, [&]() {
+		for (const PointerFunction &function : pointer_program) {
+			for (const Vec<Uptr<Instruction>> &block : function.blocks) {
+				for (const Uptr<Instruction> &instruction : block) checksum = count_var_operands(*instruction, checksum);
+			}
+		}
+	});
+	double pointer_teardown_time = time_best(num_runs, setup_pointer_program, [&]() { pointer_program.clear(); });
+
+	std::cout << "copy and erase in a " << num_edited << "-instruction function: " << edit_time * 1e3 << " ms, "
+		<< pointer_edit_time * 1e3 << " ms with pointers per block\n";
+	std::cout << "compact() afterwards: " << compact_time * 1e3 << " ms\n";
+	std::cout << "walk of the edited function (" << num_live << " instructions): "
+		<< storage_walk_time * 1e9 / num_live << " ns per instruction with all_insts(), "
+		<< block_walk_time * 1e9 / num_live << " in block order, "
+		<< pointer_walk_time * 1e9 / num_live << " with pointers per block\n";
+	std::cout << "walk of 2700 functions (" << num_program_insts << " instructions): "
+		<< program_walk_time * 1e9 / num_program_insts << " ns per instruction, "
+		<< pointer_program_walk_time * 1e9 / num_program_insts << " with pointers per block\n";
+	std::cout << "teardown of the 2700 functions: " << teardown_time * 1e3 << " ms, "
+		<< pointer_teardown_time * 1e3 << " ms with pointers per block\n";
+	// keeps the walks from being optimized away
+	std::cout << "(checksum " << checksum << ")\n";
+	return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+	// A fixed-size set of small integers stored one bit each, for dataflow
+	// analyses that keep a set of facts per block.
+	class BitSet {
+		std::vector<uint64_t> words;
+		size_t num_bits;
+
+		public:
+
+		BitSet() : num_bits { 0 } {}
+		BitSet(size_t num_bits, bool value) :
+			words((num_bits + 63) / 64, value ? ~uint64_t(0) : 0),
+			num_bits { num_bits }
+		{
+			this->clear_padding();
+		}
+
+		size_t size() const { return this->num_bits; }
+		bool test(size_t i) const { return (this->words[i / 64] >> (i % 64)) & 1; }
+		void set(size_t i) { this->words[i / 64] |= uint64_t(1) << (i % 64); }
+		void reset(size_t i) { this->words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+
+		// these return whether this set changed
+		bool intersect_with(const BitSet &other) {
+			bool has_changed = false;
+			for (size_t w = 0; w < this->words.size(); ++w) {
+				uint64_t word = this->words[w] & other.words[w];
+				has_changed |= word != this->words[w];
+				this->words[w] = word;
+			}
+			return has_changed;
+		}
+		bool union_with(const BitSet &other) {
+			bool has_changed = false;
+			for (size_t w = 0; w < this->words.size(); ++w) {
+				uint64_t word = this->words[w] | other.words[w];
+				has_changed |= word != this->words[w];
+				this->words[w] = word;
+			}
+			return has_changed;
+		}
+
+		// calls f with the index of each bit that is set, in increasing order
+		template<typename F>
+		void for_each(F f) const {
+			for (size_t w = 0; w < this->words.size(); ++w) {
+				for (uint64_t word = this->words[w]; word != 0; word &= word - 1) {
+					f(w * 64 + __builtin_ctzll(word));
+				}
+			}
+		}
+
+		void subtract(const BitSet &other) {
+			for (size_t w = 0; w < this->words.size(); ++w) {
+				this->words[w] &= ~other.words[w];
+			}
+		}
+
+		bool operator==(const BitSet &other) const { return this->words == other.words; }
+		bool operator!=(const BitSet &other) const { return !(*this == other); }
+
+		private:
+
+		// keeps the bits past the end zero so that whole words can be compared
+		void clear_padding() {
+			if (this->num_bits % 64 != 0) {
+				this->words.back() &= (uint64_t(1) << (this->num_bits % 64)) - 1;
+			}
+		}
+	};
+}
@@ -1,6 +1,7 @@
 #include "std_alias.h"
 #include "parser.h"
 #include "hir_to_mir.h"
+#include "mir_opt.h"
 #include <string>
 #include <vector>
 #include <utility>
@@ -20,7 +21,7 @@
 using namespace std_alias;
 
 void print_help(char *progName) {
-	std::cerr << "Usage: " << progName << " [-v] [-g 0|1] [-O 0|1|2] [-p] SOURCE" << std::endl;
+	std::cerr << "Usage: " << progName << " [-v] [-g 0|1] [-O 0|1|2] [-u FACTOR] [-p] SOURCE" << std::endl;
 	return;
 }
 
@@ -32,6 +33,7 @@ int main(
 	bool output_parse_tree = false;
 	bool verbose = false;
 	int32_t optimizationLevel = 3;
+	size_t unrollFactor = 4;
 
 	// Check the compiler arguments.
 	if (argc < 2) {
@@ -41,11 +43,14 @@ int main(
 
 	int32_t option;
 	int64_t functionNumber = -1;
-	while ((option = getopt(argc, argv, "vg:O:p")) != -1) {
+	while ((option = getopt(argc, argv, "vg:O:u:p")) != -1) {
 		switch (option) {
 			case 'O':
 				optimizationLevel = strtoul(optarg, NULL, 0);
 				break;
+			case 'u':
+				unrollFactor = strtoul(optarg, NULL, 0);
+				break;
 			case 'g':
 				enable_code_generator = (strtoul(optarg, NULL, 0) == 0) ? false : true;
 				break;
@@ -69,6 +74,7 @@ int main(
 
 	if (enable_code_generator) {
 		auto mir_program = La::hir_to_mir::make_mir_program(*hir_program);
+		mir::opt::optimize_program(*mir_program, optimizationLevel, unrollFactor, verbose);
 		std::ofstream o;
 		o.open("prog.IR");
 		o << mir_program->to_ir_syntax();
@@ -5,35 +5,35 @@
 
 namespace La::hir_to_mir {
 	using namespace std_alias;
+	using utils::SmallVec;
 
 	class InstructionAdder : public hir::InstructionVisitor {
 		mir::FunctionDef &mir_function;
 		const Map<hir::ExternalFunction *, mir::ExternalFunction *> &ext_func_map;
 		const Map<hir::LaFunction *, mir::FunctionDef *> &func_map;
 		Map<hir::Variable *, mir::LocalVar *> &var_map;
-		Map<std::string, mir::BasicBlock *> block_map;
+		Map<std::string, mir::BlockId> block_map;
 
 		// local variables and blocks used for compiler purposes such as array checking
-		// nullptr if we did not use them
+		// nullptr or mir::no_block if we did not use them
 		struct CompilerAdditions {
 			mir::LocalVar *temp_condition; // used to store the value of a really short-lived boolean condition
 			mir::LocalVar *line_number; // used to store the line number for tensor-error etc. purposes; ENCODED
-			mir::LocalVar *error_dim; // used to store the dimension index for tensor-error etc.; ENCODED
-			mir::LocalVar *error_length; // used to store the dimension length for tensor-error etc.; ENCODED
-			mir::LocalVar *error_index; // used to store the index for tensor-error etc.; ENCODED
-			mir::BasicBlock *unalloced_error; // used to report use of an unallocated tensor
-			mir::BasicBlock *out_of_range_tuple_error; // used to report use of an out-of-range tuple
-			mir::BasicBlock *out_of_range_one_dim_error; // used to report use of an out-of-range 1D tensor
-			mir::BasicBlock *out_of_range_multi_dim_error; // used to report use of an out-of-range n-D tensor
+			Vec<mir::LocalVar *> error_lengths; // by dimension; used to store the dimension lengths for tensor-error etc.; ENCODED
+			Vec<mir::LocalVar *> error_indices; // by dimension; used to store the indices for tensor-error etc.; ENCODED
+			mir::BlockId unalloced_error; // used to report use of an unallocated tensor
+			mir::BlockId out_of_range_tuple_error; // used to report use of an out-of-range tuple
+			mir::BlockId out_of_range_one_dim_error; // used to report use of an out-of-range 1D tensor
+			Vec<mir::BlockId> out_of_range_multi_dim_errors; // by number of dimensions; used to find which dimension of an n-D tensor access is out of range
+			Vec<mir::BlockId> out_of_range_dim_errors; // by dimension; used to report an out-of-range dimension of an n-D tensor
+			Map<const mir::LocalVar *, mir::BlockId> null_tests; // by tensor or tuple; used to tell an unallocated one from an out-of-range access
 		} compiler_additions;
 
-		// null if the previous BasicBlock already has a terminator or there are no BasicBlocks yet
-		mir::BasicBlock *active_basic_block_nullable;
+		// no_block if the previous BasicBlock already has a terminator or there are no BasicBlocks yet
+		mir::BlockId active_basic_block;
 
-		void add_inst(Opt<Uptr<mir::Place>> destination, Uptr<mir::Rvalue> rvalue) {
-			this->active_basic_block_nullable->instructions.push_back(
-				mkuptr<mir::Instruction>(mv(destination), mv(rvalue))
-			);
+		void add_inst(Opt<mir::Place> destination, mir::Rvalue rvalue) {
+			this->mir_function.append_inst(this->active_basic_block, mv(destination), mv(rvalue));
 		}
 		mir::LocalVar *get_compiler_addition_temp_condition() {
 			if (!this->compiler_additions.temp_condition) {
@@ -47,90 +47,163 @@ namespace La::hir_to_mir {
 			}
 			return this->compiler_additions.line_number;
 		}
-		mir::LocalVar *get_compiler_addition_error_dim() {
-			if (!this->compiler_additions.error_dim) {
-				this->compiler_additions.error_dim = this->make_local_var_int64("errordim");
-			}
-			return this->compiler_additions.error_dim;
-		}
-		mir::LocalVar *get_compiler_addition_error_length() {
-			if (!this->compiler_additions.error_length) {
-				this->compiler_additions.error_length = this->make_local_var_int64("errorlength");
+		mir::LocalVar *get_compiler_addition_error_length(size_t dim_num = 0) {
+			Vec<mir::LocalVar *> &error_lengths = this->compiler_additions.error_lengths;
+			while (error_lengths.size() <= dim_num) {
+				std::string suffix = error_lengths.empty() ? "" : std::to_string(error_lengths.size());
+				error_lengths.push_back(this->make_local_var_int64("errorlength" + suffix));
 			}
-			return this->compiler_additions.error_length;
+			return error_lengths[dim_num];
 		}
-		mir::LocalVar *get_compiler_addition_error_index() {
-			if (!this->compiler_additions.error_index) {
-				this->compiler_additions.error_index = this->make_local_var_int64("errorindex");
+		mir::LocalVar *get_compiler_addition_error_index(size_t dim_num = 0) {
+			Vec<mir::LocalVar *> &error_indices = this->compiler_additions.error_indices;
+			while (error_indices.size() <= dim_num) {
+				std::string suffix = error_indices.empty() ? "" : std::to_string(error_indices.size());
+				error_indices.push_back(this->make_local_var_int64("errorindex" + suffix));
 			}
-			return this->compiler_additions.error_index;
+			return error_indices[dim_num];
 		}
-		mir::BasicBlock *get_compiler_addition_unalloced_error() {
-			if (!this->compiler_additions.unalloced_error) {
+		mir::BlockId get_compiler_addition_unalloced_error() {
+			if (this->compiler_additions.unalloced_error == mir::no_block) {
 				this->compiler_additions.unalloced_error = this->create_basic_block(false, "unallocederror");
-				Vec<Uptr<mir::Operand>> args;
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_line_number()));
-				compiler_additions.unalloced_error->instructions.push_back(mkuptr<mir::Instruction>(
-					Opt<Uptr<mir::Place>>(),
-					mkuptr<mir::FunctionCall>(
-						mkuptr<mir::ExtCodeConstant>(&mir::tensor_error),
-						mv(args)
-					)
-				));
+				this->mir_function.append_inst(
+					this->compiler_additions.unalloced_error,
+					Opt<mir::Place>(),
+					mir::FunctionCall {
+						mir::ExtCodeConstant { &mir::tensor_error },
+						{ this->get_compiler_addition_line_number() }
+					}
+				);
 			}
 			return this->compiler_additions.unalloced_error;
 		}
-		mir::BasicBlock *get_compiler_addition_out_of_range_tuple_error() {
-			if (!this->compiler_additions.out_of_range_tuple_error) {
+		mir::BlockId get_compiler_addition_out_of_range_tuple_error() {
+			if (this->compiler_additions.out_of_range_tuple_error == mir::no_block) {
 				this->compiler_additions.out_of_range_tuple_error = this->create_basic_block(false, "outofrangetuple");
-				Vec<Uptr<mir::Operand>> args;
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_line_number()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_length()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_index()));
-				compiler_additions.out_of_range_tuple_error->instructions.push_back(mkuptr<mir::Instruction>(
-					Opt<Uptr<mir::Place>>(),
-					mkuptr<mir::FunctionCall>(
-						mkuptr<mir::ExtCodeConstant>(&mir::tuple_error),
-						mv(args)
-					)
-				));
+				this->mir_function.append_inst(
+					this->compiler_additions.out_of_range_tuple_error,
+					Opt<mir::Place>(),
+					mir::FunctionCall {
+						mir::ExtCodeConstant { &mir::tuple_error },
+						{
+							this->get_compiler_addition_line_number(),
+							this->get_compiler_addition_error_length(),
+							this->get_compiler_addition_error_index()
+						}
+					}
+				);
 			}
 			return this->compiler_additions.out_of_range_tuple_error;
 		}
-		mir::BasicBlock *get_compiler_addition_out_of_range_one_dim_error() {
-			if (!this->compiler_additions.out_of_range_one_dim_error) {
+		mir::BlockId get_compiler_addition_out_of_range_one_dim_error() {
+			if (this->compiler_additions.out_of_range_one_dim_error == mir::no_block) {
 				this->compiler_additions.out_of_range_one_dim_error = this->create_basic_block(false, "outofrangeonedim");
-				Vec<Uptr<mir::Operand>> args;
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_line_number()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_length()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_index()));
-				compiler_additions.out_of_range_one_dim_error->instructions.push_back(mkuptr<mir::Instruction>(
-					Opt<Uptr<mir::Place>>(),
-					mkuptr<mir::FunctionCall>(
-						mkuptr<mir::ExtCodeConstant>(&mir::tensor_error),
-						mv(args)
-					)
-				));
+				this->mir_function.append_inst(
+					this->compiler_additions.out_of_range_one_dim_error,
+					Opt<mir::Place>(),
+					mir::FunctionCall {
+						mir::ExtCodeConstant { &mir::tensor_error },
+						{
+							this->get_compiler_addition_line_number(),
+							this->get_compiler_addition_error_length(),
+							this->get_compiler_addition_error_index()
+						}
+					}
+				);
 			}
 			return this->compiler_additions.out_of_range_one_dim_error;
 		}
-		mir::BasicBlock *get_compiler_addition_out_of_range_multi_dim_error() {
-			if (!this->compiler_additions.out_of_range_multi_dim_error) {
-				this->compiler_additions.out_of_range_multi_dim_error = this->create_basic_block(false, "outofrangemultidim");
-				Vec<Uptr<mir::Operand>> args;
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_line_number()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_dim()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_length()));
-				args.push_back(mkuptr<mir::Place>(this->get_compiler_addition_error_index()));
-				compiler_additions.out_of_range_multi_dim_error->instructions.push_back(mkuptr<mir::Instruction>(
-					Opt<Uptr<mir::Place>>(),
-					mkuptr<mir::FunctionCall>(
-						mkuptr<mir::ExtCodeConstant>(&mir::tensor_error),
-						mv(args)
-					)
-				));
-			}
-			return this->compiler_additions.out_of_range_multi_dim_error;
+		// the block that an access to an n-D tensor jumps to when any of its
+		// checks fails, which repeats the checks one at a time to find the
+		// first one that failed and report it
+		mir::BlockId get_compiler_addition_out_of_range_multi_dim_error(size_t num_dims) {
+			Vec<mir::BlockId> &out_of_range_multi_dim_errors = this->compiler_additions.out_of_range_multi_dim_errors;
+			if (out_of_range_multi_dim_errors.size() <= num_dims) {
+				out_of_range_multi_dim_errors.resize(num_dims + 1, mir::no_block);
+			}
+			if (out_of_range_multi_dim_errors[num_dims] == mir::no_block) {
+				mir::BlockId block = this->create_basic_block(false, "outofrangemultidim");
+				out_of_range_multi_dim_errors[num_dims] = block;
+				// the last dimension must be the one if none of the others is
+				for (size_t dim_num = 0; dim_num + 1 < num_dims; ++dim_num) {
+					mir::BlockId reporter = this->get_compiler_addition_out_of_range_dim_error(dim_num);
+					// %booooool <- %errorindexN < 1
+					this->mir_function.append_inst(
+						block,
+						mir::Place(this->get_compiler_addition_temp_condition()),
+						mir::BinaryOperation {
+							this->get_compiler_addition_error_index(dim_num),
+							mir::Int64Constant { 1 },
+							mir::Operator::lt
+						}
+					);
+					// guard %booooool :REPORTER
+					this->mir_function.append_inst(block, Opt<mir::Place>(), mir::Guard { this->get_compiler_addition_temp_condition(), reporter });
+					// %booooool <- %errorindexN >= %errorlengthN
+					this->mir_function.append_inst(
+						block,
+						mir::Place(this->get_compiler_addition_temp_condition()),
+						mir::BinaryOperation {
+							this->get_compiler_addition_error_index(dim_num),
+							this->get_compiler_addition_error_length(dim_num),
+							mir::Operator::ge
+						}
+					);
+					// guard %booooool :REPORTER
+					this->mir_function.append_inst(block, Opt<mir::Place>(), mir::Guard { this->get_compiler_addition_temp_condition(), reporter });
+				}
+				this->mir_function.set_terminator(block, mir::BasicBlock::Goto { this->get_compiler_addition_out_of_range_dim_error(num_dims - 1) });
+			}
+			return out_of_range_multi_dim_errors[num_dims];
+		}
+		mir::BlockId get_compiler_addition_out_of_range_dim_error(size_t dim_num) {
+			Vec<mir::BlockId> &out_of_range_dim_errors = this->compiler_additions.out_of_range_dim_errors;
+			if (out_of_range_dim_errors.size() <= dim_num) {
+				out_of_range_dim_errors.resize(dim_num + 1, mir::no_block);
+			}
+			if (out_of_range_dim_errors[dim_num] == mir::no_block) {
+				out_of_range_dim_errors[dim_num] = this->create_basic_block(false, "outofrangedim");
+				this->mir_function.append_inst(
+					out_of_range_dim_errors[dim_num],
+					Opt<mir::Place>(),
+					mir::FunctionCall {
+						mir::ExtCodeConstant { &mir::tensor_error },
+						{
+							this->get_compiler_addition_line_number(),
+							this->encode(mir::Int64Constant { static_cast<int64_t>(dim_num) }),
+							this->get_compiler_addition_error_length(dim_num),
+							this->get_compiler_addition_error_index(dim_num)
+						}
+					}
+				);
+			}
+			return out_of_range_dim_errors[dim_num];
+		}
+		// the block that an access to the tensor or tuple jumps to when any
+		// of its checks fails. an unallocated one has length 0, so all of
+		// its accesses fail their checks, and this is where it's told apart
+		// from an access that is out of range.
+		mir::BlockId get_compiler_addition_null_test(mir::LocalVar *target, mir::BlockId out_of_range_reporter) {
+			auto it = this->compiler_additions.null_tests.find(target);
+			if (it != this->compiler_additions.null_tests.end()) {
+				return it->second;
+			}
+			mir::BlockId block = this->create_basic_block(false, "nulltest");
+			this->compiler_additions.null_tests.insert({ target, block });
+			// %booooool <- %TARGET = 0
+			this->mir_function.append_inst(
+				block,
+				mir::Place(this->get_compiler_addition_temp_condition()),
+				mir::BinaryOperation {
+					target,
+					mir::Int64Constant { 0 }, // ideally would just be the default value of the array type but we don't have type checking
+					mir::Operator::eq
+				}
+			);
+			// guard %booooool :unallocederror
+			this->mir_function.append_inst(block, Opt<mir::Place>(), mir::Guard { this->get_compiler_addition_temp_condition(), this->get_compiler_addition_unalloced_error() });
+			this->mir_function.set_terminator(block, mir::BasicBlock::Goto { out_of_range_reporter });
+			return block;
 		}
 
 		public:
@@ -149,31 +222,30 @@ namespace La::hir_to_mir {
 			compiler_additions {
 				nullptr,
 				nullptr,
-				nullptr,
-				nullptr,
-				nullptr,
-				nullptr,
-				nullptr,
-				nullptr,
-				nullptr
+				{},
+				{},
+				mir::no_block,
+				mir::no_block,
+				mir::no_block,
+				{},
+				{},
+				{}
 			},
-			active_basic_block_nullable { nullptr }
+			active_basic_block { mir::no_block }
 		{}
 
 		void visit(hir::InstructionDeclaration &inst) override {
 			this->ensure_active_basic_block();
-			Uptr<mir::Operand> dest_operand = this->evaluate_expr(inst.variable);
-			Uptr<mir::Place> dest_place = utils::downcast_uptr<mir::Operand, mir::Place>(mv(dest_operand));
+			mir::Operand dest_operand = this->evaluate_expr(inst.variable);
 			this->add_inst(
-				mv(dest_place),
+				mir::Place(std::get<mir::LocalVar *>(dest_operand.value)),
 				inst.type.get_default_value()
 			);
 		}
 		void visit(hir::InstructionAssignment &inst) override {
 			this->ensure_active_basic_block();
 			if (inst.maybe_dest.has_value()) {
-				Uptr<mir::Operand> dest_operand = this->evaluate_indexing_expr(*inst.maybe_dest.value());
-				Uptr<mir::Place> dest_place = utils::downcast_uptr<mir::Operand, mir::Place>(mv(dest_operand));
+				mir::Place dest_place = this->evaluate_indexing_expr(*inst.maybe_dest.value());
 				this->evaluate_expr_into_existing_place(
 					inst.source,
 					mv(dest_place)
@@ -187,13 +259,13 @@ namespace La::hir_to_mir {
 		}
 		void visit(hir::InstructionLabel &inst) override {
 			// must start a new basic block
-			mir::BasicBlock *old_block = this->active_basic_block_nullable;
+			mir::BlockId old_block = this->active_basic_block;
 			this->enter_basic_block(true, inst.label_name);
 
-			if (old_block) {
+			if (old_block != mir::no_block) {
 				// the old block falls through
 				// assert(std::holds_alternative<mir::BasicBlock::ReturnVoid>(old_block->terminator));
-				old_block->terminator = mir::BasicBlock::Goto { this->active_basic_block_nullable };
+				this->mir_function.set_terminator(old_block, mir::BasicBlock::Goto { this->active_basic_block });
 			}
 		}
 		void visit(hir::InstructionReturn &inst) override {
@@ -206,24 +278,26 @@ namespace La::hir_to_mir {
 			} else {
 				terminator = mir::BasicBlock::ReturnVoid {};
 			}
-			this->active_basic_block_nullable->terminator = mv(terminator);
-			this->active_basic_block_nullable = nullptr;
+			this->mir_function.set_terminator(this->active_basic_block, mv(terminator));
+			this->active_basic_block = mir::no_block;
 		}
 		void visit(hir::InstructionBranchUnconditional &inst) override {
 			this->ensure_active_basic_block();
-			this->active_basic_block_nullable->terminator = mir::BasicBlock::Goto {
-				this->get_basic_block_by_name(inst.label_name)
-			};
-			this->active_basic_block_nullable = nullptr;
+			mir::BlockId successor = this->get_basic_block_by_name(inst.label_name);
+			this->mir_function.set_terminator(this->active_basic_block, mir::BasicBlock::Goto { successor });
+			this->active_basic_block = mir::no_block;
 		}
 		void visit(hir::InstructionBranchConditional &inst) override {
 			this->ensure_active_basic_block();
-			this->active_basic_block_nullable->terminator = mir::BasicBlock::Branch {
-				this->decode(this->evaluate_expr(inst.condition)),
-				this->get_basic_block_by_name(inst.then_label_name),
-				this->get_basic_block_by_name(inst.else_label_name)
-			};
-			this->active_basic_block_nullable = nullptr;
+			mir::Operand condition = this->decode(this->evaluate_expr(inst.condition));
+			mir::BlockId then_block = this->get_basic_block_by_name(inst.then_label_name);
+			mir::BlockId else_block = this->get_basic_block_by_name(inst.else_label_name);
+			this->mir_function.set_terminator(this->active_basic_block, mir::BasicBlock::Branch {
+				condition,
+				then_block,
+				else_block
+			});
+			this->active_basic_block = mir::no_block;
 		}
 
 		void finish() {
@@ -245,34 +319,54 @@ namespace La::hir_to_mir {
 		// sets the new basic block to be the current basic block
 		void enter_basic_block(bool user_labeled, std::string_view label_name) {
 			if (user_labeled) {
-				this->active_basic_block_nullable = this->get_basic_block_by_name(label_name);
+				this->active_basic_block = this->get_basic_block_by_name(label_name);
 			} else {
-				this->active_basic_block_nullable = this->create_basic_block(false, label_name);
+				this->active_basic_block = this->create_basic_block(false, label_name);
 			}
 		}
 		// makes sure that there is an active basic_block
 		// should be called right before adding an instruction
 		void ensure_active_basic_block() {
-			if (!this->active_basic_block_nullable) {
+			if (this->active_basic_block == mir::no_block) {
 				this->enter_basic_block(false, "");
 			}
 		}
-		// inserts a branch instruction to the specified basic block if
-		// the temp_condition variable is 1, or falls through if it is not
-		void branch_to_block(mir::BasicBlock *jmp_dst) {
-			mir::BasicBlock *old_block = this->active_basic_block_nullable;
-			assert(old_block != nullptr);
-			mir::BasicBlock *new_block = this->create_basic_block(false, "");
-			old_block->terminator = mir::BasicBlock::Branch {
-				mkuptr<mir::Place>(this->get_compiler_addition_temp_condition()),
-				jmp_dst,
-				new_block
-			};
-			this->active_basic_block_nullable = new_block;
+		// adds a guard that jumps to the specified basic block if the
+		// temp_condition variable is 1, and otherwise continues in the same
+		// block
+		void guard_to_block(mir::BlockId jmp_dst) {
+			assert(this->active_basic_block != mir::no_block);
+			this->add_inst(
+				Opt<mir::Place>(),
+				mir::Guard { this->get_compiler_addition_temp_condition(), jmp_dst }
+			);
+		}
+		// computes one of an access's checks and adds its result (0 or 1)
+		// to the sum of the checks so far. if it's the last one, the sum
+		// goes into the temp_condition variable for guard_to_block.
+		void add_check(Opt<mir::Operand> &condition, mir::BinaryOperation check, bool is_last) {
+			// %CHECK_RESULT <- %CHECK
+			mir::LocalVar *result = is_last && !condition ? this->get_compiler_addition_temp_condition() : this->make_local_var_int64("");
+			this->add_inst(mir::Place(result), check);
+			if (!condition) {
+				condition = mir::Operand(result);
+				return;
+			}
+			// %SUM <- %SUM + %CHECK_RESULT
+			mir::LocalVar *sum = is_last ? this->get_compiler_addition_temp_condition() : this->make_local_var_int64("");
+			this->add_inst(
+				mir::Place(sum),
+				mir::BinaryOperation {
+					*condition,
+					result,
+					mir::Operator::plus
+				}
+			);
+			condition = mir::Operand(sum);
 		}
 		// will create a basic block if it doesn't already exist
 		// this must be the user-defined label name
-		mir::BasicBlock *get_basic_block_by_name(std::string_view label_name) {
+		mir::BlockId get_basic_block_by_name(std::string_view label_name) {
 			assert(label_name.length() > 0);
 			auto it = this->block_map.find(label_name);
 			if (it == this->block_map.end()) {
@@ -281,28 +375,26 @@ namespace La::hir_to_mir {
 				return it->second;
 			}
 		}
-		mir::BasicBlock *create_basic_block(bool user_labeled, std::string_view label_name) {
-			Uptr<mir::BasicBlock> block = mkuptr<mir::BasicBlock>(user_labeled, std::string(label_name));
+		mir::BlockId create_basic_block(bool user_labeled, std::string_view label_name) {
+			mir::BlockId block = this->mir_function.create_block(user_labeled, std::string(label_name));
 			if (std::holds_alternative<mir::Type::VoidType>(this->mir_function.return_type.type)) {
 				// no return value
-				block->terminator = mir::BasicBlock::ReturnVoid {};
+				this->mir_function.set_terminator(block, mir::BasicBlock::ReturnVoid {});
 			} else {
 				// block->terminator = mir::BasicBlock::ReturnVal { this->mir_function.return_type.get_default_value() };
 
 				// ignore the commented code above; do a random ass self-jump bc we have to terminate the block somehow
-				block->terminator = mir::BasicBlock::Goto { block.get() };
+				this->mir_function.set_terminator(block, mir::BasicBlock::Goto { block });
 			}
-			mir::BasicBlock *block_ptr = block.get();
-			this->mir_function.basic_blocks.push_back(mv(block));
 			if (user_labeled) {
 				// add the basic block to the mapping for label names
-				auto [_, entry_is_new] = this->block_map.insert_or_assign(std::string(label_name), block_ptr);
+				auto [_, entry_is_new] = this->block_map.insert_or_assign(std::string(label_name), block);
 				if (!entry_is_new) {
 					std::cerr << "Logic error: creating basic block that already exists.\n";
 					exit(1);
 				}
 			}
-			return block_ptr;
+			return block;
 		}
 
 		// stores in the given place the result of the hir::Expr, adding
@@ -310,32 +402,30 @@ namespace La::hir_to_mir {
 		// block if necessary in order to evaluate the given expression
 		// (including its side effects)
 		// see also evaluate_expr
-		void evaluate_expr_into_existing_place(const Uptr<hir::Expr> &expr, Opt<Uptr<mir::Place>> place) {
+		void evaluate_expr_into_existing_place(const Uptr<hir::Expr> &expr, Opt<mir::Place> place) {
 			if (const hir::BinaryOperation *bin_op = dynamic_cast<hir::BinaryOperation *>(expr.get())) {
 				mir::LocalVar *decoded_result = this->make_local_var_int64("");
+				mir::Operand lhs = this->decode(this->evaluate_expr(bin_op->lhs));
+				mir::Operand rhs = this->decode(this->evaluate_expr(bin_op->rhs));
 				this->add_inst(
-					mkuptr<mir::Place>(decoded_result),
-					mkuptr<mir::BinaryOperation>(
-						this->decode(this->evaluate_expr(bin_op->lhs)),
-						this->decode(this->evaluate_expr(bin_op->rhs)),
-						bin_op->op
-					)
+					mir::Place(decoded_result),
+					mir::BinaryOperation { lhs, rhs, bin_op->op }
 				);
 				this->add_inst(
 					mv(place),
-					this->encode(mkuptr<mir::Place>(decoded_result))
+					this->encode(decoded_result)
 				);
 			} else if (const hir::LengthGetter *length_getter = dynamic_cast<hir::LengthGetter *>(expr.get())) {
-				Opt<Uptr<mir::Operand>> dimension;
+				Opt<mir::Operand> dimension;
 				if (length_getter->dimension.has_value()) {
 					dimension = this->decode(this->evaluate_expr(length_getter->dimension.value()));
 				}
 				this->add_inst(
 					mv(place),
-					mkuptr<mir::LengthGetter>(
+					mir::LengthGetter {
 						this->evaluate_expr(length_getter->target),
-						mv(dimension)
-					)
+						dimension
+					}
 				);
 			} else if (const hir::FunctionCall *call = dynamic_cast<hir::FunctionCall *>(expr.get())) {
 				this->add_inst(
@@ -343,18 +433,24 @@ namespace La::hir_to_mir {
 					this->evaluate_function_call(*call)
 				);
 			} else if (const hir::NewArray *new_array = dynamic_cast<hir::NewArray *>(expr.get())) {
-				Vec<Uptr<mir::Operand>> dimension_lengths;
+				SmallVec<mir::Operand, 3> dimension_lengths;
 				for (const Uptr<hir::Expr> &hir_dim_len : new_array->dimension_lengths) {
 					dimension_lengths.push_back(this->evaluate_expr(hir_dim_len));
 				}
 				this->add_inst(
 					mv(place),
-					mkuptr<mir::NewArray>(mv(dimension_lengths))
+					mir::NewArray { mv(dimension_lengths) }
 				);
 			} else if (const hir::NewTuple *new_tuple = dynamic_cast<hir::NewTuple *>(expr.get())) {
 				this->add_inst(
 					mv(place),
-					mkuptr<mir::NewTuple>(this->evaluate_expr(new_tuple->length))
+					mir::NewTuple { this->evaluate_expr(new_tuple->length) }
+				);
+			} else if (const hir::IndexingExpr *indexing_expr = dynamic_cast<hir::IndexingExpr *>(expr.get()); indexing_expr && indexing_expr->indices.size() > 0) {
+				mir::Place source = this->evaluate_indexing_expr(*indexing_expr);
+				this->add_inst(
+					mv(place),
+					mv(source)
 				);
 			} else {
 				this->add_inst(
@@ -369,33 +465,31 @@ namespace La::hir_to_mir {
 		// basic block if necessary in order to evaluate the given expression
 		// (including its side effects)
 		// see also evaluate_expr_into_existing_place
-		Uptr<mir::Operand> evaluate_expr(const Uptr<hir::Expr> &expr) {
-			if (const hir::ItemRef<hir::Nameable> *item_ref = dynamic_cast<hir::ItemRef<hir::Nameable> *>(expr.get())) {
+		mir::Operand evaluate_expr(const Uptr<hir::Expr> &expr) {
+			return this->evaluate_expr(*expr);
+		}
+		mir::Operand evaluate_expr(const hir::Expr &expr) {
+			if (const hir::ItemRef<hir::Nameable> *item_ref = dynamic_cast<const hir::ItemRef<hir::Nameable> *>(&expr)) {
 				if (!item_ref->get_referent().has_value()) {
 					std::cerr << "Compiler error: unbound name `" + item_ref->get_ref_name() + "`\n";
 					exit(1);
 				}
 				hir::Nameable *referent = item_ref->get_referent().value();
 				if (hir::Variable *hir_var = dynamic_cast<hir::Variable *>(referent)) {
-					mir::LocalVar *mir_var = this->var_map.at(hir_var);
-					return mkuptr<mir::Place>(
-						mir_var,
-						Vec<Uptr<mir::Operand>> {}
-					);
+					return this->var_map.at(hir_var);
 				} else if (hir::LaFunction *hir_func = dynamic_cast<hir::LaFunction *>(referent)) {
-					mir::FunctionDef *mir_func = this->func_map.at(hir_func);
-					return mkuptr<mir::CodeConstant>(mir_func);
+					return mir::CodeConstant { this->func_map.at(hir_func) };
 				} else if (hir::ExternalFunction *hir_func = dynamic_cast<hir::ExternalFunction *>(referent)) {
-					mir::ExternalFunction *mir_func = this->ext_func_map.at(hir_func);
-					return mkuptr<mir::ExtCodeConstant>(mir_func);
+					return mir::ExtCodeConstant { this->ext_func_map.at(hir_func) };
 				} else {
 					std::cerr << "Logic error: inexhaustive match on subclasses of Nameable\n";
 					exit(1);
 				}
-			} else if (const hir::NumberLiteral *num_lit = dynamic_cast<hir::NumberLiteral *>(expr.get())) {
-				return this->encode(mkuptr<mir::Int64Constant>(num_lit->value));
-			} else if (const hir::IndexingExpr *indexing_expr = dynamic_cast<hir::IndexingExpr *>(expr.get())) {
-				return evaluate_indexing_expr(*indexing_expr);
+			} else if (const hir::NumberLiteral *num_lit = dynamic_cast<const hir::NumberLiteral *>(&expr)) {
+				return this->encode(mir::Int64Constant { num_lit->value });
+			} else if (const hir::IndexingExpr *indexing_expr = dynamic_cast<const hir::IndexingExpr *>(&expr); indexing_expr && indexing_expr->indices.size() == 0) {
+				// a bare name is parsed as an indexing expression with no indices
+				return this->evaluate_expr(*indexing_expr->target);
 			} else {
 				// FUTURE: LA doesn't allow expressions this complex, but if it
 				// did then this is where we could add logic that:
@@ -408,165 +502,144 @@ namespace La::hir_to_mir {
 			}
 		}
 
-		Uptr<mir::Rvalue> evaluate_function_call(const hir::FunctionCall &call) {
+		mir::Rvalue evaluate_function_call(const hir::FunctionCall &call) {
 			// FUTURE could add a check for if the callee is 0
 
-			Uptr<mir::Operand> callee_operand = this->evaluate_expr(call.callee);
+			mir::Operand callee_operand = this->evaluate_expr(call.callee);
 			// because an external function can only be used as a direct callee
 			// (i.e. can't be stored in a variable and indirectly called), we
 			// only need to check here to see if we're calling an std function
 			// that needs encoding/decoding
 			mir::ExternalFunction *std_func_nullable = nullptr;
-			if (mir::ExtCodeConstant *ext_code = dynamic_cast<mir::ExtCodeConstant *>(callee_operand.get())) {
+			if (const mir::ExtCodeConstant *ext_code = std::get_if<mir::ExtCodeConstant>(&callee_operand.value)) {
 				std_func_nullable = ext_code->value;
 			}
 
-			Vec<Uptr<mir::Operand>> arguments;
+			SmallVec<mir::Operand, 4> arguments;
 			for (const Uptr<hir::Expr> &hir_arg : call.arguments) {
 				arguments.push_back(this->evaluate_expr(hir_arg));
 			}
 
-			Uptr<mir::Rvalue> result = mkuptr<mir::FunctionCall>(
-				mv(callee_operand),
-				mv(arguments)
-			);
+			mir::FunctionCall result { callee_operand, mv(arguments) };
 			if (std_func_nullable && std_func_nullable->returns_val) {
 				mir::LocalVar *temp_var = this->make_local_var_int64("");
 				this->add_inst(
-					mkuptr<mir::Place>(temp_var),
+					mir::Place(temp_var),
 					mv(result)
 				);
-				result = mkuptr<mir::Place>(temp_var);
+				return mir::Operand(temp_var);
 			}
 			return result;
 		}
 
-		Uptr<mir::Operand> evaluate_indexing_expr(const hir::IndexingExpr &indexing_expr) {
+		// returns the mir::Place that the hir::IndexingExpr refers to, first
+		// adding the instructions that check that the access is valid
+		mir::Place evaluate_indexing_expr(const hir::IndexingExpr &indexing_expr) {
 			// FUTURE even though the HIR allows it, the LA language allows us
-			// to safely assume that the target of an indexing expression either
-			// refers to a local variable or a function
+			// to safely assume that the target of an indexing expression
+			// refers to a local variable here
 			const hir::ItemRef<hir::Nameable> &item_ref = dynamic_cast<const hir::ItemRef<hir::Nameable> &>(*indexing_expr.target);
 			if (!item_ref.get_referent().has_value()) {
 				std::cerr << "Compiler error: unbound name `" + item_ref.get_ref_name() + "`\n";
 				exit(1);
 			}
 
-			hir::Nameable *hir_name = item_ref.get_referent().value();
-			if (hir::Variable *hir_var = dynamic_cast<hir::Variable *>(hir_name)) {
-				mir::LocalVar *mir_var = this->var_map.at(hir_var);
+			hir::Variable *hir_var = dynamic_cast<hir::Variable *>(item_ref.get_referent().value());
+			if (!hir_var) {
+				std::cerr << "Logic error: can't convert this indexing expression to a place (probably because we don't yet support assigning to functions)\n";
+				exit(1);
+			}
+			mir::LocalVar *mir_var = this->var_map.at(hir_var);
 
-				if (indexing_expr.indices.size() > 0) {
-					// check that the array was allocated
-					// %linenum <- LINE_NUM
+			SmallVec<mir::Operand, 3> mir_indices;
+			if (indexing_expr.indices.size() > 0) {
+				// %linenum <- LINE_NUM
+				this->add_inst(
+					mir::Place(this->get_compiler_addition_line_number()),
+					this->encode(mir::Int64Constant { static_cast<int64_t>(indexing_expr.src_pos.value().line) })
+				);
+
+				bool is_tuple = std::holds_alternative<mir::Type::TupleType>(mir_var->type.type);
+				mir::BlockId error_reporter;
+				if (is_tuple) {
+					error_reporter = this->get_compiler_addition_out_of_range_tuple_error();
+				} else if (indexing_expr.indices.size() == 1) {
+					error_reporter = this->get_compiler_addition_out_of_range_one_dim_error();
+				} else {
+					// must be a multi-dimensional tensor
+					error_reporter = this->get_compiler_addition_out_of_range_multi_dim_error(indexing_expr.indices.size());
+				}
+				// an unallocated tensor or tuple fails the checks below, so
+				// it's only tested for once one of them has failed
+				error_reporter = this->get_compiler_addition_null_test(mir_var, error_reporter);
+
+				// the checks of every dimension are added up into one
+				// condition, so that the access only needs one guard. the
+				// error reporter works out which one failed.
+				SmallVec<mir::Operand, 3> mir_encoded_indices;
+				Opt<mir::Operand> out_of_range;
+				for (size_t dim_num = 0; dim_num < indexing_expr.indices.size(); ++dim_num) {
+					assert(!is_tuple || dim_num == 0);
+					mir::Operand mir_index = this->evaluate_expr(indexing_expr.indices[dim_num]);
+					mir_encoded_indices.push_back(mir_index);
+
+					// %errorindexN <- %INDEX
 					this->add_inst(
-						mkuptr<mir::Place>(this->get_compiler_addition_line_number()),
-						this->encode(mkuptr<mir::Int64Constant>(static_cast<int64_t>(indexing_expr.src_pos.value().line)))
+						mir::Place(this->get_compiler_addition_error_index(dim_num)),
+						mir_index
 					);
-					// %booooool <- %TARGET = 0
+					// %errorlengthN <- length %TARGET DIM_NUM
 					this->add_inst(
-						mkuptr<mir::Place>(this->get_compiler_addition_temp_condition()),
-						mkuptr<mir::BinaryOperation>(
-							mkuptr<mir::Place>(mir_var),
-							mkuptr<mir::Int64Constant>(0), // ideally would just be the default value of the array type but we don't have type checking
-							mir::Operator::eq
-						)
-					);
-					// br %booooool :unallocederror :CONTINUE
-					this->branch_to_block(this->get_compiler_addition_unalloced_error());
-				}
-
-
-				Vec<Uptr<mir::Operand>> mir_indices;
-				if (indexing_expr.indices.size() > 0) {
-					bool is_tuple = std::holds_alternative<mir::Type::TupleType>(mir_var->type.type);
-					mir::BasicBlock *error_reporter;
-					bool is_multi_dim = false;
-					if (is_tuple) {
-						error_reporter = this->get_compiler_addition_out_of_range_tuple_error();
-					} else if (indexing_expr.indices.size() == 1) {
-						error_reporter = this->get_compiler_addition_out_of_range_one_dim_error();
-					} else {
-						// must be a multi-dimensional tensor
-						error_reporter = this->get_compiler_addition_out_of_range_multi_dim_error();
-						is_multi_dim = true;
-					}
-
-					for (int dim_num = 0; dim_num < indexing_expr.indices.size(); ++dim_num) {
-						assert(!is_tuple || dim_num == 0);
-						const Uptr<hir::Expr> &hir_index = indexing_expr.indices[dim_num];
-
-						Uptr<mir::Operand> mir_index = this->evaluate_expr(hir_index);
-						Uptr<mir::Operand> mir_index_clone0 = this->evaluate_expr(hir_index); // FUTURE rn we just use this for a quick and dirty clone, which works because all expressions in an index position in LA are simple
-
-						// %errorindex <- %INDEX
-						this->add_inst(
-							mkuptr<mir::Place>(this->get_compiler_addition_error_index()),
-							mv(mir_index_clone0)
-						);
-						// %errorlength <- length %TARGET DIM_NUM
-						this->add_inst(
-							mkuptr<mir::Place>(this->get_compiler_addition_error_length()),
-							mkuptr<mir::LengthGetter>(
-								mkuptr<mir::Place>(mir_var),
-								is_tuple ? Opt<Uptr<mir::Operand>>() : mkuptr<mir::Int64Constant>(dim_num)
-							)
-						);
-						if (is_multi_dim) {
-							// %errordim <- encoded(DIM_NUM)
-							this->add_inst(
-								mkuptr<mir::Place>(this->get_compiler_addition_error_dim()),
-								this->encode(mkuptr<mir::Int64Constant>(dim_num))
-							);
+						mir::Place(this->get_compiler_addition_error_length(dim_num)),
+						mir::LengthGetter {
+							mir_var,
+							is_tuple ? Opt<mir::Operand>() : mir::Operand(mir::Int64Constant { static_cast<int64_t>(dim_num) })
 						}
-						// %booooool <- %errorindex < 1; compare with 1 instead of 0 because encoded(0) == 1
-						this->add_inst(
-							mkuptr<mir::Place>(this->get_compiler_addition_temp_condition()),
-							mkuptr<mir::BinaryOperation>(
-								mkuptr<mir::Place>(this->get_compiler_addition_error_index()),
-								mkuptr<mir::Int64Constant>(1),
+					);
+					// %errorindexN < 1; compare with 1 instead of 0 because
+					// encoded(0) == 1. a constant index that isn't negative
+					// doesn't need it.
+					const mir::Int64Constant *constant_index = std::get_if<mir::Int64Constant>(&mir_index.value);
+					if (!constant_index || constant_index->value < 1) {
+						this->add_check(
+							out_of_range,
+							mir::BinaryOperation {
+								this->get_compiler_addition_error_index(dim_num),
+								mir::Int64Constant { 1 },
 								mir::Operator::lt
-							)
-						);
-						// br %booooool :ERROR_REPORTER :CONTINUE
-						this->branch_to_block(error_reporter);
-						// %booooool <- %errorindex >= %errorlength
-						this->add_inst(
-							mkuptr<mir::Place>(this->get_compiler_addition_temp_condition()),
-							mkuptr<mir::BinaryOperation>(
-								mkuptr<mir::Place>(this->get_compiler_addition_error_index()),
-								mkuptr<mir::Place>(this->get_compiler_addition_error_length()),
-								mir::Operator::ge
-							)
+							},
+							false
 						);
-						// br %booooool :ERROR_REPORTER :CONTINUE
-						this->branch_to_block(error_reporter);
-
-						mir_indices.push_back(this->decode(mv(mir_index)));
 					}
+					// %errorindexN >= %errorlengthN
+					this->add_check(
+						out_of_range,
+						mir::BinaryOperation {
+							this->get_compiler_addition_error_index(dim_num),
+							this->get_compiler_addition_error_length(dim_num),
+							mir::Operator::ge
+						},
+						dim_num + 1 == indexing_expr.indices.size()
+					);
 				}
+				// guard %booooool :NULL_TEST
+				this->guard_to_block(error_reporter);
 
-				return mkuptr<mir::Place>(
-					mir_var,
-					mv(mir_indices)
-				);
-			} else if (hir::LaFunction *hir_func = dynamic_cast<hir::LaFunction *>(hir_name)) {
-				mir::FunctionDef *mir_func = this->func_map.at(hir_func);
-				return mkuptr<mir::CodeConstant>(mir_func);
-			} else {
-				std::cerr << "Logic error: can't convert this indexing expression to a place (probably because we don't yet support assigning std functions to variables)\n";
-				exit(1);
+				for (const mir::Operand &mir_index : mir_encoded_indices) {
+					mir_indices.push_back(this->decode(mir_index));
+				}
 			}
+
+			return mir::Place(mir_var, mv(mir_indices));
 		}
 
-		Uptr<mir::Operand> encode(Uptr<mir::Operand> operand) {
-			if (mir::Int64Constant *num = dynamic_cast<mir::Int64Constant *>(operand.get())) {
+		mir::Operand encode(mir::Operand operand) {
+			if (mir::Int64Constant *num = std::get_if<mir::Int64Constant>(&operand.value)) {
 				num->value = num->value * 2 + 1;
 				return operand;
-			} else if (mir::Place *place = dynamic_cast<mir::Place *>(operand.get())) {
-				// LA does not allow complex indexing expressions here
-				assert(place->indices.size() == 0);
-
-				if (const mir::Type::ArrayType *arr_type = std::get_if<mir::Type::ArrayType>(&place->target->type.type)) {
+			} else if (mir::LocalVar **local_var = std::get_if<mir::LocalVar *>(&operand.value)) {
+				mir::LocalVar *target = *local_var;
+				if (const mir::Type::ArrayType *arr_type = std::get_if<mir::Type::ArrayType>(&target->type.type)) {
 					if (arr_type->num_dimensions > 0) {
 						// encoding an array is a no-op
 						return operand;
@@ -576,27 +649,27 @@ namespace La::hir_to_mir {
 						// %TEMP_VAR <- %OPERAND << 1
 						mir::LocalVar *temp_var = this->make_local_var_int64("");
 						this->add_inst(
-							mkuptr<mir::Place>(temp_var),
-							mkuptr<mir::BinaryOperation>(
-								mkuptr<mir::Place>(place->target),
-								mkuptr<mir::Int64Constant>(1),
+							mir::Place(temp_var),
+							mir::BinaryOperation {
+								target,
+								mir::Int64Constant { 1 },
 								mir::Operator::lshift
-							)
+							}
 						);
 						// %TEMP_VAR <- %TEMP_VAR + 1
 						this->add_inst(
-							mkuptr<mir::Place>(temp_var),
-							mkuptr<mir::BinaryOperation>(
-								mkuptr<mir::Place>(temp_var),
-								mkuptr<mir::Int64Constant>(1),
+							mir::Place(temp_var),
+							mir::BinaryOperation {
+								temp_var,
+								mir::Int64Constant { 1 },
 								mir::Operator::plus
-							)
+							}
 						);
 
 						// %TEMP_VAR holds our encoded value
-						return mkuptr<mir::Place>(temp_var);
+						return temp_var;
 					}
-				} else if (std::get_if<mir::Type::TupleType>(&place->target->type.type)) {
+				} else if (std::get_if<mir::Type::TupleType>(&target->type.type)) {
 					// encoding a tuple is a no-op
 					return operand;
 				} else {
@@ -608,42 +681,24 @@ namespace La::hir_to_mir {
 				exit(1);
 			}
 		}
-		// Uptr<mir::Operand> evaluate_to_decoded(const Uptr<hir::Expr> &expr) {
-		// 	Uptr<mir::Operand> operand = this->evaluate_expr(expr);
-		// 	if (dynamic_cast<const hir::NumberLiteral *>(expr.get())) {
-		// 		// user-inputted constant, we can take a shortcut
-
-		// 	} else {
-		// 		// not a user-inputted constant, do decode
-		// 		mir::LocalVar *decoded_var = this->make_local_var_int64("");
-		// 		this->add_inst(
-		// 			mkuptr<mir::Place>(decoded_var),
-		// 			this->decode(mv(operand))
-		// 		);
-		// 		operand = mkuptr<mir::Place>(decoded_var);
-		// 	}
-		// 	return operand;
-		// }
-		Uptr<mir::Operand> decode(Uptr<mir::Operand> operand) {
-			if (mir::Place *place = dynamic_cast<mir::Place *>(operand.get())) {
+		mir::Operand decode(mir::Operand operand) {
+			if (mir::LocalVar **local_var = std::get_if<mir::LocalVar *>(&operand.value)) {
 				// assume that it is an int64
-				assert(place->indices.size() == 0);
-				const mir::Type::ArrayType &arr_type = std::get<mir::Type::ArrayType>(place->target->type.type);
+				const mir::Type::ArrayType &arr_type = std::get<mir::Type::ArrayType>((*local_var)->type.type);
 				// assert(arr_type.num_dimensions == 0); TODO why is this assertion sometimes failing?
 
 				mir::LocalVar *decoded_var = this->make_local_var_int64("");
 				this->add_inst(
-					mkuptr<mir::Place>(decoded_var),
-					mkuptr<mir::BinaryOperation>(
-						mkuptr<mir::Place>(place->target),
-						mkuptr<mir::Int64Constant>(1),
+					mir::Place(decoded_var),
+					mir::BinaryOperation {
+						*local_var,
+						mir::Int64Constant { 1 },
 						mir::Operator::rshift
-					)
+					}
 				);
-				return mkuptr<mir::Place>(decoded_var);
-
-			} else if (mir::Int64Constant *num = dynamic_cast<mir::Int64Constant *>(operand.get())) {
-				return mkuptr<mir::Int64Constant>(num->value >> 1);
+				return decoded_var;
+			} else if (mir::Int64Constant *num = std::get_if<mir::Int64Constant>(&operand.value)) {
+				return mir::Int64Constant { num->value >> 1 };
 			} else {
 				std::cerr << "Logic error: can't decode this operand.\n";
 				exit(1);
@@ -2,6 +2,7 @@
 #include "utils.h"
 #include <iostream>
 #include <algorithm>
+#include <assert.h>
 
 namespace mir {
 	ExternalFunction tensor_error("tensor-error", -1, false);
@@ -26,21 +27,21 @@ namespace mir {
 			exit(1);
 		}
 	}
-	Uptr<Operand> Type::get_default_value() const {
+	Operand Type::get_default_value() const {
 		const Variant *x = &this->type;
 		if (std::get_if<VoidType>(x)) {
 			std::cerr << "Logic error: void has no default value\n";
 			exit(1);
 		} else if (const ArrayType *array_type = std::get_if<ArrayType>(x)) {
 			if (array_type->num_dimensions == 0) {
-				return mkuptr<Int64Constant>(1);
+				return Int64Constant { 1 };
 			} else {
-				return mkuptr<Int64Constant>(0);
+				return Int64Constant { 0 };
 			}
 		} else if (std::get_if<TupleType>(x)) {
-			return mkuptr<Int64Constant>(0);
+			return Int64Constant { 0 };
 		} else if (std::get_if<CodeType>(x)) {
-			return mkuptr<Int64Constant>(0);
+			return Int64Constant { 0 };
 		} else {
 			std::cerr << "Logic error: inexhaustive Type variant\n";
 			exit(1);
@@ -63,26 +64,30 @@ namespace mir {
 		return this->type.to_ir_syntax() + " " + this->to_ir_syntax();
 	}
 
+	std::string Operand::to_ir_syntax() const {
+		const Variant *x = &this->value;
+		if (const Int64Constant *num = std::get_if<Int64Constant>(x)) {
+			return std::to_string(num->value);
+		} else if (LocalVar *const *local_var = std::get_if<LocalVar *>(x)) {
+			return (*local_var)->to_ir_syntax();
+		} else if (const CodeConstant *code = std::get_if<CodeConstant>(x)) {
+			return "@" + code->value->get_unambiguous_name();
+		} else if (const ExtCodeConstant *ext_code = std::get_if<ExtCodeConstant>(x)) {
+			return ext_code->value->name;
+		} else {
+			std::cerr << "Logic error: inexhaustive Operand variant\n";
+			exit(1);
+		}
+	}
+
 	std::string Place::to_ir_syntax() const {
 		std::string result = this->target->to_ir_syntax();
-		for (const Uptr<Operand> &index : this->indices) {
-			result += "[" + index->to_ir_syntax() + "]";
+		for (const Operand &index : this->indices) {
+			result += "[" + index.to_ir_syntax() + "]";
 		}
 		return result;
 	}
 
-	std::string Int64Constant::to_ir_syntax() const {
-		return std::to_string(this->value);
-	}
-
-	std::string CodeConstant::to_ir_syntax() const {
-		return "@" + this->value->get_unambiguous_name();
-	}
-
-	std::string ExtCodeConstant::to_ir_syntax() const {
-		return this->value->name;
-	}
-
 	std::string to_string(Operator op) {
 		static const std::string map[] = {
 			"<", "<=", "=", ">=", ">", "+", "-", "*", "&", "<<", ">>"
@@ -90,16 +95,41 @@ namespace mir {
 		return map[static_cast<int>(op)];
 	}
 
+	Opt<int64_t> evaluate(Operator op, int64_t lhs, int64_t rhs) {
+		// do the arithmetic on unsigned values so that overflow wraps
+		uint64_t ulhs = static_cast<uint64_t>(lhs);
+		uint64_t urhs = static_cast<uint64_t>(rhs);
+		switch (op) {
+			case Operator::lt: return lhs < rhs;
+			case Operator::le: return lhs <= rhs;
+			case Operator::eq: return lhs == rhs;
+			case Operator::ge: return lhs >= rhs;
+			case Operator::gt: return lhs > rhs;
+			case Operator::plus: return static_cast<int64_t>(ulhs + urhs);
+			case Operator::minus: return static_cast<int64_t>(ulhs - urhs);
+			case Operator::times: return static_cast<int64_t>(ulhs * urhs);
+			case Operator::bitwise_and: return lhs & rhs;
+			case Operator::lshift:
+				if (rhs < 0 || rhs >= 64) return {};
+				return static_cast<int64_t>(ulhs << rhs);
+			case Operator::rshift:
+				if (rhs < 0 || rhs >= 64) return {};
+				return lhs >> rhs;
+		}
+		std::cerr << "Logic error: inexhaustive Operator\n";
+		exit(1);
+	}
+
 	std::string BinaryOperation::to_ir_syntax() const {
-		return this->lhs->to_ir_syntax() + " "
+		return this->lhs.to_ir_syntax() + " "
 			+ mir::to_string(this->op) + " "
-			+ this->rhs->to_ir_syntax();
+			+ this->rhs.to_ir_syntax();
 	}
 
 	std::string LengthGetter::to_ir_syntax() const {
-		std::string result = "length " + this->target->to_ir_syntax();
+		std::string result = "length " + this->target.to_ir_syntax();
 		if (this->dimension.has_value()) {
-			result += " " + this->dimension.value()->to_ir_syntax();
+			result += " " + this->dimension.value().to_ir_syntax();
 		}
 		return result;
 	}
@@ -107,17 +137,17 @@ namespace mir {
 	std::string Instruction::to_ir_syntax() const {
 		std::string result;
 		if (this->destination.has_value()) {
-			result += this->destination.value()->to_ir_syntax() + " <- ";
+			result += this->destination.value().to_ir_syntax() + " <- ";
 		}
-		result += this->rvalue->to_ir_syntax();
+		result += this->rvalue.to_ir_syntax();
 		return result;
 	}
 
 	std::string FunctionCall::to_ir_syntax() const {
-		std::string result = "call " + this->callee->to_ir_syntax() + "(";
+		std::string result = "call " + this->callee.to_ir_syntax() + "(";
 		result += utils::format_comma_delineated_list(
 			this->arguments,
-			[](const Uptr<Operand> &arg){ return arg->to_ir_syntax(); }
+			[](const Operand &arg){ return arg.to_ir_syntax(); }
 		);
 		result += ")";
 		return result;
@@ -127,18 +157,416 @@ namespace mir {
 		std::string result = "new Array(";
 		result += utils::format_comma_delineated_list(
 			this->dimension_lengths,
-			[](const Uptr<Operand> &arg){ return arg->to_ir_syntax(); }
+			[](const Operand &arg){ return arg.to_ir_syntax(); }
 		);
 		result += ")";
 		return result;
 	}
 
 	std::string NewTuple::to_ir_syntax() const {
-		return "new Tuple(" + this->length->to_ir_syntax() + ")";
+		return "new Tuple(" + this->length.to_ir_syntax() + ")";
+	}
+
+	std::string Rvalue::to_ir_syntax() const {
+		return std::visit([](const auto &rvalue) {
+			if constexpr (std::is_same_v<std::decay_t<decltype(rvalue)>, Guard>) {
+				// it takes the whole function to name the blocks involved
+				std::cerr << "Logic error: guards are emitted by FunctionDef::block_to_ir_syntax\n";
+				exit(1);
+				return std::string();
+			} else {
+				return rvalue.to_ir_syntax();
+			}
+		}, this->value);
+	}
+
+	SmallVec<BlockId, 2> BasicBlock::get_terminator_successors() const {
+		if (const Goto *term = std::get_if<Goto>(&this->terminator)) {
+			return { term->successor };
+		} else if (const Branch *term = std::get_if<Branch>(&this->terminator)) {
+			return { term->then_block, term->else_block };
+		} else {
+			return {};
+		}
+	}
+
+	Operand *BasicBlock::get_terminator_operand() {
+		if (ReturnVal *term = std::get_if<ReturnVal>(&this->terminator)) {
+			return &term->return_value;
+		} else if (Branch *term = std::get_if<Branch>(&this->terminator)) {
+			return &term->condition;
+		} else {
+			return nullptr;
+		}
+	}
+	const Operand *BasicBlock::get_terminator_operand() const {
+		return const_cast<BasicBlock *>(this)->get_terminator_operand();
+	}
+
+	SmallVec<BlockId, 4> FunctionDef::get_successors(BlockId block) const {
+		SmallVec<BlockId, 4> result;
+		auto add = [&](BlockId successor) {
+			if (std::find(result.begin(), result.end(), successor) == result.end()) {
+				result.push_back(successor);
+			}
+		};
+		for (InstId inst : this->insts_of(block)) {
+			if (const Guard *guard = std::get_if<Guard>(&this->instructions[inst].rvalue.value)) {
+				add(guard->target);
+			}
+		}
+		for (BlockId successor : this->basic_blocks[block].get_terminator_successors()) {
+			add(successor);
+		}
+		return result;
 	}
 
-	std::string BasicBlock::to_ir_syntax(Opt<Vec<LocalVar *>> vars_to_declare) const {
-		std::string result = "\t:" + this->get_unambiguous_name() + "\n";
+	LocalVar *FunctionDef::create_local_var(bool is_user_declared, std::string name, Type type) {
+		this->local_vars.push_back(mkuptr<LocalVar>(is_user_declared, mv(name), type));
+		return this->local_vars.back().get();
+	}
+	BlockId FunctionDef::create_block(bool user_labeled, std::string label_name) {
+		this->basic_blocks.emplace_back(user_labeled, mv(label_name));
+		this->terminator_chains.push_back({ {}, 0 });
+		return this->basic_blocks.size() - 1;
+	}
+	void FunctionDef::reserve(size_t num_blocks, size_t num_insts) {
+		this->basic_blocks.reserve(num_blocks);
+		this->terminator_chains.reserve(num_blocks);
+		this->instructions.reserve(num_insts);
+		this->inst_links.reserve(num_insts);
+		this->inst_chains.reserve(num_insts);
+	}
+	InstId FunctionDef::insert_inst(BlockId block, InstId before, Opt<Place> destination, Rvalue rvalue) {
+		this->instructions.emplace_back(mv(destination), mv(rvalue));
+		this->inst_links.push_back({ no_block, no_inst, no_inst });
+		this->inst_chains.push_back({ {}, 0 });
+		InstId inst = this->instructions.size() - 1;
+		this->link_inst(inst, block, before);
+		this->register_inst(inst);
+		return inst;
+	}
+	void FunctionDef::move_inst(InstId inst, BlockId block, InstId before) {
+		assert(inst != before);
+		this->unlink_inst(inst);
+		this->link_inst(inst, block, before);
+	}
+	void FunctionDef::replace_inst(InstId inst, Opt<Place> destination, Rvalue rvalue) {
+		this->unregister_inst(inst);
+		Instruction &x = this->instructions[inst];
+		x.destination = mv(destination);
+		x.rvalue = mv(rvalue);
+		this->register_inst(inst);
+	}
+	void FunctionDef::erase_inst(InstId inst) {
+		this->unlink_inst(inst);
+		this->unregister_inst(inst);
+	}
+	void FunctionDef::set_terminator(BlockId block, BasicBlock::Terminator terminator) {
+		this->unregister_terminator(block);
+		this->basic_blocks[block].terminator = mv(terminator);
+		this->register_terminator(block);
+	}
+	void FunctionDef::erase_block(BlockId block) {
+		BasicBlock &bb = this->basic_blocks[block];
+		for (InstId inst = bb.first_inst; inst != no_inst; inst = this->inst_links[inst].next) {
+			this->inst_links[inst].parent = no_block;
+			this->unregister_inst(inst);
+		}
+		this->unregister_terminator(block);
+		bb.first_inst = no_inst;
+		bb.last_inst = no_inst;
+		bb.terminator = BasicBlock::ReturnVoid {};
+		bb.is_erased = true;
+	}
+	bool FunctionDef::replace_all_uses(LocalVar *var, Operand replacement) {
+		LocalVar *replacement_var = nullptr;
+		if (LocalVar **x = std::get_if<LocalVar *>(&replacement.value)) {
+			replacement_var = *x;
+		}
+		if (replacement_var == var) {
+			return var->uses.empty();
+		}
+
+		// each rewrite removes all of its user's uses from var->uses, so work
+		// from a snapshot
+		Vec<Use> uses = var->uses;
+		for (const Use &use : uses) {
+			if (use.is_terminator) {
+				Operand *operand = this->basic_blocks[use.user].get_terminator_operand();
+				if (*operand != Operand(var)) continue; // already rewritten
+				this->unregister_terminator(use.user);
+				*operand = replacement;
+				this->register_terminator(use.user);
+			} else {
+				Instruction &inst = this->instructions[use.user];
+				bool can_rewrite = false;
+				visit_reads(
+					inst,
+					[&](const Operand &operand) { can_rewrite |= operand == Operand(var); },
+					[&](LocalVar *const &target) { can_rewrite |= target == var && replacement_var; }
+				);
+				if (!can_rewrite) continue;
+				this->unregister_inst(use.user);
+				visit_reads(
+					inst,
+					[&](Operand &operand) {
+						if (operand == Operand(var)) operand = replacement;
+					},
+					[&](LocalVar *&target) {
+						if (target == var && replacement_var) target = replacement_var;
+					}
+				);
+				this->register_inst(use.user);
+			}
+		}
+		return var->uses.empty();
+	}
+	void FunctionDef::replace_var(LocalVar *var, LocalVar *replacement) {
+		if (var == replacement) return;
+		Vec<InstId> defs = var->defs;
+		for (InstId def : defs) {
+			Instruction inst = this->instructions[def];
+			inst.destination->target = replacement;
+			this->replace_inst(def, mv(inst.destination), mv(inst.rvalue));
+		}
+		this->replace_all_uses(var, replacement);
+	}
+	void FunctionDef::link_inst(InstId inst, BlockId block, InstId before) {
+		BasicBlock &bb = this->basic_blocks[block];
+		InstLinks &x = this->inst_links[inst];
+		x.parent = block;
+		x.next = before;
+		if (before == no_inst) {
+			x.prev = bb.last_inst;
+			bb.last_inst = inst;
+		} else {
+			assert(this->inst_links[before].parent == block);
+			x.prev = this->inst_links[before].prev;
+			this->inst_links[before].prev = inst;
+		}
+		if (x.prev == no_inst) {
+			bb.first_inst = inst;
+		} else {
+			this->inst_links[x.prev].next = inst;
+		}
+	}
+	void FunctionDef::unlink_inst(InstId inst) {
+		InstLinks &x = this->inst_links[inst];
+		assert(x.parent != no_block);
+		BasicBlock &bb = this->basic_blocks[x.parent];
+		if (x.prev == no_inst) {
+			bb.first_inst = x.next;
+		} else {
+			this->inst_links[x.prev].next = x.next;
+		}
+		if (x.next == no_inst) {
+			bb.last_inst = x.prev;
+		} else {
+			this->inst_links[x.next].prev = x.prev;
+		}
+		// leave x.next alone so that an in-progress walk can continue
+		x.parent = no_block;
+	}
+	void FunctionDef::compact() {
+		Vec<BlockId> new_block_ids(this->basic_blocks.size(), no_block);
+		Vec<BasicBlock> new_blocks;
+		Vec<Instruction> new_instructions;
+		Vec<InstLinks> new_inst_links;
+		new_instructions.reserve(this->instructions.size());
+		new_inst_links.reserve(this->instructions.size());
+		for (BlockId old_id = 0; old_id < this->basic_blocks.size(); ++old_id) {
+			if (this->basic_blocks[old_id].is_erased) continue;
+			new_block_ids[old_id] = new_blocks.size();
+			new_blocks.push_back(mv(this->basic_blocks[old_id]));
+		}
+		for (BlockId block = 0; block < new_blocks.size(); ++block) {
+			BasicBlock &bb = new_blocks[block];
+			InstId first_inst = new_instructions.size();
+			for (InstId old_inst = bb.first_inst; old_inst != no_inst; old_inst = this->inst_links[old_inst].next) {
+				InstId inst = new_instructions.size();
+				new_instructions.push_back(mv(this->instructions[old_inst]));
+				if (Guard *guard = std::get_if<Guard>(&new_instructions.back().rvalue.value)) {
+					guard->target = new_block_ids[guard->target];
+				}
+				new_inst_links.push_back({ block, inst == first_inst ? no_inst : inst - 1, inst + 1 });
+			}
+			if (new_instructions.size() == first_inst) {
+				bb.first_inst = no_inst;
+				bb.last_inst = no_inst;
+			} else {
+				bb.first_inst = first_inst;
+				bb.last_inst = new_instructions.size() - 1;
+				new_inst_links.back().next = no_inst;
+			}
+			if (BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&bb.terminator)) {
+				term->successor = new_block_ids[term->successor];
+			} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&bb.terminator)) {
+				term->then_block = new_block_ids[term->then_block];
+				term->else_block = new_block_ids[term->else_block];
+			}
+		}
+		this->basic_blocks = mv(new_blocks);
+		this->instructions = mv(new_instructions);
+		this->inst_links = mv(new_inst_links);
+		this->rebuild_def_use();
+
+		// drop the variables that nothing refers to anymore, so that they
+		// aren't declared
+		Vec<Uptr<LocalVar>> new_local_vars;
+		for (Uptr<LocalVar> &var : this->local_vars) {
+			bool is_parameter = std::find(this->parameter_vars.begin(), this->parameter_vars.end(), var.get()) != this->parameter_vars.end();
+			if (is_parameter || !var->defs.empty() || !var->uses.empty()) {
+				new_local_vars.push_back(mv(var));
+			}
+		}
+		this->local_vars = mv(new_local_vars);
+	}
+
+	FunctionDef::UserChains &FunctionDef::get_chains(const Use &use) {
+		if (use.is_terminator) {
+			return this->terminator_chains[use.user];
+		} else {
+			return this->inst_chains[use.user];
+		}
+	}
+	void FunctionDef::add_use(LocalVar *var, uint32_t user, bool is_terminator) {
+		UserChains &chains = is_terminator ? this->terminator_chains[user] : this->inst_chains[user];
+		chains.uses.push_back({ var, static_cast<uint32_t>(var->uses.size()) });
+		var->uses.push_back({ user, is_terminator, static_cast<uint32_t>(chains.uses.size() - 1) });
+	}
+	void FunctionDef::register_inst(InstId inst) {
+		if (this->is_def_use_deferred) return;
+		const Instruction &x = this->instructions[inst];
+		visit_reads(
+			x,
+			[&](const Operand &operand) {
+				if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+					this->add_use(*var, inst, false);
+				}
+			},
+			[&](LocalVar *const &target) { this->add_use(target, inst, false); }
+		);
+		if (LocalVar *defined_var = get_defined_var(x)) {
+			this->inst_chains[inst].def_index = defined_var->defs.size();
+			defined_var->defs.push_back(inst);
+		}
+	}
+	void FunctionDef::register_terminator(BlockId block) {
+		if (this->is_def_use_deferred) return;
+		const Operand *operand = this->basic_blocks[block].get_terminator_operand();
+		if (operand) {
+			if (LocalVar *const *var = std::get_if<LocalVar *>(&operand->value)) {
+				this->add_use(*var, block, true);
+			}
+		}
+	}
+	void FunctionDef::remove_uses(UserChains &chains) {
+		// remove each entry by moving the last entry of the var's list into
+		// its place and then fixing up the moved entry's back-reference
+		for (const UseSlot &slot : chains.uses) {
+			Vec<Use> &uses = slot.var->uses;
+			Use moved = uses.back();
+			uses.pop_back();
+			if (slot.index < uses.size()) {
+				uses[slot.index] = moved;
+				this->get_chains(moved).uses[moved.slot].index = slot.index;
+			}
+		}
+		chains.uses.clear();
+	}
+	void FunctionDef::unregister_inst(InstId inst) {
+		if (this->is_def_use_deferred) return;
+		UserChains &chains = this->inst_chains[inst];
+		this->remove_uses(chains);
+		if (LocalVar *defined_var = get_defined_var(this->instructions[inst])) {
+			Vec<InstId> &defs = defined_var->defs;
+			InstId moved = defs.back();
+			defs.pop_back();
+			if (chains.def_index < defs.size()) {
+				defs[chains.def_index] = moved;
+				this->inst_chains[moved].def_index = chains.def_index;
+			}
+		}
+	}
+	void FunctionDef::unregister_terminator(BlockId block) {
+		if (this->is_def_use_deferred) return;
+		this->remove_uses(this->terminator_chains[block]);
+	}
+	void FunctionDef::rebuild_def_use() {
+		this->is_def_use_deferred = false;
+		for (const Uptr<LocalVar> &var : this->local_vars) {
+			var->defs.clear();
+			var->uses.clear();
+		}
+		this->inst_chains.assign(this->instructions.size(), { {}, 0 });
+		this->terminator_chains.assign(this->basic_blocks.size(), { {}, 0 });
+		for (InstId inst : this->all_insts()) {
+			this->register_inst(inst);
+		}
+		for (BlockId block = 0; block < this->basic_blocks.size(); ++block) {
+			if (!this->basic_blocks[block].is_erased) {
+				this->register_terminator(block);
+			}
+		}
+	}
+	void FunctionDef::verify_def_use() const {
+		// the expected chains, as (user, is_terminator) pairs per var
+		Map<const LocalVar *, Vec<Pair<uint32_t, bool>>> expected_uses;
+		Map<const LocalVar *, Vec<InstId>> expected_defs;
+		for (InstId inst : this->all_insts()) {
+			const Instruction &x = this->instructions[inst];
+			visit_reads(
+				x,
+				[&](const Operand &operand) {
+					if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+						expected_uses[*var].push_back({ inst, false });
+					}
+				},
+				[&](LocalVar *const &target) { expected_uses[target].push_back({ inst, false }); }
+			);
+			if (LocalVar *defined_var = get_defined_var(x)) {
+				expected_defs[defined_var].push_back(inst);
+			}
+		}
+		for (BlockId block = 0; block < this->basic_blocks.size(); ++block) {
+			if (this->basic_blocks[block].is_erased) continue;
+			const Operand *operand = this->basic_blocks[block].get_terminator_operand();
+			if (operand) {
+				if (LocalVar *const *var = std::get_if<LocalVar *>(&operand->value)) {
+					expected_uses[*var].push_back({ block, true });
+				}
+			}
+		}
+
+		for (const Uptr<LocalVar> &var : this->local_vars) {
+			Vec<Pair<uint32_t, bool>> actual_uses;
+			for (uint32_t i = 0; i < var->uses.size(); ++i) {
+				const Use &use = var->uses[i];
+				actual_uses.push_back({ use.user, use.is_terminator });
+				const UserChains &chains = use.is_terminator ? this->terminator_chains[use.user] : this->inst_chains[use.user];
+				if (use.slot >= chains.uses.size() || chains.uses[use.slot].var != var.get() || chains.uses[use.slot].index != i) {
+					std::cerr << "Logic error: broken use back-reference for " << var->to_ir_syntax() << "\n";
+					exit(1);
+				}
+			}
+			Vec<InstId> actual_defs = var->defs;
+			Vec<Pair<uint32_t, bool>> &uses = expected_uses[var.get()];
+			Vec<InstId> &defs = expected_defs[var.get()];
+			std::sort(actual_uses.begin(), actual_uses.end());
+			std::sort(uses.begin(), uses.end());
+			std::sort(actual_defs.begin(), actual_defs.end());
+			std::sort(defs.begin(), defs.end());
+			if (actual_uses != uses || actual_defs != defs) {
+				std::cerr << "Logic error: def-use chains of " << var->to_ir_syntax() << " in @" << this->get_unambiguous_name() << " are out of date\n";
+				exit(1);
+			}
+		}
+	}
+
+	std::string FunctionDef::block_to_ir_syntax(BlockId block, Opt<Vec<LocalVar *>> vars_to_declare) const {
+		const BasicBlock &bb = this->basic_blocks[block];
+		std::string result = "\t:" + this->get_block_name(block) + "\n";
 
 		if (vars_to_declare.has_value()) {
 			for (LocalVar *local_var : vars_to_declare.value()) {
@@ -146,21 +574,35 @@ namespace mir {
 			}
 		}
 
-		for (const Uptr<Instruction> &inst : this->instructions) {
-			result += "\t" + inst->to_ir_syntax() + "\n";
+		int num_guards = 0;
+		for (InstId inst : this->insts_of(block)) {
+			const Instruction &x = this->instructions[inst];
+			if (const Guard *guard = std::get_if<Guard>(&x.rvalue.value)) {
+				// this is the only place where a block is split at a guard
+				num_guards += 1;
+				std::string continuation_name = this->get_block_name(block) + "_g" + std::to_string(num_guards);
+				result += "\tbr "
+					+ guard->condition.to_ir_syntax()
+					+ " :" + this->get_block_name(guard->target)
+					+ " :" + continuation_name
+					+ "\n";
+				result += "\t:" + continuation_name + "\n";
+			} else {
+				result += "\t" + x.to_ir_syntax() + "\n";
+			}
 		}
 
-		if (std::get_if<ReturnVoid>(&this->terminator)) {
+		if (std::get_if<BasicBlock::ReturnVoid>(&bb.terminator)) {
 			result += "\treturn\n";
-		} else if (const ReturnVal *term = std::get_if<ReturnVal>(&this->terminator)) {
-			result += "\treturn " + term->return_value->to_ir_syntax() + "\n";
-		} else if (const Goto *term = std::get_if<Goto>(&this->terminator)) {
-			result += "\tbr :" + term->successor->get_unambiguous_name() + "\n";
-		} else if (const Branch *term = std::get_if<Branch>(&this->terminator)) {
+		} else if (const BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&bb.terminator)) {
+			result += "\treturn " + term->return_value.to_ir_syntax() + "\n";
+		} else if (const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&bb.terminator)) {
+			result += "\tbr :" + this->get_block_name(term->successor) + "\n";
+		} else if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&bb.terminator)) {
 			result += "\tbr "
-				+ term->condition->to_ir_syntax()
-				+ " :" + term->then_block->get_unambiguous_name()
-				+ " :" + term->else_block->get_unambiguous_name()
+				+ term->condition.to_ir_syntax()
+				+ " :" + this->get_block_name(term->then_block)
+				+ " :" + this->get_block_name(term->else_block)
 				+ "\n";
 		} else {
 			std::cerr << "Logic error: inexhaustive match on Terminator variant\n";
@@ -169,13 +611,16 @@ namespace mir {
 
 		return result;
 	}
-	std::string BasicBlock::get_unambiguous_name() const {
-		if (this->user_labeled) {
-			return "userblock_" + std::to_string(reinterpret_cast<uintptr_t>(this)) + "_" + this->label_name;
-		} else if (this->label_name.size() > 0) {
-			return this->label_name;
+	std::string FunctionDef::get_block_name(BlockId block) const {
+		// block ids are unique within the function, so they disambiguate
+		// labels that might otherwise collide
+		const BasicBlock &bb = this->basic_blocks[block];
+		if (bb.user_labeled) {
+			return "userblock_" + std::to_string(block) + "_" + bb.label_name;
+		} else if (bb.label_name.size() > 0) {
+			return bb.label_name + "_" + std::to_string(block);
 		} else {
-			return "block_" + std::to_string(reinterpret_cast<uintptr_t>(this));
+			return "block_" + std::to_string(block);
 		}
 	}
 
@@ -187,18 +632,17 @@ namespace mir {
 		);
 		result += ") {\n";
 
-		bool is_first_block = true;
-		for (const Uptr<BasicBlock> &block : this->basic_blocks) {
-			if (is_first_block) {
+		for (BlockId block = 0; block < this->basic_blocks.size(); ++block) {
+			if (this->basic_blocks[block].is_erased) continue;
+			if (block == 0) {
 				Vec<LocalVar *> vars_to_initialize;
 				for (const Uptr<LocalVar> &local_var : this->local_vars) {
 					if (std::find(this->parameter_vars.begin(), this->parameter_vars.end(), local_var.get()) != this->parameter_vars.end()) continue;
 					vars_to_initialize.push_back(local_var.get());
 				}
-				result += block->to_ir_syntax(mv(vars_to_initialize)) + "\n";
-				is_first_block = false;
+				result += this->block_to_ir_syntax(block, mv(vars_to_initialize)) + "\n";
 			} else {
-				result += block->to_ir_syntax({}) + "\n";
+				result += this->block_to_ir_syntax(block, {}) + "\n";
 			}
 		}
 		result += "}\n";
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "std_alias.h"
+#include "small_vec.h"
 #include <variant>
+#include <type_traits>
 #include <string>
 
 // The MIR, or "mid-level intermediate representation", describes the imperative
@@ -11,9 +13,20 @@
 // also meant to closely reflect CS 322's IR language.
 namespace mir {
 	using namespace std_alias;
+	using utils::SmallVec;
 
+	struct LocalVar;
+	struct FunctionDef;
+	struct ExternalFunction;
 	struct Operand;
 
+	// blocks and instructions are referred to by their index in the
+	// containing FunctionDef's storage
+	using BlockId = uint32_t;
+	using InstId = uint32_t;
+	constexpr BlockId no_block = UINT32_MAX;
+	constexpr InstId no_inst = UINT32_MAX;
+
 	struct Type {
 		struct VoidType {};
 		struct ArrayType { int num_dimensions; };
@@ -23,7 +36,15 @@ namespace mir {
 		Variant type;
 
 		std::string to_ir_syntax() const;
-		Uptr<Operand> get_default_value() const; // the value to initialize the variable to
+		Operand get_default_value() const; // the value to initialize the variable to
+	};
+
+	// a single operand that reads a LocalVar, either in an instruction or in
+	// a block's terminator
+	struct Use {
+		uint32_t user; // the InstId or BlockId of the reader
+		bool is_terminator;
+		uint32_t slot; // bookkeeping for FunctionDef
 	};
 
 	// any function-local location in memory, including user-defined local
@@ -33,6 +54,15 @@ namespace mir {
 		std::string name; // empty means anonymous
 		Type type;
 
+		// def-use chains, kept up to date by the owning FunctionDef's
+		// mutation API. a def is an instruction that assigns to the whole
+		// variable; storing to an element only reads the array reference, so
+		// it counts as a use. a user that reads the variable through several
+		// operands has one use per operand. neither list is in any
+		// particular order.
+		Vec<InstId> defs;
+		Vec<Use> uses;
+
 		LocalVar(bool is_user_declared, std::string name, Type type) :
 			is_user_declared { is_user_declared }, name { mv(name) }, type { type }
 		{}
@@ -42,57 +72,57 @@ namespace mir {
 		std::string get_declaration() const;
 	};
 
-	// a value that can be used as the right-hand side of an
-	// InstructionAssignment
-	// closely resembles hir::Expr
-	struct Rvalue {
-		virtual std::string to_ir_syntax() const = 0;
-	};
-
-	struct Operand : Rvalue {};
+	struct Int64Constant {
+		int64_t value;
 
-	// a "place" in memory, which can be assigned to as the left-hand side of
-	// an InstructionAssignment.
-	// closely resembles hir::IndexingExpr but is more limited in the allowable'
-	// target expressions
-	struct Place : Operand {
-		LocalVar *target;
-		Vec<Uptr<Operand>> indices;
+		bool operator==(const Int64Constant &other) const { return this->value == other.value; }
+	};
 
-		Place(LocalVar *target) : target { target }, indices {} {}
-		Place(LocalVar *target, Vec<Uptr<Operand>> indices) :
-			target { target }, indices { mv(indices) }
-		{}
+	struct CodeConstant {
+		FunctionDef *value;
 
-		std::string to_ir_syntax() const override;
+		bool operator==(const CodeConstant &other) const { return this->value == other.value; }
 	};
 
-	struct Int64Constant : Operand {
-		int64_t value;
-
-		Int64Constant(int64_t value) : value { value } {}
+	struct ExtCodeConstant {
+		ExternalFunction *value;
 
-		std::string to_ir_syntax() const override;
+		bool operator==(const ExtCodeConstant &other) const { return this->value == other.value; }
 	};
 
-	struct FunctionDef;
+	// a value that can be used without touching memory: a constant, or the
+	// current value of a LocalVar. Operands are small tagged values that are
+	// stored and passed around by value.
+	struct Operand {
+		using Variant = std::variant<Int64Constant, LocalVar *, CodeConstant, ExtCodeConstant>;
+		Variant value;
 
-	struct CodeConstant : Operand {
-		FunctionDef *value;
+		Operand(Int64Constant value) : value { value } {}
+		Operand(LocalVar *value) : value { value } {}
+		Operand(CodeConstant value) : value { value } {}
+		Operand(ExtCodeConstant value) : value { value } {}
 
-		CodeConstant(FunctionDef *value) : value { value } {}
+		bool operator==(const Operand &other) const { return this->value == other.value; }
+		bool operator!=(const Operand &other) const { return !(*this == other); }
 
-		std::string to_ir_syntax() const override;
+		std::string to_ir_syntax() const;
 	};
+	static_assert(sizeof(Operand) == 16, "Operand should stay small enough to pass around by value");
 
-	struct ExternalFunction;
-
-	struct ExtCodeConstant : Operand {
-		ExternalFunction *value;
+	// a "place" in memory, which can be assigned to as the left-hand side of
+	// an InstructionAssignment, or read as an Rvalue.
+	// closely resembles hir::IndexingExpr but is more limited in the allowable
+	// target expressions
+	struct Place {
+		LocalVar *target;
+		SmallVec<Operand, 3> indices;
 
-		ExtCodeConstant(ExternalFunction *value) : value { value } {}
+		Place(LocalVar *target) : target { target }, indices {} {}
+		Place(LocalVar *target, SmallVec<Operand, 3> indices) :
+			target { target }, indices { mv(indices) }
+		{}
 
-		std::string to_ir_syntax() const override;
+		std::string to_ir_syntax() const;
 	};
 
 	enum struct Operator {
@@ -109,98 +139,206 @@ namespace mir {
 		rshift
 	};
 	std::string to_string(Operator op);
-
-	struct BinaryOperation : Rvalue {
-		Uptr<Operand> lhs;
-		Uptr<Operand> rhs;
+	// whether the operator gives 1 or 0 for whether its operands compare
+	// a certain way
+	inline bool is_comparison(Operator op) {
+		return op == Operator::lt || op == Operator::le || op == Operator::eq || op == Operator::ge || op == Operator::gt;
+	}
+
+	// the result of applying the operator to two constants the way the
+	// generated code would (wrapping on overflow), or nullopt if that isn't
+	// known at compile time, as for shift amounts outside [0, 64)
+	Opt<int64_t> evaluate(Operator op, int64_t lhs, int64_t rhs);
+
+	struct BinaryOperation {
+		Operand lhs;
+		Operand rhs;
 		Operator op;
 
-		BinaryOperation(Uptr<Operand> lhs, Uptr<Operand> rhs, Operator op) :
-			lhs { mv(lhs) }, rhs { mv(rhs) }, op { op }
-		{}
-
-		std::string to_ir_syntax() const override;
+		std::string to_ir_syntax() const;
 	};
 
-	struct LengthGetter : Rvalue {
-		Uptr<Operand> target;
-		Opt<Uptr<Operand>> dimension;
-
-		LengthGetter(Uptr<Operand> target, Opt<Uptr<Operand>> dimension) :
-			target { mv(target) }, dimension { mv(dimension) }
-		{}
+	// the length of an unallocated array or tuple (0) is 0
+	struct LengthGetter {
+		Operand target;
+		Opt<Operand> dimension;
 
-		std::string to_ir_syntax() const override;
+		std::string to_ir_syntax() const;
 	};
 
-	struct FunctionCall : Rvalue {
-		Uptr<Operand> callee;
-		Vec<Uptr<Operand>> arguments;
+	struct FunctionCall {
+		Operand callee;
+		SmallVec<Operand, 4> arguments;
 
-		FunctionCall(Uptr<Operand> callee, Vec<Uptr<Operand>> arguments) :
-			callee { mv(callee) }, arguments { mv(arguments) }
-		{}
-
-		std::string to_ir_syntax() const override;
+		std::string to_ir_syntax() const;
 	};
 
-	struct NewArray : Rvalue {
-		Vec<Uptr<Operand>> dimension_lengths;
+	struct NewArray {
+		SmallVec<Operand, 3> dimension_lengths;
 
-		NewArray(Vec<Uptr<Operand>> dimension_lengths) : dimension_lengths { mv(dimension_lengths) } {}
+		std::string to_ir_syntax() const;
+	};
 
-		std::string to_ir_syntax() const override;
+	struct NewTuple {
+		Operand length;
+
+		std::string to_ir_syntax() const;
 	};
 
-	struct NewTuple : Rvalue {
-		Uptr<Operand> length;
+	// "if the condition is nonzero, jump to the target block", without ending
+	// the current block. used for the checks in front of array and tuple
+	// accesses, whose targets are cold blocks that report the error and
+	// never come back. blocks are only split at guards when the function is
+	// emitted as IR, so passes see the control flow of the user's program
+	// rather than a block per check.
+	// a guard isn't really a value, but it lives in Rvalue so that it can
+	// sit in the instruction stream; its instruction has no destination.
+	struct Guard {
+		Operand condition;
+		BlockId target;
+	};
 
-		NewTuple(Uptr<Operand> length) : length { mv(length) } {}
+	// a value that can be used as the right-hand side of an
+	// InstructionAssignment
+	// closely resembles hir::Expr
+	struct Rvalue {
+		using Variant = std::variant<Operand, Place, BinaryOperation, LengthGetter, FunctionCall, NewArray, NewTuple, Guard>;
+		Variant value;
+
+		Rvalue(Operand value) : value { value } {}
+		Rvalue(Place value) : value { mv(value) } {}
+		Rvalue(BinaryOperation value) : value { value } {}
+		Rvalue(LengthGetter value) : value { value } {}
+		Rvalue(FunctionCall value) : value { mv(value) } {}
+		Rvalue(NewArray value) : value { mv(value) } {}
+		Rvalue(NewTuple value) : value { value } {}
+		Rvalue(Guard value) : value { value } {}
 
-		std::string to_ir_syntax() const override;
+		std::string to_ir_syntax() const;
 	};
 
 	// mir::Instruction represents an elementary type-aware option, unlike
 	// hir::Instruction which more closely resembles the syntactic construct of
 	// an LA instruction
-	// interface
 	struct Instruction {
-		Opt<Uptr<Place>> destination;
-		Uptr<Rvalue> rvalue;
+		Opt<Place> destination;
+		Rvalue rvalue;
 
-		Instruction(Opt<Uptr<Place>> destination, Uptr<Rvalue> rvalue) :
+		Instruction(Opt<Place> destination, Rvalue rvalue) :
 			destination { mv(destination) }, rvalue { mv(rvalue) }
 		{}
 
 		std::string to_ir_syntax() const;
 	};
 
+	// calls `operand_fn(Operand &)` on each operand that the instruction
+	// reads and `target_fn(LocalVar *&)` on the target of each Place that is
+	// read or indexed into. works on both const and non-const instructions.
+	template<typename I, typename OperandFn, typename TargetFn>
+	void visit_reads(I &inst, OperandFn operand_fn, TargetFn target_fn) {
+		auto visit_indexed_place = [&](auto &place) {
+			target_fn(place.target);
+			for (auto &index : place.indices) {
+				operand_fn(index);
+			}
+		};
+		if (inst.destination.has_value() && !inst.destination->indices.empty()) {
+			visit_indexed_place(*inst.destination);
+		}
+		std::visit([&](auto &rvalue) {
+			using T = std::decay_t<decltype(rvalue)>;
+			if constexpr (std::is_same_v<T, Operand>) {
+				operand_fn(rvalue);
+			} else if constexpr (std::is_same_v<T, Place>) {
+				visit_indexed_place(rvalue);
+			} else if constexpr (std::is_same_v<T, BinaryOperation>) {
+				operand_fn(rvalue.lhs);
+				operand_fn(rvalue.rhs);
+			} else if constexpr (std::is_same_v<T, LengthGetter>) {
+				operand_fn(rvalue.target);
+				if (rvalue.dimension.has_value()) {
+					operand_fn(*rvalue.dimension);
+				}
+			} else if constexpr (std::is_same_v<T, FunctionCall>) {
+				operand_fn(rvalue.callee);
+				for (auto &argument : rvalue.arguments) {
+					operand_fn(argument);
+				}
+			} else if constexpr (std::is_same_v<T, NewArray>) {
+				for (auto &dimension_length : rvalue.dimension_lengths) {
+					operand_fn(dimension_length);
+				}
+			} else if constexpr (std::is_same_v<T, NewTuple>) {
+				operand_fn(rvalue.length);
+			} else {
+				static_assert(std::is_same_v<T, Guard>, "inexhaustive Rvalue variant");
+				operand_fn(rvalue.condition);
+			}
+		}, inst.rvalue.value);
+	}
+
+	// the LocalVar that the instruction assigns as a whole, if any
+	inline LocalVar *get_defined_var(const Instruction &inst) {
+		if (inst.destination.has_value() && inst.destination->indices.empty()) {
+			return inst.destination->target;
+		}
+		return nullptr;
+	}
+
+	// whether the instruction does anything besides computing a value for
+	// its destination variable: calling a function, jumping away, or
+	// storing to an element
+	inline bool has_side_effects(const Instruction &inst) {
+		return std::holds_alternative<FunctionCall>(inst.rvalue.value)
+			|| std::holds_alternative<Guard>(inst.rvalue.value)
+			|| (inst.destination.has_value() && !inst.destination->indices.empty());
+	}
+
+	// the position of an instruction in its function; maintained by
+	// FunctionDef. an erased instruction has no parent block but keeps its
+	// links so that a walk that is positioned on it can still advance.
+	struct InstLinks {
+		BlockId parent;
+		InstId prev;
+		InstId next;
+	};
+
 	struct BasicBlock {
 		struct ReturnVoid {};
-		struct ReturnVal { Uptr<Operand> return_value; };
-		struct Goto { BasicBlock* successor; };
+		struct ReturnVal { Operand return_value; };
+		struct Goto { BlockId successor; };
 		struct Branch {
-			Uptr<Operand> condition;
-			BasicBlock *then_block;
-			BasicBlock *else_block;
+			Operand condition;
+			BlockId then_block;
+			BlockId else_block;
 		};
 		using Terminator = std::variant<ReturnVoid, ReturnVal, Goto, Branch>;
 
 		// data fields start here
 		bool user_labeled; // whether the block was given a label by the user
+		bool is_erased;
 		std::string label_name;
-		Vec<Uptr<Instruction>> instructions;
+		// the block's instructions form a doubly-linked list threaded through
+		// FunctionDef::instructions
+		InstId first_inst;
+		InstId last_inst;
 		Terminator terminator;
 
 		BasicBlock(bool user_labeled, std::string label_name) :
 			user_labeled { user_labeled },
+			is_erased { false },
 			label_name { mv(label_name) },
-			instructions {},
+			first_inst { no_inst },
+			last_inst { no_inst },
 			terminator { ReturnVoid {} }
 		{}
 
-		std::string to_ir_syntax(Opt<Vec<LocalVar *>> vars_to_declare) const;
-		std::string get_unambiguous_name() const;
+		// the blocks that the terminator can jump to. see also
+		// FunctionDef::get_successors
+		SmallVec<BlockId, 2> get_terminator_successors() const;
+		// the operand that the terminator reads, if any
+		Operand *get_terminator_operand();
+		const Operand *get_terminator_operand() const;
 	};
 
 	struct FunctionDef {
@@ -208,14 +346,193 @@ namespace mir {
 		mir::Type return_type;
 		Vec<Uptr<LocalVar>> local_vars;
 		Vec<LocalVar *> parameter_vars;
-		Vec<Uptr<BasicBlock>> basic_blocks; // the first block is always the entry block
+		// blocks are emitted in this order. the first block is always the
+		// entry block.
+		Vec<BasicBlock> basic_blocks;
+		// storage for the instructions of every block. a freshly compacted
+		// function stores each block's instructions contiguously and in
+		// block order, so a full walk of the function is a linear walk of
+		// this array. insertion and erasure are O(1) and only disturb that
+		// order until the next compact().
+		Vec<Instruction> instructions;
+		// parallel to `instructions`. kept separate so that following the
+		// links doesn't drag the (much larger) instructions through the cache
+		Vec<InstLinks> inst_links;
 
 		explicit FunctionDef(std::string user_given_name, mir::Type return_type) :
 			user_given_name { mv(user_given_name) }, return_type { return_type }
 		{}
 
+		// walks the instruction ids of a block in order. it's fine to erase
+		// the current instruction or insert new ones while walking, but note
+		// that inserting may reallocate the storage and invalidate any
+		// Instruction references that are being held.
+		class InstRange {
+			const FunctionDef *function;
+			InstId first;
+
+			public:
+
+			class iterator {
+				const FunctionDef *function;
+				InstId current;
+
+				public:
+
+				iterator(const FunctionDef *function, InstId current) : function { function }, current { current } {}
+				InstId operator*() const { return this->current; }
+				iterator &operator++() {
+					// skip over anything that was erased after the walk had
+					// already moved past its predecessor
+					const Vec<InstLinks> &links = this->function->inst_links;
+					do {
+						this->current = links[this->current].next;
+					} while (this->current != no_inst && links[this->current].parent == no_block);
+					return *this;
+				}
+				bool operator!=(const iterator &other) const { return this->current != other.current; }
+			};
+
+			InstRange(const FunctionDef *function, InstId first) : function { function }, first { first } {}
+			iterator begin() const { return iterator(this->function, this->first); }
+			iterator end() const { return iterator(this->function, no_inst); }
+		};
+
+		// walks every instruction of the function that hasn't been erased, in
+		// storage order rather than block order. this is a plain linear walk
+		// of the storage, so it's the cheapest way to visit everything when
+		// the order doesn't matter. instructions inserted during the walk are
+		// not visited.
+		class AllInstRange {
+			const FunctionDef *function;
+
+			public:
+
+			class iterator {
+				const FunctionDef *function;
+				InstId current;
+
+				public:
+
+				iterator(const FunctionDef *function, InstId current) : function { function }, current { current } {
+					this->skip_erased();
+				}
+				InstId operator*() const { return this->current; }
+				iterator &operator++() {
+					this->current += 1;
+					this->skip_erased();
+					return *this;
+				}
+				bool operator!=(const iterator &other) const { return this->current != other.current; }
+
+				private:
+
+				void skip_erased() {
+					const Vec<InstLinks> &links = this->function->inst_links;
+					while (this->current < links.size() && links[this->current].parent == no_block) {
+						this->current += 1;
+					}
+				}
+			};
+
+			AllInstRange(const FunctionDef *function) : function { function } {}
+			iterator begin() const { return iterator(this->function, 0); }
+			iterator end() const { return iterator(this->function, this->function->instructions.size()); }
+		};
+
+		// read-only on purpose: instructions and terminators must be changed
+		// through the mutation API below so that the def-use chains stay
+		// correct
+		const BasicBlock &block(BlockId id) const { return this->basic_blocks[id]; }
+		const Instruction &inst(InstId id) const { return this->instructions[id]; }
+		InstRange insts_of(BlockId block) const { return InstRange(this, this->basic_blocks[block].first_inst); }
+		AllInstRange all_insts() const { return AllInstRange(this); }
+		// every block that control can go to from the given block: the
+		// targets of its guards as well as of its terminator, without
+		// duplicates
+		SmallVec<BlockId, 4> get_successors(BlockId block) const;
+		// no_block if the instruction was erased
+		BlockId parent_of(InstId inst) const { return this->inst_links[inst].parent; }
+		InstId next_inst(InstId inst) const { return this->inst_links[inst].next; }
+		InstId prev_inst(InstId inst) const { return this->inst_links[inst].prev; }
+
+		LocalVar *create_local_var(bool is_user_declared, std::string name, Type type);
+		BlockId create_block(bool user_labeled, std::string label_name);
+		// makes room for this many blocks and instructions in total, for
+		// code that knows up front how big the function will get
+		void reserve(size_t num_blocks, size_t num_insts);
+		// inserts the instruction into the block right before `before`, or at
+		// the end of the block if `before` is no_inst
+		InstId insert_inst(BlockId block, InstId before, Opt<Place> destination, Rvalue rvalue);
+		InstId append_inst(BlockId block, Opt<Place> destination, Rvalue rvalue) {
+			return this->insert_inst(block, no_inst, mv(destination), mv(rvalue));
+		}
+		// moves an existing instruction to right before `before` in the given
+		// block (or to its end, if `before` is no_inst)
+		void move_inst(InstId inst, BlockId block, InstId before);
+		// overwrites an instruction in place, keeping its position
+		void replace_inst(InstId inst, Opt<Place> destination, Rvalue rvalue);
+		void erase_inst(InstId inst);
+		void set_terminator(BlockId block, BasicBlock::Terminator terminator);
+		// erases the block along with its instructions; the caller is
+		// responsible for making sure that no other block still jumps to it
+		void erase_block(BlockId block);
+		// rewrites every read of `var` to read `replacement` instead. the
+		// array of an indexed place can only be replaced by another
+		// LocalVar, so those reads are left alone if `replacement` is a
+		// constant. returns whether `var` is left without uses. runs in time
+		// proportional to the number of uses of `var`.
+		bool replace_all_uses(LocalVar *var, Operand replacement);
+		// rewrites every def and read of `var` to use `replacement`
+		// instead, leaving `var` unreferenced
+		void replace_var(LocalVar *var, LocalVar *replacement);
+		// drops erased blocks and instructions and lays out the remaining
+		// instructions contiguously in block order, and drops local
+		// variables that are no longer referenced. invalidates all BlockIds
+		// and InstIds that were held, as well as pointers to the dropped
+		// variables.
+		void compact();
+		// recomputes the def-use chains from scratch and dies if the ones
+		// that were maintained incrementally differ
+		void verify_def_use() const;
+		// stops maintaining the def-use chains until rebuild_def_use(), for
+		// code that builds a whole function at once and can have them built
+		// in a single pass at the end
+		void defer_def_use() { this->is_def_use_deferred = true; }
+		// recomputes the def-use chains from scratch
+		void rebuild_def_use();
+
 		std::string to_ir_syntax() const;
 		std::string get_unambiguous_name() const;
+		std::string get_block_name(BlockId block) const;
+		std::string block_to_ir_syntax(BlockId block, Opt<Vec<LocalVar *>> vars_to_declare) const;
+
+		private:
+
+		// the other half of the def-use chains: where each instruction's and
+		// terminator's entries are in the LocalVars' lists, so that a user
+		// can be unregistered in time proportional to its own operands
+		struct UseSlot {
+			LocalVar *var;
+			uint32_t index; // into var->uses
+		};
+		struct UserChains {
+			SmallVec<UseSlot, 4> uses;
+			uint32_t def_index; // into the defined var's defs, if any
+		};
+		Vec<UserChains> inst_chains; // parallel to `instructions`
+		Vec<UserChains> terminator_chains; // parallel to `basic_blocks`
+		bool is_def_use_deferred = false;
+
+		void link_inst(InstId inst, BlockId block, InstId before);
+		void unlink_inst(InstId inst);
+		UserChains &get_chains(const Use &use);
+		void remove_uses(UserChains &chains);
+		void add_use(LocalVar *var, uint32_t user, bool is_terminator);
+		void register_inst(InstId inst);
+		void unregister_inst(InstId inst);
+		void register_terminator(BlockId block);
+		void unregister_terminator(BlockId block);
 	};
 
 	struct ExternalFunction {
@@ -0,0 +1,804 @@
+#include "mir_analysis.h"
+#include <algorithm>
+
+namespace mir::analysis {
+	using utils::BitSet;
+
+	Vec<SmallVec<BlockId, 4>> compute_predecessors(const FunctionDef &function) {
+		Vec<SmallVec<BlockId, 4>> predecessors(function.basic_blocks.size());
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (function.block(block).is_erased) continue;
+			for (BlockId successor : function.get_successors(block)) {
+				predecessors[successor].push_back(block);
+			}
+		}
+		return predecessors;
+	}
+
+	Vec<BlockId> compute_reverse_postorder(const FunctionDef &function) {
+		Vec<BlockId> postorder;
+		if (function.basic_blocks.empty()) {
+			return postorder;
+		}
+		// iterative depth-first search; each stack entry remembers how many
+		// of the block's successors have been visited so far
+		Vec<bool> is_visited(function.basic_blocks.size(), false);
+		Vec<Pair<BlockId, SmallVec<BlockId, 4>>> stack;
+		Vec<size_t> next_successor;
+		is_visited[0] = true;
+		stack.push_back({ 0, function.get_successors(0) });
+		next_successor.push_back(0);
+		while (!stack.empty()) {
+			size_t &i = next_successor.back();
+			const SmallVec<BlockId, 4> &successors = stack.back().second;
+			if (i < successors.size()) {
+				BlockId successor = successors[i];
+				i += 1;
+				if (!is_visited[successor]) {
+					is_visited[successor] = true;
+					stack.push_back({ successor, function.get_successors(successor) });
+					next_successor.push_back(0);
+				}
+			} else {
+				postorder.push_back(stack.back().first);
+				stack.pop_back();
+				next_successor.pop_back();
+			}
+		}
+		return Vec<BlockId>(postorder.rbegin(), postorder.rend());
+	}
+
+	DominatorTree::DominatorTree(const FunctionDef &function, const Vec<BlockId> &reverse_postorder) :
+		immediate_dominators(function.basic_blocks.size(), no_block),
+		preorder_numbers(function.basic_blocks.size(), 0),
+		subtree_ends(function.basic_blocks.size(), 0)
+	{
+		if (reverse_postorder.empty()) return;
+
+		// "A Simple, Fast Dominance Algorithm" by Cooper, Harvey, and
+		// Kennedy
+		Vec<uint32_t> rpo_numbers(function.basic_blocks.size(), UINT32_MAX);
+		for (uint32_t i = 0; i < reverse_postorder.size(); ++i) {
+			rpo_numbers[reverse_postorder[i]] = i;
+		}
+		Vec<SmallVec<BlockId, 4>> predecessors = compute_predecessors(function);
+		Vec<BlockId> &idoms = this->immediate_dominators;
+		BlockId entry = reverse_postorder[0];
+		idoms[entry] = entry;
+		auto intersect = [&](BlockId a, BlockId b) {
+			while (a != b) {
+				while (rpo_numbers[a] > rpo_numbers[b]) a = idoms[a];
+				while (rpo_numbers[b] > rpo_numbers[a]) b = idoms[b];
+			}
+			return a;
+		};
+		bool has_changed = true;
+		while (has_changed) {
+			has_changed = false;
+			for (BlockId block : reverse_postorder) {
+				if (block == entry) continue;
+				BlockId new_idom = no_block;
+				for (BlockId predecessor : predecessors[block]) {
+					if (idoms[predecessor] == no_block) continue;
+					new_idom = new_idom == no_block ? predecessor : intersect(predecessor, new_idom);
+				}
+				if (new_idom != idoms[block]) {
+					idoms[block] = new_idom;
+					has_changed = true;
+				}
+			}
+		}
+
+		// number the tree in preorder so that dominance is an interval test
+		Vec<Vec<BlockId>> children(function.basic_blocks.size());
+		for (BlockId block : reverse_postorder) {
+			if (block != entry) children[idoms[block]].push_back(block);
+		}
+		uint32_t next_number = 0;
+		Vec<Pair<BlockId, size_t>> stack { { entry, 0 } };
+		this->preorder_numbers[entry] = next_number++;
+		while (!stack.empty()) {
+			auto &[block, next_child] = stack.back();
+			if (next_child < children[block].size()) {
+				BlockId child = children[block][next_child++];
+				this->preorder_numbers[child] = next_number++;
+				stack.push_back({ child, 0 });
+			} else {
+				this->subtree_ends[block] = next_number;
+				stack.pop_back();
+			}
+		}
+	}
+
+	Vec<BlockId> DominatorTree::get_preorder() const {
+		// the reachable blocks are numbered from 0 without gaps
+		size_t num_reachable = std::count_if(this->immediate_dominators.begin(), this->immediate_dominators.end(), [](BlockId idom) {
+			return idom != no_block;
+		});
+		Vec<BlockId> result(num_reachable);
+		for (BlockId block = 0; block < this->immediate_dominators.size(); ++block) {
+			if (this->is_reachable(block)) result[this->preorder_numbers[block]] = block;
+		}
+		return result;
+	}
+
+	Vec<SmallVec<BlockId, 2>> compute_dominance_frontiers(const FunctionDef &function, const DominatorTree &dominators) {
+		// from "A Simple, Fast Dominance Algorithm" as well: a join point is
+		// in the frontier of each block on the way up the tree from each of
+		// its predecessors to its immediate dominator
+		Vec<SmallVec<BlockId, 2>> frontiers(function.basic_blocks.size());
+		Vec<SmallVec<BlockId, 4>> predecessors = compute_predecessors(function);
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (!dominators.is_reachable(block) || predecessors[block].size() < 2) continue;
+			for (BlockId predecessor : predecessors[block]) {
+				if (!dominators.is_reachable(predecessor)) continue;
+				for (BlockId runner = predecessor; runner != dominators.get_immediate_dominator(block);) {
+					SmallVec<BlockId, 2> &frontier = frontiers[runner];
+					if (frontier.empty() || frontier.back() != block) frontier.push_back(block);
+					// the entry block is its own immediate dominator
+					BlockId idom = dominators.get_immediate_dominator(runner);
+					if (idom == runner) break;
+					runner = idom;
+				}
+			}
+		}
+		return frontiers;
+	}
+
+	SsaNames::SsaNames(const FunctionDef &function, const DominatorTree &dominators) :
+		block_phis(function.basic_blocks.size()),
+		guard_operands(function.instructions.size(), 0),
+		terminator_operands(function.basic_blocks.size(), { 0, 0 }),
+		def_names(function.instructions.size(), no_name),
+		inst_reads(function.instructions.size()),
+		terminator_reads(function.basic_blocks.size()),
+		function { function },
+		dominators { dominators }
+	{
+		for (const Uptr<LocalVar> &var : function.local_vars) {
+			this->var_numbers.insert({ var.get(), this->current_names.size() });
+			this->current_names.push_back({ 0 });
+		}
+		this->place_phis();
+		for (uint32_t phi : this->block_phis[0]) {
+			this->phis[phi].incoming_names.push_back({ Edge { false, no_block }, 0 });
+		}
+
+		// returns the operand that the edge feeds
+		auto add_incoming_names = [&](BlockId successor, Edge edge) {
+			for (uint32_t phi : this->block_phis[successor]) {
+				this->phis[phi].incoming_names.push_back({ edge, this->get_current_name(this->phis[phi].var) });
+			}
+			if (this->block_phis[successor].empty()) return uint32_t { 0 };
+			return static_cast<uint32_t>(this->phis[this->block_phis[successor][0]].incoming_names.size() - 1);
+		};
+		auto read = [&](const Operand &operand, SmallVec<NameRead, 2> &reads) {
+			if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+				reads.push_back({ *var, this->get_current_name(*var) });
+			}
+		};
+		this->walk([&](InstId inst) {
+			const Instruction &instruction = function.inst(inst);
+			visit_reads(instruction, [&](const Operand &operand) {
+				read(operand, this->inst_reads[inst]);
+			}, [](const LocalVar *) {});
+			if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+				this->guard_operands[inst] = add_incoming_names(guard->target, Edge { true, inst });
+			} else if (get_defined_var(instruction)) {
+				this->def_names[inst] = this->num_names++;
+			}
+		}, [&](BlockId block) {
+			const BasicBlock &basic_block = function.block(block);
+			if (const BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&basic_block.terminator)) {
+				read(term->return_value, this->terminator_reads[block]);
+			} else if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&basic_block.terminator)) {
+				read(term->condition, this->terminator_reads[block]);
+			}
+			SmallVec<BlockId, 2> successors = basic_block.get_terminator_successors();
+			for (size_t i = 0; i < successors.size(); ++i) {
+				this->terminator_operands[block][i] = add_incoming_names(successors[i], Edge { false, block });
+			}
+		});
+	}
+
+	void SsaNames::place_phis() {
+		size_t num_blocks = this->function.basic_blocks.size();
+		size_t num_vars = this->current_names.size();
+		// a guard to a block with successors, the first in its block
+		struct GuardTarget {
+			BlockId target;
+			uint32_t position;
+		};
+
+		// the edges into each block, counting the start of the function
+		Vec<uint32_t> num_edges_into(num_blocks, 0);
+		Vec<uint32_t> num_guards_into(num_blocks, 0);
+		if (num_blocks > 0) num_edges_into[0] = 1;
+		for (BlockId block = 0; block < num_blocks; ++block) {
+			if (!this->dominators.is_reachable(block)) continue;
+			for (InstId inst : this->function.insts_of(block)) {
+				if (const Guard *guard = std::get_if<Guard>(&this->function.inst(inst).rvalue.value)) {
+					num_edges_into[guard->target] += 1;
+					num_guards_into[guard->target] += 1;
+				}
+			}
+			for (BlockId successor : this->function.block(block).get_terminator_successors()) {
+				num_edges_into[successor] += 1;
+			}
+		}
+		Vec<bool> are_sinks(num_blocks);
+		this->are_guard_sinks.assign(num_blocks, false);
+		this->are_shared_sinks.assign(num_blocks, false);
+		for (BlockId block = 0; block < num_blocks; ++block) {
+			are_sinks[block] = this->function.block(block).get_terminator_successors().empty();
+			this->are_guard_sinks[block] = are_sinks[block] && num_edges_into[block] == 1 && num_guards_into[block] == 1;
+			this->are_shared_sinks[block] = are_sinks[block] && num_edges_into[block] > 1;
+		}
+
+		// the blocks that assign each variable, with the position of the
+		// last def in each, the variables that the shared sinks read before
+		// assigning them, the variables that each variable is copied from,
+		// and the other blocks that each block's guards go to
+		Vec<Vec<Pair<BlockId, uint32_t>>> def_blocks(num_vars);
+		Vec<Vec<uint32_t>> copied_from(num_vars);
+		Vec<SmallVec<GuardTarget, 1>> guard_targets(num_blocks);
+		for (BlockId block = 0; block < num_blocks; ++block) {
+			if (!this->dominators.is_reachable(block)) continue;
+			auto read = [&](const LocalVar *var) {
+				uint32_t var_number = this->var_numbers.at(var);
+				if (!this->are_shared_sinks[block]) return;
+				if (def_blocks[var_number].empty() || def_blocks[var_number].back().first != block) this->sink_reads.insert({ block, var_number });
+			};
+			uint32_t position = 0;
+			for (InstId inst : this->function.insts_of(block)) {
+				const Instruction &instruction = this->function.inst(inst);
+				visit_reads(instruction, [&](const Operand &operand) {
+					if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) read(*var);
+				}, read);
+				const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value);
+				if (guard && !are_sinks[guard->target]) {
+					SmallVec<GuardTarget, 1> &targets = guard_targets[block];
+					bool is_new = std::none_of(targets.begin(), targets.end(), [&](const GuardTarget &target) {
+						return target.target == guard->target;
+					});
+					if (is_new) targets.push_back({ guard->target, position });
+				}
+				if (LocalVar *dest = get_defined_var(instruction)) {
+					const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value);
+					LocalVar *const *source = operand ? std::get_if<LocalVar *>(&operand->value) : nullptr;
+					if (source && *source != dest) copied_from[this->var_numbers.at(dest)].push_back(this->var_numbers.at(*source));
+					Vec<Pair<BlockId, uint32_t>> &blocks = def_blocks[this->var_numbers.at(dest)];
+					if (blocks.empty() || blocks.back().first != block) blocks.push_back({ block, position });
+					blocks.back().second = position;
+				}
+				position += 1;
+			}
+			if (const Operand *operand = this->function.block(block).get_terminator_operand()) {
+				if (LocalVar *const *var = std::get_if<LocalVar *>(&operand->value)) read(*var);
+			}
+		}
+
+		// phis at the iterated dominance frontiers, other than in sinks
+		Vec<SmallVec<BlockId, 2>> frontiers = compute_dominance_frontiers(this->function, this->dominators);
+		// for each block, the last variable that got a phi there and the last
+		// one that queued it
+		Vec<uint32_t> phi_var_numbers(num_blocks, UINT32_MAX);
+		Vec<uint32_t> queued_var_numbers(num_blocks, UINT32_MAX);
+		// numbered in the order of local_vars
+		for (uint32_t var_number = 0; var_number < num_vars; ++var_number) {
+			const LocalVar *var = this->function.local_vars[var_number].get();
+			Vec<BlockId> worklist;
+			auto add_phi = [&](BlockId block) {
+				if (are_sinks[block] || phi_var_numbers[block] == var_number) return;
+				phi_var_numbers[block] = var_number;
+				this->block_phis[block].push_back(this->phis.size());
+				this->phis.push_back({ block, var, this->num_names++, {} });
+				if (queued_var_numbers[block] != var_number) {
+					queued_var_numbers[block] = var_number;
+					worklist.push_back(block);
+				}
+			};
+			for (const auto &[block, last_def_position] : def_blocks[var_number]) {
+				queued_var_numbers[block] = var_number;
+				worklist.push_back(block);
+			}
+			for (const auto &[block, last_def_position] : def_blocks[var_number]) {
+				// a guard leaves its block before the rest of the block has
+				// run, so what the block assigns after it meets the values
+				// from before at its target, even where the block dominates
+				// the target
+				for (const GuardTarget &target : guard_targets[block]) {
+					if (target.position < last_def_position) add_phi(target.target);
+				}
+			}
+			while (!worklist.empty()) {
+				BlockId block = worklist.back();
+				worklist.pop_back();
+				for (BlockId frontier : frontiers[block]) {
+					add_phi(frontier);
+				}
+			}
+		}
+
+		// the shared sinks only need phis for what they read, and for what
+		// that was copied from when it's always the same variable, such as
+		// the index that a loop's bounds checks copy into the variable that
+		// their error block reports
+		Vec<Pair<BlockId, uint32_t>> copied_reads;
+		for (const auto &[block, var_number] : this->sink_reads) {
+			const Vec<uint32_t> &sources = copied_from[var_number];
+			bool is_single_source = std::all_of(sources.begin(), sources.end(), [&](uint32_t source) {
+				return source == sources[0];
+			});
+			if (!sources.empty() && is_single_source) copied_reads.push_back({ block, sources[0] });
+		}
+		this->sink_reads.insert(copied_reads.begin(), copied_reads.end());
+		for (const auto &[block, var_number] : this->sink_reads) {
+			this->block_phis[block].push_back(this->phis.size());
+			this->phis.push_back({ block, this->function.local_vars[var_number].get(), this->num_names++, {} });
+		}
+	}
+
+	LoopForest::LoopForest(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, const DominatorTree &dominators) :
+		innermost_loops(function.basic_blocks.size(), no_loop)
+	{
+		Vec<SmallVec<BlockId, 4>> predecessors = compute_predecessors(function);
+		size_t num_blocks = function.basic_blocks.size();
+
+		// find the blocks of the loop headed by each block, going backward
+		// from the back edges. outer loops' headers come first in reverse
+		// postorder, so going through the headers backward puts inner loops
+		// first.
+		Vec<Vec<bool>> memberships;
+		for (auto it = reverse_postorder.rbegin(); it != reverse_postorder.rend(); ++it) {
+			BlockId header = *it;
+			Vec<bool> is_member(num_blocks, false);
+			is_member[header] = true;
+			Vec<BlockId> worklist;
+			for (BlockId predecessor : predecessors[header]) {
+				if (dominators.dominates(header, predecessor) && !is_member[predecessor]) {
+					is_member[predecessor] = true;
+					worklist.push_back(predecessor);
+				}
+			}
+			if (worklist.empty() && !std::any_of(predecessors[header].begin(), predecessors[header].end(), [&](BlockId p) { return p == header; })) {
+				continue;
+			}
+			while (!worklist.empty()) {
+				BlockId block = worklist.back();
+				worklist.pop_back();
+				for (BlockId predecessor : predecessors[block]) {
+					if (!is_member[predecessor] && dominators.is_reachable(predecessor)) {
+						is_member[predecessor] = true;
+						worklist.push_back(predecessor);
+					}
+				}
+			}
+			Loop loop { header, {}, no_loop, 0 };
+			for (BlockId block : reverse_postorder) {
+				if (is_member[block]) loop.blocks.push_back(block);
+			}
+			this->loops.push_back(mv(loop));
+			memberships.push_back(mv(is_member));
+		}
+
+		// a loop's parent is the smallest other loop containing its header
+		for (uint32_t l = 0; l < this->loops.size(); ++l) {
+			for (uint32_t m = l + 1; m < this->loops.size(); ++m) {
+				if (!memberships[m][this->loops[l].header]) continue;
+				uint32_t parent = this->loops[l].parent;
+				if (parent == no_loop || this->loops[m].blocks.size() < this->loops[parent].blocks.size()) {
+					this->loops[l].parent = m;
+				}
+			}
+		}
+		for (uint32_t l = this->loops.size(); l-- > 0;) {
+			Loop &loop = this->loops[l];
+			loop.depth = loop.parent == no_loop ? 1 : this->loops[loop.parent].depth + 1;
+			for (BlockId block : loop.blocks) {
+				this->innermost_loops[block] = l;
+			}
+		}
+	}
+
+	uint32_t VarFacts::add_fact(std::initializer_list<const LocalVar *> mentioned_vars) {
+		uint32_t fact = this->num_facts++;
+		for (const LocalVar *var : mentioned_vars) {
+			if (!var) continue;
+			Vec<uint32_t> &facts = this->facts_mentioning[var];
+			if (facts.empty() || facts.back() != fact) {
+				facts.push_back(fact);
+			}
+		}
+		return fact;
+	}
+
+	void VarFacts::finish() {
+		for (const auto &[var, facts] : this->facts_mentioning) {
+			if (facts.size() > this->num_facts / 64) {
+				BitSet mask(this->num_facts, false);
+				for (uint32_t fact : facts) {
+					mask.set(fact);
+				}
+				this->kill_masks.insert({ var, mv(mask) });
+			}
+		}
+	}
+
+	void VarFacts::kill(BitSet &state, const LocalVar *var) const {
+		auto mask_it = this->kill_masks.find(var);
+		if (mask_it != this->kill_masks.end()) {
+			state.subtract(mask_it->second);
+			return;
+		}
+		auto it = this->facts_mentioning.find(var);
+		if (it != this->facts_mentioning.end()) {
+			for (uint32_t fact : it->second) {
+				state.reset(fact);
+			}
+		}
+	}
+
+	static bool is_reference_type(const Type &type) {
+		const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&type.type);
+		return (array_type && array_type->num_dimensions > 0) || std::holds_alternative<Type::TupleType>(type.type);
+	}
+
+	// if the instruction is `c <- v = 0` for an array or tuple v, returns v
+	static LocalVar *get_null_tested_var(const Instruction &inst) {
+		const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&inst.rvalue.value);
+		if (!get_defined_var(inst) || !bin_op || bin_op->op != Operator::eq) return nullptr;
+		auto get_tested_var = [](const Operand &tested, const Operand &zero) -> LocalVar * {
+			LocalVar *const *var = std::get_if<LocalVar *>(&tested.value);
+			if (var && is_reference_type((*var)->type) && zero == Operand(Int64Constant { 0 })) {
+				return *var;
+			}
+			return nullptr;
+		};
+		LocalVar *var = get_tested_var(bin_op->lhs, bin_op->rhs);
+		return var ? var : get_tested_var(bin_op->rhs, bin_op->lhs);
+	}
+
+	KnownAllocations::KnownAllocations(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, const AllocationSummaries *summaries) :
+		function { function }, summaries { summaries }
+	{
+		for (const Uptr<LocalVar> &var : function.local_vars) {
+			if (is_reference_type(var->type)) {
+				this->allocated_facts.insert({ var.get(), this->var_facts.add_fact({ var.get() }) });
+			}
+		}
+		for (InstId inst : function.all_insts()) {
+			if (LocalVar *tested = get_null_tested_var(function.inst(inst))) {
+				LocalVar *condition = get_defined_var(function.inst(inst));
+				Vec<Pair<uint32_t, uint32_t>> &facts = this->null_test_facts[condition];
+				uint32_t allocated_fact = this->allocated_facts.at(tested);
+				bool is_known = std::any_of(facts.begin(), facts.end(), [&](const Pair<uint32_t, uint32_t> &fact) {
+					return fact.second == allocated_fact;
+				});
+				if (!is_known) {
+					facts.push_back({ this->var_facts.add_fact({ condition, tested }), allocated_fact });
+				}
+			}
+		}
+		this->var_facts.finish();
+		BitSet function_entry_state(this->var_facts.size(), false);
+		if (summaries) {
+			for (const LocalVar *parameter : function.parameter_vars) {
+				if (summaries->is_allocated_on_entry(parameter)) function_entry_state.set(this->allocated_facts.at(parameter));
+			}
+		}
+		this->entry_states = solve_forward_must(
+			function,
+			reverse_postorder,
+			this->var_facts.size(),
+			[&](BitSet &state, InstId inst) { this->transfer(state, inst); },
+			&function_entry_state
+		);
+	}
+
+	void KnownAllocations::transfer(BitSet &state, InstId inst) const {
+		const Instruction &instruction = this->function.inst(inst);
+		if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+			// getting past a guard on `v = 0` means that v isn't 0
+			if (LocalVar *const *condition = std::get_if<LocalVar *>(&guard->condition.value)) {
+				auto it = this->null_test_facts.find(*condition);
+				if (it != this->null_test_facts.end()) {
+					for (auto [null_test_fact, allocated_fact] : it->second) {
+						if (state.test(null_test_fact)) state.set(allocated_fact);
+					}
+				}
+			}
+			return;
+		}
+
+		// an access only gets past its checks if the array or tuple is
+		// allocated, since an unallocated one has length 0
+		const Place *read = std::get_if<Place>(&instruction.rvalue.value);
+		const Place *accessed = instruction.destination && !instruction.destination->indices.empty() ? &*instruction.destination : read;
+		if (accessed && !accessed->indices.empty()) {
+			auto it = this->allocated_facts.find(accessed->target);
+			if (it != this->allocated_facts.end()) state.set(it->second);
+		}
+
+		LocalVar *dest = get_defined_var(instruction);
+		if (!dest) return;
+		uint32_t new_fact = UINT32_MAX;
+		auto dest_allocated_fact = this->allocated_facts.find(dest);
+		bool is_reference = dest_allocated_fact != this->allocated_facts.end();
+		if (is_reference && (std::holds_alternative<NewArray>(instruction.rvalue.value) || std::holds_alternative<NewTuple>(instruction.rvalue.value))) {
+			new_fact = dest_allocated_fact->second;
+		} else if (const FunctionCall *call = std::get_if<FunctionCall>(&instruction.rvalue.value); is_reference && call && this->summaries) {
+			const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value);
+			if (callee && this->summaries->returns_allocated(callee->value)) {
+				new_fact = dest_allocated_fact->second;
+			}
+		} else if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value); is_reference && operand) {
+			LocalVar *const *source = std::get_if<LocalVar *>(&operand->value);
+			if (source && this->is_allocated(state, *source)) {
+				new_fact = dest_allocated_fact->second;
+			}
+		} else if (LocalVar *tested = get_null_tested_var(instruction)) {
+			// (instructions added since the analysis ran have no facts)
+			auto it = this->null_test_facts.find(dest);
+			if (it != this->null_test_facts.end()) {
+				uint32_t allocated_fact = this->allocated_facts.at(tested);
+				for (auto [null_test_fact, other_allocated_fact] : it->second) {
+					if (other_allocated_fact == allocated_fact) new_fact = null_test_fact;
+				}
+			}
+		}
+		this->var_facts.kill(state, dest);
+		if (new_fact != UINT32_MAX) state.set(new_fact);
+	}
+
+	bool KnownAllocations::is_allocated(const BitSet &state, const LocalVar *var) const {
+		auto it = this->allocated_facts.find(var);
+		return it != this->allocated_facts.end() && state.test(it->second);
+	}
+
+	bool KnownAllocations::is_passed_null_test(const BitSet &state, const LocalVar *condition) const {
+		auto it = this->null_test_facts.find(condition);
+		if (it == this->null_test_facts.end()) return false;
+		for (auto [null_test_fact, allocated_fact] : it->second) {
+			if (state.test(null_test_fact) && state.test(allocated_fact)) return true;
+		}
+		return false;
+	}
+
+	LiveVariables::LiveVariables(const FunctionDef &function, const Vec<LocalVar *> &vars) :
+		function { function },
+		live_in(function.basic_blocks.size(), BitSet(vars.size(), false))
+	{
+		for (LocalVar *var : vars) {
+			this->var_indices.insert({ var, static_cast<uint32_t>(this->var_indices.size()) });
+		}
+
+		// a backward analysis converges fastest visiting successors first
+		Vec<BlockId> postorder = compute_reverse_postorder(function);
+		std::reverse(postorder.begin(), postorder.end());
+		bool has_changed = true;
+		while (has_changed) {
+			has_changed = false;
+			for (BlockId block : postorder) {
+				BitSet live = this->get_live_out(block);
+				for (InstId inst = function.block(block).last_inst; inst != no_inst; inst = function.prev_inst(inst)) {
+					this->step_backward(live, inst);
+				}
+				if (live != this->live_in[block]) {
+					this->live_in[block] = mv(live);
+					has_changed = true;
+				}
+			}
+		}
+	}
+
+	BitSet LiveVariables::get_live_out(BlockId block) const {
+		BitSet live(this->var_indices.size(), false);
+		for (BlockId successor : this->function.block(block).get_terminator_successors()) {
+			live.union_with(this->live_in[successor]);
+		}
+		if (const Operand *operand = this->function.block(block).get_terminator_operand()) {
+			if (LocalVar *const *var = std::get_if<LocalVar *>(&operand->value)) {
+				uint32_t index = this->index_of(*var);
+				if (index != UINT32_MAX) live.set(index);
+			}
+		}
+		return live;
+	}
+
+	void LiveVariables::step_backward(BitSet &live, InstId inst) const {
+		const Instruction &instruction = this->function.inst(inst);
+		if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+			live.union_with(this->live_in[guard->target]);
+		}
+		if (LocalVar *dest = get_defined_var(instruction)) {
+			uint32_t index = this->index_of(dest);
+			if (index != UINT32_MAX) live.reset(index);
+		}
+		auto mark_live = [&](const LocalVar *var) {
+			uint32_t index = this->index_of(var);
+			if (index != UINT32_MAX) live.set(index);
+		};
+		visit_reads(
+			instruction,
+			[&](const Operand &operand) {
+				if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) mark_live(*var);
+			},
+			mark_live
+		);
+	}
+
+	CodeTargets::CodeTargets(const FunctionDef &function) {
+		Map<const LocalVar *, Vec<const LocalVar *>> copied_to; // source -> dests
+		for (const Uptr<LocalVar> &var : function.local_vars) {
+			if (!std::holds_alternative<Type::CodeType>(var->type.type)) continue;
+			Vec<Operand> &var_targets = this->targets[var.get()];
+			if (std::find(function.parameter_vars.begin(), function.parameter_vars.end(), var.get()) != function.parameter_vars.end()) {
+				this->unknown_vars.insert(var.get());
+			}
+			for (InstId def : var->defs) {
+				const Operand *source = std::get_if<Operand>(&function.inst(def).rvalue.value);
+				if (!source) {
+					this->unknown_vars.insert(var.get());
+				} else if (LocalVar *const *source_var = std::get_if<LocalVar *>(&source->value)) {
+					copied_to[*source_var].push_back(var.get());
+				} else if (!std::holds_alternative<Int64Constant>(source->value)) {
+					if (std::find(var_targets.begin(), var_targets.end(), *source) == var_targets.end()) {
+						var_targets.push_back(*source);
+					}
+				}
+			}
+		}
+
+		// pushes what each variable may hold along the copies until
+		// nothing changes
+		Vec<const LocalVar *> worklist;
+		for (const auto &[var, var_targets] : this->targets) worklist.push_back(var);
+		while (!worklist.empty()) {
+			const LocalVar *var = worklist.back();
+			worklist.pop_back();
+			auto it = copied_to.find(var);
+			if (it == copied_to.end()) continue;
+			for (const LocalVar *dest : it->second) {
+				bool has_changed = false;
+				if (this->unknown_vars.count(var) && !this->unknown_vars.count(dest)) {
+					this->unknown_vars.insert(dest);
+					has_changed = true;
+				}
+				Vec<Operand> &dest_targets = this->targets[dest];
+				for (const Operand &target : this->targets[var]) {
+					if (std::find(dest_targets.begin(), dest_targets.end(), target) == dest_targets.end()) {
+						dest_targets.push_back(target);
+						has_changed = true;
+					}
+				}
+				if (has_changed) worklist.push_back(dest);
+			}
+		}
+	}
+
+	const Vec<Operand> *CodeTargets::get_targets(const LocalVar *var) const {
+		auto it = this->targets.find(var);
+		if (it == this->targets.end() || this->unknown_vars.count(var)) return nullptr;
+		return &it->second;
+	}
+
+	CallGraph::CallGraph(const Program &program) {
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			Vec<FunctionDef *> &function_callees = this->callees[function.get()];
+			for (InstId inst : function->all_insts()) {
+				const FunctionCall *call = std::get_if<FunctionCall>(&function->inst(inst).rvalue.value);
+				if (!call) continue;
+				const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value);
+				if (!callee) continue;
+				if (std::find(function_callees.begin(), function_callees.end(), callee->value) == function_callees.end()) {
+					function_callees.push_back(callee->value);
+				}
+			}
+		}
+
+		// Tarjan's algorithm, which emits each component after every
+		// component reachable from it
+		Map<const FunctionDef *, uint32_t> indices;
+		Map<const FunctionDef *, uint32_t> low_links;
+		Vec<FunctionDef *> stack;
+		Set<const FunctionDef *> is_on_stack;
+		auto visit = [&](auto &visit, FunctionDef *function) -> void {
+			uint32_t index = indices.size();
+			indices[function] = index;
+			low_links[function] = index;
+			stack.push_back(function);
+			is_on_stack.insert(function);
+			for (FunctionDef *callee : this->callees.at(function)) {
+				if (!indices.count(callee)) {
+					visit(visit, callee);
+					low_links[function] = std::min(low_links[function], low_links[callee]);
+				} else if (is_on_stack.count(callee)) {
+					low_links[function] = std::min(low_links[function], indices[callee]);
+				}
+			}
+			if (low_links[function] != index) return;
+			Vec<FunctionDef *> scc;
+			FunctionDef *member;
+			do {
+				member = stack.back();
+				stack.pop_back();
+				is_on_stack.erase(member);
+				this->scc_indices[member] = this->sccs.size();
+				scc.push_back(member);
+			} while (member != function);
+			this->sccs.push_back(mv(scc));
+		};
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			if (!indices.count(function.get())) visit(visit, function.get());
+		}
+	}
+
+	bool CallGraph::is_recursive(const FunctionDef *function) const {
+		auto it = this->scc_indices.find(function);
+		if (it == this->scc_indices.end()) return false;
+		if (this->sccs[it->second].size() > 1) return true;
+		const Vec<FunctionDef *> &function_callees = this->callees.at(function);
+		return std::find(function_callees.begin(), function_callees.end(), function) != function_callees.end();
+	}
+
+	AllocationSummaries::AllocationSummaries(const Program &program, const CallGraph &call_graph) {
+		Set<const FunctionDef *> escaping_functions;
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			visit_code_values(*function, [&](const Operand &operand) {
+				escaping_functions.insert(std::get<CodeConstant>(operand.value).value);
+			});
+		}
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			if (function->user_given_name != "main" && !escaping_functions.count(function.get())) {
+				for (const LocalVar *parameter : function->parameter_vars) {
+					if (is_reference_type(parameter->type)) this->allocated_parameters.insert(parameter);
+				}
+			}
+			if (is_reference_type(function->return_type)) this->allocating_functions.insert(function.get());
+		}
+
+		const Vec<Vec<FunctionDef *>> &sccs = call_graph.get_sccs();
+		bool is_changed = true;
+		while (is_changed) {
+			is_changed = false;
+			for (auto scc = sccs.rbegin(); scc != sccs.rend(); ++scc) {
+				for (const FunctionDef *function : *scc) {
+					if (this->update(*function)) is_changed = true;
+				}
+			}
+		}
+	}
+
+	bool AllocationSummaries::update(const FunctionDef &function) {
+		Vec<BlockId> reverse_postorder = compute_reverse_postorder(function);
+		KnownAllocations allocations(function, reverse_postorder, this);
+		auto is_allocated = [&](const BitSet &state, const Operand &operand) {
+			LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+			return var && allocations.is_allocated(state, *var);
+		};
+
+		bool is_changed = false;
+		for (BlockId block : reverse_postorder) {
+			BitSet state = allocations.get_entry_state(block);
+			for (InstId inst : function.insts_of(block)) {
+				const FunctionCall *call = std::get_if<FunctionCall>(&function.inst(inst).rvalue.value);
+				const CodeConstant *callee = call ? std::get_if<CodeConstant>(&call->callee.value) : nullptr;
+				if (callee) {
+					const Vec<LocalVar *> &parameters = callee->value->parameter_vars;
+					for (size_t i = 0; i < parameters.size(); ++i) {
+						// (a call with too few arguments fails anyway)
+						if (i < call->arguments.size() && is_allocated(state, call->arguments[i])) continue;
+						if (this->allocated_parameters.erase(parameters[i])) is_changed = true;
+					}
+				}
+				allocations.transfer(state, inst);
+			}
+			const BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&function.block(block).terminator);
+			if (term && !is_allocated(state, term->return_value)) {
+				if (this->allocating_functions.erase(&function)) is_changed = true;
+			}
+		}
+		return is_changed;
+	}
+}
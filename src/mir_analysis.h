@@ -0,0 +1,548 @@
+#pragma once
+
+#include "std_alias.h"
+#include "mir.h"
+#include "bit_set.h"
+#include <initializer_list>
+#include <array>
+
+// Analyses over the MIR that several passes share. Results are plain data
+// computed from a snapshot of the function; they don't update themselves
+// when the function changes.
+namespace mir::analysis {
+	using namespace std_alias;
+
+	// the predecessors of each block (indexed by BlockId), counting guards as
+	// edges. erased blocks have no predecessors and are nobody's
+	// predecessor.
+	Vec<SmallVec<BlockId, 4>> compute_predecessors(const FunctionDef &function);
+
+	// the blocks reachable from the entry block, in reverse postorder
+	Vec<BlockId> compute_reverse_postorder(const FunctionDef &function);
+
+	// the dominator tree of the blocks reachable from the entry block,
+	// counting guards as edges
+	class DominatorTree {
+		Vec<BlockId> immediate_dominators; // no_block for unreachable blocks
+		Vec<uint32_t> preorder_numbers;
+		Vec<uint32_t> subtree_ends; // one past the last preorder number in the subtree
+
+		public:
+
+		DominatorTree(const FunctionDef &function, const Vec<BlockId> &reverse_postorder);
+
+		// the entry block is its own immediate dominator
+		BlockId get_immediate_dominator(BlockId block) const { return this->immediate_dominators[block]; }
+		bool is_reachable(BlockId block) const { return this->immediate_dominators[block] != no_block; }
+		// whether every path from the entry to b goes through a. every block
+		// dominates itself.
+		bool dominates(BlockId a, BlockId b) const {
+			return this->is_reachable(a) && this->is_reachable(b)
+				&& this->preorder_numbers[a] <= this->preorder_numbers[b]
+				&& this->preorder_numbers[b] < this->subtree_ends[a];
+		}
+		// the reachable blocks in preorder of the tree, so that each block
+		// comes before all the blocks it dominates
+		Vec<BlockId> get_preorder() const;
+	};
+
+	// the dominance frontier of each block: the blocks that it doesn't
+	// strictly dominate but that have a predecessor it dominates, where
+	// the values it assigns meet others
+	Vec<SmallVec<BlockId, 2>> compute_dominance_frontiers(const FunctionDef &function, const DominatorTree &dominators);
+
+	// The names that SSA form would give the values of the variables,
+	// worked out without rewriting the function: each def is a name, and
+	// so is each phi, which are placed at the iterated dominance frontiers
+	// of the blocks that assign a variable, and at the targets of the
+	// guards that come before an assignment in its block. Blocks without
+	// successors, which are mostly the ones that report errors, get fewer
+	// phis (see may_lack_phi and are_guard_sinks), so that the checks of a
+	// long function don't give each of them a phi for every variable. The
+	// value that a variable is declared with, or that a parameter is
+	// passed, is name 0. Each read sees a single name.
+	class SsaNames {
+		public:
+
+		static constexpr uint32_t no_name = UINT32_MAX;
+
+		// an edge into a block, from a guard or from a block's terminator.
+		// the entry block also has an edge from the start of the function,
+		// whose source is no_block.
+		struct Edge {
+			bool is_guard;
+			uint32_t source; // the guard's InstId or the block's BlockId
+		};
+		// every phi in a block has its operands in the same order, one for
+		// each edge into the block, starting with the edge from the start
+		// of the function in the entry block
+		struct Phi {
+			BlockId block;
+			const LocalVar *var;
+			uint32_t name;
+			Vec<Pair<Edge, uint32_t>> incoming_names;
+		};
+		struct NameRead {
+			const LocalVar *var;
+			uint32_t name;
+		};
+
+		uint32_t num_names = 1;
+		Vec<Phi> phis;
+		Vec<SmallVec<uint32_t, 2>> block_phis;
+		// the phi operand that each edge into a block with phis feeds: for
+		// each guard, and for the goto or then edge and the else edge of
+		// each block
+		Vec<uint32_t> guard_operands;
+		Vec<std::array<uint32_t, 2>> terminator_operands;
+		Vec<uint32_t> def_names; // of each instruction, or no_name if it assigns no variable
+		// the names that the operands of each instruction and terminator
+		// read, leaving out the targets of places
+		Vec<SmallVec<NameRead, 2>> inst_reads;
+		Vec<SmallVec<NameRead, 2>> terminator_reads;
+
+		// `dominators` has to outlive this
+		SsaNames(const FunctionDef &function, const DominatorTree &dominators);
+
+		// the name of the variable's value at the point that walk() is at
+		uint32_t get_current_name(const LocalVar *var) const {
+			return this->current_names[this->var_numbers.at(var)].back();
+		}
+		// whether the variable may be missing a phi in the block. the
+		// blocks without successors that several edges go to, such as the
+		// ones that report errors, where the values of most variables meet,
+		// only get phis for the variables they read before assigning, so
+		// the current names of the others there are only right after the
+		// block assigns them.
+		bool may_lack_phi(const LocalVar *var, BlockId block) const {
+			return this->are_shared_sinks[block] && !this->sink_reads.count({ block, this->var_numbers.at(var) });
+		}
+
+		// walks the reachable blocks in preorder of the dominator tree,
+		// calling `inst_fn(InstId)` on each instruction and
+		// `terminator_fn(BlockId)` on each terminator. get_current_name
+		// gives the names they read; an instruction's own def is only named
+		// after inst_fn returns.
+		template<typename InstFn, typename TerminatorFn>
+		void walk(InstFn inst_fn, TerminatorFn terminator_fn) {
+			// the variables named in each block on the path from the entry
+			// block, to unname once the walk leaves the block's subtree
+			Vec<Vec<uint32_t>> named_vars(this->function.basic_blocks.size());
+			Vec<BlockId> path;
+			for (BlockId block : this->dominators.get_preorder()) {
+				while (!path.empty() && !this->dominators.dominates(path.back(), block)) {
+					this->unname(named_vars[path.back()]);
+					path.pop_back();
+				}
+				if (this->are_guard_sinks[block]) continue;
+				this->walk_block(block, named_vars, inst_fn, terminator_fn);
+				path.push_back(block);
+			}
+			while (!path.empty()) {
+				this->unname(named_vars[path.back()]);
+				path.pop_back();
+			}
+		}
+
+		private:
+
+		const FunctionDef &function;
+		const DominatorTree &dominators;
+		Map<const LocalVar *, uint32_t> var_numbers;
+		Vec<Vec<uint32_t>> current_names; // by var number, innermost last
+		// the blocks without successors that a single guard is the only
+		// edge into. walk() visits them at the guard, where the names are
+		// the ones they see, so they need no phis.
+		Vec<bool> are_guard_sinks;
+		Vec<bool> are_shared_sinks; // see may_lack_phi
+		Set<Pair<BlockId, uint32_t>> sink_reads; // of the shared sinks, with var numbers
+
+		void place_phis();
+
+		// names the block's phis and defs, visiting the guard sinks of its
+		// guards along the way
+		template<typename InstFn, typename TerminatorFn>
+		void walk_block(BlockId block, Vec<Vec<uint32_t>> &named_vars, InstFn &inst_fn, TerminatorFn &terminator_fn) {
+			for (uint32_t phi : this->block_phis[block]) {
+				uint32_t var = this->var_numbers.at(this->phis[phi].var);
+				this->current_names[var].push_back(this->phis[phi].name);
+				named_vars[block].push_back(var);
+			}
+			for (InstId inst : this->function.insts_of(block)) {
+				inst_fn(inst);
+				const Instruction &instruction = this->function.inst(inst);
+				if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value); guard && this->are_guard_sinks[guard->target]) {
+					this->walk_block(guard->target, named_vars, inst_fn, terminator_fn);
+					this->unname(named_vars[guard->target]);
+				}
+				if (this->def_names[inst] == no_name) continue;
+				uint32_t var = this->var_numbers.at(get_defined_var(instruction));
+				this->current_names[var].push_back(this->def_names[inst]);
+				named_vars[block].push_back(var);
+			}
+			terminator_fn(block);
+		}
+
+		void unname(Vec<uint32_t> &named_vars) {
+			for (uint32_t var : named_vars) {
+				this->current_names[var].pop_back();
+			}
+			named_vars.clear();
+		}
+	};
+
+	// the natural loops of a function and how they nest. a loop is found
+	// for each block that is the target of a back edge (an edge to a block
+	// that dominates its source); control flow that only loops without
+	// such a block isn't recognized.
+	struct LoopForest {
+		static constexpr uint32_t no_loop = UINT32_MAX;
+
+		struct Loop {
+			BlockId header;
+			Vec<BlockId> blocks; // including the header, in reverse postorder
+			uint32_t parent; // the innermost loop containing this one, or no_loop
+			uint32_t depth; // 1 for outermost loops
+		};
+		// every loop comes after all the loops it contains
+		Vec<Loop> loops;
+		// the innermost loop that each block is in, or no_loop
+		Vec<uint32_t> innermost_loops;
+
+		LoopForest(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, const DominatorTree &dominators);
+
+		bool contains(uint32_t loop, BlockId block) const {
+			for (uint32_t l = this->innermost_loops[block]; l != no_loop; l = this->loops[l].parent) {
+				if (l == loop) return true;
+			}
+			return false;
+		}
+	};
+
+	// solves a forward dataflow problem whose facts must hold on every path:
+	// the facts on entry to a block are the ones that hold at the end of
+	// every edge into it, guards included, and on entry to the function
+	// only the ones in function_entry_state hold (none if it's null).
+	// `transfer(state, inst)` updates the facts across one instruction.
+	// returns the entry state of each block; blocks that can't be reached
+	// are left with every fact.
+	template<typename Transfer>
+	Vec<utils::BitSet> solve_forward_must(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, size_t num_facts, Transfer transfer, const utils::BitSet *function_entry_state = nullptr) {
+		using utils::BitSet;
+		size_t num_blocks = function.basic_blocks.size();
+		Vec<BitSet> entry_states(num_blocks, BitSet(num_facts, true));
+		if (num_blocks == 0) return entry_states;
+		BitSet initial_state = function_entry_state ? *function_entry_state : BitSet(num_facts, false);
+		entry_states[0] = initial_state;
+		while (true) {
+			Vec<BitSet> new_entry_states(num_blocks, BitSet(num_facts, true));
+			new_entry_states[0] = initial_state;
+			for (BlockId block : reverse_postorder) {
+				BitSet state = entry_states[block];
+				for (InstId inst : function.insts_of(block)) {
+					if (const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value)) {
+						new_entry_states[guard->target].intersect_with(state);
+					}
+					transfer(state, inst);
+				}
+				for (BlockId successor : function.block(block).get_terminator_successors()) {
+					new_entry_states[successor].intersect_with(state);
+				}
+			}
+			if (new_entry_states == entry_states) break;
+			entry_states = mv(new_entry_states);
+		}
+		return entry_states;
+	}
+
+	// numbers the facts of a solve_forward_must problem whose facts are
+	// about variables, so that a fact stops holding when any variable it
+	// mentions is reassigned
+	class VarFacts {
+		Map<const LocalVar *, Vec<uint32_t>> facts_mentioning;
+		// for variables mentioned by so many facts that clearing them one
+		// at a time would cost more than clearing a whole mask. without
+		// these, a variable that is reassigned over and over in a long
+		// function makes the analyses using it quadratic.
+		Map<const LocalVar *, utils::BitSet> kill_masks;
+		uint32_t num_facts = 0;
+
+		public:
+
+		// returns the new fact's index. null variables are ignored.
+		uint32_t add_fact(std::initializer_list<const LocalVar *> mentioned_vars);
+		// must be called after the last fact is added and before kill
+		void finish();
+		size_t size() const { return this->num_facts; }
+		// clears the facts that mention the variable
+		void kill(utils::BitSet &state, const LocalVar *var) const;
+	};
+
+	class AllocationSummaries;
+
+	// which array and tuple variables are known to hold an allocated
+	// (nonzero) reference at each point: ones just assigned a new array or
+	// tuple, copies of those, ones that an access has gotten past the
+	// checks of, and ones that have passed a `= 0` test. given summaries,
+	// also the parameters that every caller passes an allocated reference,
+	// on entry, and the results of calls of functions that only return
+	// allocated references.
+	class KnownAllocations {
+		const FunctionDef &function;
+		const AllocationSummaries *summaries;
+		VarFacts var_facts;
+		Map<const LocalVar *, uint32_t> allocated_facts; // "v is allocated"
+		// "c holds the result of v = 0", which a guard on c turns into "v is
+		// allocated"
+		Map<const LocalVar *, Vec<Pair<uint32_t, uint32_t>>> null_test_facts; // c -> [(fact, v's allocated fact)]
+		Vec<utils::BitSet> entry_states;
+
+		public:
+
+		KnownAllocations(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, const AllocationSummaries *summaries = nullptr);
+
+		const utils::BitSet &get_entry_state(BlockId block) const { return this->entry_states[block]; }
+		void transfer(utils::BitSet &state, InstId inst) const;
+		bool is_allocated(const utils::BitSet &state, const LocalVar *var) const;
+		// whether the variable holds the result of `v = 0` for a v that is
+		// known to be allocated, so that a guard on it can't fire
+		bool is_passed_null_test(const utils::BitSet &state, const LocalVar *condition) const;
+	};
+
+	// a bound on an integer value: `coefficient * n + constant`, where n is
+	// the length of dimension `dimension` of `array` (as a plain number,
+	// not encoded), or just `constant` if array is null. tuple lengths have
+	// dimension -1.
+	struct SymbolicBound {
+		const LocalVar *array;
+		int64_t dimension;
+		int64_t coefficient;
+		int64_t constant;
+
+		bool operator==(const SymbolicBound &other) const {
+			return this->array == other.array && this->dimension == other.dimension
+				&& this->coefficient == other.coefficient && this->constant == other.constant;
+		}
+		bool operator!=(const SymbolicBound &other) const { return !(*this == other); }
+	};
+
+	// the values that an integer may hold. a missing bound means unbounded.
+	struct ValueRange {
+		enum struct Parity { unknown, even, odd };
+
+		Opt<SymbolicBound> lower;
+		Opt<SymbolicBound> upper;
+		// encoded integers are odd, which makes the difference between an
+		// encoded index being at least 0 and at least 1
+		Parity parity = Parity::unknown;
+
+		bool operator==(const ValueRange &other) const {
+			return this->lower == other.lower && this->upper == other.upper && this->parity == other.parity;
+		}
+		bool operator!=(const ValueRange &other) const { return !(*this == other); }
+	};
+
+	// the range of values that each int64 variable may hold at each point,
+	// with bounds that can be relative to the length of an array. branches
+	// and guards on comparisons narrow the ranges of the variables compared
+	// on each side, and the ranges at loop headers are widened to unbounded
+	// in whichever direction they keep growing, so a counter that only
+	// goes up keeps its lower bound and gets its upper bound from the
+	// loop's test.
+	class ValueRanges {
+		public:
+
+		// how a variable's value was computed from other variables that
+		// haven't been assigned since
+		struct Relation {
+			enum struct Kind {
+				// the variable holds `scale * (lhs op rhs) + offset`, which
+				// covers a comparison's result and its encoding
+				comparison,
+				// the variable holds `lhs >> 1`, i.e. lhs decoded
+				half_of,
+				// the variable holds `lhs + rhs`, e.g. the sum of an
+				// access's checks
+				sum
+			};
+			Kind kind;
+			Operator op;
+			Operand lhs;
+			Operand rhs;
+			int64_t scale;
+			int64_t offset;
+
+			bool operator==(const Relation &other) const {
+				return this->kind == other.kind && this->op == other.op && this->lhs == other.lhs
+					&& this->rhs == other.rhs && this->scale == other.scale && this->offset == other.offset;
+			}
+			bool operator!=(const Relation &other) const { return !(*this == other); }
+		};
+		struct State {
+			bool is_reachable;
+			Vec<ValueRange> ranges; // indexed like the tracked variables
+			Vec<Pair<uint32_t, Relation>> relations; // by tracked variable
+
+			bool operator==(const State &other) const {
+				return this->is_reachable == other.is_reachable && this->ranges == other.ranges && this->relations == other.relations;
+			}
+			bool operator!=(const State &other) const { return !(*this == other); }
+		};
+
+		private:
+
+		const FunctionDef &function;
+		Map<const LocalVar *, uint32_t> var_indices;
+		Vec<State> entry_states;
+		bool has_converged_flag;
+
+		public:
+
+		ValueRanges(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, const LoopForest &loops);
+
+		// false if the analysis gave up (on a very large function), in
+		// which case there's nothing to be learned from it
+		bool has_converged() const { return this->has_converged_flag; }
+		const State &get_entry_state(BlockId block) const { return this->entry_states[block]; }
+		void transfer(State &state, InstId inst) const;
+		ValueRange get_range(const State &state, const Operand &operand) const;
+		// whether the operand is certainly 0, e.g. a comparison that can't
+		// hold, so that a guard on it can't fire
+		bool is_zero(const State &state, const Operand &operand) const;
+
+		private:
+
+		uint32_t index_of(const Operand &operand) const;
+		ValueRange evaluate(const State &state, const Instruction &instruction) const;
+		ValueRange evaluate_arithmetic(Operator op, const ValueRange &lhs, const ValueRange &rhs) const;
+		Opt<Relation> get_relation(const State &state, const Instruction &instruction) const;
+		Opt<Relation> get_sum_relation(const BinaryOperation &bin_op) const;
+		void assign(State &state, LocalVar *dest, ValueRange range, Opt<Relation> relation) const;
+		void forget_length(State &state, const LocalVar *array) const;
+		// narrows the ranges to the values for which the condition is
+		// nonzero (or zero)
+		void assume(State &state, const Operand &condition, bool is_true) const;
+		void merge_into(Vec<State> &states, BlockId block, const State &incoming, bool is_widening, bool &has_changed) const;
+	};
+
+	// which of a chosen set of variables are live (may still be read
+	// before being reassigned) at each point of a function
+	class LiveVariables {
+		const FunctionDef &function;
+		Map<const LocalVar *, uint32_t> var_indices;
+		Vec<utils::BitSet> live_in;
+
+		public:
+
+		// only the given variables are tracked; their indices in the
+		// BitSets are their positions in `vars`
+		LiveVariables(const FunctionDef &function, const Vec<LocalVar *> &vars);
+
+		// the index of the variable, or UINT32_MAX if it isn't tracked
+		uint32_t index_of(const LocalVar *var) const {
+			auto it = this->var_indices.find(var);
+			return it == this->var_indices.end() ? UINT32_MAX : it->second;
+		}
+		const utils::BitSet &get_live_in(BlockId block) const { return this->live_in[block]; }
+		utils::BitSet get_live_out(BlockId block) const;
+		// turns the variables live right after the instruction into the
+		// ones live right before it
+		void step_backward(utils::BitSet &live, InstId inst) const;
+	};
+
+	// the functions that each code-typed variable may hold, found from the
+	// assignments of function names and the copies between variables,
+	// regardless of where they happen. a variable that is a parameter or
+	// is assigned anything else (a call's result, an element of a tuple)
+	// may hold any function. assignments of the default value 0 don't
+	// count, since calling that would be an error anyway.
+	class CodeTargets {
+		Map<const LocalVar *, Vec<Operand>> targets; // CodeConstants and ExtCodeConstants, in the order found
+		Set<const LocalVar *> unknown_vars;
+
+		public:
+
+		explicit CodeTargets(const FunctionDef &function);
+
+		// null if the variable may hold any function
+		const Vec<Operand> *get_targets(const LocalVar *var) const;
+	};
+
+	// which functions call which directly, through a call whose callee is
+	// a CodeConstant. calls through code-typed variables aren't edges, so
+	// a function that is only reached through one looks uncalled.
+	class CallGraph {
+		Map<const FunctionDef *, Vec<FunctionDef *>> callees; // without duplicates
+		Map<const FunctionDef *, uint32_t> scc_indices;
+		Vec<Vec<FunctionDef *>> sccs;
+
+		public:
+
+		explicit CallGraph(const Program &program);
+
+		const Vec<FunctionDef *> &get_callees(const FunctionDef *function) const { return this->callees.at(function); }
+		// the strongly connected components of the graph, every component
+		// after the ones it calls into, so that walking them in order visits
+		// callees before their callers wherever there is no recursion
+		const Vec<Vec<FunctionDef *>> &get_sccs() const { return this->sccs; }
+		// whether the function can end up calling itself: it's in a
+		// component with other functions, or it calls itself directly. the
+		// functions added since the graph was built are the clones that
+		// specialization makes of functions that aren't recursive, so they
+		// aren't either.
+		bool is_recursive(const FunctionDef *function) const;
+	};
+
+	// calls `fn(const Operand &)` on every CodeConstant that the function
+	// uses other than as the callee of a call: the functions whose address
+	// escapes into a variable, an argument or a return value
+	template<typename Fn>
+	void visit_code_values(const FunctionDef &function, Fn fn) {
+		auto visit_operand = [&](const Operand &operand) {
+			if (std::holds_alternative<CodeConstant>(operand.value)) fn(operand);
+		};
+		for (InstId inst : function.all_insts()) {
+			const Instruction &instruction = function.inst(inst);
+			if (const FunctionCall *call = std::get_if<FunctionCall>(&instruction.rvalue.value)) {
+				for (const Operand &argument : call->arguments) visit_operand(argument);
+			} else {
+				visit_reads(instruction, visit_operand, [](const LocalVar *) {});
+			}
+		}
+		for (const BasicBlock &block : function.basic_blocks) {
+			if (block.is_erased) continue;
+			if (const Operand *operand = block.get_terminator_operand()) visit_operand(*operand);
+		}
+	}
+
+	// what holds about the array and tuple parameters and return values of
+	// the functions wherever they are called: which parameters every call
+	// passes an allocated reference, and which functions only ever return
+	// allocated references. KnownAllocations uses these as the state on
+	// entry to a function and after a call, which also covers parameters
+	// that the function reassigns.
+	//
+	// The facts start out holding everywhere and are taken back wherever a
+	// call or return contradicts them, going over the call graph's
+	// components from callers to callees until nothing changes, so that
+	// what recursive functions pass each other isn't lost. A function that
+	// is used as a value may be called from anywhere, so its parameters
+	// get no facts, and neither do main's.
+	class AllocationSummaries {
+		Set<const LocalVar *> allocated_parameters;
+		Set<const FunctionDef *> allocating_functions;
+
+		public:
+
+		AllocationSummaries(const Program &program, const CallGraph &call_graph);
+
+		bool is_allocated_on_entry(const LocalVar *parameter) const { return this->allocated_parameters.count(parameter); }
+		bool returns_allocated(const FunctionDef *function) const { return this->allocating_functions.count(function); }
+
+		private:
+
+		// takes back the facts that the function's calls and returns
+		// contradict, and returns whether there were any
+		bool update(const FunctionDef &function);
+	};
+}
@@ -0,0 +1,606 @@
+#include "mir_analysis.h"
+#include <algorithm>
+#include <set>
+
+namespace mir::analysis {
+	using Relation = ValueRanges::Relation;
+	using State = ValueRanges::State;
+
+	// no dimension of an array is longer than 2^58 elements, so lengths
+	// (and small multiples of them) are far from overflowing
+	static constexpr int64_t max_length = int64_t(1) << 58;
+	// a range that reaches past this is given up on, so that the values
+	// it describes can be added or doubled without wrapping around
+	static constexpr int64_t max_magnitude = int64_t(1) << 61;
+	static constexpr int64_t max_coefficient = 4;
+	// functions whose states would take more memory than this many
+	// ranges aren't analyzed
+	static constexpr size_t max_ranges = size_t(1) << 22;
+
+	static const ValueRange unbounded_range {};
+
+	static SymbolicBound constant_bound(int64_t constant) {
+		return { nullptr, 0, 0, constant };
+	}
+
+	using Parity = ValueRange::Parity;
+
+	static Parity get_parity(int64_t constant) {
+		return constant % 2 == 0 ? Parity::even : Parity::odd;
+	}
+
+	static ValueRange constant_range(int64_t constant) {
+		if (constant < -max_magnitude || constant > max_magnitude) return { {}, {}, get_parity(constant) };
+		return { constant_bound(constant), constant_bound(constant), get_parity(constant) };
+	}
+
+	static int64_t get_min(const SymbolicBound &bound) {
+		return bound.constant + std::min<int64_t>(0, bound.coefficient * max_length);
+	}
+
+	static int64_t get_max(const SymbolicBound &bound) {
+		return bound.constant + std::max<int64_t>(0, bound.coefficient * max_length);
+	}
+
+	static bool is_same_length(const SymbolicBound &a, const SymbolicBound &b) {
+		return !a.array || !b.array || (a.array == b.array && a.dimension == b.dimension);
+	}
+
+	// whether a <= b whatever the lengths are
+	static bool is_le(const SymbolicBound &a, const SymbolicBound &b) {
+		if (is_same_length(a, b)) {
+			int64_t coefficient = b.coefficient - a.coefficient;
+			int64_t constant = b.constant - a.constant;
+			return constant >= 0 && coefficient * max_length + constant >= 0;
+		}
+		return get_max(a) <= get_min(b);
+	}
+
+	// keeps the coefficient small. returns nullopt if the bound might not
+	// fit in max_magnitude.
+	static Opt<SymbolicBound> normalize(SymbolicBound bound, bool is_lower) {
+		if (bound.coefficient < -max_coefficient || bound.coefficient > max_coefficient) {
+			bound = constant_bound(is_lower ? get_min(bound) : get_max(bound));
+		}
+		if (bound.coefficient == 0) {
+			bound.array = nullptr;
+			bound.dimension = 0;
+		}
+		if (get_min(bound) < -max_magnitude || get_max(bound) > max_magnitude) return {};
+		return bound;
+	}
+
+	static Opt<SymbolicBound> add(const SymbolicBound &a, const SymbolicBound &b, bool is_lower) {
+		if (!is_same_length(a, b)) {
+			return normalize(constant_bound(is_lower ? get_min(a) + get_min(b) : get_max(a) + get_max(b)), is_lower);
+		}
+		const SymbolicBound &symbolic = a.array ? a : b;
+		return normalize({ symbolic.array, symbolic.dimension, a.coefficient + b.coefficient, a.constant + b.constant }, is_lower);
+	}
+
+	static Opt<SymbolicBound> add(const SymbolicBound &a, int64_t constant, bool is_lower) {
+		return add(a, constant_bound(constant), is_lower);
+	}
+
+	static Opt<SymbolicBound> multiply(const SymbolicBound &bound, int64_t factor, bool is_lower) {
+		return normalize({ bound.array, bound.dimension, bound.coefficient * factor, bound.constant * factor }, is_lower);
+	}
+
+	// rounds down, like an arithmetic shift
+	static SymbolicBound shift_right(const SymbolicBound &bound, int64_t amount, bool is_lower) {
+		if (amount < 8 && bound.coefficient % (int64_t(1) << amount) == 0) {
+			return { bound.array, bound.dimension, bound.coefficient >> amount, bound.constant >> amount };
+		}
+		return constant_bound((is_lower ? get_min(bound) : get_max(bound)) >> amount);
+	}
+
+	// the lower of two lower bounds, and so on
+	static Opt<SymbolicBound> loosest(const Opt<SymbolicBound> &a, const Opt<SymbolicBound> &b, bool is_lower) {
+		if (!a || !b) return {};
+		if (is_le(*a, *b)) return is_lower ? a : b;
+		if (is_le(*b, *a)) return is_lower ? b : a;
+		return is_lower ? constant_bound(std::min(get_min(*a), get_min(*b))) : constant_bound(std::max(get_max(*a), get_max(*b)));
+	}
+
+	// either bound is correct, so if neither is known to be tighter, the
+	// one relative to a length is kept because that's what bounds checks
+	// compare against
+	static Opt<SymbolicBound> tightest(const Opt<SymbolicBound> &a, const Opt<SymbolicBound> &b, bool is_lower) {
+		if (!a) return b;
+		if (!b) return a;
+		if (is_le(*a, *b)) return is_lower ? b : a;
+		if (is_le(*b, *a)) return is_lower ? a : b;
+		return b->array ? b : a;
+	}
+
+	static bool is_bounded(const ValueRange &range) {
+		return range.lower && range.upper;
+	}
+
+	static ValueRange add_ranges(const ValueRange &a, const ValueRange &b) {
+		// an unbounded value might wrap around
+		if (!is_bounded(a) || !is_bounded(b)) return unbounded_range;
+		ValueRange result { add(*a.lower, *b.lower, true), add(*a.upper, *b.upper, false) };
+		return is_bounded(result) ? result : unbounded_range;
+	}
+
+	static ValueRange multiply_range(const ValueRange &range, int64_t factor) {
+		if (!is_bounded(range)) return unbounded_range;
+		ValueRange result;
+		if (factor >= 0) {
+			result = { multiply(*range.lower, factor, true), multiply(*range.upper, factor, false) };
+		} else {
+			result = { multiply(*range.upper, factor, true), multiply(*range.lower, factor, false) };
+		}
+		return is_bounded(result) ? result : unbounded_range;
+	}
+
+	static Opt<int64_t> get_constant(const ValueRange &range) {
+		if (is_bounded(range) && !range.lower->array && *range.lower == *range.upper) {
+			return range.lower->constant;
+		}
+		return {};
+	}
+
+	// whether a < b (or a <= b) for every pair of values in the ranges
+	static bool is_always_less(const ValueRange &a, const ValueRange &b, bool is_strict) {
+		if (!a.upper || !b.lower) return false;
+		if (!is_strict) return is_le(*a.upper, *b.lower);
+		Opt<SymbolicBound> upper = add(*a.upper, 1, false);
+		return upper && is_le(*upper, *b.lower);
+	}
+
+	// 1 if the comparison always holds, 0 if it never does, nullopt if
+	// it depends
+	static Opt<int64_t> compare(Operator op, const ValueRange &lhs, const ValueRange &rhs) {
+		switch (op) {
+			case Operator::lt:
+				if (is_always_less(lhs, rhs, true)) return 1;
+				if (is_always_less(rhs, lhs, false)) return 0;
+				return {};
+			case Operator::le:
+				if (is_always_less(lhs, rhs, false)) return 1;
+				if (is_always_less(rhs, lhs, true)) return 0;
+				return {};
+			case Operator::gt: return compare(Operator::lt, rhs, lhs);
+			case Operator::ge: return compare(Operator::le, rhs, lhs);
+			case Operator::eq: {
+				Opt<int64_t> lhs_constant = get_constant(lhs), rhs_constant = get_constant(rhs);
+				if (lhs_constant && rhs_constant) return *lhs_constant == *rhs_constant;
+				if (is_always_less(lhs, rhs, true) || is_always_less(rhs, lhs, true)) return 0;
+				return {};
+			}
+			default:
+				return {};
+		}
+	}
+
+	// reverse postorder, except that the blocks of each loop come right
+	// after its header, so that a loop settles before the code after it
+	// is looked at. otherwise the code after a loop is first reached with
+	// the bounds of the loop's early iterations, which are too tight and
+	// don't match the final ones, so joining them with those loses them.
+	static Vec<BlockId> order_by_loops(const LoopForest &loops, const Vec<BlockId> &reverse_postorder, size_t num_blocks) {
+		Vec<uint32_t> loop_of_header(num_blocks, LoopForest::no_loop);
+		for (uint32_t loop = 0; loop < loops.loops.size(); ++loop) {
+			loop_of_header[loops.loops[loop].header] = loop;
+		}
+		Vec<BlockId> order;
+		Vec<bool> is_ordered(num_blocks, false);
+		auto visit = [&](auto &self, uint32_t loop, const Vec<BlockId> &blocks) -> void {
+			for (BlockId block : blocks) {
+				if (is_ordered[block]) continue;
+				uint32_t inner_loop = loop_of_header[block];
+				if (inner_loop != LoopForest::no_loop && inner_loop != loop) {
+					self(self, inner_loop, loops.loops[inner_loop].blocks);
+				} else {
+					is_ordered[block] = true;
+					order.push_back(block);
+				}
+			}
+		};
+		visit(visit, LoopForest::no_loop, reverse_postorder);
+		return order;
+	}
+
+	ValueRanges::ValueRanges(const FunctionDef &function, const Vec<BlockId> &reverse_postorder, const LoopForest &loops) :
+		function { function },
+		has_converged_flag { false }
+	{
+		// only the variables that control flow depends on are tracked: the
+		// conditions of guards and branches, and whatever those are
+		// computed from
+		Vec<LocalVar *> pending_vars;
+		auto track = [&](const Operand &operand) {
+			LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+			if (!var) return;
+			const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&(*var)->type.type);
+			if (!array_type || array_type->num_dimensions != 0) return;
+			if (this->var_indices.insert({ *var, static_cast<uint32_t>(this->var_indices.size()) }).second) {
+				pending_vars.push_back(*var);
+			}
+		};
+		for (BlockId block : reverse_postorder) {
+			for (InstId inst : function.insts_of(block)) {
+				if (const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value)) {
+					track(guard->condition);
+				}
+			}
+			if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&function.block(block).terminator)) {
+				track(term->condition);
+			}
+		}
+		while (!pending_vars.empty()) {
+			LocalVar *var = pending_vars.back();
+			pending_vars.pop_back();
+			for (InstId def : var->defs) {
+				const Rvalue &rvalue = function.inst(def).rvalue;
+				if (const Operand *operand = std::get_if<Operand>(&rvalue.value)) {
+					track(*operand);
+				} else if (const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&rvalue.value)) {
+					track(bin_op->lhs);
+					track(bin_op->rhs);
+				}
+			}
+		}
+		if (reverse_postorder.empty() || this->var_indices.size() * reverse_postorder.size() > max_ranges) {
+			return;
+		}
+
+		Vec<uint32_t> rpo_numbers(function.basic_blocks.size(), UINT32_MAX);
+		for (uint32_t i = 0; i < reverse_postorder.size(); ++i) {
+			rpo_numbers[reverse_postorder[i]] = i;
+		}
+
+		this->entry_states.assign(function.basic_blocks.size(), State { false, {}, {} });
+		this->entry_states[reverse_postorder[0]] = State { true, Vec<ValueRange>(this->var_indices.size(), unbounded_range), {} };
+		Vec<BlockId> order = order_by_loops(loops, reverse_postorder, function.basic_blocks.size());
+		Vec<uint32_t> positions(function.basic_blocks.size(), UINT32_MAX);
+		for (uint32_t i = 0; i < order.size(); ++i) {
+			positions[order[i]] = i;
+		}
+		std::set<uint32_t> worklist { 0 }; // by position in the order
+		// ranges are widened along the edges that don't go forward in
+		// reverse postorder, which is how control comes back around a
+		// loop. the edges into a loop from outside only ever bring in
+		// finitely many changes, and widening those would throw away the
+		// bounds that the first paths out of an earlier loop were missing.
+		auto flow_into = [&](BlockId from, BlockId to, const State &incoming) {
+			bool has_changed = false;
+			bool is_widening = rpo_numbers[to] <= rpo_numbers[from];
+			this->merge_into(this->entry_states, to, incoming, is_widening, has_changed);
+			if (has_changed) worklist.insert(positions[to]);
+		};
+
+		// widening makes this converge on its own, but a bound on the work
+		// is cheap insurance
+		size_t budget = 32 * reverse_postorder.size() + 64;
+		while (!worklist.empty()) {
+			if (budget-- == 0) return;
+			BlockId block = order[*worklist.begin()];
+			worklist.erase(worklist.begin());
+
+			State state = this->entry_states[block];
+			for (InstId inst : function.insts_of(block)) {
+				if (const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value)) {
+					State taken = state;
+					this->assume(taken, guard->condition, true);
+					flow_into(block, guard->target, taken);
+				}
+				this->transfer(state, inst);
+			}
+			const BasicBlock::Terminator &terminator = function.block(block).terminator;
+			if (const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&terminator)) {
+				flow_into(block, term->successor, state);
+			} else if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+				if (term->then_block == term->else_block) {
+					flow_into(block, term->then_block, state);
+				} else {
+					State then_state = state;
+					this->assume(then_state, term->condition, true);
+					flow_into(block, term->then_block, then_state);
+					this->assume(state, term->condition, false);
+					flow_into(block, term->else_block, state);
+				}
+			}
+		}
+		this->has_converged_flag = true;
+	}
+
+	void ValueRanges::merge_into(Vec<State> &states, BlockId block, const State &incoming, bool is_widening, bool &has_changed) const {
+		State &old_state = states[block];
+		if (!old_state.is_reachable) {
+			old_state = incoming;
+			has_changed = true;
+			return;
+		}
+		State new_state { true, Vec<ValueRange>(old_state.ranges.size()), {} };
+		for (size_t var = 0; var < old_state.ranges.size(); ++var) {
+			const ValueRange &old_range = old_state.ranges[var];
+			ValueRange &new_range = new_state.ranges[var];
+			new_range.lower = loosest(old_range.lower, incoming.ranges[var].lower, true);
+			new_range.upper = loosest(old_range.upper, incoming.ranges[var].upper, false);
+			new_range.parity = old_range.parity == incoming.ranges[var].parity ? old_range.parity : Parity::unknown;
+			if (is_widening) {
+				if (new_range.lower != old_range.lower) new_range.lower.reset();
+				if (new_range.upper != old_range.upper) new_range.upper.reset();
+			}
+		}
+		for (const Pair<uint32_t, Relation> &relation : old_state.relations) {
+			if (std::find(incoming.relations.begin(), incoming.relations.end(), relation) != incoming.relations.end()) {
+				new_state.relations.push_back(relation);
+			}
+		}
+		if (new_state != old_state) {
+			old_state = mv(new_state);
+			has_changed = true;
+		}
+	}
+
+	uint32_t ValueRanges::index_of(const Operand &operand) const {
+		if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+			auto it = this->var_indices.find(*var);
+			if (it != this->var_indices.end()) return it->second;
+		}
+		return UINT32_MAX;
+	}
+
+	ValueRange ValueRanges::get_range(const State &state, const Operand &operand) const {
+		if (const Int64Constant *constant = std::get_if<Int64Constant>(&operand.value)) {
+			return constant_range(constant->value);
+		}
+		uint32_t var = this->index_of(operand);
+		return var == UINT32_MAX ? unbounded_range : state.ranges[var];
+	}
+
+	bool ValueRanges::is_zero(const State &state, const Operand &operand) const {
+		Opt<int64_t> constant = get_constant(this->get_range(state, operand));
+		return constant && *constant == 0;
+	}
+
+	ValueRange ValueRanges::evaluate(const State &state, const Instruction &instruction) const {
+		if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+			return this->get_range(state, *operand);
+		}
+		if (const LengthGetter *length_getter = std::get_if<LengthGetter>(&instruction.rvalue.value)) {
+			// lengths are encoded
+			LocalVar *const *array = std::get_if<LocalVar *>(&length_getter->target.value);
+			if (!array) return unbounded_range;
+			int64_t dimension = -1;
+			if (length_getter->dimension) {
+				const Int64Constant *constant = std::get_if<Int64Constant>(&length_getter->dimension->value);
+				if (!constant) return unbounded_range;
+				dimension = constant->value;
+			}
+			SymbolicBound length { *array, dimension, 2, 1 };
+			return { length, length, Parity::odd };
+		}
+		const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+		if (!bin_op) return unbounded_range;
+
+		ValueRange lhs = this->get_range(state, bin_op->lhs);
+		ValueRange rhs = this->get_range(state, bin_op->rhs);
+		Opt<int64_t> lhs_constant = get_constant(lhs), rhs_constant = get_constant(rhs);
+		if (lhs_constant && rhs_constant) {
+			Opt<int64_t> result = mir::evaluate(bin_op->op, *lhs_constant, *rhs_constant);
+			return result ? constant_range(*result) : unbounded_range;
+		}
+		if (is_comparison(bin_op->op)) {
+			Opt<int64_t> result = compare(bin_op->op, lhs, rhs);
+			return result ? constant_range(*result) : ValueRange { constant_bound(0), constant_bound(1), Parity::unknown };
+		}
+		ValueRange result = this->evaluate_arithmetic(bin_op->op, lhs, rhs);
+		result.parity = Parity::unknown;
+		if (bin_op->op == Operator::plus || bin_op->op == Operator::minus) {
+			if (lhs.parity != Parity::unknown && rhs.parity != Parity::unknown) {
+				result.parity = lhs.parity == rhs.parity ? Parity::even : Parity::odd;
+			}
+		} else if (bin_op->op == Operator::times) {
+			if (lhs.parity == Parity::even || rhs.parity == Parity::even) {
+				result.parity = Parity::even;
+			} else if (lhs.parity == Parity::odd && rhs.parity == Parity::odd) {
+				result.parity = Parity::odd;
+			}
+		} else if (bin_op->op == Operator::lshift && rhs_constant && *rhs_constant >= 1 && *rhs_constant < 64) {
+			result.parity = Parity::even;
+		}
+		return result;
+	}
+
+	ValueRange ValueRanges::evaluate_arithmetic(Operator op, const ValueRange &lhs, const ValueRange &rhs) const {
+		Opt<int64_t> lhs_constant = get_constant(lhs), rhs_constant = get_constant(rhs);
+		switch (op) {
+			case Operator::plus:
+				return add_ranges(lhs, rhs);
+			case Operator::minus:
+				return add_ranges(lhs, multiply_range(rhs, -1));
+			case Operator::times:
+				if (rhs_constant && *rhs_constant >= -max_coefficient && *rhs_constant <= max_coefficient) {
+					return multiply_range(lhs, *rhs_constant);
+				}
+				if (lhs_constant && *lhs_constant >= -max_coefficient && *lhs_constant <= max_coefficient) {
+					return multiply_range(rhs, *lhs_constant);
+				}
+				return unbounded_range;
+			case Operator::bitwise_and:
+				if (rhs_constant && *rhs_constant >= 0) return { constant_bound(0), rhs.upper };
+				if (lhs_constant && *lhs_constant >= 0) return { constant_bound(0), lhs.upper };
+				return unbounded_range;
+			case Operator::lshift:
+				if (rhs_constant && *rhs_constant >= 0 && *rhs_constant <= 2) {
+					return multiply_range(lhs, int64_t(1) << *rhs_constant);
+				}
+				return unbounded_range;
+			case Operator::rshift: {
+				if (!rhs_constant || *rhs_constant < 0 || *rhs_constant >= 64) return unbounded_range;
+				ValueRange result;
+				if (lhs.lower) result.lower = shift_right(*lhs.lower, *rhs_constant, true);
+				if (lhs.upper) result.upper = shift_right(*lhs.upper, *rhs_constant, false);
+				return result;
+			}
+			default:
+				return unbounded_range;
+		}
+	}
+
+	Opt<Relation> ValueRanges::get_relation(const State &state, const Instruction &instruction) const {
+		const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+		if (!bin_op) return {};
+		if (is_comparison(bin_op->op)) {
+			return Relation { Relation::Kind::comparison, bin_op->op, bin_op->lhs, bin_op->rhs, 1, 0 };
+		}
+		const Operand *rhs_constant = &bin_op->rhs;
+		if (!std::holds_alternative<Int64Constant>(rhs_constant->value)) return this->get_sum_relation(*bin_op);
+		int64_t amount = std::get<Int64Constant>(rhs_constant->value).value;
+		if (bin_op->op == Operator::rshift && amount == 1 && this->index_of(bin_op->lhs) != UINT32_MAX) {
+			// a comparison's result that was encoded and then decoded again
+			// is the comparison's result
+			uint32_t source = this->index_of(bin_op->lhs);
+			for (const auto &[var, relation] : state.relations) {
+				if (var == source && relation.kind == Relation::Kind::comparison && relation.scale == 2 && (relation.offset == 0 || relation.offset == 1)) {
+					return Relation { relation.kind, relation.op, relation.lhs, relation.rhs, 1, 0 };
+				}
+			}
+			return Relation { Relation::Kind::half_of, bin_op->op, bin_op->lhs, bin_op->lhs, 1, 0 };
+		}
+		// the steps of encoding a comparison's result
+		uint32_t source = this->index_of(bin_op->lhs);
+		for (const auto &[var, relation] : state.relations) {
+			if (var != source || relation.kind != Relation::Kind::comparison) continue;
+			if (bin_op->op == Operator::lshift && amount == 1 && relation.offset == 0) {
+				return Relation { relation.kind, relation.op, relation.lhs, relation.rhs, relation.scale * 2, 0 };
+			}
+			if (bin_op->op == Operator::plus && amount == 1 && relation.scale == 2 && relation.offset == 0) {
+				return Relation { relation.kind, relation.op, relation.lhs, relation.rhs, 2, 1 };
+			}
+		}
+		return this->get_sum_relation(*bin_op);
+	}
+
+	Opt<Relation> ValueRanges::get_sum_relation(const BinaryOperation &bin_op) const {
+		if (bin_op.op != Operator::plus || this->index_of(bin_op.lhs) == UINT32_MAX || this->index_of(bin_op.rhs) == UINT32_MAX) return {};
+		return Relation { Relation::Kind::sum, bin_op.op, bin_op.lhs, bin_op.rhs, 1, 0 };
+	}
+
+	void ValueRanges::assign(State &state, LocalVar *dest, ValueRange range, Opt<Relation> relation) const {
+		// the relations that mention the variable no longer hold
+		uint32_t var = this->index_of(Operand(dest));
+		Operand assigned(dest);
+		auto mentions = [&](const Pair<uint32_t, Relation> &entry) {
+			return entry.first == var || entry.second.lhs == assigned || entry.second.rhs == assigned;
+		};
+		state.relations.erase(std::remove_if(state.relations.begin(), state.relations.end(), mentions), state.relations.end());
+		if (var == UINT32_MAX) return;
+		state.ranges[var] = range;
+		if (relation && relation->lhs != assigned && relation->rhs != assigned) {
+			state.relations.push_back({ var, mv(*relation) });
+		}
+	}
+
+	void ValueRanges::forget_length(State &state, const LocalVar *array) const {
+		for (ValueRange &range : state.ranges) {
+			if (range.lower && range.lower->array == array) range.lower = constant_bound(get_min(*range.lower));
+			if (range.upper && range.upper->array == array) range.upper = constant_bound(get_max(*range.upper));
+		}
+	}
+
+	void ValueRanges::transfer(State &state, InstId inst) const {
+		const Instruction &instruction = this->function.inst(inst);
+		if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+			this->assume(state, guard->condition, false);
+			return;
+		}
+		LocalVar *dest = get_defined_var(instruction);
+		if (!dest) return;
+		if (this->index_of(Operand(dest)) != UINT32_MAX) {
+			ValueRange range = this->evaluate(state, instruction);
+			Opt<Relation> relation = this->get_relation(state, instruction);
+			this->assign(state, dest, mv(range), mv(relation));
+		} else if (std::holds_alternative<Type::ArrayType>(dest->type.type) && std::get<Type::ArrayType>(dest->type.type).num_dimensions == 0) {
+			this->assign(state, dest, unbounded_range, {});
+		} else {
+			// an array or tuple that's reassigned has a new length
+			this->forget_length(state, dest);
+		}
+	}
+
+	void ValueRanges::assume(State &state, const Operand &condition, bool is_true) const {
+		uint32_t condition_var = this->index_of(condition);
+		if (condition_var == UINT32_MAX) return;
+		const Relation *comparison = nullptr;
+		for (const auto &[var, relation] : state.relations) {
+			if (var != condition_var) continue;
+			if (relation.kind == Relation::Kind::comparison && relation.scale == 1 && relation.offset == 0) {
+				comparison = &relation;
+			} else if (relation.kind == Relation::Kind::sum && !is_true) {
+				// a sum of values that can't be negative is only 0 if they
+				// all are
+				ValueRange lhs_range = this->get_range(state, relation.lhs);
+				ValueRange rhs_range = this->get_range(state, relation.rhs);
+				if (lhs_range.lower && get_min(*lhs_range.lower) >= 0 && rhs_range.lower && get_min(*rhs_range.lower) >= 0) {
+					Operand lhs = relation.lhs, rhs = relation.rhs;
+					this->assume(state, lhs, false);
+					this->assume(state, rhs, false);
+				}
+				return;
+			}
+		}
+		if (!comparison) return;
+
+		// narrows the ranges so that lesser < greater (or <=)
+		auto assume_less = [&](const Operand &lesser, const Operand &greater, bool is_strict) {
+			ValueRange lesser_range = this->get_range(state, lesser);
+			ValueRange greater_range = this->get_range(state, greater);
+			int64_t gap = is_strict ? 1 : 0;
+			uint32_t lesser_var = this->index_of(lesser);
+			if (lesser_var != UINT32_MAX && greater_range.upper) {
+				Opt<SymbolicBound> upper = add(*greater_range.upper, -gap, false);
+				state.ranges[lesser_var].upper = tightest(lesser_range.upper, upper, false);
+			}
+			uint32_t greater_var = this->index_of(greater);
+			if (greater_var != UINT32_MAX && lesser_range.lower) {
+				Opt<SymbolicBound> lower = add(*lesser_range.lower, gap, true);
+				state.ranges[greater_var].lower = tightest(greater_range.lower, lower, true);
+			}
+		};
+		const Operand &lhs = comparison->lhs, &rhs = comparison->rhs;
+		switch (comparison->op) {
+			case Operator::lt: is_true ? assume_less(lhs, rhs, true) : assume_less(rhs, lhs, false); break;
+			case Operator::le: is_true ? assume_less(lhs, rhs, false) : assume_less(rhs, lhs, true); break;
+			case Operator::gt: is_true ? assume_less(rhs, lhs, true) : assume_less(lhs, rhs, false); break;
+			case Operator::ge: is_true ? assume_less(rhs, lhs, false) : assume_less(lhs, rhs, true); break;
+			case Operator::eq:
+				if (is_true) {
+					assume_less(lhs, rhs, false);
+					assume_less(rhs, lhs, false);
+				}
+				break;
+			default: break;
+		}
+
+		// a narrower decoded value means a narrower encoded one, and the
+		// other way around
+		for (const auto &[decoded, relation] : state.relations) {
+			if (relation.kind != Relation::Kind::half_of) continue;
+			uint32_t encoded = this->index_of(relation.lhs);
+			ValueRange &encoded_range = state.ranges[encoded];
+			ValueRange &decoded_range = state.ranges[decoded];
+			if (decoded_range.lower) {
+				Opt<SymbolicBound> lower = multiply(*decoded_range.lower, 2, true);
+				if (lower && encoded_range.parity == Parity::odd) lower = add(*lower, 1, true);
+				encoded_range.lower = tightest(encoded_range.lower, lower, true);
+			}
+			if (decoded_range.upper) {
+				Opt<SymbolicBound> upper = multiply(*decoded_range.upper, 2, false);
+				if (upper && encoded_range.parity != Parity::even) upper = add(*upper, 1, false);
+				encoded_range.upper = tightest(encoded_range.upper, upper, false);
+			}
+			if (encoded_range.lower) {
+				decoded_range.lower = tightest(decoded_range.lower, shift_right(*encoded_range.lower, 1, true), true);
+			}
+			if (encoded_range.upper) {
+				decoded_range.upper = tightest(decoded_range.upper, shift_right(*encoded_range.upper, 1, false), false);
+			}
+		}
+	}
+}
@@ -0,0 +1,156 @@
+#include "mir_opt.h"
+#include <iostream>
+
+namespace mir::opt {
+	// runs passes over a function while keeping a tally of their changes
+	// for the verbose report
+	class PassRunner {
+		bool verbose;
+		Vec<Pair<std::string, size_t>> totals; // in the order the passes first ran
+
+		public:
+
+		explicit PassRunner(bool verbose) : verbose { verbose } {}
+
+		// if per_function_unit is given, also reports right away how many
+		// changes (counted in that unit) the pass made to this function
+		template<typename Pass>
+		void run(const std::string &pass_name, FunctionDef &function, Pass pass, const char *per_function_unit = nullptr) {
+			size_t num_changes = pass(function);
+#ifdef DEBUG
+			function.verify_def_use();
+#endif
+			if (!this->verbose) return;
+			if (per_function_unit && num_changes > 0) {
+				std::cerr << pass_name << " in @" << function.get_unambiguous_name() << ": " << num_changes << " " << per_function_unit << "\n";
+			}
+			for (Pair<std::string, size_t> &total : this->totals) {
+				if (total.first == pass_name) {
+					total.second += num_changes;
+					return;
+				}
+			}
+			this->totals.push_back({ pass_name, num_changes });
+		}
+
+		// for the passes over the whole program
+		template<typename Pass>
+		void run(const std::string &pass_name, Program &program, Pass pass) {
+			size_t num_changes = pass(program);
+#ifdef DEBUG
+			for (const Uptr<FunctionDef> &function : program.function_defs) {
+				function->verify_def_use();
+			}
+#endif
+			if (!this->verbose) return;
+			for (Pair<std::string, size_t> &total : this->totals) {
+				if (total.first == pass_name) {
+					total.second += num_changes;
+					return;
+				}
+			}
+			this->totals.push_back({ pass_name, num_changes });
+		}
+
+		void report() const {
+			if (!this->verbose) return;
+			for (const Pair<std::string, size_t> &total : this->totals) {
+				std::cerr << total.first << ": " << total.second << " changes\n";
+			}
+		}
+	};
+
+	void optimize_program(Program &program, int optimization_level, size_t unroll_factor, bool verbose) {
+		if (optimization_level <= 0) {
+			return;
+		}
+
+		PassRunner runner(verbose);
+		// saves optimizing functions that are never called
+		runner.run("unreachable function removal", program, remove_unreachable_functions);
+		// first, so that the call graph sees the calls that were indirect
+		// and doesn't count functions that only recursed through tail
+		// calls as recursive
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			runner.run("devirtualization", *function, devirtualize_calls, "calls devirtualized");
+			runner.run("tail call elimination", *function, eliminate_tail_calls, "tail calls eliminated");
+		}
+		// callees are optimized before their callers, so that what gets
+		// inlined or specialized is already optimized
+		analysis::CallGraph call_graph(program);
+		// what the functions' callers pass them stays true however the
+		// functions are optimized, so it's worked out once up front
+		analysis::AllocationSummaries summaries(program, call_graph);
+		Specializations specializations;
+		for (const Vec<FunctionDef *> &scc : call_graph.get_sccs()) {
+			for (FunctionDef *function : scc) {
+				runner.run("inlining", *function, [&](FunctionDef &function) {
+					return inline_calls(function, call_graph);
+				}, "calls inlined");
+				runner.run("cfg simplification", *function, simplify_cfg);
+				runner.run("constant propagation", *function, propagate_constants);
+				// once the lengths and indices that are constant are
+				// substituted, and before anything hoists the accesses
+				runner.run("scalar replacement", *function, replace_allocations_with_scalars, "allocations replaced");
+				runner.run("loop-invariant code motion", *function, hoist_loop_invariants);
+				runner.run("common subexpression elimination", *function, eliminate_common_subexpressions);
+				runner.run("copy propagation", *function, propagate_copies);
+				// once the arguments are constants where they can be, and
+				// before the checks go, since they tell which arrays are
+				// allocated
+				runner.run("specialization", *function, [&](FunctionDef &function) {
+					return specialize_calls(program, function, call_graph, summaries, specializations);
+				}, "calls specialized");
+				// the clones' bodies are already optimized, apart from what
+				// the facts about their arguments allow
+				for (FunctionDef *clone : specializations.new_clones) {
+					runner.run("constant propagation", *clone, propagate_constants);
+					runner.run("copy propagation", *clone, propagate_copies);
+					runner.run("redundant check elimination", *clone, [&](FunctionDef &function) {
+						return eliminate_redundant_checks(function, summaries);
+					});
+					runner.run("range-based check elimination", *clone, eliminate_checks_by_range, "checks proven safe");
+					runner.run("constant propagation", *clone, propagate_constants);
+					runner.run("copy propagation", *clone, propagate_copies);
+					runner.run("dead code elimination", *clone, eliminate_dead_code);
+					runner.run("dead store elimination", *clone, eliminate_dead_stores);
+					runner.run("cfg simplification", *clone, simplify_cfg);
+				}
+				specializations.new_clones.clear();
+				runner.run("redundant check elimination", *function, [&](FunctionDef &function) {
+					return eliminate_redundant_checks(function, summaries);
+				});
+				runner.run("range-based check elimination", *function, eliminate_checks_by_range, "checks proven safe");
+				runner.run("loop versioning", *function, version_loops, "loops versioned");
+				// folds the sums of the checks that turned out not to fail
+				runner.run("constant propagation", *function, propagate_constants);
+				runner.run("copy propagation", *function, propagate_copies);
+				runner.run("strength reduction", *function, reduce_strength);
+				// after the check elimination passes, which would lose the
+				// allocation facts that the new array gave them, and before
+				// unrolling, which would copy the allocations
+				runner.run("scratch array reuse", *function, reuse_loop_allocations, "allocations reused");
+				runner.run("loop unrolling", *function, [&](FunctionDef &function) {
+					return unroll_loops(function, unroll_factor);
+				}, "loops unrolled");
+				runner.run("dead code elimination", *function, eliminate_dead_code);
+				runner.run("dead store elimination", *function, eliminate_dead_stores);
+				runner.run("cfg simplification", *function, simplify_cfg);
+			}
+		}
+		// inlining leaves functions that nothing calls anymore, and
+		// optimization leaves parameters that nothing reads
+		runner.run("unreachable function removal", program, remove_unreachable_functions);
+		runner.run("unused parameter removal", program, remove_unused_parameters);
+		// left for last, since the callers copy the callees' temporaries
+		// and are better off with one def per temporary
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			// the arguments that were removed may have been all that read
+			// some values
+			runner.run("dead code elimination", *function, eliminate_dead_code);
+			runner.run("temporary coalescing", *function, coalesce_temporaries);
+			function->compact();
+		}
+		runner.report();
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "std_alias.h"
+#include "mir.h"
+#include "mir_analysis.h"
+
+// Optimization passes over the MIR. Each pass transforms a single function
+// in place through FunctionDef's mutation API (so the def-use chains stay
+// valid between passes) and returns the number of changes it made, which
+// is only used for reporting.
+namespace mir::opt {
+	using namespace std_alias;
+
+	// rewrites calls through code-typed variables that can only hold one
+	// function, or a few, into direct calls of those functions
+	size_t devirtualize_calls(FunctionDef &function);
+
+	// turns calls of the function itself whose result is returned right
+	// away into reassignments of the parameters and a jump back to the
+	// start of the function
+	size_t eliminate_tail_calls(FunctionDef &function);
+
+	// replaces calls to small non-recursive functions with copies of
+	// their bodies, allowing bigger callees for calls in loops and calls
+	// with constant arguments. the callees should already be optimized,
+	// since that's what gets copied.
+	size_t inline_calls(FunctionDef &function, const analysis::CallGraph &call_graph);
+
+	// folds branches on constants, removes unreachable blocks, skips over
+	// blocks that only jump elsewhere, and merges blocks that always follow
+	// one another
+	size_t simplify_cfg(FunctionDef &function);
+
+	// sparse conditional constant propagation: finds the variables that
+	// hold a known constant at each point, assuming that branches on
+	// constants only go one way, then substitutes and folds those
+	// constants. the branches that become constant are left for
+	// simplify_cfg to prune.
+	size_t propagate_constants(FunctionDef &function);
+
+	// computes the arithmetic and lengths in a loop whose operands don't
+	// change while it runs once before the loop instead, in a preheader
+	// block added in front of the loop's header
+	size_t hoist_loop_invariants(FunctionDef &function);
+
+	// replaces the small arrays and tuples of constant length that never
+	// leave the function, and are only accessed at constant indices, with
+	// a variable per element
+	size_t replace_allocations_with_scalars(FunctionDef &function);
+
+	// replaces pure computations (arithmetic, lengths, encodes and copies)
+	// whose result some variable already holds on every path to them with
+	// a copy of that variable
+	size_t eliminate_common_subexpressions(FunctionDef &function);
+
+	// replaces reads of a variable that is only ever assigned a copy of a
+	// constant or of another variable whose value can't have changed since
+	size_t propagate_copies(FunctionDef &function);
+
+	// erases the guards in front of array and tuple accesses that can't
+	// fail because an earlier check on every path to them already tested
+	// the same variable (and index) and the variable hasn't been assigned
+	// since, or the variable is a parameter that the summaries show every
+	// caller passes allocated. this leaves the instructions feeding those
+	// guards for dead code elimination.
+	size_t eliminate_redundant_checks(FunctionDef &function, const analysis::AllocationSummaries &summaries);
+
+	// erases the bounds checks in loops that the ranges of the values
+	// involved show can't fail, such as the checks on `arr[i]` in a loop
+	// that counts i up from 0 while it's less than `length arr 0`
+	size_t eliminate_checks_by_range(FunctionDef &function);
+
+	// gives counted loops whose remaining bounds checks can't be proven
+	// safe statically, such as the check on `arr[i + k]`, a second copy
+	// without those checks, entered when a test in front of the loop shows
+	// that no index the loop can reach is out of range. otherwise the
+	// original loop runs, checks and all.
+	size_t version_loops(FunctionDef &function);
+
+	// replaces multiplications by constants with shifts and additions,
+	// multiplications of a loop's counter by a value that doesn't change
+	// in the loop with a running sum, and arithmetic on decoded values
+	// whose result is encoded right away with the same arithmetic on the
+	// encoded values
+	size_t reduce_strength(FunctionDef &function);
+
+	// makes the allocations in loops of arrays whose lengths the loop
+	// doesn't change and that don't outlive the iteration allocate once
+	// per entry into the loop, zeroing that array where they used to
+	// allocate
+	size_t reuse_loop_allocations(FunctionDef &function);
+
+	// runs up to `factor` iterations of each small counted innermost loop
+	// back to back behind a single test of the loop's condition, leaving
+	// the original loop to run the iterations that remain. loops that
+	// still have checks in them are left alone, so this should run after
+	// the check elimination passes.
+	size_t unroll_loops(FunctionDef &function, size_t factor);
+
+	// erases instructions without side effects whose results are never
+	// read, along with whatever becomes dead as a result
+	size_t eliminate_dead_code(FunctionDef &function);
+
+	// erases assignments whose value is overwritten or forgotten before
+	// anything reads it on any path, such as the re-initialization of a
+	// variable declared in a loop right before it's assigned, or a store to
+	// %linenum that no check can report anymore
+	size_t eliminate_dead_stores(FunctionDef &function);
+
+	// merges the compiler's anonymous temporaries that are never live at
+	// the same time into shared variables, so that a function declares
+	// about as many variables as it has values live at once. this gives
+	// up the one-def-per-temporary shape that the other passes find
+	// easy to work with, so it should run after them.
+	size_t coalesce_temporaries(FunctionDef &function);
+
+	// the passes below work on the whole program, so that calls can be
+	// updated along with the functions they call
+
+	// removes the functions that can't be reached from main through
+	// calls, counting a function that is used as a value anywhere
+	// reachable as reachable
+	size_t remove_unreachable_functions(Program &program);
+
+	// removes the parameters that a function never reads and the return
+	// value that none of its callers use, updating every call. functions
+	// that are used as values keep their signatures, since the calls
+	// through variables can't be updated.
+	size_t remove_unused_parameters(Program &program);
+
+	// the clones that specialize_calls has made, shared between the
+	// functions whose calls it specializes
+	struct Specializations {
+		Map<std::string, FunctionDef *> clones; // by the function and what is known about the arguments
+		Map<const FunctionDef *, size_t> num_clones; // by the function cloned
+		// the clones made since the caller last took them. they are copies
+		// of the function with facts about the arguments filled in, and
+		// need constant propagation and check elimination to make use of
+		// those.
+		Vec<FunctionDef *> new_clones;
+	};
+
+	// makes the calls in the function that pass constants or arrays known
+	// to be allocated call clones of their callees that assume as much,
+	// for calls in loops and calls of functions that have loops. the
+	// number of clones is bounded.
+	size_t specialize_calls(Program &program, FunctionDef &function, const analysis::CallGraph &call_graph, const analysis::AllocationSummaries &summaries, Specializations &specializations);
+
+	// runs the passes appropriate for the optimization level over every
+	// function of the program, unrolling loops by up to unroll_factor
+	// (1 turns unrolling off). if verbose, prints what each pass did to
+	// stderr.
+	void optimize_program(Program &program, int optimization_level, size_t unroll_factor, bool verbose);
+}
@@ -0,0 +1,438 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+#include <algorithm>
+#include <tuple>
+
+namespace mir::opt {
+	using utils::BitSet;
+
+	// an index operand: a variable, or a constant when var is null
+	using IndexKey = Pair<const LocalVar *, int64_t>;
+
+	static Opt<IndexKey> get_index_key(const Operand &operand) {
+		if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+			return IndexKey { *var, 0 };
+		}
+		if (const Int64Constant *constant = std::get_if<Int64Constant>(&operand.value)) {
+			return IndexKey { nullptr, constant->value };
+		}
+		return {};
+	}
+
+	// Finds the bounds checks in front of array accesses that can't fail
+	// because the same index was already checked against the same array.
+	// The checks that hir_to_mir emits compare the (encoded) index x
+	// against 1 and against a variable L holding `length v d`, and add the
+	// results of an access's comparisons up into the one condition that it
+	// guards on. So the facts of the analysis are:
+	// - "x >= 1" and "x < length v d", which a passed check establishes
+	// - "L holds length v d"
+	// - "c holds x < 1" and "c holds x >= length v d", for the results of
+	//   the comparisons and copies of them
+	// - "c covers x < 1" and "c covers x >= length v d", for sums that
+	//   include such a result, which can only be 0 if the comparison is
+	// A guard on c turns the tests that c holds or covers into the facts
+	// above. Each fact is killed by assigning any variable it mentions. The
+	// element stores in between don't matter, since they can't change an
+	// array's length.
+	class BoundsChecks {
+		struct TestFact {
+			uint32_t fact;
+			uint32_t bound_fact; // the fact that passing the test establishes
+			bool is_exact; // "holds" rather than "covers"
+		};
+
+		const FunctionDef &function;
+		analysis::VarFacts var_facts;
+		// (x, v, d) -> "x < length v d", with v null for "x >= 1"
+		std::map<std::tuple<IndexKey, const LocalVar *, int64_t>, uint32_t> bound_facts;
+		// (L, v, d) -> "L holds length v d"
+		std::map<std::tuple<const LocalVar *, const LocalVar *, int64_t>, uint32_t> length_facts;
+		// L -> its "L holds length v d" facts, with each one's (v, d)
+		Map<const LocalVar *, Vec<std::tuple<uint32_t, const LocalVar *, int64_t>>> lengths_held;
+		// c -> the tests that c holds or covers
+		Map<const LocalVar *, Vec<TestFact>> test_facts;
+		// inst -> [(fact it establishes, fact that must hold beforehand)]
+		Map<InstId, Vec<Pair<uint32_t, uint32_t>>> generated_facts;
+		// comparison inst -> [(fact that makes it 0, fact that must hold as well)]
+		Map<InstId, Vec<Pair<uint32_t, uint32_t>>> comparison_bounds;
+		static constexpr uint32_t no_fact = UINT32_MAX;
+
+		Vec<BitSet> entry_states;
+
+		public:
+
+		BoundsChecks(const FunctionDef &function, const Vec<BlockId> &reverse_postorder) :
+			function { function }
+		{
+			this->collect_facts();
+			this->entry_states = analysis::solve_forward_must(
+				function,
+				reverse_postorder,
+				this->var_facts.size(),
+				[&](BitSet &state, InstId inst) { this->transfer(state, inst); }
+			);
+		}
+
+		const BitSet &get_entry_state(BlockId block) const { return this->entry_states[block]; }
+
+		void transfer(BitSet &state, InstId inst) const {
+			const Instruction &instruction = this->function.inst(inst);
+			if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+				LocalVar *const *condition = std::get_if<LocalVar *>(&guard->condition.value);
+				if (!condition) return;
+				auto it = this->test_facts.find(*condition);
+				if (it == this->test_facts.end()) return;
+				for (const TestFact &test : it->second) {
+					if (state.test(test.fact)) state.set(test.bound_fact);
+				}
+				return;
+			}
+
+			LocalVar *dest = get_defined_var(instruction);
+			if (!dest) return;
+			SmallVec<uint32_t, 4> new_facts;
+			auto it = this->generated_facts.find(inst);
+			if (it != this->generated_facts.end()) {
+				for (auto [fact, required_fact] : it->second) {
+					if (required_fact == no_fact || state.test(required_fact)) {
+						new_facts.push_back(fact);
+					}
+				}
+			}
+			this->var_facts.kill(state, dest);
+			for (uint32_t fact : new_facts) {
+				state.set(fact);
+			}
+		}
+
+		// whether the guard is a bounds check that can't fail
+		bool is_redundant(const BitSet &state, const Guard &guard) const {
+			return this->is_known_zero(state, guard.condition);
+		}
+
+		// whether the instruction computes a check (or a sum of checks) that
+		// can't fail, i.e. always computes 0
+		bool computes_zero(const BitSet &state, InstId inst) const {
+			const Instruction &instruction = this->function.inst(inst);
+			auto it = this->comparison_bounds.find(inst);
+			if (it != this->comparison_bounds.end()) {
+				for (auto [bound_fact, required_fact] : it->second) {
+					if (state.test(bound_fact) && (required_fact == no_fact || state.test(required_fact))) return true;
+				}
+				return false;
+			}
+			if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+				return std::holds_alternative<LocalVar *>(operand->value) && this->is_known_zero(state, *operand);
+			}
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+			return bin_op && bin_op->op == Operator::plus && this->is_known_zero(state, bin_op->lhs) && this->is_known_zero(state, bin_op->rhs);
+		}
+
+		private:
+
+		bool is_known_zero(const BitSet &state, const Operand &operand) const {
+			if (const Int64Constant *constant = std::get_if<Int64Constant>(&operand.value)) return constant->value == 0;
+			LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+			if (!var) return false;
+			auto it = this->test_facts.find(*var);
+			if (it == this->test_facts.end()) return false;
+			for (const TestFact &test : it->second) {
+				if (test.is_exact && state.test(test.fact) && state.test(test.bound_fact)) return true;
+			}
+			return false;
+		}
+
+		void collect_facts() {
+			// the lengths first, so that the comparisons against them know
+			// what they might be comparing against
+			for (InstId inst : this->function.all_insts()) {
+				const Instruction &instruction = this->function.inst(inst);
+				const LengthGetter *length_getter = std::get_if<LengthGetter>(&instruction.rvalue.value);
+				LocalVar *dest = get_defined_var(instruction);
+				if (!length_getter || !dest) continue;
+				LocalVar *const *array = std::get_if<LocalVar *>(&length_getter->target.value);
+				if (!array) continue;
+				int64_t dimension = -1; // tuples have no dimension
+				if (length_getter->dimension) {
+					const Int64Constant *constant = std::get_if<Int64Constant>(&length_getter->dimension->value);
+					if (!constant) continue;
+					dimension = constant->value;
+				}
+				auto key = std::make_tuple(dest, *array, dimension);
+				auto fact_it = this->length_facts.find(key);
+				if (fact_it == this->length_facts.end()) {
+					uint32_t fact = this->var_facts.add_fact({ dest, *array });
+					fact_it = this->length_facts.insert({ key, fact }).first;
+					this->lengths_held[dest].push_back({ fact, *array, dimension });
+				}
+				this->generated_facts[inst].push_back({ fact_it->second, no_fact });
+			}
+
+			for (InstId inst : this->function.all_insts()) {
+				const Instruction &instruction = this->function.inst(inst);
+				const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+				LocalVar *dest = get_defined_var(instruction);
+				if (!bin_op || !dest) continue;
+
+				const Operand one = Operand(Int64Constant { 1 });
+				if ((bin_op->op == Operator::lt && bin_op->rhs == one) || (bin_op->op == Operator::gt && bin_op->lhs == one)) {
+					Opt<IndexKey> index = get_index_key(bin_op->op == Operator::lt ? bin_op->lhs : bin_op->rhs);
+					if (index && index->first != dest) {
+						this->add_comparison(inst, dest, *index, nullptr, 0, no_fact);
+					}
+				} else if (bin_op->op == Operator::ge || bin_op->op == Operator::le) {
+					const Operand &index_operand = bin_op->op == Operator::ge ? bin_op->lhs : bin_op->rhs;
+					const Operand &length_operand = bin_op->op == Operator::ge ? bin_op->rhs : bin_op->lhs;
+					Opt<IndexKey> index = get_index_key(index_operand);
+					LocalVar *const *length = std::get_if<LocalVar *>(&length_operand.value);
+					if (!index || index->first == dest || !length) continue;
+					auto held_it = this->lengths_held.find(*length);
+					if (held_it == this->lengths_held.end()) continue;
+					for (auto [length_fact, array, dimension] : held_it->second) {
+						this->add_comparison(inst, dest, *index, array, dimension, length_fact);
+					}
+				}
+			}
+
+			// then the copies and sums of the comparisons' results, which may
+			// be copies and sums of each other
+			Set<const LocalVar *> flags = this->find_flags();
+			auto get_tests = [&](const Operand &operand) {
+				Vec<TestFact> tests;
+				if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+					auto it = this->test_facts.find(*var);
+					if (it != this->test_facts.end()) tests = it->second;
+				}
+				return tests;
+			};
+			bool has_changed = true;
+			while (has_changed) {
+				has_changed = false;
+				for (InstId inst : this->function.all_insts()) {
+					const Instruction &instruction = this->function.inst(inst);
+					LocalVar *dest = get_defined_var(instruction);
+					if (!dest) continue;
+					if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+						for (const TestFact &test : get_tests(*operand)) {
+							has_changed |= this->add_derived_test(inst, dest, test.bound_fact, test.is_exact, test.fact);
+						}
+						continue;
+					}
+					const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+					if (!bin_op || bin_op->op != Operator::plus) continue;
+					// a sum is only 0 if both of its parts are if neither can
+					// be negative
+					auto is_flag = [&](const Operand &operand) {
+						LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+						const Int64Constant *constant = std::get_if<Int64Constant>(&operand.value);
+						return (var && flags.count(*var)) || (constant && constant->value >= 0);
+					};
+					if (!is_flag(bin_op->lhs) || !is_flag(bin_op->rhs)) continue;
+					for (const Operand *part : { &bin_op->lhs, &bin_op->rhs }) {
+						for (const TestFact &test : get_tests(*part)) {
+							has_changed |= this->add_derived_test(inst, dest, test.bound_fact, false, test.fact);
+						}
+					}
+				}
+			}
+			this->var_facts.finish();
+		}
+
+		// the variables that can only ever hold comparison results (0 or 1)
+		// or sums of them
+		Set<const LocalVar *> find_flags() const {
+			Set<const LocalVar *> flags;
+			Set<const LocalVar *> non_flags(this->function.parameter_vars.begin(), this->function.parameter_vars.end());
+			for (InstId inst : this->function.all_insts()) {
+				const Instruction &instruction = this->function.inst(inst);
+				if (!instruction.destination) continue;
+				LocalVar *dest = get_defined_var(instruction);
+				const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+				const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value);
+				bool may_be_flag = false;
+				if (bin_op) {
+					may_be_flag = is_comparison(bin_op->op) || bin_op->op == Operator::plus;
+				} else if (operand) {
+					const Int64Constant *constant = std::get_if<Int64Constant>(&operand->value);
+					may_be_flag = std::holds_alternative<LocalVar *>(operand->value) || (constant && constant->value >= 0);
+				}
+				if (!dest || !may_be_flag) {
+					non_flags.insert(instruction.destination->target);
+				} else {
+					flags.insert(dest);
+				}
+			}
+			// then the copies and sums of anything else aren't either
+			bool has_changed = true;
+			while (has_changed) {
+				has_changed = false;
+				for (InstId inst : this->function.all_insts()) {
+					const Instruction &instruction = this->function.inst(inst);
+					LocalVar *dest = get_defined_var(instruction);
+					if (!dest || non_flags.count(dest)) continue;
+					bool reads_non_flag = false;
+					auto check = [&](const Operand &operand) {
+						LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+						if (var && !flags.count(*var)) reads_non_flag = true;
+						if (var && non_flags.count(*var)) reads_non_flag = true;
+					};
+					if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+						check(*operand);
+					} else if (const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value); bin_op && bin_op->op == Operator::plus) {
+						check(bin_op->lhs);
+						check(bin_op->rhs);
+					}
+					if (reads_non_flag) {
+						non_flags.insert(dest);
+						has_changed = true;
+					}
+				}
+			}
+			for (const LocalVar *var : non_flags) flags.erase(var);
+			return flags;
+		}
+
+		// records that the instruction makes its destination hold the
+		// comparison of the index against the given bound, which it can
+		// only know if required_fact holds beforehand
+		void add_comparison(InstId inst, const LocalVar *condition, IndexKey index, const LocalVar *array, int64_t dimension, uint32_t required_fact) {
+			auto bound_key = std::make_tuple(index, array, dimension);
+			auto bound_it = this->bound_facts.find(bound_key);
+			if (bound_it == this->bound_facts.end()) {
+				uint32_t fact = this->var_facts.add_fact({ index.first, array });
+				bound_it = this->bound_facts.insert({ bound_key, fact }).first;
+			}
+			uint32_t bound_fact = bound_it->second;
+			this->comparison_bounds[inst].push_back({ bound_fact, required_fact });
+			uint32_t test_fact = this->get_test_fact(condition, bound_fact, true, index.first, array);
+			this->generated_facts[inst].push_back({ test_fact, required_fact });
+		}
+
+		// records that the instruction makes its destination hold or cover
+		// a test if required_fact holds beforehand. returns whether that's
+		// new.
+		bool add_derived_test(InstId inst, const LocalVar *condition, uint32_t bound_fact, bool is_exact, uint32_t required_fact) {
+			uint32_t test_fact = this->get_test_fact(condition, bound_fact, is_exact, nullptr, nullptr);
+			Vec<Pair<uint32_t, uint32_t>> &facts = this->generated_facts[inst];
+			for (auto [fact, other_required_fact] : facts) {
+				if (fact == test_fact && other_required_fact == required_fact) return false;
+			}
+			facts.push_back({ test_fact, required_fact });
+			return true;
+		}
+
+		// index and array are the variables that the test mentions besides
+		// the condition, if the fact doesn't exist yet
+		uint32_t get_test_fact(const LocalVar *condition, uint32_t bound_fact, bool is_exact, const LocalVar *index, const LocalVar *array) {
+			Vec<TestFact> &tests = this->test_facts[condition];
+			for (const TestFact &test : tests) {
+				if (test.bound_fact == bound_fact && test.is_exact == is_exact) return test.fact;
+			}
+			if (!index && !array) {
+				// a derived test mentions the same variables as the one it's
+				// derived from
+				for (const auto &[key, fact] : this->bound_facts) {
+					if (fact == bound_fact) {
+						index = std::get<0>(key).first;
+						array = std::get<1>(key);
+						break;
+					}
+				}
+			}
+			uint32_t test_fact = this->var_facts.add_fact({ condition, index, array });
+			tests.push_back({ test_fact, bound_fact, is_exact });
+			return test_fact;
+		}
+	};
+
+	static bool is_zero_constant(const Rvalue &rvalue) {
+		const Operand *operand = std::get_if<Operand>(&rvalue.value);
+		return operand && *operand == Operand(Int64Constant { 0 });
+	}
+
+	size_t eliminate_redundant_checks(FunctionDef &function, const analysis::AllocationSummaries &summaries) {
+		Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(function);
+		analysis::KnownAllocations allocations(function, reverse_postorder, &summaries);
+		BoundsChecks bounds_checks(function, reverse_postorder);
+
+		// the analyses describe the function as it was, so the changes are
+		// only made after all of them have been looked at. erasing a guard
+		// that can't fail, or replacing a check that can't fail with 0,
+		// doesn't change what holds after it.
+		Vec<InstId> redundant_guards;
+		Vec<InstId> redundant_checks;
+		for (BlockId block : reverse_postorder) {
+			BitSet allocated = allocations.get_entry_state(block);
+			BitSet in_bounds = bounds_checks.get_entry_state(block);
+			for (InstId inst : function.insts_of(block)) {
+				const Instruction &instruction = function.inst(inst);
+				if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+					LocalVar *const *condition = std::get_if<LocalVar *>(&guard->condition.value);
+					if ((condition && allocations.is_passed_null_test(allocated, *condition)) || bounds_checks.is_redundant(in_bounds, *guard)) {
+						redundant_guards.push_back(inst);
+					}
+				} else if (bounds_checks.computes_zero(in_bounds, inst) && !is_zero_constant(instruction.rvalue)) {
+					redundant_checks.push_back(inst);
+				}
+				allocations.transfer(allocated, inst);
+				bounds_checks.transfer(in_bounds, inst);
+			}
+		}
+		for (InstId inst : redundant_guards) {
+			function.erase_inst(inst);
+		}
+		for (InstId inst : redundant_checks) {
+			Opt<Place> destination = function.inst(inst).destination;
+			function.replace_inst(inst, mv(destination), Operand(Int64Constant { 0 }));
+		}
+		return redundant_guards.size() + redundant_checks.size();
+	}
+
+	size_t eliminate_checks_by_range(FunctionDef &function) {
+		// outside of loops, eliminate_redundant_checks and constant
+		// propagation already find what this would
+		Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(function);
+		analysis::DominatorTree dominators(function, reverse_postorder);
+		analysis::LoopForest forest(function, reverse_postorder, dominators);
+		// (the error blocks that jump to themselves don't count)
+		bool has_loop = std::any_of(forest.loops.begin(), forest.loops.end(), [&](const analysis::LoopForest::Loop &loop) {
+			SmallVec<BlockId, 4> successors = function.get_successors(loop.header);
+			return loop.blocks.size() > 1 || successors.size() > 1;
+		});
+		if (!has_loop) return 0;
+		analysis::ValueRanges ranges(function, reverse_postorder, forest);
+		if (!ranges.has_converged()) return 0;
+
+		// the guards whose condition can't be nonzero go, and so do the
+		// checks that can't fail among the ones that a guard adds up, even
+		// if the others can
+		Vec<InstId> safe_guards;
+		Vec<InstId> safe_checks;
+		for (BlockId block : reverse_postorder) {
+			analysis::ValueRanges::State state = ranges.get_entry_state(block);
+			if (!state.is_reachable) continue;
+			for (InstId inst : function.insts_of(block)) {
+				const Instruction &instruction = function.inst(inst);
+				const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value);
+				if (guard && ranges.is_zero(state, guard->condition)) {
+					safe_guards.push_back(inst);
+				}
+				ranges.transfer(state, inst);
+				const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+				LocalVar *dest = get_defined_var(instruction);
+				if (bin_op && dest && is_comparison(bin_op->op) && ranges.is_zero(state, Operand(dest))) {
+					safe_checks.push_back(inst);
+				}
+			}
+		}
+		for (InstId inst : safe_guards) {
+			function.erase_inst(inst);
+		}
+		for (InstId inst : safe_checks) {
+			Opt<Place> destination = function.inst(inst).destination;
+			function.replace_inst(inst, mv(destination), Operand(Int64Constant { 0 }));
+		}
+		return safe_checks.size();
+	}
+}
@@ -0,0 +1,97 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using utils::BitSet;
+
+	static bool is_same_type(const Type &a, const Type &b) {
+		if (a.type.index() != b.type.index()) return false;
+		if (const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&a.type)) {
+			return array_type->num_dimensions == std::get<Type::ArrayType>(b.type).num_dimensions;
+		}
+		return true;
+	}
+
+	size_t coalesce_temporaries(FunctionDef &function) {
+		// only the anonymous variables that hir_to_mir makes for
+		// intermediate values are merged; user variables and the named
+		// compiler variables keep their identity
+		Vec<LocalVar *> temps;
+		for (const Uptr<LocalVar> &var : function.local_vars) {
+			bool is_parameter = std::find(function.parameter_vars.begin(), function.parameter_vars.end(), var.get()) != function.parameter_vars.end();
+			if (!var->is_user_declared && var->name.empty() && !is_parameter && !var->defs.empty()) {
+				temps.push_back(var.get());
+			}
+		}
+		if (temps.size() < 2) return 0;
+		analysis::LiveVariables liveness(function, temps);
+
+		// two temporaries interfere if one is assigned while the other is
+		// live, unless it's assigned a copy of the other (in which case
+		// they hold the same value anyway)
+		Vec<Vec<uint32_t>> interferences(temps.size());
+		for (BlockId block : analysis::compute_reverse_postorder(function)) {
+			BitSet live = liveness.get_live_out(block);
+			for (InstId inst = function.block(block).last_inst; inst != no_inst; inst = function.prev_inst(inst)) {
+				const Instruction &instruction = function.inst(inst);
+				uint32_t dest = liveness.index_of(get_defined_var(instruction));
+				if (dest != UINT32_MAX) {
+					uint32_t source = UINT32_MAX;
+					if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+						if (LocalVar *const *var = std::get_if<LocalVar *>(&operand->value)) {
+							source = liveness.index_of(*var);
+						}
+					}
+					live.for_each([&](size_t other) {
+						if (other != dest && other != source) {
+							interferences[dest].push_back(other);
+							interferences[other].push_back(dest);
+						}
+					});
+				}
+				liveness.step_backward(live, inst);
+			}
+		}
+
+		// greedily put each temporary in the first group of the same type
+		// that it doesn't interfere with. each group becomes one variable.
+		struct Group {
+			LocalVar *representative;
+			BitSet interferences;
+		};
+		Vec<Group> groups;
+		size_t num_merged = 0;
+		for (uint32_t temp = 0; temp < temps.size(); ++temp) {
+			Group *group = nullptr;
+			for (Group &candidate : groups) {
+				if (is_same_type(candidate.representative->type, temps[temp]->type) && !candidate.interferences.test(temp)) {
+					group = &candidate;
+					break;
+				}
+			}
+			if (group) {
+				function.replace_var(temps[temp], group->representative);
+				num_merged += 1;
+			} else {
+				groups.push_back({ temps[temp], BitSet(temps.size(), false) });
+				group = &groups.back();
+			}
+			for (uint32_t other : interferences[temp]) {
+				group->interferences.set(other);
+			}
+		}
+
+		// merging a copy's source and destination leaves it copying a
+		// variable to itself
+		for (InstId inst : function.all_insts()) {
+			const Instruction &instruction = function.inst(inst);
+			const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value);
+			LocalVar *dest = get_defined_var(instruction);
+			if (dest && operand && *operand == Operand(dest)) {
+				function.erase_inst(inst);
+			}
+		}
+		return num_merged;
+	}
+}
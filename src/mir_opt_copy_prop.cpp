@@ -0,0 +1,171 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+
+namespace mir::opt {
+	// Replaces reads of a variable with reads of the variable it was copied
+	// from, wherever that variable still holds the value it was copied
+	// with. Over the names that SSA form would give the values (see
+	// analysis::SsaNames), a copy `dest <- source` makes dest's new name
+	// stand for the name that source had, so a read of dest can read source
+	// instead wherever source's name is still that one. A phi is a copy
+	// too when every edge brings in a copy of the same variable, made with
+	// the name that variable has at the end of the edge. Chains of copies
+	// are followed back to the original through the names, walking the
+	// dominator tree once, so no dataflow over the whole function is
+	// needed. A phi whose operands are all one name or the phi itself, as
+	// at a loop that doesn't assign the variable, stands for that name.
+	// Copies of constants are left to propagate_constants.
+	class CopyPropagator {
+		// the variable and name that a name was copied from
+		struct CopySource {
+			LocalVar *var;
+			uint32_t name;
+		};
+
+		FunctionDef &function;
+		analysis::DominatorTree dominators;
+		analysis::SsaNames names;
+		Vec<CopySource> copy_sources; // by name, with a null var if the name isn't a copy
+		Vec<uint32_t> same_names; // by name, the name that each stands for
+		Vec<InstId> def_insts; // by name, for the names of instructions
+
+		public:
+
+		explicit CopyPropagator(FunctionDef &function) :
+			function { function },
+			dominators(function, analysis::compute_reverse_postorder(function)),
+			names(function, this->dominators),
+			copy_sources(this->names.num_names, CopySource { nullptr, 0 }),
+			same_names(this->names.num_names),
+			def_insts(this->names.num_names, no_inst)
+		{
+			for (uint32_t name = 0; name < this->names.num_names; ++name) {
+				this->same_names[name] = name;
+			}
+			for (InstId inst : function.all_insts()) {
+				const Instruction &instruction = function.inst(inst);
+				uint32_t name = this->names.def_names[inst];
+				if (name == analysis::SsaNames::no_name) continue;
+				this->def_insts[name] = inst;
+				const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value);
+				if (!operand) continue;
+				LocalVar *const *source = std::get_if<LocalVar *>(&operand->value);
+				if (!source || *source == get_defined_var(instruction)) continue;
+				// the copy's only read
+				this->copy_sources[name] = { *source, this->names.inst_reads[inst][0].name };
+			}
+			// the operands of a phi come before it, other than through back
+			// edges, whose phis are taken not to be copies
+			for (BlockId block : this->dominators.get_preorder()) {
+				Map<const LocalVar *, const analysis::SsaNames::Phi *> block_phis;
+				for (uint32_t phi : this->names.block_phis[block]) {
+					block_phis.insert({ this->names.phis[phi].var, &this->names.phis[phi] });
+					this->same_names[this->names.phis[phi].name] = this->get_same_name(this->names.phis[phi]);
+				}
+				for (uint32_t phi : this->names.block_phis[block]) {
+					uint32_t name = this->names.phis[phi].name;
+					if (this->same_names[name] == name) this->copy_sources[name] = this->get_phi_source(this->names.phis[phi], block_phis);
+				}
+			}
+		}
+
+		// returns the number of reads rewritten
+		size_t rewrite() {
+			size_t num_replaced = 0;
+			BlockId block = no_block;
+			auto substitute = [&](LocalVar *&var) {
+				// the last variable along the chain of copies that still
+				// holds the value
+				LocalVar *origin = var;
+				for (CopySource source = this->copy_sources[this->same_names[this->names.get_current_name(var)]]; source.var; source = this->copy_sources[this->same_names[source.name]]) {
+					if (this->holds(block, source)) origin = source.var;
+				}
+				if (origin == var) return;
+				var = origin;
+				num_replaced += 1;
+			};
+			auto substitute_operand = [&](Operand &operand) {
+				if (LocalVar **var = std::get_if<LocalVar *>(&operand.value)) {
+					substitute(*var);
+				}
+			};
+
+			this->names.walk([&](InstId inst) {
+				block = this->function.parent_of(inst);
+				size_t num_replaced_before = num_replaced;
+				Instruction new_inst = this->function.inst(inst);
+				visit_reads(new_inst, substitute_operand, substitute);
+				if (num_replaced != num_replaced_before) {
+					this->function.replace_inst(inst, mv(new_inst.destination), mv(new_inst.rvalue));
+				}
+			}, [&](BlockId terminator_block) {
+				block = terminator_block;
+				BasicBlock::Terminator terminator = this->function.block(block).terminator;
+				size_t num_replaced_before = num_replaced;
+				if (BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&terminator)) {
+					substitute_operand(term->return_value);
+				} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+					substitute_operand(term->condition);
+				}
+				if (num_replaced != num_replaced_before) {
+					this->function.set_terminator(block, terminator);
+				}
+			});
+			return num_replaced;
+		}
+
+		private:
+
+		// whether the variable still has the name in the block that walk()
+		// is at
+		bool holds(BlockId block, const CopySource &source) const {
+			if (this->same_names[this->names.get_current_name(source.var)] != this->same_names[source.name]) return false;
+			if (!this->names.may_lack_phi(source.var, block)) return true;
+			// otherwise the current name is only right after the block
+			// assigns it
+			InstId def = this->def_insts[source.name];
+			return def != no_inst && this->function.parent_of(def) == block;
+		}
+
+		// the phi's only operand other than itself, or the phi if it has
+		// several
+		uint32_t get_same_name(const analysis::SsaNames::Phi &phi) const {
+			uint32_t same_name = phi.name;
+			for (const auto &[edge, name] : phi.incoming_names) {
+				// the names through back edges aren't resolved yet
+				uint32_t incoming = this->same_names[name];
+				if (incoming == phi.name || incoming == same_name) continue;
+				if (same_name != phi.name) return phi.name;
+				same_name = incoming;
+			}
+			return same_name;
+		}
+
+		// `block_phis` has the phis in the phi's block by variable
+		CopySource get_phi_source(const analysis::SsaNames::Phi &phi, const Map<const LocalVar *, const analysis::SsaNames::Phi *> &block_phis) const {
+			static constexpr CopySource not_copy { nullptr, 0 };
+			const CopySource &first_source = this->copy_sources[this->same_names[phi.incoming_names[0].second]];
+			if (!first_source.var) return not_copy;
+			if (this->names.may_lack_phi(first_source.var, phi.block)) return not_copy;
+			// the source's name in the block, from its own phi there if it
+			// has one and otherwise the same along every edge
+			auto it = block_phis.find(first_source.var);
+			const analysis::SsaNames::Phi *source_phi = it == block_phis.end() ? nullptr : it->second;
+			CopySource result { first_source.var, this->same_names[source_phi ? source_phi->name : first_source.name] };
+			for (size_t i = 0; i < phi.incoming_names.size(); ++i) {
+				uint32_t name = this->same_names[phi.incoming_names[i].second];
+				uint32_t source_name = this->same_names[source_phi ? source_phi->incoming_names[i].second : result.name];
+				// around a loop that assigns neither variable
+				if (name == phi.name && source_name == result.name) continue;
+				const CopySource &source = this->copy_sources[name];
+				if (source.var != result.var || this->same_names[source.name] != source_name) return not_copy;
+			}
+			return result;
+		}
+	};
+
+	size_t propagate_copies(FunctionDef &function) {
+		CopyPropagator propagator(function);
+		return propagator.rewrite();
+	}
+}
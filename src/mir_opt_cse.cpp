@@ -0,0 +1,274 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+#include <tuple>
+
+namespace mir::opt {
+	// a pure computation, normalized so that computations that always give
+	// the same result compare equal
+	struct ExprKey {
+		enum struct Kind : uint8_t {
+			copy,
+			binary_operation,
+			array_length,
+			tuple_length,
+			encode // the `x << 1` then `+ 1` pair that hir_to_mir emits
+		};
+		Kind kind;
+		Operator op;
+		Operand lhs;
+		Operand rhs;
+
+		static Pair<size_t, uint64_t> operand_order(const Operand &operand) {
+			return std::visit([&](const auto &value) -> Pair<size_t, uint64_t> {
+				using T = std::decay_t<decltype(value)>;
+				if constexpr (std::is_same_v<T, Int64Constant>) {
+					return { operand.value.index(), static_cast<uint64_t>(value.value) };
+				} else if constexpr (std::is_same_v<T, LocalVar *>) {
+					return { operand.value.index(), reinterpret_cast<uintptr_t>(value) };
+				} else {
+					return { operand.value.index(), reinterpret_cast<uintptr_t>(value.value) };
+				}
+			}, operand.value);
+		}
+	};
+
+	static bool reads_var(const Operand &operand, const LocalVar *var) {
+		LocalVar *const *read_var = std::get_if<LocalVar *>(&operand.value);
+		return read_var && *read_var == var;
+	}
+
+	// the computation that the instruction assigns to its destination, if
+	// it is pure and doesn't read the variable it overwrites
+	static Opt<ExprKey> get_expr_key(const FunctionDef &function, InstId inst) {
+		const Instruction &instruction = function.inst(inst);
+		LocalVar *dest = get_defined_var(instruction);
+		if (!dest) return {};
+		const Int64Constant unused { 0 };
+
+		if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+			if (reads_var(*operand, dest)) return {};
+			return ExprKey { ExprKey::Kind::copy, Operator::eq, *operand, unused };
+		} else if (const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value)) {
+			// `dest <- dest + 1` right after `dest <- x << 1` leaves dest
+			// holding x encoded
+			if (bin_op->op == Operator::plus && reads_var(bin_op->lhs, dest) && bin_op->rhs == Operand(Int64Constant { 1 })) {
+				InstId prev = function.prev_inst(inst);
+				if (prev != no_inst && get_defined_var(function.inst(prev)) == dest) {
+					const BinaryOperation *shift = std::get_if<BinaryOperation>(&function.inst(prev).rvalue.value);
+					if (shift && shift->op == Operator::lshift && shift->rhs == Operand(Int64Constant { 1 }) && !reads_var(shift->lhs, dest)) {
+						return ExprKey { ExprKey::Kind::encode, Operator::lshift, shift->lhs, unused };
+					}
+				}
+			}
+			if (reads_var(bin_op->lhs, dest) || reads_var(bin_op->rhs, dest)) return {};
+
+			// turn the comparisons around so that `a > b` matches `b < a`.
+			// symmetric operators get their operands in a fixed order once
+			// they are named (see ValueKey).
+			Operator op = bin_op->op;
+			Operand lhs = bin_op->lhs;
+			Operand rhs = bin_op->rhs;
+			if (op == Operator::gt || op == Operator::ge) {
+				op = op == Operator::gt ? Operator::lt : Operator::le;
+				std::swap(lhs, rhs);
+			}
+			return ExprKey { ExprKey::Kind::binary_operation, op, lhs, rhs };
+		} else if (const LengthGetter *length_getter = std::get_if<LengthGetter>(&instruction.rvalue.value)) {
+			// the length of an array or tuple can't change until the variable
+			// holding it is reassigned
+			if (reads_var(length_getter->target, dest)) return {};
+			if (length_getter->dimension.has_value()) {
+				if (reads_var(*length_getter->dimension, dest)) return {};
+				return ExprKey { ExprKey::Kind::array_length, Operator::eq, length_getter->target, *length_getter->dimension };
+			}
+			return ExprKey { ExprKey::Kind::tuple_length, Operator::eq, length_getter->target, unused };
+		}
+		return {};
+	}
+
+	static bool is_symmetric(Operator op) {
+		return op == Operator::plus || op == Operator::times || op == Operator::eq || op == Operator::bitwise_and;
+	}
+
+	// Finds computations whose result is already held by some variable.
+	// Since the MIR isn't in SSA form, a dominating computation isn't
+	// enough on its own: the variable holding its result and the variables
+	// it read must also not have been reassigned since. So the computations
+	// are compared by the names that SSA form would give the values they
+	// read (see analysis::SsaNames), and a variable holds a result as long
+	// as its current name is the one its computation gave it. The results
+	// are kept in a table scoped to the dominator tree, as the names are
+	// walked.
+	class CommonSubexpressionEliminator {
+		// an ExprKey with its variables replaced by the names of their
+		// values
+		struct ValueKey {
+			ExprKey::Kind kind;
+			Operator op;
+			Pair<size_t, uint64_t> lhs;
+			Pair<size_t, uint64_t> rhs;
+
+			bool operator<(const ValueKey &other) const {
+				return std::tie(this->kind, this->op, this->lhs, this->rhs) < std::tie(other.kind, other.op, other.lhs, other.rhs);
+			}
+			bool operator==(const ValueKey &other) const {
+				return std::tie(this->kind, this->op, this->lhs, this->rhs) == std::tie(other.kind, other.op, other.lhs, other.rhs);
+			}
+		};
+		// a variable holding a computation's result, with the name it got
+		// from it
+		struct Holder {
+			LocalVar *var;
+			uint32_t name;
+			BlockId block;
+		};
+		// the blocks on the path from the entry block to the one being
+		// walked, each with the table entries it overwrote
+		struct Scope {
+			BlockId block;
+			Vec<Pair<ValueKey, Opt<Holder>>> overwritten;
+		};
+
+		FunctionDef &function;
+		analysis::DominatorTree dominators;
+		analysis::SsaNames names;
+		Vec<Opt<ExprKey>> inst_keys;
+		Vec<Opt<Pair<ValueKey, BlockId>>> name_keys; // the computation whose result each name is, and its block
+		Map<ValueKey, Holder> holders;
+		Vec<Scope> scopes;
+
+		public:
+
+		explicit CommonSubexpressionEliminator(FunctionDef &function) :
+			function { function },
+			dominators(function, analysis::compute_reverse_postorder(function)),
+			names(function, this->dominators),
+			inst_keys(function.instructions.size()),
+			name_keys(this->names.num_names)
+		{
+			// before anything is rewritten, since an encode's key depends on
+			// the shift before it
+			for (InstId inst : function.all_insts()) {
+				this->inst_keys[inst] = get_expr_key(function, inst);
+			}
+		}
+
+		// replaces each computation whose result is available in some
+		// variable with a copy of that variable (or removes it if it's the
+		// destination itself). returns the number of instructions changed.
+		size_t rewrite() {
+			size_t num_changes = 0;
+			InstId prev = no_inst;
+			this->names.walk([&](InstId inst) {
+				InstId shift = prev;
+				prev = inst;
+				BlockId block = this->function.parent_of(inst);
+				this->enter(block);
+				if (!this->inst_keys[inst].has_value()) return;
+				ValueKey key = this->get_value_key(*this->inst_keys[inst]);
+				LocalVar *dest = get_defined_var(this->function.inst(inst));
+				Holder holder { dest, this->names.def_names[inst], block };
+				uint32_t dest_name = this->names.get_current_name(dest);
+				this->name_keys[holder.name] = { key, block };
+				auto it = this->holders.find(key);
+				bool is_held = it != this->holders.end() && this->holds(it->second, block);
+				// dest may hold the result already without being the
+				// variable that the table has for it
+				const Opt<Pair<ValueKey, BlockId>> &dest_key = this->name_keys[dest_name];
+				if (dest_key.has_value() && dest_key->first == key && this->holds({ dest, dest_name, dest_key->second }, block)) {
+					// under its new name from here on
+					if (!is_held || it->second.var == dest) this->set_holder(key, holder);
+					num_changes += this->replace_with_copy(inst, shift, dest, dest);
+				} else if (is_held) {
+					num_changes += this->replace_with_copy(inst, shift, dest, it->second.var);
+				} else {
+					this->set_holder(key, holder);
+				}
+			}, [&](BlockId) {
+				prev = no_inst;
+			});
+			return num_changes;
+		}
+
+		private:
+
+		// leaves the blocks that don't dominate the block, which includes
+		// the blocks without successors that the walk visits at their guard
+		void enter(BlockId block) {
+			while (!this->scopes.empty() && !this->dominators.dominates(this->scopes.back().block, block)) {
+				Vec<Pair<ValueKey, Opt<Holder>>> &overwritten = this->scopes.back().overwritten;
+				for (auto it = overwritten.rbegin(); it != overwritten.rend(); ++it) {
+					if (it->second.has_value()) {
+						this->holders.insert_or_assign(it->first, *it->second);
+					} else {
+						this->holders.erase(it->first);
+					}
+				}
+				this->scopes.pop_back();
+			}
+			if (this->scopes.empty() || this->scopes.back().block != block) this->scopes.push_back({ block, {} });
+		}
+
+		void set_holder(const ValueKey &key, Holder holder) {
+			auto [it, is_new] = this->holders.insert({ key, holder });
+			this->scopes.back().overwritten.push_back({ key, is_new ? Opt<Holder>() : Opt<Holder>(it->second) });
+			it->second = holder;
+		}
+
+		// whether the variable still holds the result in the block that the
+		// walk is at
+		bool holds(const Holder &holder, BlockId block) const {
+			if (this->names.get_current_name(holder.var) != holder.name) return false;
+			// otherwise the current name is only right after the block
+			// assigns it
+			return !this->names.may_lack_phi(holder.var, block) || holder.block == block;
+		}
+
+		ValueKey get_value_key(const ExprKey &key) const {
+			auto name_of = [&](const Operand &operand) {
+				Pair<size_t, uint64_t> value = ExprKey::operand_order(operand);
+				// every variable's value on entry is name 0, so those are
+				// told apart by the variable, under an index of their own
+				if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value); var && this->names.get_current_name(*var) != 0) {
+					value = { std::variant_size_v<decltype(operand.value)>, this->names.get_current_name(*var) };
+				}
+				return value;
+			};
+			ValueKey value_key { key.kind, key.op, name_of(key.lhs), name_of(key.rhs) };
+			if (key.kind == ExprKey::Kind::binary_operation && is_symmetric(key.op) && value_key.rhs < value_key.lhs) {
+				std::swap(value_key.lhs, value_key.rhs);
+			}
+			return value_key;
+		}
+
+		// `shift` is the instruction that came before this one, in case this
+		// is the second half of an encode
+		size_t replace_with_copy(InstId inst, InstId shift, LocalVar *dest, LocalVar *holder) {
+			if (this->inst_keys[inst]->kind == ExprKey::Kind::encode) {
+				// the shift is part of the same computation, so it goes too
+				// (unless it was already found redundant on its own). the
+				// shift itself overwrites dest, so dest can't be the holder.
+				this->function.replace_inst(inst, Place(dest), Operand(holder));
+				if (this->function.parent_of(shift) != no_block) {
+					this->function.erase_inst(shift);
+				}
+				return 2;
+			}
+			if (holder == dest) {
+				this->function.erase_inst(inst);
+				return 1;
+			}
+			if (std::holds_alternative<Operand>(this->function.inst(inst).rvalue.value)) {
+				// a copy of a copy is no better than the original
+				return 0;
+			}
+			this->function.replace_inst(inst, Place(dest), Operand(holder));
+			return 1;
+		}
+	};
+
+	size_t eliminate_common_subexpressions(FunctionDef &function) {
+		CommonSubexpressionEliminator eliminator(function);
+		return eliminator.rewrite();
+	}
+}
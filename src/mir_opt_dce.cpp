@@ -0,0 +1,57 @@
+#include "mir_opt.h"
+
+namespace mir::opt {
+	static bool is_dead(const FunctionDef &function, InstId inst) {
+		const Instruction &x = function.inst(inst);
+		if (has_side_effects(x)) {
+			return false;
+		}
+		if (!x.destination.has_value()) {
+			return true;
+		}
+		LocalVar *defined_var = get_defined_var(x);
+		return defined_var && defined_var->uses.empty();
+	}
+
+	size_t eliminate_dead_code(FunctionDef &function) {
+		Vec<InstId> worklist;
+		for (InstId inst : function.all_insts()) {
+			if (is_dead(function, inst)) {
+				worklist.push_back(inst);
+			}
+		}
+
+		size_t num_erased = 0;
+		SmallVec<LocalVar *, 8> read_vars;
+		while (!worklist.empty()) {
+			InstId inst = worklist.back();
+			worklist.pop_back();
+			// an instruction can be queued more than once
+			if (function.parent_of(inst) == no_block || !is_dead(function, inst)) {
+				continue;
+			}
+
+			read_vars.clear();
+			visit_reads(
+				function.inst(inst),
+				[&](const Operand &operand) {
+					if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+						read_vars.push_back(*var);
+					}
+				},
+				[&](LocalVar *const &target) { read_vars.push_back(target); }
+			);
+			function.erase_inst(inst);
+			num_erased += 1;
+
+			// the defs of anything that this was the last reader of are now
+			// dead too
+			for (LocalVar *var : read_vars) {
+				if (var->uses.empty()) {
+					worklist.insert(worklist.end(), var->defs.begin(), var->defs.end());
+				}
+			}
+		}
+		return num_erased;
+	}
+}
@@ -0,0 +1,126 @@
+#include "mir_opt.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using analysis::visit_code_values;
+
+	size_t remove_unreachable_functions(Program &program) {
+		// every function that main calls or that becomes a value somewhere
+		// reachable, since a value may be called from anywhere
+		Set<const FunctionDef *> reachable;
+		Vec<const FunctionDef *> worklist;
+		auto reach = [&](const FunctionDef *function) {
+			if (reachable.insert(function).second) worklist.push_back(function);
+		};
+		for (const Uptr<FunctionDef> &function : program.function_defs) {
+			if (function->user_given_name == "main") reach(function.get());
+		}
+		while (!worklist.empty()) {
+			const FunctionDef *function = worklist.back();
+			worklist.pop_back();
+			for (InstId inst : function->all_insts()) {
+				const FunctionCall *call = std::get_if<FunctionCall>(&function->inst(inst).rvalue.value);
+				if (!call) continue;
+				if (const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value)) reach(callee->value);
+			}
+			visit_code_values(*function, [&](const Operand &operand) {
+				reach(std::get<CodeConstant>(operand.value).value);
+			});
+		}
+
+		size_t num_functions = program.function_defs.size();
+		program.function_defs.erase(std::remove_if(program.function_defs.begin(), program.function_defs.end(), [&](const Uptr<FunctionDef> &function) {
+			return !reachable.count(function.get());
+		}), program.function_defs.end());
+		return num_functions - program.function_defs.size();
+	}
+
+	// Removes the parameters that a function never reads and the return
+	// value of a function whose callers all ignore it, along with the
+	// arguments and destinations at the call sites. Only functions that
+	// are never used as values qualify, since a call through a variable
+	// can't be updated; main keeps its signature regardless.
+	class SignatureShrinker {
+		Program &program;
+		Map<const FunctionDef *, Vec<Pair<FunctionDef *, InstId>>> call_sites;
+		Set<const FunctionDef *> escaping_functions;
+
+		public:
+
+		explicit SignatureShrinker(Program &program) : program { program } {
+			for (const Uptr<FunctionDef> &function : program.function_defs) {
+				for (InstId inst : function->all_insts()) {
+					const FunctionCall *call = std::get_if<FunctionCall>(&function->inst(inst).rvalue.value);
+					if (!call) continue;
+					if (const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value)) {
+						this->call_sites[callee->value].push_back({ function.get(), inst });
+					}
+				}
+				visit_code_values(*function, [&](const Operand &operand) {
+					this->escaping_functions.insert(std::get<CodeConstant>(operand.value).value);
+				});
+			}
+		}
+
+		// returns the number of parameters and return values removed
+		size_t shrink() {
+			size_t num_removed = 0;
+			for (const Uptr<FunctionDef> &function : this->program.function_defs) {
+				if (function->user_given_name == "main" || this->escaping_functions.count(function.get())) continue;
+				num_removed += this->remove_unused_parameters(*function);
+				if (this->remove_unused_return_value(*function)) num_removed += 1;
+			}
+			return num_removed;
+		}
+
+		private:
+
+		const Vec<Pair<FunctionDef *, InstId>> &get_call_sites(const FunctionDef &function) {
+			return this->call_sites[&function];
+		}
+
+		size_t remove_unused_parameters(FunctionDef &function) {
+			size_t num_removed = 0;
+			// backwards, so that the indices of the remaining arguments
+			// stay valid
+			for (size_t i = function.parameter_vars.size(); i-- > 0;) {
+				// a parameter that is only assigned becomes an ordinary
+				// local variable
+				if (!function.parameter_vars[i]->uses.empty()) continue;
+				function.parameter_vars.erase(function.parameter_vars.begin() + i);
+				for (const auto &[caller, inst] : this->get_call_sites(function)) {
+					Instruction instruction = caller->inst(inst);
+					FunctionCall &call = std::get<FunctionCall>(instruction.rvalue.value);
+					call.arguments.erase(call.arguments.begin() + i);
+					caller->replace_inst(inst, mv(instruction.destination), mv(instruction.rvalue));
+				}
+				num_removed += 1;
+			}
+			return num_removed;
+		}
+
+		bool remove_unused_return_value(FunctionDef &function) {
+			if (std::holds_alternative<Type::VoidType>(function.return_type.type)) return false;
+			for (const auto &[caller, inst] : this->get_call_sites(function)) {
+				const Opt<Place> &destination = caller->inst(inst).destination;
+				if (destination.has_value() && (!destination->indices.empty() || !destination->target->uses.empty())) return false;
+			}
+
+			function.return_type = Type { Type::VoidType {} };
+			for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+				if (!function.block(block).is_erased && std::holds_alternative<BasicBlock::ReturnVal>(function.block(block).terminator)) {
+					function.set_terminator(block, BasicBlock::ReturnVoid {});
+				}
+			}
+			for (const auto &[caller, inst] : this->get_call_sites(function)) {
+				caller->replace_inst(inst, {}, caller->inst(inst).rvalue);
+			}
+			return true;
+		}
+	};
+
+	size_t remove_unused_parameters(Program &program) {
+		SignatureShrinker shrinker(program);
+		return shrinker.shrink();
+	}
+}
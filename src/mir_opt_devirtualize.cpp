@@ -0,0 +1,186 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+#include <algorithm>
+
+namespace mir::opt {
+	// calls through a variable that may hold more functions than this are
+	// left alone
+	constexpr size_t max_guarded_targets = 3;
+
+	static bool is_same_type(const Type &a, const Type &b) {
+		if (a.type.index() != b.type.index()) return false;
+		if (const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&a.type)) {
+			return array_type->num_dimensions == std::get<Type::ArrayType>(b.type).num_dimensions;
+		}
+		return true;
+	}
+
+	// whether the argument can be passed as the parameter. a constant 0 is
+	// the default value of every reference type, while any other constant
+	// is a number
+	static bool is_passable(const Operand &argument, const LocalVar *parameter) {
+		const Operand::Variant *x = &argument.value;
+		if (LocalVar *const *var = std::get_if<LocalVar *>(x)) {
+			return is_same_type((*var)->type, parameter->type);
+		} else if (const Int64Constant *num = std::get_if<Int64Constant>(x)) {
+			const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&parameter->type.type);
+			return (array_type && array_type->num_dimensions == 0) || num->value == 0;
+		} else {
+			return std::holds_alternative<Type::CodeType>(parameter->type.type);
+		}
+	}
+
+	// whether the call's arguments fit the target's parameters. external
+	// functions only say how many parameters they take
+	static bool is_callable_with(const Operand &target, const FunctionCall &call) {
+		if (const CodeConstant *code = std::get_if<CodeConstant>(&target.value)) {
+			const Vec<LocalVar *> &parameters = code->value->parameter_vars;
+			if (parameters.size() != call.arguments.size()) return false;
+			for (size_t i = 0; i < parameters.size(); ++i) {
+				if (!is_passable(call.arguments[i], parameters[i])) return false;
+			}
+			return true;
+		}
+		return static_cast<size_t>(std::get<ExtCodeConstant>(target.value).value->num_parameters) == call.arguments.size();
+	}
+
+	// Rewrites calls through code-typed variables into direct calls, using
+	// what CodeTargets knows about the functions each variable may hold. A
+	// call through a variable that can only hold one function calls that
+	// function. One through a variable that can hold a few branches on
+	// which of them it holds and calls that one directly.
+	//
+	// CodeTargets doesn't follow the order of the assignments, so a
+	// variable's functions may include ones that a given call can't be
+	// reaching, whose parameters don't fit its arguments. Calling such a
+	// function directly would pass values of the wrong type (which later
+	// passes are free to read as the wrong type, e.g. by hoisting the
+	// length of a number out of a loop), and leaving it out would be wrong
+	// whenever the call does reach it. So if any of the functions don't
+	// fit, the call stays indirect.
+	//
+	// The IR can't compare functions, so for the branches each variable
+	// whose functions are known gets an int64 tag that says which one it
+	// holds: it's assigned the function's number (counting from 1) next to
+	// every assignment of a function name, 0 next to every assignment of
+	// the default value, and the other variable's tag next to every copy.
+	class Devirtualizer {
+		FunctionDef &function;
+		analysis::CodeTargets code_targets;
+		Map<const LocalVar *, LocalVar *> tags;
+		Vec<Operand> tagged_targets; // a target's number is its index plus 1
+
+		public:
+
+		explicit Devirtualizer(FunctionDef &function) :
+			function { function }, code_targets(function)
+		{}
+
+		// returns the number of calls rewritten
+		size_t devirtualize() {
+			Vec<Pair<InstId, Vec<Operand>>> calls;
+			for (InstId inst : this->function.all_insts()) {
+				const FunctionCall *call = std::get_if<FunctionCall>(&this->function.inst(inst).rvalue.value);
+				if (!call) continue;
+				LocalVar *const *callee = std::get_if<LocalVar *>(&call->callee.value);
+				if (!callee) continue;
+				const Vec<Operand> *targets = this->code_targets.get_targets(*callee);
+				if (!targets || targets->size() > max_guarded_targets) continue;
+				bool is_callable = std::all_of(targets->begin(), targets->end(), [&](const Operand &target) {
+					return is_callable_with(target, *call);
+				});
+				if (is_callable) calls.push_back({ inst, *targets });
+			}
+			for (const auto &[inst, targets] : calls) {
+				if (targets.size() == 1) {
+					Instruction instruction = this->function.inst(inst);
+					std::get<FunctionCall>(instruction.rvalue.value).callee = targets.front();
+					this->function.replace_inst(inst, mv(instruction.destination), mv(instruction.rvalue));
+				} else {
+					this->emit_guarded_calls(inst, targets);
+				}
+			}
+			return calls.size();
+		}
+
+		private:
+
+		void emit_guarded_calls(InstId call_inst, const Vec<Operand> &targets) {
+			this->create_tags();
+			BlockId block = this->function.parent_of(call_inst);
+			Instruction instruction = this->function.inst(call_inst);
+			const FunctionCall &call = std::get<FunctionCall>(instruction.rvalue.value);
+			LocalVar *tag = this->tags.at(std::get<LocalVar *>(call.callee.value));
+
+			// everything after the call moves to the continuation
+			BlockId continuation = this->function.create_block(false, "devirtreturn");
+			for (InstId inst = this->function.next_inst(call_inst); inst != no_inst;) {
+				InstId next = this->function.next_inst(inst);
+				this->function.move_inst(inst, continuation, no_inst);
+				inst = next;
+			}
+			this->function.set_terminator(continuation, this->function.block(block).terminator);
+			this->function.erase_inst(call_inst);
+
+			// the last function is called without a test, which also covers
+			// the call of a variable that still holds its default value
+			BlockId test_block = block;
+			for (size_t i = 0; i < targets.size(); ++i) {
+				BlockId call_block = this->function.create_block(false, "devirtcall");
+				FunctionCall direct_call = call;
+				direct_call.callee = targets[i];
+				this->function.append_inst(call_block, instruction.destination, mv(direct_call));
+				this->function.set_terminator(call_block, BasicBlock::Goto { continuation });
+				if (i + 1 == targets.size()) {
+					this->function.set_terminator(test_block, BasicBlock::Goto { call_block });
+					break;
+				}
+
+				LocalVar *is_target = this->function.create_local_var(false, "", tag->type);
+				this->function.append_inst(test_block, Place(is_target), BinaryOperation { Operand(tag), Operand(Int64Constant { this->get_number(targets[i]) }), Operator::eq });
+				BlockId next_test_block = this->function.create_block(false, "devirttest");
+				this->function.set_terminator(test_block, BasicBlock::Branch { Operand(is_target), call_block, next_test_block });
+				test_block = next_test_block;
+			}
+		}
+
+		int64_t get_number(const Operand &target) {
+			auto it = std::find(this->tagged_targets.begin(), this->tagged_targets.end(), target);
+			if (it != this->tagged_targets.end()) return it - this->tagged_targets.begin() + 1;
+			this->tagged_targets.push_back(target);
+			return this->tagged_targets.size();
+		}
+
+		void create_tags() {
+			if (!this->tags.empty()) return;
+			// collected first, since creating the tags adds to local_vars
+			Vec<LocalVar *> tagged_vars;
+			for (const Uptr<LocalVar> &var : this->function.local_vars) {
+				if (this->code_targets.get_targets(var.get())) tagged_vars.push_back(var.get());
+			}
+			for (LocalVar *var : tagged_vars) {
+				this->tags[var] = this->function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+			}
+			for (LocalVar *var : tagged_vars) {
+				// copied, since inserting changes the defs
+				Vec<InstId> defs = var->defs;
+				for (InstId def : defs) {
+					// known targets mean that every def copies an operand
+					Operand source = std::get<Operand>(this->function.inst(def).rvalue.value);
+					Operand tag_value = Int64Constant { 0 };
+					if (LocalVar *const *source_var = std::get_if<LocalVar *>(&source.value)) {
+						tag_value = this->tags.at(*source_var);
+					} else if (!std::holds_alternative<Int64Constant>(source.value)) {
+						tag_value = Int64Constant { this->get_number(source) };
+					}
+					this->function.insert_inst(this->function.parent_of(def), this->function.next_inst(def), Place(this->tags.at(var)), tag_value);
+				}
+			}
+		}
+	};
+
+	size_t devirtualize_calls(FunctionDef &function) {
+		Devirtualizer devirtualizer(function);
+		return devirtualizer.devirtualize();
+	}
+}
@@ -0,0 +1,44 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+
+namespace mir::opt {
+	using utils::BitSet;
+
+	size_t eliminate_dead_stores(FunctionDef &function) {
+		Vec<LocalVar *> vars;
+		for (const Uptr<LocalVar> &var : function.local_vars) {
+			if (!var->defs.empty()) vars.push_back(var.get());
+		}
+		Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(function);
+
+		// erasing a store can make the stores feeding it dead in turn, so
+		// repeat until nothing changes
+		size_t num_erased = 0;
+		while (true) {
+			analysis::LiveVariables liveness(function, vars);
+			size_t num_erased_this_round = 0;
+			for (BlockId block : reverse_postorder) {
+				BitSet live = liveness.get_live_out(block);
+				InstId inst = function.block(block).last_inst;
+				while (inst != no_inst) {
+					InstId prev = function.prev_inst(inst);
+					const Instruction &instruction = function.inst(inst);
+					LocalVar *dest = get_defined_var(instruction);
+					// guards are where the error blocks read %linenum and the
+					// like, so stores to those survive exactly when some
+					// check could still report them
+					if (dest && !has_side_effects(instruction) && !live.test(liveness.index_of(dest))) {
+						function.erase_inst(inst);
+						num_erased_this_round += 1;
+					} else {
+						liveness.step_backward(live, inst);
+					}
+					inst = prev;
+				}
+			}
+			if (num_erased_this_round == 0) break;
+			num_erased += num_erased_this_round;
+		}
+		return num_erased;
+	}
+}
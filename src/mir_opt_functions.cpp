@@ -0,0 +1,56 @@
+#include "mir_opt_functions.h"
+#include "mir_analysis.h"
+
+namespace mir::opt {
+	size_t get_function_size(const FunctionDef &function) {
+		size_t size = 0;
+		for (const InstLinks &links : function.inst_links) {
+			if (links.parent != no_block) size += 1;
+		}
+		for (const BasicBlock &block : function.basic_blocks) {
+			if (!block.is_erased) size += 1;
+		}
+		return size;
+	}
+
+	Vec<BlockId> copy_function_body(FunctionDef &dest, const FunctionDef &source, const std::function<LocalVar *(LocalVar *)> &map_var) {
+		Vec<BlockId> source_blocks = analysis::compute_reverse_postorder(source);
+		Vec<BlockId> copies(source.basic_blocks.size(), no_block);
+		for (BlockId block : source_blocks) {
+			const BasicBlock &bb = source.block(block);
+			copies[block] = dest.create_block(bb.user_labeled, bb.label_name);
+		}
+
+		auto map_operand = [&](Operand &operand) {
+			if (LocalVar **var = std::get_if<LocalVar *>(&operand.value)) *var = map_var(*var);
+		};
+		for (BlockId block : source_blocks) {
+			for (InstId inst : source.insts_of(block)) {
+				Instruction instruction = source.inst(inst);
+				visit_reads(instruction, map_operand, [&](LocalVar *&target) {
+					target = map_var(target);
+				});
+				if (instruction.destination.has_value() && instruction.destination->indices.empty()) {
+					instruction.destination->target = map_var(instruction.destination->target);
+				}
+				if (Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+					guard->target = copies[guard->target];
+				}
+				dest.append_inst(copies[block], mv(instruction.destination), mv(instruction.rvalue));
+			}
+
+			BasicBlock::Terminator terminator = source.block(block).terminator;
+			if (BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&terminator)) {
+				term->successor = copies[term->successor];
+			} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+				map_operand(term->condition);
+				term->then_block = copies[term->then_block];
+				term->else_block = copies[term->else_block];
+			} else if (BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&terminator)) {
+				map_operand(term->return_value);
+			}
+			dest.set_terminator(copies[block], mv(terminator));
+		}
+		return copies;
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "std_alias.h"
+#include "mir.h"
+#include <functional>
+
+// The plumbing that the passes which work across functions share:
+// measuring a function and copying its body into another one.
+namespace mir::opt {
+	using namespace std_alias;
+
+	// the number of instructions plus the number of blocks (for their
+	// terminators), as a measure of how much code the function is
+	size_t get_function_size(const FunctionDef &function);
+
+	// appends copies of the blocks of `source` that can be reached from
+	// its entry to `dest`, the copy of the entry first, with every
+	// variable replaced by map_var(variable). the jumps between the
+	// blocks go between the copies; returns are copied as they are.
+	// returns the copy of each block of `source` by BlockId, or no_block
+	// for the ones that weren't copied.
+	Vec<BlockId> copy_function_body(FunctionDef &dest, const FunctionDef &source, const std::function<LocalVar *(LocalVar *)> &map_var);
+}
@@ -0,0 +1,157 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+#include "mir_opt_functions.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	// a callee of at most this size is inlined wherever it's called from
+	constexpr size_t base_inline_size = 12;
+	// how much bigger a callee may be for each loop around the call, up to
+	// max_counted_depth loops
+	constexpr size_t inline_size_per_depth = 12;
+	constexpr uint32_t max_counted_depth = 3;
+	// how much bigger a callee may be for each constant argument, which
+	// constant propagation can then fold into the inlined body
+	constexpr size_t inline_size_per_constant = 6;
+	// the caller stops taking in callees once it's this big
+	constexpr size_t max_caller_size = 3000;
+
+	// Replaces calls to small functions with copies of their bodies. A
+	// call is inlined if the callee's size is below a limit that grows
+	// with the number of loops around the call and with the number of
+	// constant arguments, as long as the callee isn't recursive: a
+	// recursive callee would contain a call that could be inlined again,
+	// without end.
+	//
+	// The call's block is split at the call. The callee's parameters
+	// become local variables that are assigned the arguments before
+	// jumping to the copy of the callee's entry, and each return becomes
+	// an assignment of the returned value to the call's destination,
+	// followed by a jump to the rest of the split block.
+	class Inliner {
+		FunctionDef &function;
+		const analysis::CallGraph &call_graph;
+		Set<std::string> var_names; // of the named compiler variables
+
+		public:
+
+		Inliner(FunctionDef &function, const analysis::CallGraph &call_graph) :
+			function { function }, call_graph { call_graph }
+		{
+			for (const Uptr<LocalVar> &var : function.local_vars) {
+				if (!var->is_user_declared && !var->name.empty()) this->var_names.insert(var->name);
+			}
+		}
+
+		// returns the number of calls inlined
+		size_t inline_calls() {
+			Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(this->function);
+			analysis::DominatorTree dominators(this->function, reverse_postorder);
+			LoopForest forest(this->function, reverse_postorder, dominators);
+
+			// decided up front, so that the calls in inlined bodies aren't
+			// considered again: their callees have already had their own
+			// chance at inlining them
+			Vec<InstId> calls_to_inline;
+			for (BlockId block : reverse_postorder) {
+				uint32_t loop = forest.innermost_loops[block];
+				uint32_t depth = loop == LoopForest::no_loop ? 0 : forest.loops[loop].depth;
+				for (InstId inst : this->function.insts_of(block)) {
+					if (this->should_inline(inst, depth)) calls_to_inline.push_back(inst);
+				}
+			}
+
+			size_t size = get_function_size(this->function);
+			size_t num_inlined = 0;
+			for (InstId inst : calls_to_inline) {
+				const FunctionDef &callee = *std::get<CodeConstant>(std::get<FunctionCall>(this->function.inst(inst).rvalue.value).callee.value).value;
+				size_t callee_size = get_function_size(callee);
+				if (size + callee_size > max_caller_size) continue;
+				this->inline_call(inst, callee);
+				size += callee_size;
+				num_inlined += 1;
+			}
+			return num_inlined;
+		}
+
+		private:
+
+		bool should_inline(InstId inst, uint32_t depth) const {
+			const FunctionCall *call = std::get_if<FunctionCall>(&this->function.inst(inst).rvalue.value);
+			if (!call) return false;
+			const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value);
+			if (!callee || callee->value == &this->function || this->call_graph.is_recursive(callee->value)) return false;
+			if (call->arguments.size() != callee->value->parameter_vars.size()) return false;
+
+			size_t max_size = base_inline_size + inline_size_per_depth * std::min(depth, max_counted_depth);
+			for (const Operand &argument : call->arguments) {
+				if (!std::holds_alternative<LocalVar *>(argument.value)) max_size += inline_size_per_constant;
+			}
+			return get_function_size(*callee->value) <= max_size;
+		}
+
+		void inline_call(InstId call_inst, const FunctionDef &callee) {
+			BlockId block = this->function.parent_of(call_inst);
+			Opt<Place> destination = this->function.inst(call_inst).destination;
+			FunctionCall call = std::get<FunctionCall>(this->function.inst(call_inst).rvalue.value);
+
+			// everything after the call moves to the continuation
+			BlockId continuation = this->function.create_block(false, "inlinereturn");
+			for (InstId inst = this->function.next_inst(call_inst); inst != no_inst;) {
+				InstId next = this->function.next_inst(inst);
+				this->function.move_inst(inst, continuation, no_inst);
+				inst = next;
+			}
+			this->function.set_terminator(continuation, this->function.block(block).terminator);
+
+			Map<const LocalVar *, LocalVar *> var_copies;
+			auto map_var = [&](LocalVar *var) {
+				auto it = var_copies.find(var);
+				if (it != var_copies.end()) return it->second;
+				LocalVar *copy = this->function.create_local_var(var->is_user_declared, this->get_copy_name(*var, callee), var->type);
+				var_copies[var] = copy;
+				return copy;
+			};
+
+			// the parameters are assigned in the call's block, which then
+			// goes on to the callee's entry
+			for (size_t i = 0; i < call.arguments.size(); ++i) {
+				this->function.insert_inst(block, call_inst, Place(map_var(callee.parameter_vars[i])), call.arguments[i]);
+			}
+			this->function.erase_inst(call_inst);
+			Vec<BlockId> block_copies = copy_function_body(this->function, callee, map_var);
+			this->function.set_terminator(block, BasicBlock::Goto { block_copies[0] });
+
+			for (BlockId copy : block_copies) {
+				if (copy == no_block) continue;
+				const BasicBlock::Terminator &terminator = this->function.block(copy).terminator;
+				if (const BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&terminator)) {
+					if (destination.has_value()) this->function.append_inst(copy, destination, term->return_value);
+				} else if (!std::holds_alternative<BasicBlock::ReturnVoid>(terminator)) {
+					continue;
+				}
+				this->function.set_terminator(copy, BasicBlock::Goto { continuation });
+			}
+		}
+
+		// the callee's named compiler variables (such as %linenum) are
+		// emitted under their names, so their copies need new ones
+		std::string get_copy_name(const LocalVar &var, const FunctionDef &callee) {
+			if (var.is_user_declared || var.name.empty()) return var.name;
+			std::string base = var.name + "_" + callee.get_unambiguous_name();
+			std::string name = base;
+			for (size_t i = 1; this->var_names.count(name); ++i) {
+				name = base + "_" + std::to_string(i);
+			}
+			this->var_names.insert(name);
+			return name;
+		}
+	};
+
+	size_t inline_calls(FunctionDef &function, const analysis::CallGraph &call_graph) {
+		Inliner inliner(function, call_graph);
+		return inliner.inline_calls();
+	}
+}
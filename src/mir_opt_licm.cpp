@@ -0,0 +1,132 @@
+#include "mir_opt.h"
+#include "mir_opt_loops.h"
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	// Moves the computations in a loop whose operands don't change while
+	// the loop runs into the loop's preheader. MIR variables can be
+	// assigned more than once, so instead of moving the instruction itself
+	// (whose destination may be assigned elsewhere in the loop too), the
+	// preheader computes the value into a fresh variable and the
+	// instruction becomes a copy of it, which copy propagation and dead
+	// store elimination clean up afterwards.
+	//
+	// Only arithmetic and lengths are hoisted; calls, guards, allocations,
+	// and array accesses stay where they are, so the order of the
+	// program's output and errors is untouched. A length can be read
+	// whether or not its array is allocated, since an unallocated one has
+	// length 0.
+	class LoopInvariantHoister {
+		FunctionDef &function;
+		Vec<BlockId> reverse_postorder;
+		analysis::DominatorTree dominators;
+		LoopForest forest;
+		Vec<SmallVec<BlockId, 4>> predecessors;
+
+		public:
+
+		explicit LoopInvariantHoister(FunctionDef &function) :
+			function { function },
+			reverse_postorder { analysis::compute_reverse_postorder(function) },
+			dominators(function, this->reverse_postorder),
+			forest(function, this->reverse_postorder, this->dominators),
+			predecessors { analysis::compute_predecessors(function) }
+		{}
+
+		// returns the number of instructions hoisted. inner loops go first,
+		// so that something can be hoisted out of several loops in turn.
+		size_t hoist() {
+			size_t num_hoisted = 0;
+			for (uint32_t loop = 0; loop < this->forest.loops.size(); ++loop) {
+				if (!is_transformable_loop(this->function, this->forest, loop)) continue;
+				BlockId preheader = find_preheader(this->function, this->forest, loop, this->predecessors);
+				if (preheader == no_block) continue;
+				num_hoisted += this->hoist_from(loop, preheader);
+			}
+			return num_hoisted;
+		}
+
+		private:
+
+		size_t hoist_from(uint32_t loop, BlockId preheader) {
+			Map<const LocalVar *, uint32_t> num_defs_in_loop;
+			for (BlockId block : this->forest.loops[loop].blocks) {
+				for (InstId inst : this->function.insts_of(block)) {
+					if (LocalVar *dest = get_defined_var(this->function.inst(inst))) {
+						num_defs_in_loop[dest] += 1;
+					}
+				}
+			}
+			auto is_defined_in_loop = [&](const LocalVar *var) {
+				return num_defs_in_loop.find(var) != num_defs_in_loop.end();
+			};
+
+			// the variables whose only def in the loop has been hoisted,
+			// mapped to the variable holding their value and that def
+			Map<const LocalVar *, Pair<LocalVar *, InstId>> hoisted_vars;
+			size_t num_hoisted = 0;
+			for (BlockId block : this->forest.loops[loop].blocks) {
+				// the variables that have been assigned a copy of a hoisted
+				// value earlier in this block and not reassigned since
+				Map<const LocalVar *, LocalVar *> local_copies;
+				for (InstId inst : this->function.insts_of(block)) {
+					const Instruction &instruction = this->function.inst(inst);
+					LocalVar *dest = get_defined_var(instruction);
+					if (!dest) continue;
+
+					bool is_invariant = false;
+					Rvalue new_rvalue = instruction.rvalue;
+					if (std::holds_alternative<BinaryOperation>(new_rvalue.value) || std::holds_alternative<LengthGetter>(new_rvalue.value)) {
+						is_invariant = true;
+						auto substitute = [&](Operand &operand) {
+							LocalVar **var = std::get_if<LocalVar *>(&operand.value);
+							if (!var || !is_defined_in_loop(*var)) return;
+							if (auto it = local_copies.find(*var); it != local_copies.end()) {
+								*var = it->second;
+								return;
+							}
+							auto it = hoisted_vars.find(*var);
+							if (it != hoisted_vars.end() && num_defs_in_loop[*var] == 1) {
+								BlockId def_block = this->function.parent_of(it->second.second);
+								if (def_block != block && this->dominators.dominates(def_block, block)) {
+									*var = it->second.first;
+									return;
+								}
+							}
+							is_invariant = false;
+						};
+						if (BinaryOperation *binop = std::get_if<BinaryOperation>(&new_rvalue.value)) {
+							substitute(binop->lhs);
+							substitute(binop->rhs);
+						} else {
+							LengthGetter &length_getter = std::get<LengthGetter>(new_rvalue.value);
+							substitute(length_getter.target);
+							if (length_getter.dimension) substitute(*length_getter.dimension);
+						}
+					}
+
+					if (!is_invariant) {
+						local_copies.erase(dest);
+						continue;
+					}
+					LocalVar *temp = this->function.create_local_var(false, "", dest->type);
+					this->function.append_inst(preheader, Place(temp), mv(new_rvalue));
+					this->function.replace_inst(inst, Place(dest), Operand(temp));
+					local_copies[dest] = temp;
+					if (num_defs_in_loop[dest] == 1) {
+						hoisted_vars[dest] = { temp, inst };
+					}
+					num_hoisted += 1;
+				}
+			}
+			return num_hoisted;
+		}
+	};
+
+	size_t hoist_loop_invariants(FunctionDef &function) {
+		insert_preheaders(function);
+		LoopInvariantHoister hoister(function);
+		return hoister.hoist();
+	}
+}
@@ -0,0 +1,247 @@
+#include "mir_opt_loops.h"
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	bool has_exit(const FunctionDef &function, const LoopForest &forest, uint32_t loop) {
+		for (BlockId block : forest.loops[loop].blocks) {
+			for (BlockId successor : function.get_successors(block)) {
+				if (!forest.contains(loop, successor)) return true;
+			}
+		}
+		return false;
+	}
+
+	bool is_transformable_loop(const FunctionDef &function, const LoopForest &forest, uint32_t loop) {
+		return forest.loops[loop].header != 0 && has_exit(function, forest, loop);
+	}
+
+	BlockId find_preheader(const FunctionDef &function, const LoopForest &forest, uint32_t loop, const Vec<SmallVec<BlockId, 4>> &predecessors) {
+		BlockId header = forest.loops[loop].header;
+		BlockId preheader = no_block;
+		for (BlockId predecessor : predecessors[header]) {
+			if (forest.contains(loop, predecessor)) continue;
+			if (preheader != no_block && preheader != predecessor) return no_block;
+			preheader = predecessor;
+		}
+		if (preheader == no_block) return no_block;
+		const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&function.block(preheader).terminator);
+		if (!term || term->successor != header) return no_block;
+		for (InstId inst : function.insts_of(preheader)) {
+			if (std::holds_alternative<Guard>(function.inst(inst).rvalue.value)) return no_block;
+		}
+		return preheader;
+	}
+
+	void retarget_edges(FunctionDef &function, BlockId from, BlockId to, BlockId new_to) {
+		for (InstId inst : function.insts_of(from)) {
+			const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value);
+			if (guard && guard->target == to) {
+				function.replace_inst(inst, {}, Guard { guard->condition, new_to });
+			}
+		}
+		BasicBlock::Terminator terminator = function.block(from).terminator;
+		if (BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&terminator)) {
+			if (term->successor == to) term->successor = new_to;
+		} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+			if (term->then_block == to) term->then_block = new_to;
+			if (term->else_block == to) term->else_block = new_to;
+		} else {
+			return;
+		}
+		function.set_terminator(from, terminator);
+	}
+
+	void insert_preheaders(FunctionDef &function) {
+		Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(function);
+		analysis::DominatorTree dominators(function, reverse_postorder);
+		LoopForest forest(function, reverse_postorder, dominators);
+		Vec<SmallVec<BlockId, 4>> predecessors = analysis::compute_predecessors(function);
+
+		// decided up front because the forest doesn't know about the new
+		// blocks
+		Vec<Pair<BlockId, SmallVec<BlockId, 4>>> headers_to_enter; // header, predecessors outside the loop
+		for (uint32_t loop = 0; loop < forest.loops.size(); ++loop) {
+			if (!is_transformable_loop(function, forest, loop)) continue;
+			if (find_preheader(function, forest, loop, predecessors) != no_block) continue;
+			SmallVec<BlockId, 4> outside_predecessors;
+			for (BlockId predecessor : predecessors[forest.loops[loop].header]) {
+				if (!forest.contains(loop, predecessor)) outside_predecessors.push_back(predecessor);
+			}
+			headers_to_enter.push_back({ forest.loops[loop].header, mv(outside_predecessors) });
+		}
+
+		for (const auto &[header, outside_predecessors] : headers_to_enter) {
+			BlockId preheader = function.create_block(false, "preheader");
+			function.set_terminator(preheader, BasicBlock::Goto { header });
+			for (BlockId predecessor : outside_predecessors) {
+				retarget_edges(function, predecessor, header, preheader);
+			}
+		}
+	}
+
+	Vec<BlockId> clone_blocks(FunctionDef &function, const Vec<BlockId> &blocks, const std::string &label_name) {
+		Map<BlockId, BlockId> copies;
+		Vec<BlockId> result;
+		for (BlockId block : blocks) {
+			BlockId copy = function.create_block(false, label_name);
+			copies[block] = copy;
+			result.push_back(copy);
+		}
+		auto map_target = [&](BlockId target) {
+			auto it = copies.find(target);
+			return it == copies.end() ? target : it->second;
+		};
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			for (InstId inst : function.insts_of(blocks[i])) {
+				// copied, since appending may reallocate the instructions
+				Instruction instruction = function.inst(inst);
+				if (Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+					guard->target = map_target(guard->target);
+				}
+				function.append_inst(result[i], mv(instruction.destination), mv(instruction.rvalue));
+			}
+			BasicBlock::Terminator terminator = function.block(blocks[i]).terminator;
+			if (BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&terminator)) {
+				term->successor = map_target(term->successor);
+			} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+				term->then_block = map_target(term->then_block);
+				term->else_block = map_target(term->else_block);
+			}
+			function.set_terminator(result[i], mv(terminator));
+		}
+		return result;
+	}
+
+	static LocalVar *get_var(const Operand &operand) {
+		LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+		return var ? *var : nullptr;
+	}
+
+	// Works out which assignments in a loop add a constant to the variable
+	// they assign. A value is written as an offset from the value that the
+	// variable has right before the assignment, either as is or decoded,
+	// and is followed back through the defs of the temporaries that it was
+	// computed from: the last one before the reader in the same block, or
+	// else the only one in the loop, if its block dominates the reader's
+	// and the variable's only def in the loop is the assignment, so that
+	// nothing in between changes the variable.
+	class InductionFinder {
+		// steps bigger than this are left alone, so that the offsets
+		// can't overflow
+		static constexpr int64_t max_step_magnitude = int64_t(1) << 40;
+
+		struct StepForm {
+			bool is_decoded;
+			int64_t offset;
+		};
+
+		const FunctionDef &function;
+		const analysis::DominatorTree &dominators;
+		Map<const LocalVar *, Vec<InstId>> defs; // in the loop
+
+		public:
+
+		InductionFinder(const FunctionDef &function, const analysis::DominatorTree &dominators, const Vec<BlockId> &blocks) :
+			function { function }, dominators { dominators }
+		{
+			for (BlockId block : blocks) {
+				for (InstId inst : function.insts_of(block)) {
+					if (LocalVar *dest = get_defined_var(function.inst(inst))) this->defs[dest].push_back(inst);
+				}
+			}
+		}
+
+		Map<const LocalVar *, Vec<InductionStep>> find() const {
+			Map<const LocalVar *, Vec<InductionStep>> result;
+			for (const auto &[var, var_defs] : this->defs) {
+				const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&var->type.type);
+				if (!array_type || array_type->num_dimensions != 0) continue;
+				Vec<InductionStep> steps;
+				for (InstId def : var_defs) {
+					Opt<StepForm> form = this->get_inst_form(var, def, def);
+					if (!form || form->is_decoded) break;
+					steps.push_back({ def, form->offset });
+				}
+				if (steps.size() == var_defs.size()) result.insert({ var, mv(steps) });
+			}
+			return result;
+		}
+
+		private:
+
+		// the last def of the variable in the block of `before`, before it
+		InstId find_def_before(const LocalVar *var, InstId before) const {
+			for (InstId inst = this->function.prev_inst(before); inst != no_inst; inst = this->function.prev_inst(inst)) {
+				if (get_defined_var(this->function.inst(inst)) == var) return inst;
+			}
+			return no_inst;
+		}
+
+		// the def of the variable that `reader` reads, if it's one of the
+		// ones described above
+		InstId find_reaching_def(const LocalVar *read_var, const LocalVar *var, InstId reader) const {
+			InstId result = this->find_def_before(read_var, reader);
+			if (result != no_inst) return result;
+			auto it = this->defs.find(read_var);
+			if (it == this->defs.end() || it->second.size() != 1 || this->defs.at(var).size() != 1) return no_inst;
+			result = it->second[0];
+			BlockId block = this->function.parent_of(result);
+			if (block == this->function.parent_of(reader) || !this->dominators.dominates(block, this->function.parent_of(reader))) return no_inst;
+			return result;
+		}
+
+		// the value of the operand where `reader` reads it, as a form over
+		// the value of `var` right before `def`
+		Opt<StepForm> get_operand_form(const LocalVar *var, InstId def, const Operand &operand, InstId reader) const {
+			LocalVar *read_var = get_var(operand);
+			if (!read_var) return {};
+			if (read_var == var) {
+				// the variable can't change between the read and `def`
+				bool is_unchanged = this->function.parent_of(reader) == this->function.parent_of(def)
+					? this->find_def_before(var, reader) == this->find_def_before(var, def)
+					: this->find_def_before(var, def) == no_inst && this->defs.at(var).size() == 1;
+				if (!is_unchanged) return {};
+				return StepForm { false, 0 };
+			}
+			InstId operand_def = this->find_reaching_def(read_var, var, reader);
+			if (operand_def == no_inst) return {};
+			return this->get_inst_form(var, def, operand_def);
+		}
+
+		// the value that the instruction assigns, as a form like the above
+		Opt<StepForm> get_inst_form(const LocalVar *var, InstId def, InstId inst) const {
+			const Rvalue &rvalue = this->function.inst(inst).rvalue;
+			if (const Operand *copied = std::get_if<Operand>(&rvalue.value)) {
+				return this->get_operand_form(var, def, *copied, inst);
+			}
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&rvalue.value);
+			if (!bin_op) return {};
+			const Int64Constant *constant = std::get_if<Int64Constant>(&bin_op->rhs.value);
+			const Operand *other = &bin_op->lhs;
+			if (!constant && bin_op->op == Operator::plus) {
+				constant = std::get_if<Int64Constant>(&bin_op->lhs.value);
+				other = &bin_op->rhs;
+			}
+			if (!constant || constant->value < -max_step_magnitude || constant->value > max_step_magnitude) return {};
+			Opt<StepForm> form = this->get_operand_form(var, def, *other, inst);
+			if (!form || form->offset < -max_step_magnitude || form->offset > max_step_magnitude) return {};
+			if (bin_op->op == Operator::plus) {
+				return StepForm { form->is_decoded, form->offset + constant->value };
+			} else if (bin_op->op == Operator::rshift && constant->value == 1 && !form->is_decoded) {
+				// the variable holds an encoded value, 2n + 1, so
+				// (2n + 1 + offset) >> 1 is n + (offset + 1) >> 1
+				return StepForm { true, (form->offset + 1) >> 1 };
+			} else if (bin_op->op == Operator::lshift && constant->value == 1 && form->is_decoded) {
+				// (n + offset) << 1 is 2n + 1 + 2 * offset - 1
+				return StepForm { false, 2 * form->offset - 1 };
+			}
+			return {};
+		}
+	};
+
+	Map<const LocalVar *, Vec<InductionStep>> find_induction_variables(const FunctionDef &function, const analysis::DominatorTree &dominators, const Vec<BlockId> &blocks) {
+		InductionFinder finder(function, dominators, blocks);
+		return finder.find();
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "std_alias.h"
+#include "mir.h"
+#include "mir_analysis.h"
+
+// The plumbing that the passes which restructure loops share: finding and
+// making preheaders, redirecting edges, copying a loop's blocks, and
+// finding the loop's counters.
+namespace mir::opt {
+	using namespace std_alias;
+
+	// whether control can leave the loop. the error blocks of a function
+	// that returns a value end in a jump to themselves, and there's
+	// nothing to gain from transforming those.
+	bool has_exit(const FunctionDef &function, const analysis::LoopForest &forest, uint32_t loop);
+
+	// whether there can be a preheader in front of the loop. the entry
+	// block holds the declarations, so nothing can come before it.
+	bool is_transformable_loop(const FunctionDef &function, const analysis::LoopForest &forest, uint32_t loop);
+
+	// the block that control always passes through right before entering
+	// the loop from outside, if there is one: the loop's only predecessor
+	// outside of it, ending in a plain jump to the header and without
+	// guards
+	BlockId find_preheader(const FunctionDef &function, const analysis::LoopForest &forest, uint32_t loop, const Vec<SmallVec<BlockId, 4>> &predecessors);
+
+	// makes every edge from `from` to `to` go to `new_to` instead
+	void retarget_edges(FunctionDef &function, BlockId from, BlockId to, BlockId new_to);
+
+	// gives every loop that is_transformable_loop allows a block that only
+	// jumps to its header and that all the edges into the loop go
+	// through. the new blocks that nothing gets put into are removed again
+	// by simplify_cfg.
+	void insert_preheaders(FunctionDef &function);
+
+	// appends copies of the given blocks to the function. edges between
+	// the given blocks go between the copies, and the copies' other edges
+	// go where the originals' do. returns the copies in the same order.
+	Vec<BlockId> clone_blocks(FunctionDef &function, const Vec<BlockId> &blocks, const std::string &label_name);
+
+	// an assignment to an induction variable, and the constant that it
+	// adds
+	struct InductionStep {
+		InstId inst;
+		int64_t amount;
+	};
+
+	// the int64 variables that the blocks only assign by adding constants
+	// to them, each with those assignments in block order. the constant
+	// is found by following the value assigned back to the variable's
+	// previous value, through the temporaries that it was computed from
+	// and the decoding and encoding around additions that lowering
+	// leaves, as long as nothing in between can change the variable.
+	Map<const LocalVar *, Vec<InductionStep>> find_induction_variables(const FunctionDef &function, const analysis::DominatorTree &dominators, const Vec<BlockId> &blocks);
+}
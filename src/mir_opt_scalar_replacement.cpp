@@ -0,0 +1,211 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using utils::BitSet;
+
+	// arrays and tuples with more elements than this keep their allocation
+	constexpr int64_t max_replaced_length = 16;
+
+	// Replaces the one-dimensional arrays and tuples of constant length
+	// that never leave the function with a variable per element. A
+	// candidate is assigned by exactly one allocation (and otherwise only
+	// its default value), and is only read by accesses at constant
+	// indices in range, by `= 0` tests and by its length, at points where
+	// it is known to be allocated. Anything else it is used for (a copy, a
+	// call, a store into another array, a return) lets it escape, and so
+	// does any access that could fail, so that the errors it reports stay
+	// the same.
+	//
+	// The allocation becomes assignments of 0 (encoded) to the elements,
+	// the accesses become copies, the tests and lengths become constants,
+	// and constant propagation folds the checks that used them.
+	class ScalarReplacer {
+		struct Candidate {
+			LocalVar *var;
+			InstId allocation;
+			int64_t length;
+		};
+
+		FunctionDef &function;
+
+		public:
+
+		explicit ScalarReplacer(FunctionDef &function) : function { function } {}
+
+		// returns the number of allocations replaced
+		size_t replace() {
+			Vec<Candidate> candidates = this->find_candidates();
+			for (const Candidate &candidate : candidates) {
+				this->replace(candidate);
+			}
+			return candidates.size();
+		}
+
+		private:
+
+		Vec<Candidate> find_candidates() const {
+			Map<const LocalVar *, Candidate> candidates;
+			for (const Uptr<LocalVar> &var : this->function.local_vars) {
+				if (Opt<Candidate> candidate = this->get_candidate(var.get())) {
+					candidates.insert({ var.get(), *candidate });
+				}
+			}
+			if (candidates.empty()) return {};
+
+			// every use must see the allocation, not the default value
+			Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(this->function);
+			analysis::KnownAllocations allocations(this->function, reverse_postorder);
+			for (BlockId block : reverse_postorder) {
+				BitSet state = allocations.get_entry_state(block);
+				for (InstId inst : this->function.insts_of(block)) {
+					visit_reads(this->function.inst(inst), [&](const Operand &operand) {
+						LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+						if (var && !allocations.is_allocated(state, *var)) candidates.erase(*var);
+					}, [&](const LocalVar *target) {
+						if (!allocations.is_allocated(state, target)) candidates.erase(target);
+					});
+					allocations.transfer(state, inst);
+				}
+			}
+
+			Vec<Candidate> result;
+			for (const Uptr<LocalVar> &var : this->function.local_vars) {
+				auto it = candidates.find(var.get());
+				if (it != candidates.end()) result.push_back(it->second);
+			}
+			return result;
+		}
+
+		Opt<Candidate> get_candidate(LocalVar *var) const {
+			const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&var->type.type);
+			bool is_tuple = std::holds_alternative<Type::TupleType>(var->type.type);
+			if (!is_tuple && (!array_type || array_type->num_dimensions != 1)) return {};
+			if (std::find(this->function.parameter_vars.begin(), this->function.parameter_vars.end(), var) != this->function.parameter_vars.end()) return {};
+
+			Opt<Candidate> candidate;
+			for (InstId def : var->defs) {
+				const Rvalue &rvalue = this->function.inst(def).rvalue;
+				if (const Operand *operand = std::get_if<Operand>(&rvalue.value); operand && *operand == Operand(Int64Constant { 0 })) continue;
+				const Operand *length = nullptr;
+				if (const NewArray *new_array = std::get_if<NewArray>(&rvalue.value); new_array && new_array->dimension_lengths.size() == 1) {
+					length = &new_array->dimension_lengths[0];
+				} else if (const NewTuple *new_tuple = std::get_if<NewTuple>(&rvalue.value)) {
+					length = &new_tuple->length;
+				}
+				const Int64Constant *encoded_length = length ? std::get_if<Int64Constant>(&length->value) : nullptr;
+				if (candidate || !encoded_length || encoded_length->value % 2 == 0) return {};
+				int64_t decoded_length = encoded_length->value >> 1;
+				if (decoded_length <= 0 || decoded_length > max_replaced_length) return {};
+				candidate = Candidate { var, def, decoded_length };
+			}
+			if (!candidate) return {};
+
+			for (const Use &use : var->uses) {
+				if (use.is_terminator || !this->is_replaceable_use(this->function.inst(use.user), *candidate)) return {};
+			}
+			return candidate;
+		}
+
+		// the element that the place refers to, if it's an element of the
+		// candidate at a constant index in range
+		static Opt<int64_t> get_element(const Place &place, const Candidate &candidate) {
+			if (place.target != candidate.var || place.indices.size() != 1) return {};
+			const Int64Constant *index = std::get_if<Int64Constant>(&place.indices[0].value);
+			if (!index || index->value < 0 || index->value >= candidate.length) return {};
+			return index->value;
+		}
+
+		static bool is_int64(const LocalVar *var) {
+			const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&var->type.type);
+			return array_type && array_type->num_dimensions == 0;
+		}
+
+		static bool is_null_test(const Rvalue &rvalue, LocalVar *var) {
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&rvalue.value);
+			if (!bin_op || bin_op->op != Operator::eq) return false;
+			Operand null = Int64Constant { 0 };
+			return (bin_op->lhs == Operand(var) && bin_op->rhs == null) || (bin_op->lhs == null && bin_op->rhs == Operand(var));
+		}
+
+		static bool is_length(const Rvalue &rvalue, LocalVar *var) {
+			const LengthGetter *length = std::get_if<LengthGetter>(&rvalue.value);
+			return length && length->target == Operand(var)
+				&& (!length->dimension.has_value() || *length->dimension == Operand(Int64Constant { 0 }));
+		}
+
+		// whether every read of the candidate in the instruction is one
+		// that can be replaced
+		bool is_replaceable_use(const Instruction &instruction, const Candidate &candidate) const {
+			size_t num_reads = 0;
+			visit_reads(instruction, [&](const Operand &operand) {
+				if (operand == Operand(candidate.var)) num_reads += 1;
+			}, [&](const LocalVar *target) {
+				if (target == candidate.var) num_reads += 1;
+			});
+
+			// the elements become int64 variables, so they may only be
+			// assigned and copied to numbers
+			size_t num_replaceable = 0;
+			const Rvalue &rvalue = instruction.rvalue;
+			if (instruction.destination.has_value() && get_element(*instruction.destination, candidate)) {
+				const Operand *operand = std::get_if<Operand>(&rvalue.value);
+				LocalVar *const *source = operand ? std::get_if<LocalVar *>(&operand->value) : nullptr;
+				if (source && !is_int64(*source)) return false;
+				num_replaceable += 1;
+			}
+			if (const Place *place = std::get_if<Place>(&rvalue.value); place && get_element(*place, candidate)) {
+				LocalVar *dest = get_defined_var(instruction);
+				if (!dest || !is_int64(dest)) return false;
+				num_replaceable += 1;
+			} else if (is_null_test(rvalue, candidate.var) || is_length(rvalue, candidate.var)) {
+				num_replaceable += 1;
+			}
+			return num_reads == num_replaceable;
+		}
+
+		void replace(const Candidate &candidate) {
+			Vec<LocalVar *> elements;
+			for (int64_t i = 0; i < candidate.length; ++i) {
+				elements.push_back(this->function.create_local_var(false, "", Type { Type::ArrayType { 0 } }));
+			}
+
+			// copied, since replacing changes the uses
+			Vec<InstId> users;
+			for (const Use &use : candidate.var->uses) {
+				if (std::find(users.begin(), users.end(), use.user) == users.end()) users.push_back(use.user);
+			}
+			for (InstId inst : users) {
+				Instruction instruction = this->function.inst(inst);
+				if (instruction.destination.has_value()) {
+					if (Opt<int64_t> element = get_element(*instruction.destination, candidate)) {
+						instruction.destination = Place(elements[*element]);
+					}
+				}
+				if (const Place *place = std::get_if<Place>(&instruction.rvalue.value)) {
+					if (Opt<int64_t> element = get_element(*place, candidate)) {
+						instruction.rvalue = Operand(elements[*element]);
+					}
+				} else if (is_null_test(instruction.rvalue, candidate.var)) {
+					instruction.rvalue = Operand(Int64Constant { 0 });
+				} else if (is_length(instruction.rvalue, candidate.var)) {
+					instruction.rvalue = Operand(Int64Constant { candidate.length * 2 + 1 });
+				}
+				this->function.replace_inst(inst, mv(instruction.destination), mv(instruction.rvalue));
+			}
+
+			// a new array starts out all zeros, every time it's allocated
+			BlockId block = this->function.parent_of(candidate.allocation);
+			for (LocalVar *element : elements) {
+				this->function.insert_inst(block, candidate.allocation, Place(element), Operand(Int64Constant { 1 }));
+			}
+			this->function.erase_inst(candidate.allocation);
+		}
+	};
+
+	size_t replace_allocations_with_scalars(FunctionDef &function) {
+		ScalarReplacer replacer(function);
+		return replacer.replace();
+	}
+}
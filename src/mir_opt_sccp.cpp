@@ -0,0 +1,368 @@
+#include "mir_opt.h"
+#include <algorithm>
+
+namespace mir::opt {
+	// what is known about a value: nothing yet (nothing that can run has
+	// been seen to produce it), that it's a single constant, or that it
+	// isn't one
+	struct ConstantValue {
+		enum struct Kind { unknown, constant, overdefined };
+		Kind kind;
+		Operand value; // if constant
+
+		bool is_constant() const { return this->kind == Kind::constant; }
+		bool operator==(const ConstantValue &other) const {
+			return this->kind == other.kind
+				&& (this->kind != Kind::constant || this->value == other.value);
+		}
+		bool operator!=(const ConstantValue &other) const { return !(*this == other); }
+	};
+	static const ConstantValue unknown { ConstantValue::Kind::unknown, Int64Constant { 0 } };
+	static const ConstantValue overdefined { ConstantValue::Kind::overdefined, Int64Constant { 0 } };
+
+	// what is true of both values
+	static ConstantValue meet(const ConstantValue &a, const ConstantValue &b) {
+		if (a.kind == ConstantValue::Kind::unknown) return b;
+		if (b.kind == ConstantValue::Kind::unknown || a == b) return a;
+		return overdefined;
+	}
+
+	// the other operand of `x + 0` or `0 + x`
+	static Opt<Operand> get_added_to_zero(const Rvalue &rvalue) {
+		const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&rvalue.value);
+		if (!bin_op || bin_op->op != Operator::plus) return {};
+		if (bin_op->rhs == Operand(Int64Constant { 0 })) return bin_op->lhs;
+		if (bin_op->lhs == Operand(Int64Constant { 0 })) return bin_op->rhs;
+		return {};
+	}
+
+	// Sparse conditional constant propagation, after "Constant Propagation
+	// with Conditional Branches" by Wegman and Zadeck, over the names that
+	// SSA form would give the values (see analysis::SsaNames). The values
+	// of the scalar variables flow from names to the reads and phi operands
+	// that see them, and a phi only takes in the operands for the edges
+	// into its block that have been taken. A name's value only goes down
+	// twice, and each time only what reads that name is looked at again (a
+	// phi just meets its value with the one operand that changed), so the
+	// work is proportional to the number of reads and phi operands. Name 0,
+	// the value a variable is declared with or a parameter is passed, is
+	// never constant.
+	//
+	// An edge is only taken once the branch or guard at its start can go
+	// that way, and the rest of a block only runs once every guard before it
+	// is known not to always fire, assuming that branches and guards on
+	// constants only go one way.
+	class ConstantPropagator {
+		using SsaNames = analysis::SsaNames;
+		using NameRead = SsaNames::NameRead;
+		using Edge = SsaNames::Edge;
+		using Phi = SsaNames::Phi;
+
+		struct PhiOperand {
+			uint32_t phi;
+			uint32_t operand;
+		};
+
+		FunctionDef &function;
+		analysis::DominatorTree dominators;
+		SsaNames names;
+		Set<const LocalVar *> scalar_vars; // the variables whose values are tracked
+		Vec<uint32_t> positions; // of each instruction in its block
+
+		// by name
+		Vec<ConstantValue> values;
+		Vec<SmallVec<Use, 2>> name_reads;
+		Vec<SmallVec<PhiOperand, 2>> name_phis;
+
+		Vec<bool> is_executable; // for each block
+		// the first instruction of each executable block that isn't known to
+		// run yet, or no_inst if the whole block and its terminator do
+		Vec<InstId> frontiers;
+		Vec<bool> can_guard_fire;
+		Vec<uint8_t> taken_edges; // for each block, 1 for the goto or then edge and 2 for the else edge
+		Vec<BlockId> block_worklist;
+		Vec<Use> read_worklist;
+		Vec<PhiOperand> phi_worklist;
+
+		public:
+
+		explicit ConstantPropagator(FunctionDef &function) :
+			function { function },
+			dominators(function, analysis::compute_reverse_postorder(function)),
+			names(function, this->dominators),
+			positions(function.instructions.size(), 0),
+			values(this->names.num_names, unknown),
+			name_reads(this->names.num_names),
+			name_phis(this->names.num_names),
+			is_executable(function.basic_blocks.size(), false),
+			frontiers(function.basic_blocks.size(), no_inst),
+			can_guard_fire(function.instructions.size(), false),
+			taken_edges(function.basic_blocks.size(), 0)
+		{
+			for (const Uptr<LocalVar> &var : function.local_vars) {
+				const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&var->type.type);
+				bool is_scalar = (array_type && array_type->num_dimensions == 0)
+					|| std::holds_alternative<Type::CodeType>(var->type.type);
+				if (is_scalar) this->scalar_vars.insert(var.get());
+			}
+			this->values[0] = overdefined;
+			for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+				uint32_t position = 0;
+				for (InstId inst : function.insts_of(block)) {
+					this->positions[inst] = position++;
+					for (const NameRead &read : this->names.inst_reads[inst]) {
+						this->name_reads[read.name].push_back(Use { inst, false, 0 });
+					}
+				}
+				for (const NameRead &read : this->names.terminator_reads[block]) {
+					this->name_reads[read.name].push_back(Use { block, true, 0 });
+				}
+			}
+			for (uint32_t phi = 0; phi < this->names.phis.size(); ++phi) {
+				const Vec<Pair<Edge, uint32_t>> &incoming_names = this->names.phis[phi].incoming_names;
+				for (uint32_t operand = 0; operand < incoming_names.size(); ++operand) {
+					this->name_phis[incoming_names[operand].second].push_back({ phi, operand });
+				}
+			}
+		}
+
+		void solve() {
+			if (this->function.basic_blocks.empty()) return;
+			this->take_edge(0, 0);
+			while (!this->block_worklist.empty() || !this->phi_worklist.empty() || !this->read_worklist.empty()) {
+				if (!this->block_worklist.empty()) {
+					BlockId block = this->block_worklist.back();
+					this->block_worklist.pop_back();
+					this->advance(block);
+				} else if (!this->phi_worklist.empty()) {
+					PhiOperand operand = this->phi_worklist.back();
+					this->phi_worklist.pop_back();
+					this->visit_phi_operand(operand);
+				} else {
+					Use read = this->read_worklist.back();
+					this->read_worklist.pop_back();
+					this->revisit(read);
+				}
+			}
+		}
+
+		// replaces every read of a variable that is known to be constant
+		// with that constant, and folds operations whose operands are all
+		// constants or that add 0. returns the number of operands and instructions
+		// changed.
+		size_t rewrite() {
+			size_t num_changes = 0;
+			// the IR only does arithmetic and comparisons on numbers and
+			// variables, so function names can't be substituted there
+			bool is_arithmetic = false;
+			const SmallVec<NameRead, 2> *reads = nullptr;
+			auto substitute = [&](Operand &operand) {
+				ConstantValue value = this->evaluate_operand(*reads, operand);
+				if (is_arithmetic && !std::holds_alternative<Int64Constant>(value.value.value)) return;
+				if (value.is_constant() && std::holds_alternative<LocalVar *>(operand.value)) {
+					operand = value.value;
+					num_changes += 1;
+				}
+			};
+
+			for (BlockId block = 0; block < this->function.basic_blocks.size(); ++block) {
+				if (!this->is_executable[block]) continue;
+				for (InstId inst : this->function.insts_of(block)) {
+					Instruction new_inst = this->function.inst(inst);
+					size_t num_changes_before = num_changes;
+					is_arithmetic = std::holds_alternative<BinaryOperation>(new_inst.rvalue.value);
+					reads = &this->names.inst_reads[inst];
+					visit_reads(new_inst, substitute, [](LocalVar *&) {});
+					ConstantValue value = this->evaluate_rvalue(*reads, new_inst.rvalue);
+					if (value.is_constant() && !std::holds_alternative<Operand>(new_inst.rvalue.value)) {
+						new_inst.rvalue = value.value;
+						num_changes += 1;
+					} else if (Opt<Operand> operand = get_added_to_zero(new_inst.rvalue)) {
+						// what's left of a sum of checks once some of them
+						// are known not to fail
+						new_inst.rvalue = *operand;
+						num_changes += 1;
+					}
+					if (num_changes != num_changes_before) {
+						this->function.replace_inst(inst, mv(new_inst.destination), mv(new_inst.rvalue));
+					}
+					// a guard that always fires, after which the rest of the
+					// block is dead
+					if (inst == this->frontiers[block]) break;
+				}
+				if (this->frontiers[block] != no_inst) continue;
+
+				BasicBlock::Terminator terminator = this->function.block(block).terminator;
+				size_t num_changes_before = num_changes;
+				is_arithmetic = false;
+				reads = &this->names.terminator_reads[block];
+				if (BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&terminator)) {
+					substitute(term->return_value);
+				} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+					substitute(term->condition);
+				}
+				if (num_changes != num_changes_before) {
+					this->function.set_terminator(block, terminator);
+				}
+			}
+			return num_changes;
+		}
+
+		private:
+
+		ConstantValue evaluate_operand(const SmallVec<NameRead, 2> &reads, const Operand &operand) const {
+			if (LocalVar *const *var = std::get_if<LocalVar *>(&operand.value)) {
+				if (!this->scalar_vars.count(*var)) return overdefined;
+				for (const NameRead &read : reads) {
+					if (read.var == *var) return this->values[read.name];
+				}
+				return overdefined;
+			}
+			return { ConstantValue::Kind::constant, operand };
+		}
+
+		ConstantValue evaluate_rvalue(const SmallVec<NameRead, 2> &reads, const Rvalue &rvalue) const {
+			if (const Operand *operand = std::get_if<Operand>(&rvalue.value)) {
+				return this->evaluate_operand(reads, *operand);
+			} else if (const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&rvalue.value)) {
+				ConstantValue lhs = this->evaluate_operand(reads, bin_op->lhs);
+				ConstantValue rhs = this->evaluate_operand(reads, bin_op->rhs);
+				if (lhs.kind == ConstantValue::Kind::overdefined || rhs.kind == ConstantValue::Kind::overdefined) return overdefined;
+				if (!lhs.is_constant() || !rhs.is_constant()) return unknown;
+				const Int64Constant *lhs_num = std::get_if<Int64Constant>(&lhs.value.value);
+				const Int64Constant *rhs_num = std::get_if<Int64Constant>(&rhs.value.value);
+				if (!lhs_num || !rhs_num) return overdefined;
+				Opt<int64_t> result = evaluate(bin_op->op, lhs_num->value, rhs_num->value);
+				if (!result.has_value()) return overdefined;
+				return { ConstantValue::Kind::constant, Int64Constant { *result } };
+			}
+			return overdefined;
+		}
+
+		void set_value(uint32_t name, const ConstantValue &value) {
+			if (value == this->values[name]) return;
+			this->values[name] = value;
+			for (Use read : this->name_reads[name]) {
+				this->read_worklist.push_back(read);
+			}
+			for (PhiOperand operand : this->name_phis[name]) {
+				this->phi_worklist.push_back(operand);
+			}
+		}
+
+		// called once an edge into the block has been taken, whose operand
+		// its phis now take in
+		void take_edge(BlockId block, uint32_t operand) {
+			for (uint32_t phi : this->names.block_phis[block]) {
+				this->phi_worklist.push_back({ phi, operand });
+			}
+			if (this->is_executable[block]) return;
+			this->is_executable[block] = true;
+			this->frontiers[block] = this->function.block(block).first_inst;
+			this->block_worklist.push_back(block);
+		}
+
+		bool is_taken(const Edge &edge, BlockId target) const {
+			if (edge.is_guard) return this->can_guard_fire[edge.source];
+			if (edge.source == no_block) return true;
+			uint8_t taken_edges = this->taken_edges[edge.source];
+			if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&this->function.block(edge.source).terminator)) {
+				return (term->then_block == target && (taken_edges & 1)) || (term->else_block == target && (taken_edges & 2));
+			}
+			return taken_edges & 1;
+		}
+
+		void visit_phi_operand(PhiOperand operand) {
+			const Phi &phi = this->names.phis[operand.phi];
+			const auto &[edge, name] = phi.incoming_names[operand.operand];
+			if (this->is_taken(edge, phi.block)) {
+				this->set_value(phi.name, meet(this->values[phi.name], this->values[name]));
+			}
+		}
+
+		// runs a block on from the first instruction that wasn't known to
+		// run, as far as what's known so far allows
+		void advance(BlockId block) {
+			while (this->frontiers[block] != no_inst) {
+				InstId inst = this->frontiers[block];
+				if (std::holds_alternative<Guard>(this->function.inst(inst).rvalue.value)) {
+					if (!this->visit_guard(inst)) return;
+				} else {
+					this->visit_def(inst);
+				}
+				this->frontiers[block] = this->function.next_inst(inst);
+			}
+			this->visit_terminator(block);
+		}
+
+		// looks at a read again after the value it sees has changed
+		void revisit(Use read) {
+			if (read.is_terminator) {
+				if (this->is_executable[read.user] && this->frontiers[read.user] == no_inst) {
+					this->visit_terminator(read.user);
+				}
+				return;
+			}
+			InstId inst = read.user;
+			BlockId block = this->function.parent_of(inst);
+			if (!this->is_executable[block]) return;
+			InstId frontier = this->frontiers[block];
+			if (inst == frontier) {
+				this->block_worklist.push_back(block);
+			} else if (frontier == no_inst || this->positions[inst] < this->positions[frontier]) {
+				if (std::holds_alternative<Guard>(this->function.inst(inst).rvalue.value)) {
+					this->visit_guard(inst);
+				} else {
+					this->visit_def(inst);
+				}
+			}
+		}
+
+		// takes the guard's edge if the guard can fire. returns whether the
+		// instructions after the guard can run.
+		bool visit_guard(InstId inst) {
+			const Guard &guard = std::get<Guard>(this->function.inst(inst).rvalue.value);
+			ConstantValue condition = this->evaluate_operand(this->names.inst_reads[inst], guard.condition);
+			if (condition.kind == ConstantValue::Kind::unknown) return false;
+			const Int64Constant *condition_num = condition.is_constant() ? std::get_if<Int64Constant>(&condition.value.value) : nullptr;
+			if ((!condition_num || condition_num->value != 0) && !this->can_guard_fire[inst]) {
+				this->can_guard_fire[inst] = true;
+				this->take_edge(guard.target, this->names.guard_operands[inst]);
+			}
+			// if the guard always fires, the rest of the block is dead and
+			// will be removed along with it
+			return !condition_num || condition_num->value == 0;
+		}
+
+		void visit_def(InstId inst) {
+			uint32_t name = this->names.def_names[inst];
+			if (name == SsaNames::no_name || !this->scalar_vars.count(get_defined_var(this->function.inst(inst)))) return;
+			ConstantValue value = this->evaluate_rvalue(this->names.inst_reads[inst], this->function.inst(inst).rvalue);
+			this->set_value(name, meet(this->values[name], value));
+		}
+
+		void visit_terminator(BlockId block) {
+			const BasicBlock::Terminator &terminator = this->function.block(block).terminator;
+			auto take_terminator_edge = [&](uint8_t edge, BlockId successor) {
+				if (this->taken_edges[block] & edge) return;
+				this->taken_edges[block] |= edge;
+				this->take_edge(successor, this->names.terminator_operands[block][edge - 1]);
+			};
+			if (const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&terminator)) {
+				take_terminator_edge(1, term->successor);
+			} else if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+				ConstantValue condition = this->evaluate_operand(this->names.terminator_reads[block], term->condition);
+				if (condition.kind == ConstantValue::Kind::unknown) return;
+				const Int64Constant *condition_num = condition.is_constant() ? std::get_if<Int64Constant>(&condition.value.value) : nullptr;
+				if (!condition_num || condition_num->value != 0) take_terminator_edge(1, term->then_block);
+				if (!condition_num || condition_num->value == 0) take_terminator_edge(2, term->else_block);
+			}
+		}
+	};
+
+	size_t propagate_constants(FunctionDef &function) {
+		ConstantPropagator propagator(function);
+		propagator.solve();
+		return propagator.rewrite();
+	}
+}
@@ -0,0 +1,290 @@
+#include "mir_opt.h"
+#include "mir_opt_loops.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	// arrays and tuples with at most this many elements are zeroed by a
+	// store per element, and bigger ones by a loop
+	constexpr int64_t max_unrolled_zeroing = 16;
+
+	// Makes the allocations of arrays and tuples in a loop reuse one array
+	// instead of allocating a new one every iteration. This only works if
+	// nothing can still see the array from the iteration before: the
+	// variable that holds it must only be used for accesses, lengths and
+	// `= 0` tests, never copied, passed, stored or returned, so that
+	// reassigning the variable drops the last reference to the old array.
+	// The lengths must not change in the loop either, so that the array
+	// that is reused always has the ones that the allocation would give it.
+	//
+	// The array belongs to the outermost loop around the allocation that
+	// doesn't assign the lengths. If they are constants, it's allocated in
+	// that loop's preheader, which can't fail. Otherwise allocating there
+	// could report an error for a loop that never gets to the allocation,
+	// so it's allocated where the allocation was, the first time control
+	// gets there after entering the loop. From then on, the allocation
+	// becomes zeroing that array, followed by assigning it to the
+	// variable.
+	//
+	// What zeroing costs is judged by the number of elements. Allocating
+	// stores to every element too, so zeroing never makes more stores,
+	// and it saves the call to the allocator along with the memory, which
+	// is never freed. Up to max_unrolled_zeroing elements get a store
+	// each. Bigger arrays and tuples, and those whose lengths aren't
+	// constants, are zeroed by a loop, which only handles one dimension.
+	// If the loop never stores into the array, its elements are still 0
+	// and there is nothing to zero.
+	class AllocationReuser {
+		// an allocation to turn into reusing `scratch`, which the
+		// preheader allocates or, if `is_lazy`, resets to null
+		struct Allocation {
+			InstId inst;
+			BlockId preheader;
+			bool is_lazy;
+			LocalVar *scratch;
+		};
+
+		FunctionDef &function;
+		Vec<BlockId> reverse_postorder;
+		analysis::DominatorTree dominators;
+		LoopForest forest;
+		Vec<SmallVec<BlockId, 4>> predecessors;
+
+		public:
+
+		explicit AllocationReuser(FunctionDef &function) :
+			function { function },
+			reverse_postorder { analysis::compute_reverse_postorder(function) },
+			dominators(function, this->reverse_postorder),
+			forest(function, this->reverse_postorder, this->dominators),
+			predecessors { analysis::compute_predecessors(function) }
+		{}
+
+		// returns the number of allocations that reuse an array
+		size_t reuse() {
+			Vec<Allocation> allocations;
+			for (BlockId block : this->reverse_postorder) {
+				if (this->forest.innermost_loops[block] == LoopForest::no_loop) continue;
+				for (InstId inst : this->function.insts_of(block)) {
+					if (!this->is_reusable(this->function.inst(inst))) continue;
+					BlockId preheader = this->find_outermost_preheader(block, this->function.inst(inst).rvalue);
+					if (preheader == no_block) continue;
+					bool is_lazy = !get_element_count(this->function.inst(inst).rvalue);
+					allocations.push_back({ inst, preheader, is_lazy, nullptr });
+				}
+			}
+			// the preheaders are filled in before any block is split, so
+			// that they are still where control enters the loops
+			for (Allocation &allocation : allocations) {
+				const Instruction &instruction = this->function.inst(allocation.inst);
+				LocalVar *var = get_defined_var(instruction);
+				allocation.scratch = this->function.create_local_var(false, "", var->type);
+				if (allocation.is_lazy) {
+					this->function.append_inst(allocation.preheader, Place(allocation.scratch), var->type.get_default_value());
+				} else {
+					this->function.append_inst(allocation.preheader, Place(allocation.scratch), instruction.rvalue);
+				}
+			}
+			for (const Allocation &allocation : allocations) {
+				this->emit_reuse(allocation);
+			}
+			return allocations.size();
+		}
+
+		private:
+
+		// the encoded lengths of the allocation's dimensions, or none if
+		// it isn't an allocation
+		static SmallVec<Operand, 3> get_lengths(const Rvalue &rvalue) {
+			if (const NewArray *new_array = std::get_if<NewArray>(&rvalue.value)) {
+				return new_array->dimension_lengths;
+			} else if (const NewTuple *new_tuple = std::get_if<NewTuple>(&rvalue.value)) {
+				return { new_tuple->length };
+			}
+			return {};
+		}
+
+		// the number of elements that the allocation makes, if its lengths
+		// are constants that it can't fail on
+		static Opt<int64_t> get_element_count(const Rvalue &rvalue) {
+			int64_t count = 1;
+			for (const Operand &length : get_lengths(rvalue)) {
+				const Int64Constant *encoded_length = std::get_if<Int64Constant>(&length.value);
+				if (!encoded_length || encoded_length->value % 2 == 0) return {};
+				int64_t decoded_length = encoded_length->value >> 1;
+				if (decoded_length < 0) return {};
+				// only compared against max_unrolled_zeroing, so it stops
+				// growing past that instead of overflowing
+				count = std::min(count * std::min(decoded_length, max_unrolled_zeroing + 1), max_unrolled_zeroing + 1);
+			}
+			return count;
+		}
+
+		bool is_reusable(const Instruction &instruction) const {
+			LocalVar *var = get_defined_var(instruction);
+			size_t num_lengths = get_lengths(instruction.rvalue).size();
+			if (!var || num_lengths == 0) return false;
+			if (std::find(this->function.parameter_vars.begin(), this->function.parameter_vars.end(), var) != this->function.parameter_vars.end()) return false;
+			for (const Use &use : var->uses) {
+				if (use.is_terminator || !is_private_use(this->function.inst(use.user), var)) return false;
+			}
+			// what zeroing the array takes
+			if (!is_stored_into(this->function, var)) return true;
+			Opt<int64_t> element_count = get_element_count(instruction.rvalue);
+			return (element_count && *element_count <= max_unrolled_zeroing) || num_lengths == 1;
+		}
+
+		// whether the instruction only reads the variable as the target of
+		// accesses, lengths and `= 0` tests, none of which let the array
+		// escape
+		static bool is_private_use(const Instruction &instruction, LocalVar *var) {
+			size_t num_reads = 0;
+			visit_reads(instruction, [&](const Operand &operand) {
+				if (operand == Operand(var)) num_reads += 1;
+			}, [&](const LocalVar *target) {
+				if (target == var) num_reads += 1;
+			});
+
+			size_t num_private_reads = 0;
+			if (instruction.destination.has_value() && !instruction.destination->indices.empty() && instruction.destination->target == var) {
+				num_private_reads += 1;
+			}
+			const Rvalue &rvalue = instruction.rvalue;
+			if (const Place *place = std::get_if<Place>(&rvalue.value); place && !place->indices.empty() && place->target == var) {
+				num_private_reads += 1;
+			} else if (const LengthGetter *length = std::get_if<LengthGetter>(&rvalue.value); length && length->target == Operand(var)) {
+				num_private_reads += 1;
+			} else if (const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&rvalue.value); bin_op && bin_op->op == Operator::eq) {
+				Operand null = Int64Constant { 0 };
+				if ((bin_op->lhs == Operand(var) && bin_op->rhs == null) || (bin_op->lhs == null && bin_op->rhs == Operand(var))) {
+					num_private_reads += 1;
+				}
+			}
+			return num_reads == num_private_reads;
+		}
+
+		// whether the loop assigns the variable that the operand reads
+		bool is_assigned_in(uint32_t loop, const Operand &operand) const {
+			LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+			if (!var) return false;
+			return std::any_of((*var)->defs.begin(), (*var)->defs.end(), [&](InstId def) {
+				return this->forest.contains(loop, this->function.parent_of(def));
+			});
+		}
+
+		// the preheader of the outermost loop around the block that doesn't
+		// assign the allocation's lengths, or no_block
+		BlockId find_outermost_preheader(BlockId block, const Rvalue &allocation) const {
+			SmallVec<Operand, 3> lengths = get_lengths(allocation);
+			BlockId result = no_block;
+			for (uint32_t loop = this->forest.innermost_loops[block]; loop != LoopForest::no_loop; loop = this->forest.loops[loop].parent) {
+				// and so do the loops around it
+				if (std::any_of(lengths.begin(), lengths.end(), [&](const Operand &length) { return this->is_assigned_in(loop, length); })) break;
+				if (!is_transformable_loop(this->function, this->forest, loop)) continue;
+				BlockId preheader = find_preheader(this->function, this->forest, loop, this->predecessors);
+				if (preheader != no_block) result = preheader;
+			}
+			return result;
+		}
+
+		static bool is_stored_into(const FunctionDef &function, const LocalVar *var) {
+			return std::any_of(var->uses.begin(), var->uses.end(), [&](const Use &use) {
+				const Opt<Place> &destination = function.inst(use.user).destination;
+				return destination.has_value() && destination->target == var;
+			});
+		}
+
+		void emit_reuse(const Allocation &allocation) {
+			BlockId block = this->function.parent_of(allocation.inst);
+			Instruction instruction = this->function.inst(allocation.inst);
+			LocalVar *var = get_defined_var(instruction);
+			LocalVar *scratch = allocation.scratch;
+			SmallVec<Operand, 3> lengths = get_lengths(instruction.rvalue);
+			bool needs_zeroing = is_stored_into(this->function, var);
+			Opt<int64_t> element_count = get_element_count(instruction.rvalue);
+
+			if (!allocation.is_lazy && (!needs_zeroing || *element_count <= max_unrolled_zeroing)) {
+				if (needs_zeroing) {
+					this->emit_zeroing_stores(block, allocation.inst, scratch, lengths);
+				}
+				this->function.replace_inst(allocation.inst, Place(var), Operand(scratch));
+				return;
+			}
+
+			// the allocation starts a block of its own, which the ways of
+			// getting a zeroed array go on to
+			BlockId rest = this->function.create_block(false, "scratchrest");
+			for (InstId inst = allocation.inst; inst != no_inst;) {
+				InstId next = this->function.next_inst(inst);
+				this->function.move_inst(inst, rest, no_inst);
+				inst = next;
+			}
+			this->function.set_terminator(rest, this->function.block(block).terminator);
+			BlockId zeroing = needs_zeroing ? this->make_zeroing_loop(scratch, lengths[0], rest) : rest;
+			if (allocation.is_lazy) {
+				BlockId allocating = this->function.create_block(false, "scratchalloc");
+				this->function.append_inst(allocating, Place(scratch), mv(instruction.rvalue));
+				this->function.set_terminator(allocating, BasicBlock::Goto { rest });
+				LocalVar *is_new = this->function.create_local_var(false, "", Type { Type::ArrayType { 0 } });
+				this->function.append_inst(block, Place(is_new), BinaryOperation { Operand(scratch), Operand(Int64Constant { 0 }), Operator::eq });
+				this->function.set_terminator(block, BasicBlock::Branch { Operand(is_new), allocating, zeroing });
+			} else {
+				this->function.set_terminator(block, BasicBlock::Goto { zeroing });
+			}
+			this->function.replace_inst(allocation.inst, Place(var), Operand(scratch));
+		}
+
+		// stores 0 (encoded) to every element of an array of constant
+		// lengths, right before `before`
+		void emit_zeroing_stores(BlockId block, InstId before, LocalVar *scratch, const SmallVec<Operand, 3> &lengths) {
+			size_t num_lengths = lengths.size();
+			Vec<int64_t> decoded_lengths;
+			for (const Operand &length : lengths) {
+				decoded_lengths.push_back(std::get<Int64Constant>(length.value).value >> 1);
+			}
+			if (std::find(decoded_lengths.begin(), decoded_lengths.end(), 0) != decoded_lengths.end()) return;
+			// counts through the elements' indices like an odometer
+			Vec<int64_t> indices(num_lengths, 0);
+			while (true) {
+				SmallVec<Operand, 3> index_operands;
+				for (int64_t index : indices) index_operands.push_back(Operand(Int64Constant { index }));
+				this->function.insert_inst(block, before, Place(scratch, mv(index_operands)), Operand(Int64Constant { 1 }));
+				size_t dimension = num_lengths;
+				while (dimension > 0 && ++indices[dimension - 1] == decoded_lengths[dimension - 1]) {
+					indices[dimension - 1] = 0;
+					dimension -= 1;
+				}
+				if (dimension == 0) break;
+			}
+		}
+
+		// a loop that stores 0 (encoded) to every element of a
+		// one-dimensional array or tuple and then goes on to `exit`.
+		// returns the block it starts at.
+		BlockId make_zeroing_loop(LocalVar *scratch, const Operand &length, BlockId exit) {
+			Type int64_type { Type::ArrayType { 0 } };
+			LocalVar *index = this->function.create_local_var(false, "", int64_type);
+			LocalVar *decoded_length = this->function.create_local_var(false, "", int64_type);
+			LocalVar *is_in_range = this->function.create_local_var(false, "", int64_type);
+			BlockId entry = this->function.create_block(false, "scratchzero");
+			BlockId test = this->function.create_block(false, "scratchzerotest");
+			BlockId body = this->function.create_block(false, "scratchzerobody");
+			this->function.append_inst(entry, Place(index), Operand(Int64Constant { 0 }));
+			this->function.append_inst(entry, Place(decoded_length), BinaryOperation { length, Operand(Int64Constant { 1 }), Operator::rshift });
+			this->function.set_terminator(entry, BasicBlock::Goto { test });
+			this->function.append_inst(test, Place(is_in_range), BinaryOperation { Operand(index), Operand(decoded_length), Operator::lt });
+			this->function.set_terminator(test, BasicBlock::Branch { Operand(is_in_range), body, exit });
+			this->function.append_inst(body, Place(scratch, { Operand(index) }), Operand(Int64Constant { 1 }));
+			this->function.append_inst(body, Place(index), BinaryOperation { Operand(index), Operand(Int64Constant { 1 }), Operator::plus });
+			this->function.set_terminator(body, BasicBlock::Goto { test });
+			return entry;
+		}
+	};
+
+	size_t reuse_loop_allocations(FunctionDef &function) {
+		insert_preheaders(function);
+		AllocationReuser reuser(function);
+		return reuser.reuse();
+	}
+}
@@ -0,0 +1,180 @@
+#include "mir_opt.h"
+#include "mir_analysis.h"
+
+namespace mir::opt {
+	static bool is_live_block(const FunctionDef &function, BlockId block) {
+		return !function.block(block).is_erased;
+	}
+
+	// turns branches and guards on constant conditions into unconditional
+	// control flow
+	static size_t fold_constant_branches(FunctionDef &function) {
+		size_t num_folded = 0;
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (!is_live_block(function, block)) continue;
+
+			for (InstId inst : function.insts_of(block)) {
+				const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value);
+				if (!guard) continue;
+				const Int64Constant *condition = std::get_if<Int64Constant>(&guard->condition.value);
+				if (!condition) continue;
+				num_folded += 1;
+				if (condition->value == 0) {
+					function.erase_inst(inst);
+				} else {
+					// the guard always fires, so nothing after it runs
+					BlockId target = guard->target;
+					while (function.block(block).last_inst != inst) {
+						function.erase_inst(function.block(block).last_inst);
+					}
+					function.erase_inst(inst);
+					function.set_terminator(block, BasicBlock::Goto { target });
+					break;
+				}
+			}
+
+			if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&function.block(block).terminator)) {
+				if (const Int64Constant *condition = std::get_if<Int64Constant>(&term->condition.value)) {
+					BlockId successor = condition->value != 0 ? term->then_block : term->else_block;
+					function.set_terminator(block, BasicBlock::Goto { successor });
+					num_folded += 1;
+				} else if (term->then_block == term->else_block) {
+					function.set_terminator(block, BasicBlock::Goto { term->then_block });
+					num_folded += 1;
+				}
+			}
+		}
+		return num_folded;
+	}
+
+	static size_t remove_unreachable_blocks(FunctionDef &function) {
+		Vec<bool> is_reachable(function.basic_blocks.size(), false);
+		for (BlockId block : analysis::compute_reverse_postorder(function)) {
+			is_reachable[block] = true;
+		}
+		size_t num_removed = 0;
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (is_live_block(function, block) && !is_reachable[block]) {
+				function.erase_block(block);
+				num_removed += 1;
+			}
+		}
+		return num_removed;
+	}
+
+	// makes jumps to empty blocks skip straight to where those blocks would
+	// have gone
+	static size_t thread_jumps(FunctionDef &function) {
+		// the block that control ends up in after entering the given block
+		// and passing through any empty blocks that just jump elsewhere
+		Vec<BlockId> destinations(function.basic_blocks.size(), no_block);
+		auto get_destination = [&](BlockId block) {
+			if (destinations[block] != no_block) {
+				return destinations[block];
+			}
+			// the entry block is never skipped because it holds the
+			// declarations. the step limit guards against cycles of empty
+			// blocks.
+			BlockId current = block;
+			for (size_t steps = 0; steps < function.basic_blocks.size(); ++steps) {
+				const BasicBlock &bb = function.block(current);
+				const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&bb.terminator);
+				if (current == 0 || bb.first_inst != no_inst || !term || term->successor == current) break;
+				current = term->successor;
+			}
+			destinations[block] = current;
+			return current;
+		};
+
+		size_t num_threaded = 0;
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (!is_live_block(function, block)) continue;
+
+			for (InstId inst : function.insts_of(block)) {
+				const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value);
+				if (guard && get_destination(guard->target) != guard->target) {
+					Guard new_guard { guard->condition, get_destination(guard->target) };
+					function.replace_inst(inst, {}, new_guard);
+					num_threaded += 1;
+				}
+			}
+
+			BasicBlock::Terminator terminator = function.block(block).terminator;
+			if (BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&terminator)) {
+				BlockId successor = term->successor;
+				const BasicBlock &successor_block = function.block(successor);
+				if (get_destination(successor) != successor) {
+					term->successor = get_destination(successor);
+				} else if (successor != block && successor != 0 && successor_block.first_inst == no_inst && !std::holds_alternative<BasicBlock::Goto>(successor_block.terminator)) {
+					// jumping to an empty block that returns or branches is
+					// the same as doing that directly
+					terminator = successor_block.terminator;
+				} else {
+					continue;
+				}
+			} else if (BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(&terminator)) {
+				BlockId then_destination = get_destination(term->then_block);
+				BlockId else_destination = get_destination(term->else_block);
+				if (then_destination == term->then_block && else_destination == term->else_block) continue;
+				term->then_block = then_destination;
+				term->else_block = else_destination;
+			} else {
+				continue;
+			}
+			function.set_terminator(block, terminator);
+			num_threaded += 1;
+		}
+		return num_threaded;
+	}
+
+	// appends each block to its predecessor if the predecessor always jumps
+	// to it and nothing else does
+	static size_t merge_blocks(FunctionDef &function) {
+		Vec<SmallVec<BlockId, 4>> predecessors = analysis::compute_predecessors(function);
+		Vec<bool> is_guard_target(function.basic_blocks.size(), false);
+		for (InstId inst : function.all_insts()) {
+			if (const Guard *guard = std::get_if<Guard>(&function.inst(inst).rvalue.value)) {
+				is_guard_target[guard->target] = true;
+			}
+		}
+
+		size_t num_merged = 0;
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (!is_live_block(function, block)) continue;
+			while (true) {
+				const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(&function.block(block).terminator);
+				if (!term) break;
+				BlockId successor = term->successor;
+				if (successor == block || successor == 0 || predecessors[successor].size() != 1 || is_guard_target[successor]) break;
+
+				while (function.block(successor).first_inst != no_inst) {
+					function.move_inst(function.block(successor).first_inst, block, no_inst);
+				}
+				function.set_terminator(block, function.block(successor).terminator);
+				function.erase_block(successor);
+				num_merged += 1;
+				// the successors of the merged block now have this block as
+				// their predecessor instead
+				for (BlockId next : function.get_successors(block)) {
+					for (BlockId &predecessor : predecessors[next]) {
+						if (predecessor == successor) predecessor = block;
+					}
+				}
+			}
+		}
+		return num_merged;
+	}
+
+	size_t simplify_cfg(FunctionDef &function) {
+		size_t num_changes = 0;
+		while (true) {
+			size_t num_new_changes = fold_constant_branches(function)
+				+ remove_unreachable_blocks(function)
+				+ thread_jumps(function)
+				+ merge_blocks(function);
+			if (num_new_changes == 0) break;
+			num_changes += num_new_changes;
+		}
+		return num_changes;
+	}
+}
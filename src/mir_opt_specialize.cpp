@@ -0,0 +1,192 @@
+#include "mir_opt.h"
+#include "mir_opt_functions.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	// bounds on the code that specialization may add
+	constexpr size_t max_clones_per_function = 2;
+	constexpr size_t max_clones = 8;
+	constexpr size_t max_specialized_size = 400;
+
+	// Clones a function for calls that tell it something about its
+	// arguments, and makes those calls call the clone. A constant argument
+	// (a number or a function) is dropped from the clone's parameters and
+	// assigned to the parameter's variable at the clone's entry instead,
+	// where constant propagation picks it up. An array argument that is
+	// known to be allocated at the call makes the clone's tests of that
+	// parameter against 0 false, as long as the clone never reassigns it.
+	//
+	// Only calls in loops, or of functions that have loops, are worth the
+	// extra code, and only callees that aren't recursive qualify, so that
+	// the clones aren't either. Calls that tell the callee the same things
+	// share a clone, and the clones are limited per function and in total.
+	class Specializer {
+		Program &program;
+		FunctionDef &function;
+		const analysis::CallGraph &call_graph;
+		const analysis::AllocationSummaries &summaries;
+		Specializations &specializations;
+
+		public:
+
+		Specializer(Program &program, FunctionDef &function, const analysis::CallGraph &call_graph, const analysis::AllocationSummaries &summaries, Specializations &specializations) :
+			program { program }, function { function }, call_graph { call_graph }, summaries { summaries }, specializations { specializations }
+		{}
+
+		// returns the number of calls retargeted to clones
+		size_t specialize() {
+			Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(this->function);
+			analysis::DominatorTree dominators(this->function, reverse_postorder);
+			LoopForest forest(this->function, reverse_postorder, dominators);
+			analysis::KnownAllocations known_allocations(this->function, reverse_postorder, &this->summaries);
+
+			// decided up front, since retargeting doesn't change what is
+			// known at the other calls
+			Vec<Pair<InstId, Vec<ArgumentFact>>> calls;
+			for (BlockId block : reverse_postorder) {
+				bool is_in_loop = forest.innermost_loops[block] != LoopForest::no_loop;
+				utils::BitSet state = known_allocations.get_entry_state(block);
+				for (InstId inst : this->function.insts_of(block)) {
+					if (Opt<Vec<ArgumentFact>> facts = this->get_facts(inst, state, known_allocations, is_in_loop)) {
+						calls.push_back({ inst, mv(*facts) });
+					}
+					known_allocations.transfer(state, inst);
+				}
+			}
+
+			size_t num_specialized = 0;
+			for (const auto &[inst, facts] : calls) {
+				FunctionCall call = std::get<FunctionCall>(this->function.inst(inst).rvalue.value);
+				FunctionDef *callee = std::get<CodeConstant>(call.callee.value).value;
+				FunctionDef *clone = this->get_clone(*callee, facts);
+				if (!clone) continue;
+
+				FunctionCall new_call { CodeConstant { clone }, {} };
+				for (size_t i = 0; i < call.arguments.size(); ++i) {
+					if (facts[i].kind != ArgumentFact::Kind::constant) new_call.arguments.push_back(call.arguments[i]);
+				}
+				this->function.replace_inst(inst, this->function.inst(inst).destination, mv(new_call));
+				num_specialized += 1;
+			}
+			return num_specialized;
+		}
+
+		private:
+
+		struct ArgumentFact {
+			enum struct Kind { none, constant, allocated };
+			Kind kind;
+			Opt<Operand> constant;
+		};
+
+		Opt<Vec<ArgumentFact>> get_facts(InstId inst, const utils::BitSet &state, const analysis::KnownAllocations &known_allocations, bool is_in_loop) const {
+			const FunctionCall *call = std::get_if<FunctionCall>(&this->function.inst(inst).rvalue.value);
+			if (!call) return {};
+			const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value);
+			if (!callee || callee->value->user_given_name == "main" || this->call_graph.is_recursive(callee->value)) return {};
+			if (call->arguments.size() != callee->value->parameter_vars.size()) return {};
+			if (get_function_size(*callee->value) > max_specialized_size) return {};
+			if (!is_in_loop && !has_loop(*callee->value)) return {};
+
+			Vec<ArgumentFact> facts;
+			bool has_fact = false;
+			for (const Operand &argument : call->arguments) {
+				LocalVar *const *var = std::get_if<LocalVar *>(&argument.value);
+				if (!var) {
+					facts.push_back({ ArgumentFact::Kind::constant, argument });
+				} else if (known_allocations.is_allocated(state, *var)) {
+					facts.push_back({ ArgumentFact::Kind::allocated, {} });
+				} else {
+					facts.push_back({ ArgumentFact::Kind::none, {} });
+				}
+				has_fact = has_fact || facts.back().kind != ArgumentFact::Kind::none;
+			}
+			if (!has_fact) return {};
+			return facts;
+		}
+
+		static bool has_loop(const FunctionDef &function) {
+			Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(function);
+			analysis::DominatorTree dominators(function, reverse_postorder);
+			return !LoopForest(function, reverse_postorder, dominators).loops.empty();
+		}
+
+		// the clone of the callee for calls with these facts about their
+		// arguments, made if need be and the limits allow it
+		FunctionDef *get_clone(FunctionDef &callee, const Vec<ArgumentFact> &facts) {
+			std::string key = callee.get_unambiguous_name() + "(";
+			for (const ArgumentFact &fact : facts) {
+				if (fact.kind == ArgumentFact::Kind::constant) {
+					key += fact.constant->to_ir_syntax();
+				} else if (fact.kind == ArgumentFact::Kind::allocated) {
+					key += "allocated";
+				}
+				key += ",";
+			}
+			key += ")";
+			auto it = this->specializations.clones.find(key);
+			if (it != this->specializations.clones.end()) return it->second;
+			size_t &num_clones = this->specializations.num_clones[&callee];
+			if (num_clones >= max_clones_per_function || this->specializations.clones.size() >= max_clones) return nullptr;
+			num_clones += 1;
+
+			Uptr<FunctionDef> clone = mkuptr<FunctionDef>(this->get_clone_name(callee), callee.return_type);
+			Map<const LocalVar *, LocalVar *> var_copies;
+			auto map_var = [&](LocalVar *var) {
+				auto it = var_copies.find(var);
+				if (it != var_copies.end()) return it->second;
+				LocalVar *copy = clone->create_local_var(var->is_user_declared, var->name, var->type);
+				var_copies[var] = copy;
+				return copy;
+			};
+			for (size_t i = 0; i < facts.size(); ++i) {
+				LocalVar *parameter = map_var(callee.parameter_vars[i]);
+				if (facts[i].kind != ArgumentFact::Kind::constant) clone->parameter_vars.push_back(parameter);
+			}
+			copy_function_body(*clone, callee, map_var);
+
+			for (size_t i = 0; i < facts.size(); ++i) {
+				LocalVar *parameter = var_copies.at(callee.parameter_vars[i]);
+				if (facts[i].kind == ArgumentFact::Kind::constant) {
+					clone->insert_inst(0, clone->block(0).first_inst, Place(parameter), *facts[i].constant);
+				} else if (facts[i].kind == ArgumentFact::Kind::allocated && parameter->defs.empty()) {
+					// copied, since replacing changes the uses
+					Vec<Use> uses = parameter->uses;
+					for (const Use &use : uses) {
+						if (use.is_terminator) continue;
+						const Instruction &instruction = clone->inst(use.user);
+						const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+						if (!bin_op || bin_op->op != Operator::eq) continue;
+						Operand null = Int64Constant { 0 };
+						if ((bin_op->lhs == Operand(parameter) && bin_op->rhs == null) || (bin_op->lhs == null && bin_op->rhs == Operand(parameter))) {
+							clone->replace_inst(use.user, instruction.destination, null);
+						}
+					}
+				}
+			}
+
+			FunctionDef *result = clone.get();
+			this->program.function_defs.push_back(mv(clone));
+			this->specializations.clones[key] = result;
+			this->specializations.new_clones.push_back(result);
+			return result;
+		}
+
+		std::string get_clone_name(const FunctionDef &callee) const {
+			for (size_t i = 1;; ++i) {
+				std::string name = callee.get_unambiguous_name() + "_spec" + std::to_string(i);
+				bool is_taken = std::any_of(this->program.function_defs.begin(), this->program.function_defs.end(), [&](const Uptr<FunctionDef> &function) {
+					return function->user_given_name == name;
+				});
+				if (!is_taken) return name;
+			}
+		}
+	};
+
+	size_t specialize_calls(Program &program, FunctionDef &function, const analysis::CallGraph &call_graph, const analysis::AllocationSummaries &summaries, Specializations &specializations) {
+		Specializer specializer(program, function, call_graph, summaries, specializations);
+		return specializer.specialize();
+	}
+}
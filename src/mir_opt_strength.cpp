@@ -0,0 +1,512 @@
+#include "mir_opt.h"
+#include "mir_opt_loops.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	static LocalVar *get_var(const Operand &operand) {
+		LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+		return var ? *var : nullptr;
+	}
+
+	static Opt<int64_t> get_constant(const Operand &operand) {
+		const Int64Constant *constant = std::get_if<Int64Constant>(&operand.value);
+		if (!constant) return {};
+		return constant->value;
+	}
+
+	// arithmetic that wraps around like the target's instead of being
+	// undefined on overflow
+	static int64_t wrapping_add(int64_t a, int64_t b) {
+		return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+	}
+
+	static int64_t wrapping_multiply(int64_t a, int64_t b) {
+		return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+	}
+
+	// k if the value (read as unsigned) is 2^k
+	static Opt<int64_t> get_exponent(int64_t value) {
+		uint64_t bits = static_cast<uint64_t>(value);
+		if (bits == 0 || (bits & (bits - 1)) != 0) return {};
+		int64_t exponent = 0;
+		while (bits > 1) {
+			bits >>= 1;
+			exponent += 1;
+		}
+		return exponent;
+	}
+
+	static bool is_int64(const LocalVar *var) {
+		const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&var->type.type);
+		return array_type && array_type->num_dimensions == 0;
+	}
+
+	// whether a multiplication by the constant is worth at most one
+	// simple operation
+	static bool is_cheap_factor(int64_t factor) {
+		return factor == 0 || factor == 1 || get_exponent(factor).has_value();
+	}
+
+	// Finds which variables hold another variable decoded (`x >> 1`)
+	// where each instruction reads them: the SSA name that the instruction
+	// reads (see analysis::SsaNames) is that of a decode, and the variable
+	// decoded still has the name it had there.
+	class DecodedValues {
+		// a decode's source and the name that it decoded
+		struct Decode {
+			LocalVar *source;
+			uint32_t name;
+		};
+		// a variable that an instruction reads, holding the source decoded
+		struct DecodedRead {
+			const LocalVar *var;
+			LocalVar *source;
+		};
+
+		// for each instruction when the analysis ran
+		Vec<SmallVec<DecodedRead, 1>> decoded_reads;
+
+		public:
+
+		explicit DecodedValues(const FunctionDef &function) :
+			decoded_reads(function.instructions.size())
+		{
+			analysis::DominatorTree dominators(function, analysis::compute_reverse_postorder(function));
+			analysis::SsaNames names(function, dominators);
+			Vec<Decode> decodes(names.num_names, Decode { nullptr, 0 }); // by the name of the decode
+			for (InstId inst : function.all_insts()) {
+				const Instruction &instruction = function.inst(inst);
+				LocalVar *dest = get_defined_var(instruction);
+				const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+				if (!dest || !bin_op || bin_op->op != Operator::rshift || bin_op->rhs != Operand(Int64Constant { 1 })) continue;
+				LocalVar *source = get_var(bin_op->lhs);
+				if (!source || source == dest) continue;
+				decodes[names.def_names[inst]] = { source, names.inst_reads[inst][0].name };
+			}
+			names.walk([&](InstId inst) {
+				BlockId block = function.parent_of(inst);
+				for (const analysis::SsaNames::NameRead &read : names.inst_reads[inst]) {
+					const Decode &decode = decodes[read.name];
+					if (!decode.source || names.may_lack_phi(decode.source, block)) continue;
+					if (names.get_current_name(decode.source) != decode.name) continue;
+					this->decoded_reads[inst].push_back({ read.var, decode.source });
+				}
+			}, [](BlockId) {});
+		}
+
+		// the variable that `var` holds decoded where the instruction reads
+		// it, if any. nothing is known about instructions added since the
+		// analysis ran.
+		LocalVar *get_source(InstId inst, const LocalVar *var) const {
+			if (inst >= this->decoded_reads.size()) return nullptr;
+			for (const DecodedRead &read : this->decoded_reads[inst]) {
+				if (read.var == var) return read.source;
+			}
+			return nullptr;
+		}
+	};
+
+	// Rewrites the arithmetic that the lowering wraps in decodes and an
+	// encode to work on the encoded values directly. With a = 2x + 1 and
+	// b = 2y + 1, the encoding of x + y is a + b - 1, of x - y it's
+	// a - b + 1, and of x * c for a constant c it's a * c - c + 1, so
+	// `%x <- %a >> 1`, `%p <- %x + 3`, `%e <- %p << 1`, `%e <- %e + 1`
+	// becomes `%e <- %a + 6`. These hold modulo 2^64 as well, so the
+	// results are the same even when the arithmetic overflows.
+	//
+	// The lowering only ever stores encoded values into the int64
+	// variables that the program declares, and its temporaries that are
+	// only ever assigned encodes are encoded too, so both are known to be
+	// encoded everywhere. An operation and the encode of its result are
+	// only matched within a block, which is where the lowering puts them,
+	// but the decodes of the operands may come from anywhere they still
+	// hold, since common subexpression elimination leaves one decode of a
+	// variable for several operations.
+	class TaggedArithmeticSimplifier {
+		// `op` applied to the decodings of the two encoded operands
+		struct DecodedOperation {
+			Operator op;
+			Operand lhs;
+			Operand rhs;
+		};
+
+		FunctionDef &function;
+		Vec<BlockId> reverse_postorder;
+		DecodedValues decoded_values;
+		Set<const LocalVar *> encoded_temps;
+		// the operations on decoded values computed so far in the block
+		Vec<Pair<LocalVar *, DecodedOperation>> operations;
+
+		public:
+
+		explicit TaggedArithmeticSimplifier(FunctionDef &function) :
+			function { function },
+			reverse_postorder { analysis::compute_reverse_postorder(function) },
+			decoded_values(function)
+		{
+			for (const Uptr<LocalVar> &var : function.local_vars) {
+				if (var->is_user_declared || var->defs.empty()) continue;
+				bool is_encoded = std::all_of(var->defs.begin(), var->defs.end(), [&](InstId def) {
+					InstId prev = function.prev_inst(def);
+					InstId next = function.next_inst(def);
+					return this->is_encode(def, next) || (prev != no_inst && this->is_encode(prev, def));
+				});
+				if (is_encoded) this->encoded_temps.insert(var.get());
+			}
+		}
+
+		size_t simplify() {
+			size_t num_simplified = 0;
+			for (BlockId block : this->reverse_postorder) {
+				num_simplified += this->simplify_block(block);
+			}
+			return num_simplified;
+		}
+
+		private:
+
+		size_t simplify_block(BlockId block) {
+			this->operations.clear();
+			size_t num_simplified = 0;
+			InstId next = no_inst;
+			for (InstId inst = this->function.block(block).first_inst; inst != no_inst; inst = next) {
+				next = this->function.next_inst(inst);
+				const Instruction &instruction = this->function.inst(inst);
+				LocalVar *dest = get_defined_var(instruction);
+				if (!dest) continue;
+				if (this->is_encode(inst, next)) {
+					// the second half of the encode only finishes it
+					InstId after_encode = this->function.next_inst(next);
+					if (this->simplify_encode(inst, next)) num_simplified += 1;
+					this->forget(dest);
+					next = after_encode;
+					continue;
+				}
+				const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+				Opt<DecodedOperation> operation;
+				if (bin_op) operation = this->get_decoded_operation(inst, *bin_op);
+				this->forget(dest);
+				if (operation && !this->reads(*operation, dest)) this->operations.push_back({ dest, *operation });
+			}
+			return num_simplified;
+		}
+
+		bool is_encoded(const LocalVar *var) const {
+			if (var->is_user_declared) return is_int64(var);
+			return this->encoded_temps.count(var) > 0;
+		}
+
+		// the encoded operand whose decoding the instruction's operand holds
+		Opt<Operand> get_encoded(InstId inst, const Operand &operand) const {
+			if (Opt<int64_t> constant = get_constant(operand)) {
+				return Operand(Int64Constant { wrapping_add(wrapping_multiply(*constant, 2), 1) });
+			}
+			LocalVar *source = this->decoded_values.get_source(inst, get_var(operand));
+			if (!source || !this->is_encoded(source)) return {};
+			return Operand(source);
+		}
+
+		Opt<DecodedOperation> get_decoded_operation(InstId inst, const BinaryOperation &bin_op) const {
+			if (bin_op.op != Operator::plus && bin_op.op != Operator::minus && bin_op.op != Operator::times) return {};
+			Opt<Operand> lhs = this->get_encoded(inst, bin_op.lhs);
+			Opt<Operand> rhs = this->get_encoded(inst, bin_op.rhs);
+			if (!lhs || !rhs) return {};
+			if (get_constant(*lhs) && get_constant(*rhs)) return {};
+			// only multiplying by a constant distributes over the encoding
+			if (bin_op.op == Operator::times && !get_constant(bin_op.lhs) && !get_constant(bin_op.rhs)) return {};
+			return DecodedOperation { bin_op.op, *lhs, *rhs };
+		}
+
+		static bool reads(const DecodedOperation &operation, const LocalVar *var) {
+			return get_var(operation.lhs) == var || get_var(operation.rhs) == var;
+		}
+
+		// whether the instruction and the next one are `%dest <- %x << 1`
+		// and `%dest <- %dest + 1`
+		bool is_encode(InstId inst, InstId next) const {
+			const Instruction &instruction = this->function.inst(inst);
+			LocalVar *dest = get_defined_var(instruction);
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+			if (!dest || !bin_op || bin_op->op != Operator::lshift || bin_op->rhs != Operand(Int64Constant { 1 }) || next == no_inst) return false;
+			const Instruction &next_instruction = this->function.inst(next);
+			const BinaryOperation *next_bin_op = std::get_if<BinaryOperation>(&next_instruction.rvalue.value);
+			return get_defined_var(next_instruction) == dest && next_bin_op && next_bin_op->op == Operator::plus
+				&& next_bin_op->lhs == Operand(dest) && next_bin_op->rhs == Operand(Int64Constant { 1 });
+		}
+
+		// rewrites the encode of an operation on decoded values, if it is
+		// one. returns whether it did.
+		bool simplify_encode(InstId inst, InstId next) {
+			LocalVar *dest = get_defined_var(this->function.inst(inst));
+			LocalVar *encoded = get_var(std::get<BinaryOperation>(this->function.inst(inst).rvalue.value).lhs);
+			const DecodedOperation *found = nullptr;
+			for (const auto &[var, operation] : this->operations) {
+				if (var == encoded) found = &operation;
+			}
+			if (!found) return false;
+			DecodedOperation operation = *found;
+			Opt<int64_t> lhs_constant = get_constant(operation.lhs);
+			Opt<int64_t> rhs_constant = get_constant(operation.rhs);
+			Opt<BinaryOperation> result;
+			Opt<int64_t> adjustment;
+			switch (operation.op) {
+				case Operator::plus:
+					if (rhs_constant) {
+						result = BinaryOperation { operation.lhs, Operand(Int64Constant { wrapping_add(*rhs_constant, -1) }), Operator::plus };
+					} else if (lhs_constant) {
+						result = BinaryOperation { operation.rhs, Operand(Int64Constant { wrapping_add(*lhs_constant, -1) }), Operator::plus };
+					} else {
+						result = BinaryOperation { operation.lhs, operation.rhs, Operator::plus };
+						adjustment = -1;
+					}
+					break;
+				case Operator::minus:
+					if (rhs_constant) {
+						result = BinaryOperation { operation.lhs, Operand(Int64Constant { wrapping_add(1, -*rhs_constant) }), Operator::plus };
+					} else if (lhs_constant) {
+						result = BinaryOperation { Operand(Int64Constant { wrapping_add(*lhs_constant, 1) }), operation.rhs, Operator::minus };
+					} else {
+						result = BinaryOperation { operation.lhs, operation.rhs, Operator::minus };
+						adjustment = 1;
+					}
+					break;
+				case Operator::times: {
+					// the constant is the encoded factor
+					int64_t factor = (rhs_constant ? *rhs_constant : *lhs_constant) >> 1;
+					const Operand &value = rhs_constant ? operation.lhs : operation.rhs;
+					result = BinaryOperation { value, Operand(Int64Constant { factor }), Operator::times };
+					adjustment = wrapping_add(1, -factor);
+					break;
+				}
+				default:
+					return false;
+			}
+			this->function.replace_inst(inst, Place(dest), *result);
+			if (adjustment && *adjustment != 0) {
+				this->function.replace_inst(next, Place(dest), BinaryOperation { Operand(dest), Operand(Int64Constant { *adjustment }), Operator::plus });
+			} else {
+				this->function.erase_inst(next);
+			}
+			return true;
+		}
+
+		// drops the operations that depend on the variable
+		void forget(LocalVar *var) {
+			this->operations.erase(std::remove_if(this->operations.begin(), this->operations.end(), [&](const auto &entry) {
+				return entry.first == var || reads(entry.second, var);
+			}), this->operations.end());
+		}
+	};
+
+	// Replaces multiplications in loops by a counter (or the counter
+	// decoded) and a value that doesn't change in the loop with a variable
+	// that holds the product all along: it's computed once in the
+	// preheader and increased by the counter's step times the value
+	// wherever the counter is increased. The loops handled are those where
+	// every assignment to the counter adds a constant to it, either
+	// directly or through a temporary assigned right before.
+	class InductionVariableReducer {
+		FunctionDef &function;
+		Vec<BlockId> reverse_postorder;
+		analysis::DominatorTree dominators;
+		LoopForest forest;
+		Vec<SmallVec<BlockId, 4>> predecessors;
+		DecodedValues decoded_values;
+
+		public:
+
+		explicit InductionVariableReducer(FunctionDef &function) :
+			function { function },
+			reverse_postorder { analysis::compute_reverse_postorder(function) },
+			dominators(function, this->reverse_postorder),
+			forest(function, this->reverse_postorder, this->dominators),
+			predecessors { analysis::compute_predecessors(function) },
+			decoded_values(function)
+		{}
+
+		// returns the number of multiplications replaced. inner loops go
+		// first, so a product of an outer loop's counter that was hoisted
+		// out of an inner loop is reduced in the outer one.
+		size_t reduce() {
+			size_t num_reduced = 0;
+			for (uint32_t loop = 0; loop < this->forest.loops.size(); ++loop) {
+				if (!is_transformable_loop(this->function, this->forest, loop)) continue;
+				BlockId preheader = find_preheader(this->function, this->forest, loop, this->predecessors);
+				if (preheader == no_block) continue;
+				num_reduced += this->reduce_in(loop, preheader);
+			}
+			return num_reduced;
+		}
+
+		private:
+
+		size_t reduce_in(uint32_t loop, BlockId preheader) {
+			const Vec<BlockId> &blocks = this->forest.loops[loop].blocks;
+			Map<const LocalVar *, Vec<InductionStep>> counters = find_induction_variables(this->function, this->dominators, blocks);
+			if (counters.empty()) return 0;
+			Set<const LocalVar *> assigned_vars;
+			for (BlockId block : blocks) {
+				for (InstId inst : this->function.insts_of(block)) {
+					if (LocalVar *dest = get_defined_var(this->function.inst(inst))) assigned_vars.insert(dest);
+				}
+			}
+			auto is_invariant = [&](const Operand &operand) {
+				LocalVar *var = get_var(operand);
+				return !var || !assigned_vars.count(var);
+			};
+
+			// the recurrences made so far: the counter, whether it's
+			// decoded, the value multiplied by, and the variable holding
+			// the product
+			Vec<std::tuple<LocalVar *, bool, Operand, LocalVar *>> recurrences;
+			size_t num_reduced = 0;
+			for (BlockId block : blocks) {
+				for (InstId inst : this->function.insts_of(block)) {
+					const Instruction &instruction = this->function.inst(inst);
+					LocalVar *dest = get_defined_var(instruction);
+					if (!dest) continue;
+					const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+
+					LocalVar *counter = nullptr;
+					bool is_decoded = false;
+					Opt<Operand> factor;
+					if (bin_op && bin_op->op == Operator::times) {
+						Pair<Operand, Operand> orders[] = { { bin_op->lhs, bin_op->rhs }, { bin_op->rhs, bin_op->lhs } };
+						for (const auto &[operand, other] : orders) {
+							LocalVar *var = get_var(operand);
+							if (!var || !is_invariant(other)) continue;
+							if (Opt<int64_t> constant = get_constant(other); constant && is_cheap_factor(*constant)) continue;
+							is_decoded = !counters.count(var);
+							counter = is_decoded ? this->decoded_values.get_source(inst, var) : var;
+							if (counter && !counters.count(counter)) counter = nullptr;
+							if (counter) {
+								factor = other;
+								break;
+							}
+						}
+					}
+					if (counter && is_decoded) {
+						for (const InductionStep &step : counters.at(counter)) {
+							if (step.amount % 2 != 0) counter = nullptr;
+						}
+					}
+
+					if (!counter) continue;
+
+					LocalVar *product = nullptr;
+					for (const auto &[other_counter, other_is_decoded, other_factor, var] : recurrences) {
+						if (other_counter == counter && other_is_decoded == is_decoded && other_factor == *factor) product = var;
+					}
+					if (!product) {
+						product = this->make_recurrence(preheader, counter, is_decoded, *factor, counters.at(counter));
+						recurrences.push_back({ counter, is_decoded, *factor, product });
+					}
+					this->function.replace_inst(inst, Place(dest), Operand(product));
+					num_reduced += 1;
+				}
+			}
+			return num_reduced;
+		}
+
+		// makes the variable that holds `counter * factor` (or
+		// `(counter >> 1) * factor`) throughout the loop
+		LocalVar *make_recurrence(BlockId preheader, LocalVar *counter, bool is_decoded, const Operand &factor, const Vec<InductionStep> &steps) {
+			LocalVar *product = this->function.create_local_var(false, "", counter->type);
+			Operand base(counter);
+			if (is_decoded) {
+				LocalVar *decoded = this->function.create_local_var(false, "", counter->type);
+				this->function.append_inst(preheader, Place(decoded), BinaryOperation { base, Operand(Int64Constant { 1 }), Operator::rshift });
+				base = Operand(decoded);
+			}
+			this->function.append_inst(preheader, Place(product), BinaryOperation { base, factor, Operator::times });
+
+			Vec<Pair<int64_t, Operand>> increments; // by the counter's step
+			for (const InductionStep &step : steps) {
+				int64_t amount = is_decoded ? step.amount / 2 : step.amount;
+				Opt<Operand> increment;
+				for (const auto &[other_amount, operand] : increments) {
+					if (other_amount == amount) increment = operand;
+				}
+				if (!increment) {
+					if (Opt<int64_t> constant = get_constant(factor)) {
+						increment = Operand(Int64Constant { wrapping_multiply(amount, *constant) });
+					} else if (amount == 1) {
+						increment = factor;
+					} else {
+						LocalVar *scaled = this->function.create_local_var(false, "", counter->type);
+						this->function.append_inst(preheader, Place(scaled), BinaryOperation { factor, Operand(Int64Constant { amount }), Operator::times });
+						increment = Operand(scaled);
+					}
+					increments.push_back({ amount, *increment });
+				}
+				BlockId block = this->function.parent_of(step.inst);
+				this->function.insert_inst(block, this->function.next_inst(step.inst), Place(product), BinaryOperation { Operand(product), *increment, Operator::plus });
+			}
+			return product;
+		}
+	};
+
+	// multiplications by constants that are worth at most two simple
+	// operations, as shifts and additions
+	static size_t reduce_constant_multiplications(FunctionDef &function) {
+		size_t num_reduced = 0;
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (function.block(block).is_erased) continue;
+			for (InstId inst : function.insts_of(block)) {
+				const Instruction &instruction = function.inst(inst);
+				const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+				LocalVar *dest = get_defined_var(instruction);
+				if (!bin_op || bin_op->op != Operator::times || !dest) continue;
+				Opt<int64_t> factor = get_constant(bin_op->rhs);
+				Operand value = bin_op->lhs;
+				if (!factor) {
+					factor = get_constant(bin_op->lhs);
+					value = bin_op->rhs;
+				}
+				if (!factor || get_constant(value)) continue;
+
+				auto shifted = [&](int64_t exponent) {
+					return BinaryOperation { value, Operand(Int64Constant { exponent }), Operator::lshift };
+				};
+				// the rewrites with two operations shift into a temporary
+				// first, since the destination may be the value
+				auto shift_into_temp = [&](int64_t exponent) {
+					LocalVar *temp = function.create_local_var(false, "", dest->type);
+					function.insert_inst(block, inst, Place(temp), shifted(exponent));
+					return Operand(temp);
+				};
+				int64_t negated = wrapping_multiply(*factor, -1);
+				Opt<Rvalue> result;
+				if (*factor == 0) {
+					result = Rvalue(Operand(Int64Constant { 0 }));
+				} else if (*factor == 1) {
+					result = Rvalue(value);
+				} else if (Opt<int64_t> exponent = get_exponent(*factor)) {
+					result = Rvalue(shifted(*exponent));
+				} else if (Opt<int64_t> exponent = get_exponent(wrapping_add(*factor, -1))) {
+					result = Rvalue(BinaryOperation { shift_into_temp(*exponent), value, Operator::plus });
+				} else if (Opt<int64_t> exponent = get_exponent(wrapping_add(*factor, 1))) {
+					result = Rvalue(BinaryOperation { shift_into_temp(*exponent), value, Operator::minus });
+				} else if (Opt<int64_t> exponent = get_exponent(negated)) {
+					result = Rvalue(BinaryOperation { Operand(Int64Constant { 0 }), *exponent == 0 ? value : shift_into_temp(*exponent), Operator::minus });
+				}
+				if (!result) continue;
+				function.replace_inst(inst, Place(dest), mv(*result));
+				num_reduced += 1;
+			}
+		}
+		return num_reduced;
+	}
+
+	size_t reduce_strength(FunctionDef &function) {
+		TaggedArithmeticSimplifier simplifier(function);
+		size_t num_reduced = simplifier.simplify();
+		insert_preheaders(function);
+		InductionVariableReducer reducer(function);
+		num_reduced += reducer.reduce();
+		num_reduced += reduce_constant_multiplications(function);
+		return num_reduced;
+	}
+}
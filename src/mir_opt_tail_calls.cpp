@@ -0,0 +1,91 @@
+#include "mir_opt.h"
+
+namespace mir::opt {
+	static LocalVar *get_var(const Operand &operand) {
+		LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+		return var ? *var : nullptr;
+	}
+
+	// whether the call is a call of the function itself whose result (if
+	// any) is returned right away, possibly through copies: the rest of
+	// the block is copies of the result, and the block returns the result
+	// or one of those copies
+	static bool is_self_tail_call(const FunctionDef &function, InstId inst) {
+		const Instruction &instruction = function.inst(inst);
+		const FunctionCall *call = std::get_if<FunctionCall>(&instruction.rvalue.value);
+		if (!call) return false;
+		const CodeConstant *callee = std::get_if<CodeConstant>(&call->callee.value);
+		if (!callee || callee->value != &function || call->arguments.size() != function.parameter_vars.size()) return false;
+		if (instruction.destination.has_value() && !instruction.destination->indices.empty()) return false;
+
+		Set<const LocalVar *> result_vars;
+		if (LocalVar *dest = get_defined_var(instruction)) result_vars.insert(dest);
+		for (InstId next = function.next_inst(inst); next != no_inst; next = function.next_inst(next)) {
+			const Instruction &copy = function.inst(next);
+			const Operand *source = std::get_if<Operand>(&copy.rvalue.value);
+			LocalVar *dest = get_defined_var(copy);
+			if (!source || !dest || !result_vars.count(get_var(*source))) return false;
+			result_vars.insert(dest);
+		}
+		const BasicBlock::Terminator &terminator = function.block(function.parent_of(inst)).terminator;
+		if (std::holds_alternative<BasicBlock::ReturnVoid>(terminator)) return true;
+		const BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(&terminator);
+		return term && result_vars.count(get_var(term->return_value));
+	}
+
+	size_t eliminate_tail_calls(FunctionDef &function) {
+		if (function.basic_blocks.empty()) return 0;
+		Vec<InstId> tail_calls;
+		for (BlockId block = 0; block < function.basic_blocks.size(); ++block) {
+			if (function.block(block).is_erased) continue;
+			for (InstId inst : function.insts_of(block)) {
+				if (is_self_tail_call(function, inst)) tail_calls.push_back(inst);
+			}
+		}
+		if (tail_calls.empty()) return 0;
+
+		// the entry block's instructions move to a new loop header, so that
+		// the tail calls can jump back to the start of the function
+		// without redoing whatever the entry block might be needed for
+		BlockId header = function.create_block(false, "tailrecursion");
+		for (InstId inst = function.block(0).first_inst; inst != no_inst;) {
+			InstId next = function.next_inst(inst);
+			function.move_inst(inst, header, no_inst);
+			inst = next;
+		}
+		function.set_terminator(header, function.block(0).terminator);
+		function.set_terminator(0, BasicBlock::Goto { header });
+
+		for (InstId inst : tail_calls) {
+			BlockId block = function.parent_of(inst);
+			FunctionCall call = std::get<FunctionCall>(function.inst(inst).rvalue.value);
+			// the copies of the result
+			for (InstId next = function.next_inst(inst); next != no_inst;) {
+				InstId after = function.next_inst(next);
+				function.erase_inst(next);
+				next = after;
+			}
+			function.erase_inst(inst);
+
+			// the arguments are all read, in order, before any parameter is
+			// reassigned, since an argument may read another parameter
+			Vec<Operand> arguments;
+			for (size_t i = 0; i < call.arguments.size(); ++i) {
+				LocalVar *parameter = function.parameter_vars[i];
+				if (LocalVar *var = get_var(call.arguments[i]); var && var != parameter) {
+					LocalVar *temp = function.create_local_var(false, "", parameter->type);
+					function.append_inst(block, Place(temp), Operand(var));
+					arguments.push_back(Operand(temp));
+				} else {
+					arguments.push_back(call.arguments[i]);
+				}
+			}
+			for (size_t i = 0; i < arguments.size(); ++i) {
+				if (arguments[i] == Operand(function.parameter_vars[i])) continue;
+				function.append_inst(block, Place(function.parameter_vars[i]), arguments[i]);
+			}
+			function.set_terminator(block, BasicBlock::Goto { header });
+		}
+		return tail_calls.size();
+	}
+}
@@ -0,0 +1,237 @@
+#include "mir_opt.h"
+#include "mir_opt_loops.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using analysis::LoopForest;
+
+	// a loop is only unrolled as far as its copies stay below this many
+	// instructions in total
+	constexpr size_t max_unrolled_size = 120;
+	// keeps the sum in the test in front of the copies from overflowing:
+	// the decoded counter is below 2^62 in size
+	constexpr int64_t max_step = 1 << 20;
+
+	static LocalVar *get_var(const Operand &operand) {
+		LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+		return var ? *var : nullptr;
+	}
+
+	// Runs `factor` iterations of a counted loop in a row without testing
+	// the loop's condition in between, whenever a test in front of them
+	// shows that the condition would hold for all of them. The original
+	// loop stays as the remainder loop: when fewer iterations than that
+	// are left, control goes on to it.
+	//
+	// The loops handled are innermost loops whose header computes
+	// `(i >> 1) < n` or `(i >> 1) <= n` for a bound n that doesn't change
+	// in the loop and stays in the loop while that holds, where i is
+	// assigned exactly once per iteration, adding the same positive even
+	// constant (the encoding of the step) each time. Each
+	// copy still computes the header's values, since the body may use
+	// them, but its branch becomes a jump into the body and the test is
+	// left for dead code elimination.
+	//
+	// Loops with guards left in them aren't unrolled: these are the
+	// copies of versioned loops that only run when some access is out of
+	// bounds, and loops whose checks are slow enough anyway that the loop
+	// overhead doesn't matter.
+	class LoopUnroller {
+		FunctionDef &function;
+		size_t factor;
+		Vec<BlockId> reverse_postorder;
+		analysis::DominatorTree dominators;
+		LoopForest forest;
+		Vec<SmallVec<BlockId, 4>> predecessors;
+
+		public:
+
+		LoopUnroller(FunctionDef &function, size_t factor) :
+			function { function },
+			factor { factor },
+			reverse_postorder { analysis::compute_reverse_postorder(function) },
+			dominators(function, this->reverse_postorder),
+			forest(function, this->reverse_postorder, this->dominators),
+			predecessors { analysis::compute_predecessors(function) }
+		{}
+
+		// returns the number of loops unrolled
+		size_t unroll() {
+			Vec<bool> has_inner_loop(this->forest.loops.size(), false);
+			for (const LoopForest::Loop &loop : this->forest.loops) {
+				if (loop.parent != LoopForest::no_loop) has_inner_loop[loop.parent] = true;
+			}
+			// the loops don't share blocks, so unrolling one doesn't change
+			// what was found out about the others
+			size_t num_unrolled = 0;
+			for (uint32_t loop = 0; loop < this->forest.loops.size(); ++loop) {
+				if (has_inner_loop[loop] || !is_transformable_loop(this->function, this->forest, loop)) continue;
+				BlockId preheader = find_preheader(this->function, this->forest, loop, this->predecessors);
+				if (preheader == no_block) continue;
+				if (this->unroll_loop(loop, preheader)) num_unrolled += 1;
+			}
+			return num_unrolled;
+		}
+
+		private:
+
+		// the counter's test in the header, as `decoded_counter op bound`
+		struct CounterTest {
+			LocalVar *counter;
+			Operator op; // lt or le
+			Operand bound;
+		};
+
+		bool unroll_loop(uint32_t loop, BlockId preheader) {
+			const LoopForest::Loop &loop_info = this->forest.loops[loop];
+			BlockId header = loop_info.header;
+
+			// the size model: how many copies fit
+			size_t size = 0;
+			for (BlockId block : loop_info.blocks) {
+				for (InstId inst : this->function.insts_of(block)) {
+					if (std::holds_alternative<Guard>(this->function.inst(inst).rvalue.value)) return false;
+					size += 1;
+				}
+				size += 1; // the terminator
+			}
+			size_t factor = std::min(this->factor, max_unrolled_size / size);
+			if (factor < 2) return false;
+
+			const BasicBlock::Branch *test = std::get_if<BasicBlock::Branch>(&this->function.block(header).terminator);
+			if (!test || !this->forest.contains(loop, test->then_block) || this->forest.contains(loop, test->else_block)) return false;
+			BlockId body_entry = test->then_block;
+			if (body_entry == header) return false;
+
+			Set<const LocalVar *> assigned_vars;
+			for (BlockId block : loop_info.blocks) {
+				for (InstId inst : this->function.insts_of(block)) {
+					if (LocalVar *dest = get_defined_var(this->function.inst(inst))) assigned_vars.insert(dest);
+				}
+			}
+			Opt<CounterTest> counter_test = this->find_counter_test(header, test->condition);
+			if (!counter_test) return false;
+			if (LocalVar *bound = get_var(counter_test->bound); bound && assigned_vars.count(bound)) return false;
+
+			// the counter's only def in the loop, which must run exactly once
+			// every iteration
+			Map<const LocalVar *, Vec<InductionStep>> counters = find_induction_variables(this->function, this->dominators, loop_info.blocks);
+			auto counter_steps = counters.find(counter_test->counter);
+			if (counter_steps == counters.end() || counter_steps->second.size() != 1) return false;
+			auto [counter_def, step] = counter_steps->second[0];
+			BlockId counter_block = this->function.parent_of(counter_def);
+			if (counter_block == header) return false;
+			for (BlockId predecessor : this->predecessors[header]) {
+				if (this->forest.contains(loop, predecessor) && !this->dominators.dominates(counter_block, predecessor)) return false;
+			}
+			if (step <= 0 || step % 2 != 0 || step / 2 > max_step) return false;
+
+			this->emit_copies(loop, preheader, *counter_test, step / 2, factor);
+			return true;
+		}
+
+		// the last def of the variable in the block before `before`
+		InstId find_def_in_block(BlockId block, const LocalVar *var, InstId before) const {
+			InstId result = no_inst;
+			for (InstId inst : this->function.insts_of(block)) {
+				if (inst == before) break;
+				if (get_defined_var(this->function.inst(inst)) == var) result = inst;
+			}
+			return result;
+		}
+
+		// the def of the operand in the block before `before`, if it's
+		// `%var <- x op 1`
+		InstId find_op_by_one(BlockId block, const Operand &operand, InstId before, Operator op) const {
+			LocalVar *var = get_var(operand);
+			InstId def = var ? this->find_def_in_block(block, var, before) : no_inst;
+			if (def == no_inst) return no_inst;
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&this->function.inst(def).rvalue.value);
+			if (!bin_op || bin_op->op != op || bin_op->rhs != Operand(Int64Constant { 1 })) return no_inst;
+			return def;
+		}
+
+		const BinaryOperation &get_bin_op(InstId inst) const {
+			return std::get<BinaryOperation>(this->function.inst(inst).rvalue.value);
+		}
+
+		// follows the header's condition back to a comparison of a decoded
+		// counter, through the encode and decode of the comparison's result
+		Opt<CounterTest> find_counter_test(BlockId header, const Operand &condition) const {
+			Operand compared = condition;
+			InstId def = no_inst;
+			// `((c << 1) + 1) >> 1` is c
+			if (InstId decode = this->find_op_by_one(header, condition, no_inst, Operator::rshift); decode != no_inst) {
+				InstId plus = this->find_op_by_one(header, this->get_bin_op(decode).lhs, decode, Operator::plus);
+				if (plus == no_inst) return {};
+				InstId shift = this->find_op_by_one(header, this->get_bin_op(plus).lhs, plus, Operator::lshift);
+				if (shift == no_inst) return {};
+				compared = this->get_bin_op(shift).lhs;
+				def = shift;
+			}
+			LocalVar *var = get_var(compared);
+			InstId comparison = var ? this->find_def_in_block(header, var, def) : no_inst;
+			if (comparison == no_inst) return {};
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&this->function.inst(comparison).rvalue.value);
+			if (!bin_op) return {};
+			Operator op = bin_op->op;
+			Operand lhs = bin_op->lhs, rhs = bin_op->rhs;
+			if (op == Operator::gt || op == Operator::ge) {
+				std::swap(lhs, rhs);
+				op = op == Operator::gt ? Operator::lt : Operator::le;
+			}
+			if (op != Operator::lt && op != Operator::le) return {};
+
+			InstId decode = this->find_op_by_one(header, lhs, comparison, Operator::rshift);
+			if (decode == no_inst) return {};
+			LocalVar *counter = get_var(this->get_bin_op(decode).lhs);
+			if (!counter) return {};
+			return CounterTest { counter, op, rhs };
+		}
+
+		void emit_copies(uint32_t loop, BlockId preheader, const CounterTest &counter_test, int64_t step, size_t factor) {
+			const Vec<BlockId> &blocks = this->forest.loops[loop].blocks;
+			BlockId header = this->forest.loops[loop].header;
+			BlockId body_entry = std::get<BasicBlock::Branch>(this->function.block(header).terminator).then_block;
+			size_t header_index = std::find(blocks.begin(), blocks.end(), header) - blocks.begin();
+			size_t body_entry_index = std::find(blocks.begin(), blocks.end(), body_entry) - blocks.begin();
+
+			// whether the counter's test holds for the next `factor`
+			// iterations, i.e. for the last of them
+			BlockId entry_test = this->function.create_block(false, "unrolltest");
+			LocalVar *decoded = this->make_temp(counter_test.counter);
+			this->function.append_inst(entry_test, Place(decoded), BinaryOperation { Operand(counter_test.counter), Operand(Int64Constant { 1 }), Operator::rshift });
+			LocalVar *last = this->make_temp(counter_test.counter);
+			this->function.append_inst(entry_test, Place(last), BinaryOperation { Operand(decoded), Operand(Int64Constant { step * static_cast<int64_t>(factor - 1) }), Operator::plus });
+			LocalVar *holds = this->make_temp(counter_test.counter);
+			this->function.append_inst(entry_test, Place(holds), BinaryOperation { Operand(last), counter_test.bound, counter_test.op });
+
+			Vec<Vec<BlockId>> copies;
+			for (size_t i = 0; i < factor; ++i) {
+				copies.push_back(clone_blocks(this->function, blocks, "unrolled"));
+				this->function.set_terminator(copies[i][header_index], BasicBlock::Goto { copies[i][body_entry_index] });
+			}
+			// each copy's back edges go on to the next copy, and the last
+			// one's back to the test
+			for (size_t i = 0; i < factor; ++i) {
+				BlockId next = i + 1 < factor ? copies[i + 1][header_index] : entry_test;
+				for (BlockId copy : copies[i]) {
+					retarget_edges(this->function, copy, copies[i][header_index], next);
+				}
+			}
+			this->function.set_terminator(entry_test, BasicBlock::Branch { Operand(holds), copies[0][header_index], header });
+			retarget_edges(this->function, preheader, header, entry_test);
+		}
+
+		LocalVar *make_temp(const LocalVar *counter) {
+			return this->function.create_local_var(false, "", counter->type);
+		}
+	};
+
+	size_t unroll_loops(FunctionDef &function, size_t factor) {
+		if (factor < 2) return 0;
+		insert_preheaders(function);
+		LoopUnroller unroller(function, factor);
+		return unroller.unroll();
+	}
+}
@@ -0,0 +1,835 @@
+#include "mir_opt.h"
+#include "mir_opt_loops.h"
+#include <algorithm>
+
+namespace mir::opt {
+	using utils::BitSet;
+	using analysis::LoopForest;
+
+	// loops with more instructions than this aren't copied
+	static constexpr size_t max_loop_size = 200;
+	// the test in front of the loop only lets the fast copy run if the
+	// values that the proof is about are at most this big, and the
+	// counter's last value at most half of it. a length needs no test: an
+	// array of 2^54 elements wouldn't fit in a 57 bit address space. with
+	// the limits on the forms below, nothing that the loop computes from
+	// those values can overflow, so the forms are exact.
+	static constexpr int64_t magnitude_bits = 56;
+	static constexpr int64_t max_magnitude = int64_t(1) << magnitude_bits;
+	static constexpr int64_t max_coefficient = 4;
+	static constexpr size_t max_terms = 4;
+	static constexpr int64_t max_constant = int64_t(1) << 20;
+
+	// a value that a form is made of: a variable's value at the top of the
+	// current iteration (which for a variable that the loop doesn't assign
+	// is its value throughout), or the length of one of an array's
+	// dimensions (-1 for a tuple). either can be decoded, i.e. shifted
+	// right by 1.
+	struct Term {
+		LocalVar *var;
+		bool is_length;
+		int64_t dimension;
+		bool is_decoded;
+
+		bool operator==(const Term &other) const {
+			return this->var == other.var && this->is_length == other.is_length
+				&& this->dimension == other.dimension && this->is_decoded == other.is_decoded;
+		}
+	};
+
+	// sum of coefficient * term, plus a constant
+	struct AffineForm {
+		Vec<Pair<Term, int64_t>> terms; // no zero coefficients
+		int64_t constant;
+
+		int64_t get_coefficient(const Term &term) const {
+			for (const auto &[other, coefficient] : this->terms) {
+				if (other == term) return coefficient;
+			}
+			return 0;
+		}
+	};
+
+	// `scale * (lhs op rhs) + offset`: a comparison's result, possibly
+	// encoded
+	struct Comparison {
+		Operator op;
+		AffineForm lhs;
+		AffineForm rhs;
+		int64_t scale;
+		int64_t offset;
+		// the instruction that computed exactly `lhs op rhs`, if the value
+		// came straight from one
+		InstId inst;
+	};
+
+	// the sum of comparisons' results, the way an access's checks are
+	// combined into the condition of a single guard. it's nonzero exactly
+	// when one of the comparisons holds.
+	struct CheckSum {
+		Vec<Comparison> comparisons;
+	};
+
+	using SymbolicValue = std::variant<AffineForm, Comparison, CheckSum>;
+
+	static AffineForm constant_form(int64_t constant) {
+		return { {}, constant };
+	}
+
+	static AffineForm term_form(Term term) {
+		AffineForm form { {}, 0 };
+		form.terms.push_back({ term, 1 });
+		return form;
+	}
+
+	static bool is_small(const AffineForm &form) {
+		if (form.terms.size() > max_terms) return false;
+		for (const auto &[term, coefficient] : form.terms) {
+			if (coefficient < -max_coefficient || coefficient > max_coefficient) return false;
+		}
+		return form.constant >= -max_constant && form.constant <= max_constant;
+	}
+
+	static Opt<AffineForm> add_forms(const AffineForm &a, const AffineForm &b, int64_t b_factor) {
+		AffineForm result = a;
+		for (const auto &[term, coefficient] : b.terms) {
+			bool is_found = false;
+			for (size_t i = 0; i < result.terms.size(); ++i) {
+				if (result.terms[i].first == term) {
+					result.terms[i].second += b_factor * coefficient;
+					if (result.terms[i].second == 0) result.terms.erase(result.terms.begin() + i);
+					is_found = true;
+					break;
+				}
+			}
+			if (!is_found) result.terms.push_back({ term, b_factor * coefficient });
+		}
+		result.constant += b_factor * b.constant;
+		if (!is_small(result)) return {};
+		return result;
+	}
+
+	static Opt<AffineForm> scale_form(const AffineForm &form, int64_t factor) {
+		if (factor == 0) return constant_form(0);
+		if (factor < -max_coefficient || factor > max_coefficient) return {};
+		return add_forms(constant_form(0), form, factor);
+	}
+
+	// the comparisons that a guard's condition adds up, if it is such a sum
+	static Opt<Vec<Comparison>> get_summed_comparisons(const SymbolicValue &value) {
+		if (const Comparison *comparison = std::get_if<Comparison>(&value)) {
+			if (comparison->inst == no_inst) return {};
+			return Vec<Comparison> { *comparison };
+		}
+		if (const CheckSum *sum = std::get_if<CheckSum>(&value)) return sum->comparisons;
+		// a comparison that was found not to hold
+		const AffineForm &form = std::get<AffineForm>(value);
+		if (form.terms.empty() && form.constant == 0) return Vec<Comparison> {};
+		return {};
+	}
+
+	// form >> 1, if that can be written as a form
+	static Opt<AffineForm> decode_form(const AffineForm &form) {
+		if (form.terms.size() == 1 && form.terms[0].second == 1 && form.constant == 0 && !form.terms[0].first.is_decoded) {
+			Term term = form.terms[0].first;
+			term.is_decoded = true;
+			return term_form(term);
+		}
+		AffineForm result { {}, form.constant >> 1 };
+		for (const auto &[term, coefficient] : form.terms) {
+			if (coefficient % 2 != 0) return {};
+			result.terms.push_back({ term, coefficient / 2 });
+		}
+		return result;
+	}
+
+	// Makes a second copy of a counted loop whose array and tuple checks
+	// are shown not to fail by a single test in front of the loop, and
+	// runs that copy instead of the original whenever the test passes.
+	// The original, with all its checks, still runs otherwise, so an
+	// access that is out of bounds reports the same error at the same
+	// point as before.
+	//
+	// The loops handled are innermost loops whose header tests a counter i
+	// against a bound that doesn't change in the loop (`i < n` or `i <= n`,
+	// decoded) and stays in the loop while the test holds, where every
+	// assignment to i in the loop adds a constant >= 0 to it (see
+	// find_induction_variables). The values that the checks compare
+	// are written as forms over the counter and the values that don't
+	// change in the loop, so each check's comparison is monotone in the
+	// counter, and it is enough to test it for the first iteration and
+	// for the last one the header's test allows. Guards on conditions that
+	// don't change in the loop at all are tested once as well. A check
+	// whose test would read a length is only removed if it runs in every
+	// iteration and the length is of an array or tuple, since the test
+	// reads it before the loop; a loop with any other such check is left
+	// alone.
+	class LoopVersioner {
+		FunctionDef &function;
+		const LoopForest &forest;
+		const analysis::DominatorTree &dominators;
+		const Vec<SmallVec<BlockId, 4>> &predecessors;
+		uint32_t loop;
+		BlockId preheader;
+
+		// the variables that the loop assigns, numbered
+		Map<const LocalVar *, uint32_t> loop_vars;
+		// the variables with a single def in the loop, mapped to its value
+		// and block
+		Map<const LocalVar *, Pair<SymbolicValue, BlockId>> single_def_values;
+		Map<const LocalVar *, uint32_t> num_defs_in_loop;
+
+		LocalVar *counter = nullptr;
+		AffineForm counter_bound; // the counter (decoded) stays below this
+		BlockId body_entry = no_block; // where the loop goes when the test holds
+		// the values of the guards' conditions where they are
+		Map<InstId, Opt<SymbolicValue>> guard_conditions;
+		// the blocks of the comparisons that the loop computes
+		Map<InstId, BlockId> comparison_blocks;
+
+		// the checks that the fast copy goes without: comparisons that are
+		// replaced by 0 there, with what has to be tested in the preheader
+		// as `difference op 0`, and guards on unchanging conditions, which
+		// are erased (these have no comparison)
+		Vec<Pair<InstId, Opt<Comparison>>> removable_checks;
+		// the guards on sums of comparisons, with the comparisons. a guard
+		// goes once all of them are removed.
+		Vec<Pair<InstId, Vec<InstId>>> summed_guards;
+		// whether a check reads a length that the loop may not read
+		bool has_speculative_read = false;
+
+		// what has been computed into the preheader so far
+		Vec<Pair<Term, Operand>> materialized_terms;
+		Vec<std::tuple<Term, int64_t, Operand>> materialized_products;
+
+		public:
+
+		LoopVersioner(FunctionDef &function, const LoopForest &forest, const analysis::DominatorTree &dominators, const Vec<SmallVec<BlockId, 4>> &predecessors, uint32_t loop, BlockId preheader) :
+			function { function }, forest { forest }, dominators { dominators }, predecessors { predecessors }, loop { loop }, preheader { preheader }
+		{}
+
+		// returns whether the loop was versioned
+		bool version() {
+			if (!this->analyze()) return false;
+			BlockId header = this->forest.loops[this->loop].header;
+			if (!this->emit_tests(header)) return false;
+			Vec<BlockId> copies = clone_blocks(this->function, this->forest.loops[this->loop].blocks, "fastpath");
+			this->remove_checks_in_copies(copies);
+			this->function.set_terminator(this->preheader, BasicBlock::Goto { copies[0] });
+			return true;
+		}
+
+		private:
+
+		bool analyze() {
+			const LoopForest::Loop &loop = this->forest.loops[this->loop];
+			size_t size = 0;
+			for (BlockId block : loop.blocks) {
+				for (InstId inst : this->function.insts_of(block)) {
+					size += 1;
+					if (LocalVar *dest = get_defined_var(this->function.inst(inst))) {
+						this->num_defs_in_loop[dest] += 1;
+						this->loop_vars.insert({ dest, static_cast<uint32_t>(this->loop_vars.size()) });
+					}
+				}
+			}
+			if (size > max_loop_size) return false;
+
+			const BasicBlock::Branch *test = std::get_if<BasicBlock::Branch>(&this->function.block(loop.header).terminator);
+			if (!test) return false;
+			bool stays_if_true = this->forest.contains(this->loop, test->then_block);
+			bool stays_if_false = this->forest.contains(this->loop, test->else_block);
+			if (stays_if_true == stays_if_false) return false;
+			this->body_entry = stays_if_true ? test->then_block : test->else_block;
+			if (this->body_entry == loop.header || this->predecessors[this->body_entry].size() != 1) return false;
+
+			Opt<SymbolicValue> condition = this->evaluate_blocks(test->condition);
+			if (!condition || !this->find_counter(*condition, stays_if_true)) return false;
+			// every assignment to the counter adds the encoding of a
+			// constant >= 0 to it
+			Map<const LocalVar *, Vec<InductionStep>> counters = find_induction_variables(this->function, this->dominators, loop.blocks);
+			auto counter_steps = counters.find(this->counter);
+			if (counter_steps == counters.end()) return false;
+			for (const InductionStep &step : counter_steps->second) {
+				if (step.amount < 0 || step.amount % 2 != 0) return false;
+			}
+			this->find_removable_checks();
+			return !this->has_speculative_read && !this->removable_checks.empty();
+		}
+
+		bool is_invariant(const AffineForm &form) const {
+			for (const auto &[term, coefficient] : form.terms) {
+				if (this->loop_vars.count(term.var) && !term.is_length) return false;
+			}
+			return true;
+		}
+
+		// whether the form only depends on the counter and on values that
+		// don't change in the loop, increasing or decreasing with the
+		// counter
+		bool is_monotone(const AffineForm &form) const {
+			int64_t encoded = 0, decoded = 0;
+			for (const auto &[term, coefficient] : form.terms) {
+				if (term.is_length || !this->loop_vars.count(term.var)) continue;
+				if (term.var != this->counter) return false;
+				(term.is_decoded ? decoded : encoded) = coefficient;
+			}
+			return (encoded >= 0 && decoded >= 0) || (encoded <= 0 && decoded <= 0);
+		}
+
+		// walks the loop's blocks, recording what the guards test. returns
+		// the value of the header's condition.
+		Opt<SymbolicValue> evaluate_blocks(const Operand &header_condition) {
+			const LoopForest::Loop &loop = this->forest.loops[this->loop];
+			// the loop's variables that may have been assigned since the
+			// top of the iteration, at the end of each block
+			Map<BlockId, BitSet> assigned_at_exit;
+			Opt<SymbolicValue> header_condition_value;
+
+			for (BlockId block : loop.blocks) {
+				BitSet assigned(this->loop_vars.size(), false);
+				if (block != loop.header) {
+					for (BlockId predecessor : this->predecessors[block]) {
+						auto it = assigned_at_exit.find(predecessor);
+						if (it == assigned_at_exit.end()) {
+							assigned = BitSet(this->loop_vars.size(), true);
+							break;
+						}
+						assigned.union_with(it->second);
+					}
+				}
+
+				Map<const LocalVar *, Opt<SymbolicValue>> local_values;
+				auto get_value = [&](const Operand &operand) -> Opt<SymbolicValue> {
+					if (const Int64Constant *constant = std::get_if<Int64Constant>(&operand.value)) {
+						return SymbolicValue(constant_form(constant->value));
+					}
+					LocalVar *const *var = std::get_if<LocalVar *>(&operand.value);
+					if (!var) return {};
+					if (auto it = local_values.find(*var); it != local_values.end()) return it->second;
+					auto loop_var_it = this->loop_vars.find(*var);
+					if (loop_var_it == this->loop_vars.end()) {
+						return SymbolicValue(term_form({ *var, false, 0, false }));
+					}
+					auto single_it = this->single_def_values.find(*var);
+					if (single_it != this->single_def_values.end() && single_it->second.second != block
+						&& this->dominators.dominates(single_it->second.second, block)) {
+						return single_it->second.first;
+					}
+					if (!assigned.test(loop_var_it->second)) {
+						return SymbolicValue(term_form({ *var, false, 0, false }));
+					}
+					return {};
+				};
+
+				for (InstId inst : this->function.insts_of(block)) {
+					const Instruction &instruction = this->function.inst(inst);
+					if (const Guard *guard = std::get_if<Guard>(&instruction.rvalue.value)) {
+						this->guard_conditions[inst] = get_value(guard->condition);
+						continue;
+					}
+					LocalVar *dest = get_defined_var(instruction);
+					if (!dest) continue;
+					Opt<SymbolicValue> value = this->evaluate(inst, instruction, get_value);
+					if (const Comparison *comparison = value ? std::get_if<Comparison>(&*value) : nullptr; comparison && comparison->inst == inst) {
+						this->comparison_blocks.insert({ inst, block });
+					}
+					if (this->num_defs_in_loop[dest] == 1 && value) {
+						this->single_def_values.insert({ dest, { *value, block } });
+					}
+					local_values[dest] = mv(value);
+					assigned.set(this->loop_vars.at(dest));
+				}
+				if (block == loop.header) header_condition_value = get_value(header_condition);
+				assigned_at_exit.insert({ block, mv(assigned) });
+			}
+
+			return header_condition_value;
+		}
+
+		template<typename GetValue>
+		Opt<SymbolicValue> evaluate(InstId inst, const Instruction &instruction, GetValue &get_value) const {
+			if (const Operand *operand = std::get_if<Operand>(&instruction.rvalue.value)) {
+				return get_value(*operand);
+			}
+			if (const LengthGetter *length_getter = std::get_if<LengthGetter>(&instruction.rvalue.value)) {
+				LocalVar *const *target = std::get_if<LocalVar *>(&length_getter->target.value);
+				if (!target || this->loop_vars.count(*target)) return {};
+				int64_t dimension = -1;
+				if (length_getter->dimension) {
+					const Int64Constant *constant = std::get_if<Int64Constant>(&length_getter->dimension->value);
+					if (!constant) return {};
+					dimension = constant->value;
+				}
+				return SymbolicValue(term_form({ *target, true, dimension, false }));
+			}
+			const BinaryOperation *bin_op = std::get_if<BinaryOperation>(&instruction.rvalue.value);
+			if (!bin_op) return {};
+			Opt<SymbolicValue> lhs = get_value(bin_op->lhs);
+			Opt<SymbolicValue> rhs = get_value(bin_op->rhs);
+			if (!lhs || !rhs) return {};
+			const AffineForm *lhs_form = std::get_if<AffineForm>(&*lhs);
+			const AffineForm *rhs_form = std::get_if<AffineForm>(&*rhs);
+			Opt<int64_t> rhs_constant;
+			if (rhs_form && rhs_form->terms.empty()) rhs_constant = rhs_form->constant;
+
+			if (bin_op->op == Operator::plus) {
+				Opt<Vec<Comparison>> lhs_comparisons = get_summed_comparisons(*lhs);
+				Opt<Vec<Comparison>> rhs_comparisons = get_summed_comparisons(*rhs);
+				if (lhs_comparisons && rhs_comparisons) {
+					CheckSum sum { mv(*lhs_comparisons) };
+					sum.comparisons.insert(sum.comparisons.end(), rhs_comparisons->begin(), rhs_comparisons->end());
+					return SymbolicValue(mv(sum));
+				}
+			}
+			if (const Comparison *comparison = std::get_if<Comparison>(&*lhs)) {
+				// the steps of encoding and decoding a comparison's result
+				Comparison result = *comparison;
+				if (bin_op->op == Operator::lshift && rhs_constant == 1 && result.offset == 0) {
+					result.scale *= 2;
+				} else if (bin_op->op == Operator::plus && rhs_constant == 1 && result.scale == 2 && result.offset == 0) {
+					result.offset = 1;
+				} else if (bin_op->op == Operator::rshift && rhs_constant == 1 && result.scale == 2) {
+					result.scale = 1;
+					result.offset = 0;
+				} else {
+					return {};
+				}
+				result.inst = result.scale == 1 && result.offset == 0 ? inst : no_inst;
+				return SymbolicValue(result);
+			}
+			if (!lhs_form || !rhs_form) return {};
+			Opt<AffineForm> result;
+			switch (bin_op->op) {
+				case Operator::lt:
+				case Operator::le:
+				case Operator::ge:
+				case Operator::gt:
+					return SymbolicValue(Comparison { bin_op->op, *lhs_form, *rhs_form, 1, 0, inst });
+				case Operator::plus:
+					result = add_forms(*lhs_form, *rhs_form, 1);
+					break;
+				case Operator::minus:
+					result = add_forms(*lhs_form, *rhs_form, -1);
+					break;
+				case Operator::times:
+					if (rhs_constant) {
+						result = scale_form(*lhs_form, *rhs_constant);
+					} else if (lhs_form->terms.empty()) {
+						result = scale_form(*rhs_form, lhs_form->constant);
+					}
+					break;
+				case Operator::lshift:
+					if (rhs_constant && *rhs_constant >= 0 && *rhs_constant <= 2) {
+						result = scale_form(*lhs_form, int64_t(1) << *rhs_constant);
+					}
+					break;
+				case Operator::rshift:
+					if (rhs_constant == 1) result = decode_form(*lhs_form);
+					break;
+				default:
+					break;
+			}
+			if (!result) return {};
+			return SymbolicValue(*result);
+		}
+
+		// finds the counter and its bound from the header's condition
+		bool find_counter(const SymbolicValue &condition, bool stays_if_true) {
+			const Comparison *comparison = std::get_if<Comparison>(&condition);
+			if (!comparison || comparison->scale != 1 || comparison->offset != 0) return false;
+			Operator op = comparison->op;
+			AffineForm counter_side = comparison->lhs, bound_side = comparison->rhs;
+			// written as counter < bound or counter <= bound
+			if (op == Operator::gt || op == Operator::ge) {
+				std::swap(counter_side, bound_side);
+				op = op == Operator::gt ? Operator::lt : Operator::le;
+			}
+			if (!stays_if_true) {
+				// staying while !(counter < bound), i.e. bound <= counter,
+				// counts down, which isn't handled
+				return false;
+			}
+			if (counter_side.terms.size() != 1 || counter_side.constant != 0) return false;
+			auto [term, coefficient] = counter_side.terms[0];
+			if (coefficient != 1 || !term.is_decoded || term.is_length || !this->loop_vars.count(term.var)) return false;
+			if (!this->is_invariant(bound_side)) return false;
+			this->counter = term.var;
+			Opt<AffineForm> bound = op == Operator::lt ? bound_side : add_forms(bound_side, constant_form(1), 1);
+			if (!bound) return false;
+			this->counter_bound = *bound;
+			return true;
+		}
+
+		// the comparisons that guards test are removable one by one, so an
+		// access whose checks aren't all understood still loses the ones
+		// that are
+		void find_removable_checks() {
+			const LoopForest::Loop &loop = this->forest.loops[this->loop];
+			Vec<BlockId> latches;
+			for (BlockId predecessor : this->predecessors[loop.header]) {
+				if (this->forest.contains(this->loop, predecessor)) latches.push_back(predecessor);
+			}
+			for (BlockId block : loop.blocks) {
+				bool is_every_iteration = std::all_of(latches.begin(), latches.end(), [&](BlockId latch) {
+					return this->dominators.dominates(block, latch);
+				});
+				for (InstId inst : this->function.insts_of(block)) {
+					const Guard *guard = std::get_if<Guard>(&this->function.inst(inst).rvalue.value);
+					if (!guard) continue;
+					LocalVar *const *condition = std::get_if<LocalVar *>(&guard->condition.value);
+					if (condition && !this->loop_vars.count(*condition)) {
+						this->removable_checks.push_back({ inst, {} });
+						continue;
+					}
+					const Opt<SymbolicValue> &value = this->guard_conditions[inst];
+					if (!value) continue;
+					Opt<Vec<Comparison>> comparisons = get_summed_comparisons(*value);
+					if (!comparisons) continue;
+					Vec<InstId> summed;
+					for (const Comparison &comparison : *comparisons) summed.push_back(comparison.inst);
+					this->summed_guards.push_back({ inst, mv(summed) });
+					for (const Comparison &comparison : *comparisons) {
+						if (!this->is_removable(comparison)) continue;
+						Opt<AffineForm> difference = add_forms(comparison.lhs, comparison.rhs, -1);
+						if (!this->is_safe_to_hoist(*difference, is_every_iteration)) {
+							this->has_speculative_read = true;
+							continue;
+						}
+						this->removable_checks.push_back({ comparison.inst, Comparison { comparison.op, *difference, constant_form(0), 1, 0, comparison.inst } });
+					}
+				}
+			}
+		}
+
+		// the test in front of the loop reads the lengths in the form. that
+		// is only safe if the loop would have read them in its first
+		// iteration anyway, i.e. the guard runs in every iteration, and if
+		// the variables are arrays or tuples whatever the loop does, rather
+		// than numbers in a branch that never runs.
+		bool is_safe_to_hoist(const AffineForm &difference, bool is_every_iteration) const {
+			for (const auto &[term, coefficient] : difference.terms) {
+				if (!term.is_length) continue;
+				if (!is_every_iteration) return false;
+				const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(&term.var->type.type);
+				bool is_tuple = std::holds_alternative<Type::TupleType>(term.var->type.type);
+				if (term.dimension < 0 ? !is_tuple : (!array_type || term.dimension >= array_type->num_dimensions)) return false;
+			}
+			return true;
+		}
+
+		bool is_removable(const Comparison &comparison) const {
+			auto block_it = this->comparison_blocks.find(comparison.inst);
+			if (block_it == this->comparison_blocks.end()) return false;
+			for (const auto &[inst, _] : this->removable_checks) {
+				if (inst == comparison.inst) return false;
+			}
+			Opt<AffineForm> difference = add_forms(comparison.lhs, comparison.rhs, -1);
+			if (!difference || !this->is_monotone(*difference)) return false;
+			// the counter is only known to be below its bound past the
+			// header's test
+			return this->is_invariant(*difference) || this->dominators.dominates(this->body_entry, block_it->second);
+		}
+
+		LocalVar *emit(BinaryOperation bin_op) {
+			LocalVar *temp = this->function.create_local_var(false, "", this->counter->type);
+			this->function.append_inst(this->preheader, Place(temp), bin_op);
+			return temp;
+		}
+
+		void emit_test(Operand condition, BlockId slow_path) {
+			this->function.append_inst(this->preheader, {}, Guard { condition, slow_path });
+		}
+
+		// leaves the fast copy unless -max_magnitude <= value < max_magnitude
+		void emit_magnitude_test(Operand value, bool is_decoded, BlockId slow_path) {
+			if (is_decoded) {
+				// a decoded value is far enough from overflowing to shift
+				// the range to [0, 2 * max_magnitude) and test it in one go
+				LocalVar *shifted = this->emit({ value, Operand(Int64Constant { max_magnitude }), Operator::plus });
+				this->emit_test(this->emit({ Operand(shifted), Operand(Int64Constant { magnitude_bits + 1 }), Operator::rshift }), slow_path);
+				return;
+			}
+			this->emit_test(this->emit({ value, Operand(Int64Constant { -max_magnitude }), Operator::lt }), slow_path);
+			this->emit_test(this->emit({ value, Operand(Int64Constant { max_magnitude }), Operator::ge }), slow_path);
+		}
+
+		Operand materialize(const Term &term, BlockId slow_path) {
+			for (const auto &[other, operand] : this->materialized_terms) {
+				if (other == term) return operand;
+			}
+			Operand value(term.var);
+			if (term.is_length) {
+				LocalVar *length = this->function.create_local_var(false, "", this->counter->type);
+				Opt<Operand> dimension;
+				if (term.dimension >= 0) dimension = Operand(Int64Constant { term.dimension });
+				this->function.append_inst(this->preheader, Place(length), LengthGetter { Operand(term.var), dimension });
+				value = Operand(length);
+			}
+			if (term.is_decoded) {
+				value = Operand(this->emit({ value, Operand(Int64Constant { 1 }), Operator::rshift }));
+			}
+			if (!term.is_length) {
+				// a variable that was assigned a length or a decoded value
+				// right before the loop is as good as one
+				Opt<Rvalue> def = this->find_def_before_loop(term.var);
+				const BinaryOperation *bin_op = def ? std::get_if<BinaryOperation>(&def->value) : nullptr;
+				bool is_decoded = term.is_decoded || (bin_op && bin_op->op == Operator::rshift && bin_op->rhs == Operand(Int64Constant { 1 }));
+				bool is_length = !term.is_decoded && def && std::holds_alternative<LengthGetter>(def->value);
+				if (!is_length) this->emit_magnitude_test(value, is_decoded, slow_path);
+			}
+			this->materialized_terms.push_back({ term, value });
+			return value;
+		}
+
+		Operand emit_form(const AffineForm &form, BlockId slow_path) {
+			// the terms with positive coefficients go first, so that the
+			// others can be subtracted
+			Vec<Pair<Term, int64_t>> terms = form.terms;
+			std::stable_sort(terms.begin(), terms.end(), [](const auto &a, const auto &b) { return a.second > 0 && b.second < 0; });
+			Opt<Operand> sum;
+			for (const auto &[term, coefficient] : terms) {
+				Operand value = this->materialize(term, slow_path);
+				bool is_subtracted = sum && coefficient < 0;
+				int64_t factor = is_subtracted ? -coefficient : coefficient;
+				if (factor != 1) value = this->emit_product(term, value, factor);
+				if (!sum) {
+					sum = value;
+				} else {
+					sum = Operand(this->emit({ *sum, value, is_subtracted ? Operator::minus : Operator::plus }));
+				}
+			}
+			if (!sum) return Operand(Int64Constant { form.constant });
+			if (form.constant == 0) return *sum;
+			return Operand(this->emit({ *sum, Operand(Int64Constant { form.constant }), Operator::plus }));
+		}
+
+		Operand emit_product(const Term &term, Operand value, int64_t factor) {
+			for (const auto &[other, other_factor, product] : this->materialized_products) {
+				if (other == term && other_factor == factor) return product;
+			}
+			Operand product(this->emit({ value, Operand(Int64Constant { factor }), Operator::times }));
+			this->materialized_products.push_back({ term, factor, product });
+			return product;
+		}
+
+		// the form's value in the last iteration that the header's test
+		// allows, in which the counter (decoded) is the bound minus 1
+		Opt<AffineForm> at_last_iteration(const AffineForm &form, const AffineForm &last_counter) const {
+			AffineForm result { {}, form.constant };
+			Opt<AffineForm> encoded_last_counter = add_forms(constant_form(1), last_counter, 2);
+			if (!encoded_last_counter) return {};
+			for (const auto &[term, coefficient] : form.terms) {
+				Opt<AffineForm> summand;
+				if (term.var == this->counter && !term.is_length) {
+					summand = add_forms(constant_form(0), term.is_decoded ? last_counter : *encoded_last_counter, coefficient);
+				} else {
+					AffineForm single { {}, 0 };
+					single.terms.push_back({ term, coefficient });
+					summand = single;
+				}
+				Opt<AffineForm> sum = summand ? add_forms(result, *summand, 1) : Opt<AffineForm> {};
+				if (!sum) return {};
+				result = *sum;
+			}
+			return result;
+		}
+
+		// calls f on the instructions that run right before the end of the
+		// preheader, last first, for as long as it returns true and the
+		// blocks leading there can only be entered one way
+		template<typename F>
+		void walk_back_from_preheader(F f) const {
+			BlockId block = this->preheader;
+			Vec<bool> is_visited(this->function.basic_blocks.size(), false);
+			while (!is_visited[block]) {
+				is_visited[block] = true;
+				Vec<InstId> insts;
+				for (InstId inst : this->function.insts_of(block)) insts.push_back(inst);
+				for (size_t i = insts.size(); i-- > 0;) {
+					if (!f(this->function.inst(insts[i]))) return;
+				}
+				if (this->predecessors[block].size() != 1) return;
+				BlockId predecessor = this->predecessors[block][0];
+				// an edge from a guard leaves the rest of its block out
+				for (InstId inst : this->function.insts_of(predecessor)) {
+					const Guard *guard = std::get_if<Guard>(&this->function.inst(inst).rvalue.value);
+					if (guard && guard->target == block) return;
+				}
+				block = predecessor;
+			}
+		}
+
+		// what the variable was last assigned before the loop, if that is
+		// known
+		Opt<Rvalue> find_def_before_loop(const LocalVar *var) const {
+			Opt<Rvalue> result;
+			this->walk_back_from_preheader([&](const Instruction &instruction) {
+				if (get_defined_var(instruction) != var) return true;
+				result = instruction.rvalue;
+				return false;
+			});
+			// a variable assigned only once, on every path to the loop, such
+			// as a length hoisted out of an enclosing loop
+			if (!result && var->defs.size() == 1) {
+				InstId def = var->defs[0];
+				if (this->dominators.dominates(this->function.parent_of(def), this->preheader)) result = this->function.inst(def).rvalue;
+			}
+			return result;
+		}
+
+		// the constant that the variable holds when the loop is entered, if
+		// it is assigned one right before
+		Opt<int64_t> find_constant_before_loop(const LocalVar *var) const {
+			Opt<Rvalue> def = this->find_def_before_loop(var);
+			const Operand *operand = def ? std::get_if<Operand>(&def->value) : nullptr;
+			const Int64Constant *constant = operand ? std::get_if<Int64Constant>(&operand->value) : nullptr;
+			if (!constant) return {};
+			return constant->value;
+		}
+
+		// replaces the terms whose value is a known constant when the loop
+		// is entered by that constant
+		AffineForm fold_known_terms(const AffineForm &form) const {
+			AffineForm result = constant_form(form.constant);
+			for (const auto &[term, coefficient] : form.terms) {
+				AffineForm summand { {}, 0 };
+				summand.terms.push_back({ term, coefficient });
+				if (!term.is_length) {
+					Opt<int64_t> constant = this->find_constant_before_loop(term.var);
+					if (constant && *constant >= -max_magnitude && *constant <= max_magnitude) {
+						if (Opt<AffineForm> folded = scale_form(constant_form(term.is_decoded ? *constant >> 1 : *constant), coefficient)) {
+							summand = *folded;
+						}
+					}
+				}
+				Opt<AffineForm> sum = add_forms(result, summand, 1);
+				if (!sum) return form;
+				result = *sum;
+			}
+			return result;
+		}
+
+		// emits the tests in front of the loop that send control to the
+		// original loop. returns false if it's known that they always
+		// would.
+		bool emit_tests(BlockId slow_path) {
+			// the comparisons to test, each for the first and the last
+			// iteration, as `difference op 0`
+			Vec<Pair<Operator, AffineForm>> tests;
+			Vec<Pair<InstId, Opt<Comparison>>> kept_checks;
+			Opt<AffineForm> last_counter = add_forms(this->counter_bound, constant_form(-1), 1);
+			for (const auto &[inst, comparison] : this->removable_checks) {
+				if (!comparison) {
+					kept_checks.push_back({ inst, comparison });
+					continue;
+				}
+				// the forms at the last iteration must fit the limits too,
+				// or the check stays
+				Opt<AffineForm> last = last_counter ? this->at_last_iteration(comparison->lhs, *last_counter) : Opt<AffineForm> {};
+				if (!last) continue;
+				kept_checks.push_back({ inst, comparison });
+				for (const AffineForm &difference : { comparison->lhs, *last }) {
+					AffineForm folded = this->fold_known_terms(difference);
+					if (folded.terms.empty()) {
+						// the check fails in the first or last iteration
+						if (*mir::evaluate(comparison->op, folded.constant, 0) != 0) return false;
+						continue;
+					}
+					tests.push_back({ comparison->op, folded });
+				}
+			}
+			this->removable_checks = mv(kept_checks);
+			if (this->removable_checks.empty()) return false;
+			// the counter stays between its first value, which is bounded as
+			// a term, and its last one. if the last one is below the first,
+			// the loop's body doesn't run at all.
+			AffineForm folded_last_counter = this->fold_known_terms(*last_counter);
+			if (!tests.empty() && folded_last_counter.terms.empty() && folded_last_counter.constant > max_magnitude / 2) return false;
+
+			for (const auto &[guard, comparison] : this->removable_checks) {
+				if (comparison) continue;
+				LocalVar *condition = std::get<LocalVar *>(std::get<Guard>(this->function.inst(guard).rvalue.value).condition.value);
+				this->emit_test(Operand(condition), slow_path);
+			}
+			// when the bound is a single term or two, its own bound is
+			// enough
+			int64_t bound_weight = 0;
+			for (const auto &[term, coefficient] : this->counter_bound.terms) bound_weight += std::abs(coefficient);
+			if (!tests.empty() && !folded_last_counter.terms.empty() && bound_weight > 2) {
+				Operand last = this->emit_form(folded_last_counter, slow_path);
+				this->emit_test(this->emit({ last, Operand(Int64Constant { max_magnitude / 2 }), Operator::gt }), slow_path);
+			}
+			for (const auto &[op, difference] : tests) {
+				Operand value = this->emit_form(difference, slow_path);
+				this->emit_test(this->emit({ value, Operand(Int64Constant { 0 }), op }), slow_path);
+			}
+			return true;
+		}
+
+		bool is_removed(InstId inst) const {
+			for (const auto &[check, _] : this->removable_checks) {
+				if (check == inst) return true;
+			}
+			return false;
+		}
+
+		// the comparisons are replaced rather than the sums simplified,
+		// since the variables they go into are shared with the original
+		// loop, where they aren't constant
+		void remove_checks_in_copies(const Vec<BlockId> &copies) {
+			Vec<InstId> removed_guards;
+			for (const auto &[guard, comparisons] : this->summed_guards) {
+				if (std::all_of(comparisons.begin(), comparisons.end(), [&](InstId inst) { return this->is_removed(inst); })) {
+					removed_guards.push_back(guard);
+				}
+			}
+			const Vec<BlockId> &blocks = this->forest.loops[this->loop].blocks;
+			Vec<Pair<InstId, bool>> to_remove; // copy, whether it's a comparison
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				auto copy_it = this->function.insts_of(copies[i]).begin();
+				for (InstId inst : this->function.insts_of(blocks[i])) {
+					for (const auto &[check, comparison] : this->removable_checks) {
+						if (check == inst) to_remove.push_back({ *copy_it, comparison.has_value() });
+					}
+					if (std::find(removed_guards.begin(), removed_guards.end(), inst) != removed_guards.end()) {
+						to_remove.push_back({ *copy_it, false });
+					}
+					++copy_it;
+				}
+			}
+			for (const auto &[inst, is_comparison] : to_remove) {
+				if (is_comparison) {
+					Opt<Place> destination = this->function.inst(inst).destination;
+					this->function.replace_inst(inst, mv(destination), Operand(Int64Constant { 0 }));
+				} else {
+					this->function.erase_inst(inst);
+				}
+			}
+		}
+	};
+
+	size_t version_loops(FunctionDef &function) {
+		insert_preheaders(function);
+		Vec<BlockId> reverse_postorder = analysis::compute_reverse_postorder(function);
+		analysis::DominatorTree dominators(function, reverse_postorder);
+		LoopForest forest(function, reverse_postorder, dominators);
+		Vec<SmallVec<BlockId, 4>> predecessors = analysis::compute_predecessors(function);
+
+		Vec<bool> has_inner_loop(forest.loops.size(), false);
+		for (const LoopForest::Loop &loop : forest.loops) {
+			if (loop.parent != LoopForest::no_loop) has_inner_loop[loop.parent] = true;
+		}
+		// the loops don't share blocks, so versioning one doesn't change
+		// what was found out about the others
+		size_t num_versioned = 0;
+		for (uint32_t loop = 0; loop < forest.loops.size(); ++loop) {
+			if (has_inner_loop[loop] || !is_transformable_loop(function, forest, loop)) continue;
+			BlockId preheader = find_preheader(function, forest, loop, predecessors);
+			if (preheader == no_block) continue;
+			LoopVersioner versioner(function, forest, dominators, predecessors, loop, preheader);
+			if (versioner.version()) num_versioned += 1;
+		}
+		return num_versioned;
+	}
+}
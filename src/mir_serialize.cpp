@@ -0,0 +1,757 @@
+#include "mir_serialize.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mir {
+	namespace {
+		const char magic[4] = { 'L', 'A', 'M', 'R' };
+
+		enum struct OperandTag : uint8_t {
+			int64_constant,
+			local_var,
+			code_constant,
+			ext_code_constant
+		};
+
+		// rvalues that are plain operands are encoded with their OperandTag,
+		// so the rvalue tags start after the operand tags
+		enum struct RvalueTag : uint8_t {
+			place = 4,
+			binary_operation,
+			length_getter,
+			function_call,
+			new_array,
+			new_tuple,
+			guard
+		};
+
+		enum struct TypeTag : uint8_t {
+			void_type,
+			array_type,
+			tuple_type,
+			code_type
+		};
+
+		enum struct TerminatorTag : uint8_t {
+			return_void,
+			return_val,
+			go_to,
+			branch
+		};
+
+		// external functions that are referred to by MIR but are not part of
+		// Program::external_functions. they are numbered after the program's
+		// own external functions.
+		ExternalFunction *const builtin_external_functions[] = {
+			&tensor_error,
+			&tuple_error
+		};
+		constexpr size_t num_builtin_external_functions = sizeof(builtin_external_functions) / sizeof(builtin_external_functions[0]);
+
+		[[noreturn]] void die_malformed(const char *reason) {
+			std::cerr << "Error: malformed binary MIR (" << reason << ")\n";
+			exit(1);
+		}
+
+		class ByteWriter {
+			std::string &buffer;
+
+			public:
+
+			explicit ByteWriter(std::string &buffer) : buffer { buffer } {}
+
+			void put_byte(uint8_t byte) {
+				this->buffer.push_back(static_cast<char>(byte));
+			}
+			void put_varint(uint64_t value) {
+				char bytes[10];
+				int len = 0;
+				while (value >= 0x80) {
+					bytes[len++] = static_cast<char>((value & 0x7f) | 0x80);
+					value >>= 7;
+				}
+				bytes[len++] = static_cast<char>(value);
+				this->buffer.append(bytes, len);
+			}
+			void put_signed_varint(int64_t value) {
+				// zigzag so that small negative numbers stay small
+				this->put_varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+			}
+			void put_fixed32(uint32_t value) {
+				for (int i = 0; i < 4; ++i) {
+					this->put_byte(static_cast<uint8_t>(value >> (8 * i)));
+				}
+			}
+			void put_fixed64(uint64_t value) {
+				for (int i = 0; i < 8; ++i) {
+					this->put_byte(static_cast<uint8_t>(value >> (8 * i)));
+				}
+			}
+			void put_bytes(std::string_view bytes) {
+				this->buffer.append(bytes.data(), bytes.size());
+			}
+			size_t position() const {
+				return this->buffer.size();
+			}
+		};
+
+		class ByteReader {
+			const char *cur;
+			const char *end;
+
+			public:
+
+			ByteReader(const char *begin, const char *end) : cur { begin }, end { end } {}
+
+			uint8_t get_byte() {
+				if (this->cur == this->end) die_malformed("unexpected end of data");
+				return static_cast<uint8_t>(*this->cur++);
+			}
+			uint64_t get_varint() {
+				uint64_t result = 0;
+				for (int shift = 0; shift < 64; shift += 7) {
+					uint8_t byte = this->get_byte();
+					result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+					if (!(byte & 0x80)) {
+						return result;
+					}
+				}
+				die_malformed("varint too long");
+			}
+			int64_t get_signed_varint() {
+				uint64_t zigzag = this->get_varint();
+				return static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+			}
+			uint32_t get_fixed32() {
+				uint32_t result = 0;
+				for (int i = 0; i < 4; ++i) {
+					result |= static_cast<uint32_t>(this->get_byte()) << (8 * i);
+				}
+				return result;
+			}
+			uint64_t get_fixed64() {
+				uint64_t result = 0;
+				for (int i = 0; i < 8; ++i) {
+					result |= static_cast<uint64_t>(this->get_byte()) << (8 * i);
+				}
+				return result;
+			}
+			std::string_view get_bytes(size_t length) {
+				if (static_cast<size_t>(this->end - this->cur) < length) die_malformed("unexpected end of data");
+				std::string_view result(this->cur, length);
+				this->cur += length;
+				return result;
+			}
+			// reads a count of items that each take at least one byte, making
+			// sure that a corrupted count can't cause a huge allocation
+			size_t get_count() {
+				uint64_t count = this->get_varint();
+				if (count > static_cast<uint64_t>(this->end - this->cur)) die_malformed("count exceeds remaining data");
+				return static_cast<size_t>(count);
+			}
+			const char *position() const {
+				return this->cur;
+			}
+		};
+
+		void encode_type(ByteWriter &writer, const Type &type) {
+			const Type::Variant *x = &type.type;
+			if (std::get_if<Type::VoidType>(x)) {
+				writer.put_byte(static_cast<uint8_t>(TypeTag::void_type));
+			} else if (const Type::ArrayType *array_type = std::get_if<Type::ArrayType>(x)) {
+				writer.put_byte(static_cast<uint8_t>(TypeTag::array_type));
+				writer.put_varint(array_type->num_dimensions);
+			} else if (std::get_if<Type::TupleType>(x)) {
+				writer.put_byte(static_cast<uint8_t>(TypeTag::tuple_type));
+			} else if (std::get_if<Type::CodeType>(x)) {
+				writer.put_byte(static_cast<uint8_t>(TypeTag::code_type));
+			} else {
+				std::cerr << "Logic error: inexhaustive Type variant\n";
+				exit(1);
+			}
+		}
+		Type decode_type(ByteReader &reader) {
+			switch (static_cast<TypeTag>(reader.get_byte())) {
+				case TypeTag::void_type: return { Type::VoidType {} };
+				case TypeTag::array_type: return { Type::ArrayType { static_cast<int>(reader.get_varint()) } };
+				case TypeTag::tuple_type: return { Type::TupleType {} };
+				case TypeTag::code_type: return { Type::CodeType {} };
+				default: die_malformed("bad type tag");
+			}
+		}
+
+		class ProgramEncoder {
+			const Program &program;
+			std::string bodies;
+			ByteWriter bodies_writer;
+			Vec<std::string_view> strings;
+			std::unordered_map<std::string_view, uint32_t> string_ids;
+			std::unordered_map<const FunctionDef *, uint32_t> function_ids;
+			std::unordered_map<const ExternalFunction *, uint32_t> external_function_ids;
+
+			// per-function state
+			std::unordered_map<const LocalVar *, uint32_t> local_var_ids;
+			Vec<uint32_t> block_ids; // indexed by BlockId; erased blocks are skipped
+
+			public:
+
+			explicit ProgramEncoder(const Program &program) :
+				program { program },
+				bodies {},
+				bodies_writer { this->bodies }
+			{
+				for (const Uptr<FunctionDef> &function_def : program.function_defs) {
+					this->function_ids.emplace(function_def.get(), this->function_ids.size());
+				}
+				for (const Uptr<ExternalFunction> &external_function : program.external_functions) {
+					this->external_function_ids.emplace(external_function.get(), this->external_function_ids.size());
+				}
+				for (ExternalFunction *builtin : builtin_external_functions) {
+					this->external_function_ids.emplace(builtin, this->external_function_ids.size());
+				}
+			}
+
+			std::string encode() {
+				// the bodies are encoded first because that is when most of
+				// the strings get interned
+				Vec<Pair<uint64_t, uint64_t>> body_ranges;
+				for (const Uptr<FunctionDef> &function_def : this->program.function_defs) {
+					size_t start = this->bodies_writer.position();
+					this->encode_function_body(*function_def);
+					body_ranges.emplace_back(start, this->bodies_writer.position() - start);
+				}
+				for (const Uptr<FunctionDef> &function_def : this->program.function_defs) {
+					this->intern(function_def->user_given_name);
+				}
+				for (const Uptr<ExternalFunction> &external_function : this->program.external_functions) {
+					this->intern(external_function->name);
+				}
+
+				std::string result;
+				result.reserve(this->bodies.size() + 64 + 16 * this->strings.size());
+				ByteWriter writer(result);
+				writer.put_bytes(std::string_view(magic, sizeof(magic)));
+				writer.put_fixed32(binary_format_version);
+
+				writer.put_varint(this->strings.size());
+				for (std::string_view string : this->strings) {
+					writer.put_varint(string.size());
+					writer.put_bytes(string);
+				}
+
+				writer.put_varint(this->program.external_functions.size());
+				for (const Uptr<ExternalFunction> &external_function : this->program.external_functions) {
+					writer.put_varint(this->string_ids.at(external_function->name));
+					writer.put_signed_varint(external_function->num_parameters);
+					writer.put_byte(external_function->returns_val);
+				}
+
+				writer.put_varint(this->program.function_defs.size());
+				for (size_t i = 0; i < this->program.function_defs.size(); ++i) {
+					const FunctionDef &function_def = *this->program.function_defs[i];
+					writer.put_varint(this->string_ids.at(function_def.user_given_name));
+					encode_type(writer, function_def.return_type);
+					writer.put_fixed64(body_ranges[i].first);
+					writer.put_fixed64(body_ranges[i].second);
+				}
+
+				writer.put_bytes(this->bodies);
+				return result;
+			}
+
+			private:
+
+			uint32_t intern(std::string_view string) {
+				auto [it, is_new] = this->string_ids.emplace(string, this->strings.size());
+				if (is_new) {
+					this->strings.push_back(string);
+				}
+				return it->second;
+			}
+
+			void encode_function_body(const FunctionDef &function_def) {
+				ByteWriter &writer = this->bodies_writer;
+
+				this->local_var_ids.clear();
+				writer.put_varint(function_def.local_vars.size());
+				for (const Uptr<LocalVar> &local_var : function_def.local_vars) {
+					this->local_var_ids.emplace(local_var.get(), this->local_var_ids.size());
+					writer.put_byte(local_var->is_user_declared);
+					writer.put_varint(this->intern(local_var->name));
+					encode_type(writer, local_var->type);
+					// the lengths of its def-use chains, so that the decoder
+					// can allocate them once
+					writer.put_varint(local_var->defs.size());
+					writer.put_varint(local_var->uses.size());
+				}
+				writer.put_varint(function_def.parameter_vars.size());
+				for (LocalVar *parameter_var : function_def.parameter_vars) {
+					writer.put_varint(this->local_var_ids.at(parameter_var));
+				}
+
+				this->block_ids.assign(function_def.basic_blocks.size(), UINT32_MAX);
+				uint32_t num_blocks = 0;
+				for (BlockId block = 0; block < function_def.basic_blocks.size(); ++block) {
+					if (!function_def.block(block).is_erased) {
+						this->block_ids[block] = num_blocks++;
+					}
+				}
+				writer.put_varint(num_blocks);
+				// the total, so that the decoder can allocate once
+				size_t num_instructions = 0;
+				for ([[maybe_unused]] InstId inst : function_def.all_insts()) {
+					num_instructions += 1;
+				}
+				writer.put_varint(num_instructions);
+				for (BlockId block = 0; block < function_def.basic_blocks.size(); ++block) {
+					if (!function_def.block(block).is_erased) {
+						this->encode_basic_block(function_def, block);
+					}
+				}
+			}
+
+			void encode_basic_block(const FunctionDef &function_def, BlockId block_id) {
+				ByteWriter &writer = this->bodies_writer;
+				const BasicBlock &block = function_def.block(block_id);
+				writer.put_byte(block.user_labeled);
+				writer.put_varint(this->intern(block.label_name));
+				size_t num_instructions = 0;
+				for ([[maybe_unused]] InstId inst : function_def.insts_of(block_id)) {
+					num_instructions += 1;
+				}
+				writer.put_varint(num_instructions);
+				for (InstId inst_id : function_def.insts_of(block_id)) {
+					const Instruction &inst = function_def.inst(inst_id);
+					if (inst.destination.has_value()) {
+						writer.put_byte(1);
+						this->encode_place(inst.destination.value());
+					} else {
+						writer.put_byte(0);
+					}
+					this->encode_rvalue(inst.rvalue);
+				}
+
+				const BasicBlock::Terminator *x = &block.terminator;
+				if (std::get_if<BasicBlock::ReturnVoid>(x)) {
+					writer.put_byte(static_cast<uint8_t>(TerminatorTag::return_void));
+				} else if (const BasicBlock::ReturnVal *term = std::get_if<BasicBlock::ReturnVal>(x)) {
+					writer.put_byte(static_cast<uint8_t>(TerminatorTag::return_val));
+					this->encode_operand(term->return_value);
+				} else if (const BasicBlock::Goto *term = std::get_if<BasicBlock::Goto>(x)) {
+					writer.put_byte(static_cast<uint8_t>(TerminatorTag::go_to));
+					writer.put_varint(this->block_ids[term->successor]);
+				} else if (const BasicBlock::Branch *term = std::get_if<BasicBlock::Branch>(x)) {
+					writer.put_byte(static_cast<uint8_t>(TerminatorTag::branch));
+					this->encode_operand(term->condition);
+					writer.put_varint(this->block_ids[term->then_block]);
+					writer.put_varint(this->block_ids[term->else_block]);
+				} else {
+					std::cerr << "Logic error: inexhaustive match on Terminator variant\n";
+					exit(1);
+				}
+			}
+
+			void encode_place(const Place &place) {
+				ByteWriter &writer = this->bodies_writer;
+				writer.put_varint(this->local_var_ids.at(place.target));
+				this->encode_operand_list(place.indices);
+			}
+
+			void encode_operand(const Operand &operand) {
+				ByteWriter &writer = this->bodies_writer;
+				const Operand::Variant *x = &operand.value;
+				if (const Int64Constant *num = std::get_if<Int64Constant>(x)) {
+					writer.put_byte(static_cast<uint8_t>(OperandTag::int64_constant));
+					writer.put_signed_varint(num->value);
+				} else if (LocalVar *const *local_var = std::get_if<LocalVar *>(x)) {
+					writer.put_byte(static_cast<uint8_t>(OperandTag::local_var));
+					writer.put_varint(this->local_var_ids.at(*local_var));
+				} else if (const CodeConstant *code = std::get_if<CodeConstant>(x)) {
+					writer.put_byte(static_cast<uint8_t>(OperandTag::code_constant));
+					writer.put_varint(this->function_ids.at(code->value));
+				} else if (const ExtCodeConstant *ext_code = std::get_if<ExtCodeConstant>(x)) {
+					writer.put_byte(static_cast<uint8_t>(OperandTag::ext_code_constant));
+					writer.put_varint(this->external_function_ids.at(ext_code->value));
+				} else {
+					std::cerr << "Logic error: inexhaustive Operand variant\n";
+					exit(1);
+				}
+			}
+
+			template<typename Operands>
+			void encode_operand_list(const Operands &operands) {
+				this->bodies_writer.put_varint(operands.size());
+				for (const Operand &operand : operands) {
+					this->encode_operand(operand);
+				}
+			}
+
+			void encode_rvalue(const Rvalue &rvalue) {
+				ByteWriter &writer = this->bodies_writer;
+				const Rvalue::Variant *x = &rvalue.value;
+				if (const Operand *operand = std::get_if<Operand>(x)) {
+					this->encode_operand(*operand);
+				} else if (const Place *place = std::get_if<Place>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::place));
+					this->encode_place(*place);
+				} else if (const BinaryOperation *bin_op = std::get_if<BinaryOperation>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::binary_operation));
+					writer.put_byte(static_cast<uint8_t>(bin_op->op));
+					this->encode_operand(bin_op->lhs);
+					this->encode_operand(bin_op->rhs);
+				} else if (const LengthGetter *length_getter = std::get_if<LengthGetter>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::length_getter));
+					this->encode_operand(length_getter->target);
+					writer.put_byte(length_getter->dimension.has_value());
+					if (length_getter->dimension.has_value()) {
+						this->encode_operand(length_getter->dimension.value());
+					}
+				} else if (const FunctionCall *call = std::get_if<FunctionCall>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::function_call));
+					this->encode_operand(call->callee);
+					this->encode_operand_list(call->arguments);
+				} else if (const NewArray *new_array = std::get_if<NewArray>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::new_array));
+					this->encode_operand_list(new_array->dimension_lengths);
+				} else if (const NewTuple *new_tuple = std::get_if<NewTuple>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::new_tuple));
+					this->encode_operand(new_tuple->length);
+				} else if (const Guard *guard = std::get_if<Guard>(x)) {
+					writer.put_byte(static_cast<uint8_t>(RvalueTag::guard));
+					this->encode_operand(guard->condition);
+					writer.put_varint(this->block_ids[guard->target]);
+				} else {
+					std::cerr << "Logic error: inexhaustive Rvalue variant\n";
+					exit(1);
+				}
+			}
+		};
+
+		// decodes everything up to (but not including) the function bodies.
+		// fills in the program's external functions and FunctionDefs (whose
+		// bodies are left empty) and returns the byte range of each body.
+		Vec<Pair<uint64_t, uint64_t>> decode_header(ByteReader &reader, Vec<std::string> &strings, Program &program) {
+			if (reader.get_bytes(sizeof(magic)) != std::string_view(magic, sizeof(magic))) {
+				die_malformed("bad magic number");
+			}
+			uint32_t version = reader.get_fixed32();
+			if (version != binary_format_version) {
+				std::cerr << "Error: binary MIR has format version " << version
+					<< " but this compiler reads version " << binary_format_version << "\n";
+				exit(1);
+			}
+
+			size_t num_strings = reader.get_count();
+			strings.reserve(num_strings);
+			for (size_t i = 0; i < num_strings; ++i) {
+				size_t length = reader.get_varint();
+				strings.emplace_back(reader.get_bytes(length));
+			}
+			auto get_string = [&](uint64_t id) -> const std::string & {
+				if (id >= strings.size()) die_malformed("bad string id");
+				return strings[id];
+			};
+
+			size_t num_external_functions = reader.get_count();
+			for (size_t i = 0; i < num_external_functions; ++i) {
+				const std::string &name = get_string(reader.get_varint());
+				int num_parameters = static_cast<int>(reader.get_signed_varint());
+				bool returns_val = reader.get_byte() != 0;
+				program.external_functions.push_back(mkuptr<ExternalFunction>(name, num_parameters, returns_val));
+			}
+
+			Vec<Pair<uint64_t, uint64_t>> body_ranges;
+			size_t num_functions = reader.get_count();
+			body_ranges.reserve(num_functions);
+			for (size_t i = 0; i < num_functions; ++i) {
+				const std::string &name = get_string(reader.get_varint());
+				Type return_type = decode_type(reader);
+				program.function_defs.push_back(mkuptr<FunctionDef>(name, return_type));
+				uint64_t offset = reader.get_fixed64();
+				uint64_t size = reader.get_fixed64();
+				body_ranges.emplace_back(offset, size);
+			}
+			return body_ranges;
+		}
+
+		class FunctionDecoder {
+			const Vec<std::string> &strings;
+			Program &program;
+			FunctionDef &function_def;
+			ByteReader reader;
+			size_t num_blocks;
+
+			public:
+
+			FunctionDecoder(const Vec<std::string> &strings, Program &program, FunctionDef &function_def, ByteReader reader) :
+				strings { strings }, program { program }, function_def { function_def }, reader { reader }, num_blocks { 0 }
+			{}
+
+			void decode() {
+				size_t num_local_vars = this->reader.get_count();
+				this->function_def.local_vars.reserve(num_local_vars);
+				for (size_t i = 0; i < num_local_vars; ++i) {
+					bool is_user_declared = this->reader.get_byte() != 0;
+					const std::string &name = this->get_string();
+					Type type = decode_type(this->reader);
+					LocalVar *local_var = this->function_def.create_local_var(is_user_declared, name, type);
+					local_var->defs.reserve(this->reader.get_count());
+					local_var->uses.reserve(this->reader.get_count());
+				}
+				size_t num_parameters = this->reader.get_count();
+				for (size_t i = 0; i < num_parameters; ++i) {
+					this->function_def.parameter_vars.push_back(this->get_local_var());
+				}
+
+				// blocks can refer to blocks that come after them, so block ids
+				// are checked against the final number of blocks
+				this->num_blocks = this->reader.get_count();
+				this->function_def.reserve(this->num_blocks, this->reader.get_count());
+				// the def-use chains are built in one pass once everything
+				// is in place, into the lists reserved above
+				this->function_def.defer_def_use();
+				for (size_t i = 0; i < this->num_blocks; ++i) {
+					this->decode_basic_block();
+				}
+				this->function_def.rebuild_def_use();
+			}
+
+			private:
+
+			const std::string &get_string() {
+				uint64_t id = this->reader.get_varint();
+				if (id >= this->strings.size()) die_malformed("bad string id");
+				return this->strings[id];
+			}
+			LocalVar *get_local_var() {
+				uint64_t id = this->reader.get_varint();
+				if (id >= this->function_def.local_vars.size()) die_malformed("bad local variable id");
+				return this->function_def.local_vars[id].get();
+			}
+			BlockId get_block() {
+				uint64_t id = this->reader.get_varint();
+				if (id >= this->num_blocks) die_malformed("bad block id");
+				return id;
+			}
+
+			void decode_basic_block() {
+				bool user_labeled = this->reader.get_byte() != 0;
+				BlockId block_id = this->function_def.create_block(user_labeled, this->get_string());
+				size_t num_instructions = this->reader.get_count();
+				for (size_t i = 0; i < num_instructions; ++i) {
+					Opt<Place> destination;
+					if (this->reader.get_byte()) {
+						destination = this->decode_place();
+					}
+					Rvalue rvalue = this->decode_rvalue();
+					this->function_def.append_inst(block_id, mv(destination), mv(rvalue));
+				}
+
+				switch (static_cast<TerminatorTag>(this->reader.get_byte())) {
+					case TerminatorTag::return_void: {
+						this->function_def.set_terminator(block_id, BasicBlock::ReturnVoid {});
+						break;
+					}
+					case TerminatorTag::return_val: {
+						this->function_def.set_terminator(block_id, BasicBlock::ReturnVal { this->decode_operand() });
+						break;
+					}
+					case TerminatorTag::go_to: {
+						this->function_def.set_terminator(block_id, BasicBlock::Goto { this->get_block() });
+						break;
+					}
+					case TerminatorTag::branch: {
+						Operand condition = this->decode_operand();
+						BlockId then_block = this->get_block();
+						BlockId else_block = this->get_block();
+						this->function_def.set_terminator(block_id, BasicBlock::Branch { condition, then_block, else_block });
+						break;
+					}
+					default: die_malformed("bad terminator tag");
+				}
+			}
+
+			Place decode_place() {
+				LocalVar *target = this->get_local_var();
+				return Place(target, this->decode_operand_list<3>());
+			}
+
+			Operand decode_operand() {
+				return this->decode_operand_with_tag(this->reader.get_byte());
+			}
+			Operand decode_operand_with_tag(uint8_t tag) {
+				switch (static_cast<OperandTag>(tag)) {
+					case OperandTag::int64_constant: {
+						return Int64Constant { this->reader.get_signed_varint() };
+					}
+					case OperandTag::local_var: {
+						return this->get_local_var();
+					}
+					case OperandTag::code_constant: {
+						uint64_t id = this->reader.get_varint();
+						if (id >= this->program.function_defs.size()) die_malformed("bad function id");
+						return CodeConstant { this->program.function_defs[id].get() };
+					}
+					case OperandTag::ext_code_constant: {
+						uint64_t id = this->reader.get_varint();
+						size_t num_external_functions = this->program.external_functions.size();
+						if (id < num_external_functions) {
+							return ExtCodeConstant { this->program.external_functions[id].get() };
+						} else if (id - num_external_functions < num_builtin_external_functions) {
+							return ExtCodeConstant { builtin_external_functions[id - num_external_functions] };
+						} else {
+							die_malformed("bad external function id");
+						}
+					}
+					default: die_malformed("bad operand tag");
+				}
+			}
+			template<size_t N>
+			SmallVec<Operand, N> decode_operand_list() {
+				size_t num_operands = this->reader.get_count();
+				SmallVec<Operand, N> operands;
+				operands.reserve(num_operands);
+				for (size_t i = 0; i < num_operands; ++i) {
+					operands.push_back(this->decode_operand());
+				}
+				return operands;
+			}
+
+			Rvalue decode_rvalue() {
+				uint8_t tag = this->reader.get_byte();
+				switch (static_cast<RvalueTag>(tag)) {
+					case RvalueTag::place: {
+						return this->decode_place();
+					}
+					case RvalueTag::binary_operation: {
+						uint8_t op = this->reader.get_byte();
+						if (op > static_cast<uint8_t>(Operator::rshift)) die_malformed("bad operator");
+						Operand lhs = this->decode_operand();
+						Operand rhs = this->decode_operand();
+						return BinaryOperation { lhs, rhs, static_cast<Operator>(op) };
+					}
+					case RvalueTag::length_getter: {
+						Operand target = this->decode_operand();
+						Opt<Operand> dimension;
+						if (this->reader.get_byte()) {
+							dimension = this->decode_operand();
+						}
+						return LengthGetter { target, dimension };
+					}
+					case RvalueTag::function_call: {
+						Operand callee = this->decode_operand();
+						return FunctionCall { callee, this->decode_operand_list<4>() };
+					}
+					case RvalueTag::new_array: {
+						return NewArray { this->decode_operand_list<3>() };
+					}
+					case RvalueTag::new_tuple: {
+						return NewTuple { this->decode_operand() };
+					}
+					case RvalueTag::guard: {
+						Operand condition = this->decode_operand();
+						return Guard { condition, this->get_block() };
+					}
+					default: {
+						return this->decode_operand_with_tag(tag);
+					}
+				}
+			}
+		};
+	}
+
+	std::string serialize_program(const Program &program) {
+		return ProgramEncoder(program).encode();
+	}
+
+	Uptr<Program> deserialize_program(std::string_view bytes) {
+		auto program = mkuptr<Program>();
+		Vec<std::string> strings;
+		ByteReader reader(bytes.data(), bytes.data() + bytes.size());
+		Vec<Pair<uint64_t, uint64_t>> body_ranges = decode_header(reader, strings, *program);
+		const char *bodies_start = reader.position();
+		size_t bodies_size = bytes.data() + bytes.size() - bodies_start;
+		for (size_t i = 0; i < body_ranges.size(); ++i) {
+			auto [offset, size] = body_ranges[i];
+			if (offset > bodies_size || size > bodies_size - offset) die_malformed("function body out of range");
+			ByteReader body_reader(bodies_start + offset, bodies_start + offset + size);
+			FunctionDecoder(strings, *program, *program->function_defs[i], body_reader).decode();
+		}
+		return program;
+	}
+
+	MappedProgram::MappedProgram(const char *mapped_data, size_t mapped_size) :
+		mapped_data { mapped_data },
+		mapped_size { mapped_size },
+		strings {},
+		function_entries {},
+		bodies_start { nullptr },
+		program { mkuptr<Program>() }
+	{
+		ByteReader reader(mapped_data, mapped_data + mapped_size);
+		Vec<Pair<uint64_t, uint64_t>> body_ranges = decode_header(reader, this->strings, *this->program);
+		this->bodies_start = reader.position();
+		size_t bodies_size = mapped_data + mapped_size - this->bodies_start;
+		for (auto [offset, size] : body_ranges) {
+			if (offset > bodies_size || size > bodies_size - offset) die_malformed("function body out of range");
+			this->function_entries.push_back({ offset, size, false });
+		}
+	}
+
+	Uptr<MappedProgram> MappedProgram::open(const std::string &path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			std::cerr << "Error: could not open " << path << ": " << strerror(errno) << "\n";
+			exit(1);
+		}
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+			std::cerr << "Error: " << path << " is not a binary MIR file\n";
+			exit(1);
+		}
+		size_t size = static_cast<size_t>(file_stat.st_size);
+		void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // the mapping stays valid after the descriptor is closed
+		if (data == MAP_FAILED) {
+			std::cerr << "Error: could not map " << path << ": " << strerror(errno) << "\n";
+			exit(1);
+		}
+		return Uptr<MappedProgram>(new MappedProgram(static_cast<const char *>(data), size));
+	}
+
+	MappedProgram::~MappedProgram() {
+		munmap(const_cast<char *>(this->mapped_data), this->mapped_size);
+	}
+
+	FunctionDef *MappedProgram::load_function(size_t function_index) {
+		FunctionEntry &entry = this->function_entries.at(function_index);
+		FunctionDef *function_def = this->program->function_defs[function_index].get();
+		if (!entry.is_loaded) {
+			const char *body = this->bodies_start + entry.body_offset;
+			FunctionDecoder(this->strings, *this->program, *function_def, ByteReader(body, body + entry.body_size)).decode();
+			entry.is_loaded = true;
+		}
+		return function_def;
+	}
+
+	Opt<FunctionDef *> MappedProgram::load_function_by_name(std::string_view name) {
+		for (size_t i = 0; i < this->program->function_defs.size(); ++i) {
+			if (this->program->function_defs[i]->user_given_name == name) {
+				return this->load_function(i);
+			}
+		}
+		return {};
+	}
+
+	void MappedProgram::load_all_functions() {
+		for (size_t i = 0; i < this->function_entries.size(); ++i) {
+			this->load_function(i);
+		}
+	}
+}
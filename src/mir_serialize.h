@@ -0,0 +1,67 @@
+#pragma once
+
+#include "std_alias.h"
+#include "mir.h"
+#include <string>
+#include <string_view>
+
+// A compact, versioned binary encoding of a mir::Program, used for caching
+// and for handing a program between processes without going through the
+// text IR.
+//
+// Layout of an encoded program (all multi-byte integers are LEB128 varints
+// unless noted otherwise; signed values are zigzag-encoded):
+//   magic "LAMR", format version (4 bytes, little-endian)
+//   string table: every name in the program, interned once
+//   external function table
+//   function table: name, return type, and the fixed-width (8 byte) offset
+//     and size of the function's body relative to the start of the bodies
+//   function bodies: the local variables (with the lengths of their def-use
+//     chains, so that decoding allocates them once), the parameters, the
+//     total number of instructions, and the blocks
+// Because each body can be located directly from the function table, a
+// single function can be decoded without touching the rest of the file.
+namespace mir {
+	using namespace std_alias;
+
+	constexpr uint32_t binary_format_version = 1;
+
+	std::string serialize_program(const Program &program);
+	Uptr<Program> deserialize_program(std::string_view bytes);
+
+	// A program file that is memory-mapped and decoded lazily. All the
+	// FunctionDefs of the program exist as soon as the file is opened (so that
+	// references between functions can be resolved), but their bodies are
+	// only decoded when requested through load_function.
+	class MappedProgram {
+		struct FunctionEntry {
+			uint64_t body_offset;
+			uint64_t body_size;
+			bool is_loaded;
+		};
+
+		const char *mapped_data;
+		size_t mapped_size;
+		Vec<std::string> strings;
+		Vec<FunctionEntry> function_entries;
+		const char *bodies_start;
+		Uptr<Program> program;
+
+		MappedProgram(const char *mapped_data, size_t mapped_size);
+
+		public:
+
+		// dies if the file can't be opened or is not a valid program file
+		static Uptr<MappedProgram> open(const std::string &path);
+		~MappedProgram();
+		MappedProgram(const MappedProgram &) = delete;
+		MappedProgram &operator=(const MappedProgram &) = delete;
+
+		// the program is owned by the MappedProgram; functions that haven't
+		// been loaded yet have no local variables and no basic blocks
+		Program &get_program() { return *this->program; }
+		FunctionDef *load_function(size_t function_index);
+		Opt<FunctionDef *> load_function_by_name(std::string_view name);
+		void load_all_functions();
+	};
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+
+namespace utils {
+	// A vector that stores up to N elements inline, only going to the heap
+	// when it grows past that. Restricted to trivially copyable element types
+	// so that elements can be moved around with memcpy.
+	template<typename T, size_t N>
+	class SmallVec {
+		static_assert(std::is_trivially_copyable_v<T>, "SmallVec only supports trivially copyable types");
+		static_assert(N > 0, "SmallVec needs room for at least one inline element");
+
+		uint32_t length;
+		uint32_t capacity; // equal to N iff the elements are stored inline
+		T *heap_items;
+		alignas(T) unsigned char inline_storage[N * sizeof(T)];
+
+		public:
+
+		SmallVec() : length { 0 }, capacity { N }, heap_items { nullptr } {}
+		SmallVec(std::initializer_list<T> items) : SmallVec() {
+			this->reserve(items.size());
+			for (const T &item : items) {
+				this->push_back(item);
+			}
+		}
+		SmallVec(const SmallVec &other) : SmallVec() {
+			this->reserve(other.length);
+			std::memcpy(static_cast<void *>(this->data()), other.data(), other.length * sizeof(T));
+			this->length = other.length;
+		}
+		SmallVec(SmallVec &&other) noexcept : SmallVec() {
+			this->take(other);
+		}
+		SmallVec &operator=(const SmallVec &other) {
+			if (this != &other) {
+				this->length = 0;
+				this->reserve(other.length);
+				std::memcpy(static_cast<void *>(this->data()), other.data(), other.length * sizeof(T));
+				this->length = other.length;
+			}
+			return *this;
+		}
+		SmallVec &operator=(SmallVec &&other) noexcept {
+			if (this != &other) {
+				this->release_heap();
+				this->take(other);
+			}
+			return *this;
+		}
+		~SmallVec() {
+			this->release_heap();
+		}
+
+		T *data() {
+			return this->capacity > N ? this->heap_items : reinterpret_cast<T *>(this->inline_storage);
+		}
+		const T *data() const {
+			return this->capacity > N ? this->heap_items : reinterpret_cast<const T *>(this->inline_storage);
+		}
+		size_t size() const { return this->length; }
+		bool empty() const { return this->length == 0; }
+
+		T *begin() { return this->data(); }
+		T *end() { return this->data() + this->length; }
+		const T *begin() const { return this->data(); }
+		const T *end() const { return this->data() + this->length; }
+
+		T &operator[](size_t index) { return this->data()[index]; }
+		const T &operator[](size_t index) const { return this->data()[index]; }
+		T &back() { return this->data()[this->length - 1]; }
+		const T &back() const { return this->data()[this->length - 1]; }
+
+		void reserve(size_t new_capacity) {
+			if (new_capacity <= this->capacity) {
+				return;
+			}
+			T *new_items = static_cast<T *>(std::malloc(new_capacity * sizeof(T)));
+			std::memcpy(static_cast<void *>(new_items), this->data(), this->length * sizeof(T));
+			this->release_heap();
+			this->heap_items = new_items;
+			this->capacity = static_cast<uint32_t>(new_capacity);
+		}
+		void push_back(const T &item) {
+			if (this->length == this->capacity) {
+				// copy first in case `item` lives in our own storage
+				T copy = item;
+				this->reserve(this->capacity * 2);
+				std::memcpy(static_cast<void *>(this->data() + this->length), &copy, sizeof(T));
+			} else {
+				std::memcpy(static_cast<void *>(this->data() + this->length), &item, sizeof(T));
+			}
+			this->length += 1;
+		}
+		void pop_back() {
+			this->length -= 1;
+		}
+		T *erase(T *position) {
+			T *items = this->data();
+			size_t index = position - items;
+			std::memmove(static_cast<void *>(items + index), items + index + 1, (this->length - index - 1) * sizeof(T));
+			this->length -= 1;
+			return items + index;
+		}
+		void clear() {
+			this->length = 0;
+		}
+
+		private:
+
+		void release_heap() {
+			if (this->capacity > N) {
+				std::free(this->heap_items);
+				this->heap_items = nullptr;
+				this->capacity = N;
+			}
+		}
+		// steals the elements of `other`, leaving it empty; expects that
+		// this vector doesn't own any heap memory
+		void take(SmallVec &other) {
+			if (other.capacity > N) {
+				this->heap_items = other.heap_items;
+				this->capacity = other.capacity;
+				other.heap_items = nullptr;
+				other.capacity = N;
+			} else {
+				std::memcpy(static_cast<void *>(this->inline_storage), other.inline_storage, other.length * sizeof(T));
+			}
+			this->length = other.length;
+			other.length = 0;
+		}
+	};
+
+	template<typename T, size_t N>
+	bool operator==(const SmallVec<T, N> &lhs, const SmallVec<T, N> &rhs) {
+		if (lhs.size() != rhs.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < lhs.size(); ++i) {
+			if (!(lhs[i] == rhs[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+}